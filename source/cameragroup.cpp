@@ -0,0 +1,214 @@
+#include <chrono>
+#include <string>
+
+#include "cameragroup.h"
+
+CameraGroup::CameraGroup( long long toleranceUs, enum v4l2cam_group_policy policy, int maxHeld )
+{
+    m_tolerance = toleranceUs;
+    m_policy = policy;
+    m_maxHeld = (maxHeld > 0) ? maxHeld : 1;
+    m_running = false;
+
+    m_matched = 0;
+    m_unmatched = 0;
+}
+
+
+CameraGroup::~CameraGroup()
+{
+    // release any held frames, the cameras belong to the caller
+    for( auto &m : m_members )
+    {
+        for( auto x : m.queue ) freeFrame( x );
+        m.queue.clear();
+    }
+}
+
+
+void CameraGroup::addCamera( V4l2Camera * cam, long long offsetUs )
+{
+    if( !cam ) return;
+
+    struct groupMember m;
+    m.cam = cam;
+    m.offset = offsetUs;
+
+    m_members.push_back( m );
+}
+
+
+bool CameraGroup::start( enum v4l2cam_fetch_mode mode )
+{
+    if( m_running ) return true;
+    if( m_members.size() == 0 ) return false;
+
+    // open everything first, so the streams can be switched on as close together as possible
+    for( auto &m : m_members )
+    {
+        if( !m.cam->isOpen() && !m.cam->open() )
+        {
+            m.cam->log( "CameraGroup unable to open camera", v4l2cam_msg_type::error );
+            stop();
+            return false;
+        }
+    }
+
+    for( auto &m : m_members )
+    {
+        if( !m.cam->init( mode ) )
+        {
+            m.cam->log( "CameraGroup unable to start streaming", v4l2cam_msg_type::error );
+            stop();
+            return false;
+        }
+    }
+
+    m_running = true;
+
+    return true;
+}
+
+
+void CameraGroup::stop()
+{
+    for( auto &m : m_members )
+    {
+        if( m.cam->isOpen() ) m.cam->close();
+
+        for( auto x : m.queue ) freeFrame( x );
+        m.queue.clear();
+    }
+
+    m_running = false;
+}
+
+
+void CameraGroup::freeFrame( struct v4l2cam_image_buffer * frame )
+{
+    if( frame )
+    {
+        if( frame->buffer ) delete [] frame->buffer;
+        delete frame;
+    }
+}
+
+
+long long CameraGroup::stampOf( struct groupMember & m, struct v4l2cam_image_buffer * frame )
+{
+    return frame->timestamp + m.offset;
+}
+
+
+bool CameraGroup::refill( struct groupMember & m )
+{
+    // blocks for at least one frame, picks up anything else already waiting, up to m_maxHeld
+    // only called on an empty queue, so that also bounds the frames held per camera
+    std::vector<struct v4l2cam_image_buffer *> frames = m.cam->fetchBatch( m_maxHeld );
+
+    if( frames.size() == 0 )
+    {
+        m.cam->log( "CameraGroup fetch returned no frames", v4l2cam_msg_type::warning );
+        return false;
+    }
+
+    for( auto x : frames )
+    {
+        // no kernel timestamp, recover one from the arrival time
+        if( x->timestamp <= 0 )
+        {
+            x->timestamp = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+        }
+        m.queue.push_back( x );
+    }
+
+    return true;
+}
+
+
+struct v4l2cam_frameset * CameraGroup::fetchFrameset()
+{
+    if( !m_running ) return nullptr;
+
+    while( true )
+    {
+        // every camera needs at least one frame to compare
+        for( auto &m : m_members )
+        {
+            if( m.queue.empty() && !refill( m ) ) return nullptr;
+        }
+
+        // the newest head frame is the reference, queues are in time order so anything
+        // older than (reference - tolerance) can never be matched
+        long long ref = stampOf( m_members[0], m_members[0].queue.front() );
+        for( auto &m : m_members )
+        {
+            long long t = stampOf( m, m.queue.front() );
+            if( t > ref ) ref = t;
+        }
+
+        bool starved = false;
+
+        for( int i=0;i<(int)m_members.size();i++ )
+        {
+            struct groupMember &m = m_members[i];
+
+            while( !m.queue.empty() && (stampOf( m, m.queue.front() ) < ref - m_tolerance) )
+            {
+                struct v4l2cam_image_buffer * stale = m.queue.front();
+                m.queue.pop_front();
+                m_unmatched++;
+
+                if( holdUnmatched == m_policy )
+                {
+                    // hand it back on its own, so the caller still sees every frame
+                    struct v4l2cam_frameset * set = new struct v4l2cam_frameset;
+                    set->frames.assign( m_members.size(), nullptr );
+                    set->frames[i] = stale;
+                    set->timestamp = stampOf( m, stale );
+                    set->spread = 0;
+                    set->complete = false;
+                    return set;
+                }
+
+                freeFrame( stale );
+            }
+
+            if( m.queue.empty() ) starved = true;
+        }
+
+        // go round again and pull more frames from whoever ran dry
+        if( starved ) continue;
+
+        // every head is now within tolerance of the reference
+        struct v4l2cam_frameset * set = new struct v4l2cam_frameset;
+        long long oldest = ref;
+
+        for( auto &m : m_members )
+        {
+            struct v4l2cam_image_buffer * x = m.queue.front();
+            m.queue.pop_front();
+
+            long long t = stampOf( m, x );
+            if( t < oldest ) oldest = t;
+
+            set->frames.push_back( x );
+        }
+
+        set->timestamp = ref;
+        set->spread = ref - oldest;
+        set->complete = true;
+        m_matched++;
+
+        return set;
+    }
+}
+
+
+void CameraGroup::releaseFrameset( struct v4l2cam_frameset * set )
+{
+    if( !set ) return;
+
+    for( auto x : set->frames ) freeFrame( x );
+    delete set;
+}
@@ -0,0 +1,81 @@
+#ifndef CAMERAGROUP_H
+#define CAMERAGROUP_H
+
+#include "v4l2camera.h"
+
+#include <deque>
+#include <vector>
+
+// What to do with frames that have no partner in the other cameras
+//
+enum v4l2cam_group_policy
+{
+    dropUnmatched, holdUnmatched
+};
+
+// v4l2cam_frameset - one frame per camera, captured within the group tolerance
+//
+struct v4l2cam_frameset
+{
+    long long timestamp;            // newest timestamp in the set, microseconds
+    long long spread;               // newest - oldest timestamp in the set, microseconds
+    bool complete;                  // false if this is a partial set (holdUnmatched policy)
+    std::vector<struct v4l2cam_image_buffer *> frames;     // in the order the cameras were added, nullptr if missing
+};
+
+// CameraGroup - synchronized capture across several cameras
+//
+// - cameras are not owned by the group, they must outlive it
+// - frames are matched on their capture timestamp plus a per camera offset (for cameras on different clocks)
+// - frames with no timestamp are stamped on arrival
+//
+class CameraGroup
+{
+private:
+    struct groupMember
+    {
+        V4l2Camera * cam;
+        long long offset;
+        std::deque<struct v4l2cam_image_buffer *> queue;
+    };
+
+    std::vector<struct groupMember> m_members;
+    long long m_tolerance;
+    enum v4l2cam_group_policy m_policy;
+    int m_maxHeld;
+    bool m_running;
+
+    long long m_matched;
+    long long m_unmatched;
+
+    long long stampOf( struct groupMember & m, struct v4l2cam_image_buffer * frame );
+    bool refill( struct groupMember & m );
+    void freeFrame( struct v4l2cam_image_buffer * frame );
+
+public:
+    CameraGroup( long long toleranceUs = 5000, enum v4l2cam_group_policy policy = dropUnmatched, int maxHeld = 8 );
+    ~CameraGroup();
+
+    // Group setup, offset is added to every timestamp from this camera
+    //
+    void addCamera( V4l2Camera * cam, long long offsetUs = 0 );
+    int size() { return m_members.size(); };
+
+    // Stream control, start opens and initializes every camera back to back
+    //
+    bool start( enum v4l2cam_fetch_mode mode = userPtrMode );
+    void stop();
+    bool isRunning() { return m_running; };
+
+    // Frame set retrieval, blocks until a set is available, nullptr on failure
+    //
+    struct v4l2cam_frameset * fetchFrameset();
+    void releaseFrameset( struct v4l2cam_frameset * set );
+
+    // Statistics
+    //
+    long long getMatchedCount() { return m_matched; };
+    long long getUnmatchedCount() { return m_unmatched; };
+};
+
+#endif // CAMERAGROUP_H
@@ -1,5 +1,7 @@
 #include <cstring>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
 
 // using ioctl for low level device enumeration and control
 #include <sys/ioctl.h>
@@ -7,6 +9,10 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/mman.h>
 
 #include "linuxcamera.h"
 
@@ -22,6 +28,9 @@ LinuxCamera::LinuxCamera( std::string device_name )
     m_cameraType = "generic Linux UVC";
 
     m_healthCounter = 0;
+    m_frameIntervalUs = 33333;
+    m_timePerFrame.numerator = 1;
+    m_timePerFrame.denominator = 30;
 
     memset(&buf, 0, NUM_QBUF* sizeof(struct v4l2_buffer));
 }
@@ -33,11 +42,22 @@ LinuxCamera::~LinuxCamera()
     if( m_fid > -1 ) ::close(m_fid);
 
     // free the buffers if they have been allocated
+    freeBuffers();
+}
+
+
+void LinuxCamera::freeBuffers()
+{
     for( int i=0;i<NUM_QBUF;i++ )
     {
-        if( buf[i].m.userptr > 0 ) delete (unsigned char *)buf[i].m.userptr;
+        if( buf[i].m.userptr > 0 )
+        {
+            // harmless if the buffer was never locked
+            if( m_streamConfig.lockMemory ) munlock( (void *)buf[i].m.userptr, buf[i].length );
+            delete [] (unsigned char *)buf[i].m.userptr;
+            buf[i].m.userptr = 0;
+        }
     }
-
 }
 
 
@@ -206,9 +226,10 @@ bool LinuxCamera::init( enum v4l2cam_fetch_mode newMode )
                     // queue up the buffer
                     //struct v4l2_buffer buf;
 
+                    // release anything left over from a previous init()
+                    freeBuffers();
                     memset(&buf, 0, NUM_QBUF * sizeof(struct v4l2_buffer));
 
-                    // queue up all the buffers
                     for( int i=0;i<NUM_QBUF;i++ )
                     {
                         buf[i].type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -218,7 +239,24 @@ bool LinuxCamera::init( enum v4l2cam_fetch_mode newMode )
                         buf[i].m.userptr = (unsigned long)(new unsigned char[this->m_currentMode.size]);
                         //buf.length = m_frameBuffer->length;
                         buf[i].length = m_currentMode.size;
+                    }
+
+                    // real-time tuning, failures are logged but streaming carries on without them
+                    applyStreamConfig();
 
+                    // the watchdog deadlines are based on the configured frame interval
+                    struct v4l2_streamparm streamparm;
+                    memset(&streamparm, 0, sizeof(streamparm));
+                    streamparm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+                    if( (-1 != ioctl( m_fid, VIDIOC_G_PARM, &streamparm)) && (streamparm.parm.capture.timeperframe.denominator > 0) )
+                    {
+                        m_frameIntervalUs = (1000000LL * streamparm.parm.capture.timeperframe.numerator) / streamparm.parm.capture.timeperframe.denominator;
+                        m_timePerFrame = streamparm.parm.capture.timeperframe;
+                    }
+
+                    // queue up all the buffers
+                    for( int i=0;i<NUM_QBUF;i++ )
+                    {
                         if( -1 == ioctl(m_fid, VIDIOC_QBUF, &(buf[i]) ) )
                         {
                             log( "ioctl(VIDIOC_QBUF) failed : " + std::string(strerror(errno)), error );
@@ -255,9 +293,336 @@ bool LinuxCamera::init( enum v4l2cam_fetch_mode newMode )
 }
 
 
+bool LinuxCamera::applyStreamConfig()
+{
+    bool ret = true;
+
+    // capture buffers first, prefault so the first frames do not take page faults
+    for( int i=0;i<NUM_QBUF;i++ )
+    {
+        if( 0 == buf[i].m.userptr ) continue;
+
+        if( m_streamConfig.prefault ) memset( (void *)buf[i].m.userptr, 0, buf[i].length );
+
+        if( m_streamConfig.lockMemory && (-1 == mlock( (void *)buf[i].m.userptr, buf[i].length )) )
+        {
+            if( (EPERM == errno) || (ENOMEM == errno) ) log( "mlock() of capture buffers failed, insufficient privileges : raise RLIMIT_MEMLOCK (ulimit -l) or grant CAP_IPC_LOCK", error );
+            else log( "mlock() of capture buffers failed : " + std::string(strerror(errno)), error );
+            ret = false;
+            break;
+        }
+    }
+
+    // pin the calling thread to the requested CPUs
+    if( m_streamConfig.cpuAffinity.size() > 0 )
+    {
+        cpu_set_t cpus;
+        CPU_ZERO( &cpus );
+        for( int x : m_streamConfig.cpuAffinity ) if( (x >= 0) && (x < CPU_SETSIZE) ) CPU_SET( x, &cpus );
+
+        if( -1 == sched_setaffinity( 0, sizeof(cpu_set_t), &cpus ) )
+        {
+            log( "sched_setaffinity() failed : " + std::string(strerror(errno)), error );
+            ret = false;
+        }
+    }
+
+    // real-time scheduling for the calling thread
+    if( schedDefault != m_streamConfig.schedPolicy )
+    {
+        struct sched_param param;
+        memset( &param, 0, sizeof(param) );
+        param.sched_priority = m_streamConfig.schedPriority;
+
+        int policy = (schedFifo == m_streamConfig.schedPolicy) ? SCHED_FIFO : SCHED_RR;
+
+        if( -1 == sched_setscheduler( 0, policy, &param ) )
+        {
+            if( EPERM == errno ) log( "sched_setscheduler() failed, insufficient privileges : real-time scheduling needs CAP_SYS_NICE or root (or an RLIMIT_RTPRIO of at least " + std::to_string(param.sched_priority) + ")", error );
+            else log( "sched_setscheduler() failed : " + std::string(strerror(errno)), error );
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+
+//
+// Stall watchdog
+//
+bool LinuxCamera::waitForFrame( int timeoutMs )
+{
+    struct pollfd pfd;
+    pfd.fd = m_fid;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int ret;
+    do { ret = poll( &pfd, 1, timeoutMs ); } while( (-1 == ret) && (EINTR == errno) );
+
+    return( (ret > 0) && (pfd.revents & POLLIN) );
+}
+
+bool LinuxCamera::dequeueWatched( struct v4l2_buffer * out )
+{
+    if( !m_watchdogOn ) return dequeueBuffer( out, false );
+
+    // deadline is a number of missed frame intervals, never shorter than 100ms
+    int timeoutMs = (int)(((long long)m_watchdogFrames * m_frameIntervalUs) / 1000);
+    if( timeoutMs < 100 ) timeoutMs = 100;
+
+    if( !waitForFrame( timeoutMs ) && !recoverStream( timeoutMs ) ) return false;
+
+    return dequeueBuffer( out, false );
+}
+
+bool LinuxCamera::recoverStream( int timeoutMs )
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    m_watchdogStats.stalls++;
+    log( "Stream stalled, no frame for " + std::to_string(timeoutMs) + " ms, attempting recovery", warning );
+
+    // escalate, each stage gets one frame deadline to produce a frame
+    int stage = 0;
+    if( requeueAll() && waitForFrame( timeoutMs ) ) stage = 1;
+    else if( restartStream() && waitForFrame( timeoutMs ) ) stage = 2;
+    else if( reopenStream() && waitForFrame( timeoutMs ) ) stage = 3;
+
+    m_watchdogStats.lastRecoveryUs = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start ).count();
+
+    switch( stage )
+    {
+        case 1:
+            m_watchdogStats.requeues++;
+            log( "Stream recovered by re-queueing buffers in " + std::to_string(m_watchdogStats.lastRecoveryUs / 1000) + " ms", warning );
+            break;
+
+        case 2:
+            m_watchdogStats.restarts++;
+            log( "Stream recovered by STREAMOFF/STREAMON in " + std::to_string(m_watchdogStats.lastRecoveryUs / 1000) + " ms", warning );
+            break;
+
+        case 3:
+            m_watchdogStats.reopens++;
+            log( "Stream recovered by re-opening device in " + std::to_string(m_watchdogStats.lastRecoveryUs / 1000) + " ms", warning );
+            break;
+
+        default:
+            m_watchdogStats.failures++;
+            log( "Stream recovery failed after " + std::to_string(m_watchdogStats.lastRecoveryUs / 1000) + " ms", critical );
+
+            // nothing more we can do, let isHealthy() report it
+            m_healthCounter = s_healthCountLimit;
+            return false;
+    }
+
+    m_healthCounter = 0;
+
+    return true;
+}
+
+bool LinuxCamera::requeueAll()
+{
+    bool ret = true;
+
+    // hand back any buffer the driver does not currently own
+    for( int i=0;i<NUM_QBUF;i++ )
+    {
+        struct v4l2_buffer tmp = buf[i];
+
+        if( -1 == ioctl(m_fid, VIDIOC_QUERYBUF, &tmp) ) { ret = false; continue; }
+        if( tmp.flags & (V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE) ) continue;
+
+        if( -1 == ioctl(m_fid, VIDIOC_QBUF, &(buf[i])) ) ret = false;
+    }
+
+    return ret;
+}
+
+bool LinuxCamera::restartStream()
+{
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    // STREAMOFF returns every buffer to us, so they all need to be queued again
+    if( -1 == ioctl(m_fid, VIDIOC_STREAMOFF, &type) )
+    {
+        log( "ioctl(VIDIOC_STREAMOFF) failed : " + std::string(strerror(errno)), error );
+        return false;
+    }
+
+    for( int i=0;i<NUM_QBUF;i++ )
+    {
+        if( -1 == ioctl(m_fid, VIDIOC_QBUF, &(buf[i])) )
+        {
+            log( "ioctl(VIDIOC_QBUF) failed : " + std::string(strerror(errno)), error );
+            return false;
+        }
+    }
+
+    if( -1 == ioctl(m_fid, VIDIOC_STREAMON, &type) )
+    {
+        log( "ioctl(VIDIOC_STREAMON) failed : " + std::string(strerror(errno)), error );
+        return false;
+    }
+
+    return true;
+}
+
+bool LinuxCamera::reopenStream()
+{
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    // start from scratch on a new file descriptor, keeping our buffers and format
+    ioctl(m_fid, VIDIOC_STREAMOFF, &type);
+    ::close(m_fid);
+
+    m_fid = ::open(m_devName.c_str(), O_RDWR);
+    if( -1 == m_fid )
+    {
+        log( "Unable to re-open device : " + std::string(strerror(errno)), error );
+        return false;
+    }
+
+    struct v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.pixelformat = m_currentMode.fourcc;
+    fmt.fmt.pix.width       = m_currentMode.width;
+    fmt.fmt.pix.height      = m_currentMode.height;
+
+    if( -1 == ioctl(m_fid, VIDIOC_S_FMT, &fmt) )
+    {
+        log( "ioctl(VIDIOC_S_FMT) failed : " + std::string(strerror(errno)), error );
+        return false;
+    }
+
+    struct v4l2_streamparm streamparm;
+    memset(&streamparm, 0, sizeof(streamparm));
+    streamparm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    streamparm.parm.capture.timeperframe = m_timePerFrame;
+    if( -1 == ioctl(m_fid, VIDIOC_S_PARM, &streamparm) ) log( "ioctl(VIDIOC_S_PARM - FrameRate) failed : " + std::string(strerror(errno)), warning );
+
+    struct v4l2_requestbuffers req;
+    memset(&req,0,sizeof(struct v4l2_requestbuffers));
+    req.count  = NUM_QBUF;
+    req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_USERPTR;
+
+    if( -1 == ioctl(m_fid, VIDIOC_REQBUFS, &req) )
+    {
+        log( "ioctl(VIDIOC_REQBUF) failed : " + std::string(strerror(errno)), error );
+        return false;
+    }
+
+    for( int i=0;i<NUM_QBUF;i++ )
+    {
+        if( -1 == ioctl(m_fid, VIDIOC_QBUF, &(buf[i])) )
+        {
+            log( "ioctl(VIDIOC_QBUF) failed : " + std::string(strerror(errno)), error );
+            return false;
+        }
+    }
+
+    if( -1 == ioctl(m_fid, VIDIOC_STREAMON, &type) )
+    {
+        log( "ioctl(VIDIOC_STREAMON) failed : " + std::string(strerror(errno)), error );
+        return false;
+    }
+
+    return true;
+}
+
+
 //
 // Data Retreiaval routines
 //
+bool LinuxCamera::dequeueBuffer( struct v4l2_buffer * out, bool nonBlocking )
+{
+    bool ret = false;
+
+    memset(out, 0, sizeof(struct v4l2_buffer));
+
+    out->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    out->memory = V4L2_MEMORY_USERPTR;
+
+    if( -1 == ioctl(m_fid, VIDIOC_DQBUF, out) )
+    {
+        // an empty queue is expected when draining, it is not a failure
+        if( nonBlocking && (EAGAIN == errno) ) return false;
+
+        log( "ioctl(VIDIOC_DQBUF) failed : " + std::string(strerror(errno)), error );
+        m_healthCounter++;
+
+    } else ret = true;
+
+    return ret;
+}
+
+bool LinuxCamera::requeueBuffer( struct v4l2_buffer * in )
+{
+    bool ret = false;
+
+    if( -1 == ioctl(m_fid, VIDIOC_QBUF, in) ) 
+    {
+        log( "ioctl(VIDIOC_QBUF) failed : " + std::string(strerror(errno) ), error );
+        m_healthCounter++;
+
+    } else
+    {
+        ret = true;
+        m_healthCounter = 0;
+    }
+
+    return ret;
+}
+
+int LinuxCamera::setNonBlocking()
+{
+    // returns the original flags so they can be restored, -1 on failure
+    int flags = fcntl( m_fid, F_GETFL );
+
+    if( (-1 == flags) || (-1 == fcntl( m_fid, F_SETFL, flags | O_NONBLOCK )) )
+    {
+        log( "fcntl(O_NONBLOCK) failed : " + std::string(strerror(errno)), warning );
+        flags = -1;
+    }
+
+    return flags;
+}
+
+void LinuxCamera::restoreBlocking( int flags )
+{
+    if( -1 != flags ) fcntl( m_fid, F_SETFL, flags );
+}
+
+struct v4l2cam_image_buffer * LinuxCamera::copyBuffer( struct v4l2_buffer * in )
+{
+    struct v4l2cam_image_buffer * retBuffer = new struct v4l2cam_image_buffer;
+
+    retBuffer->buffer = new unsigned char[in->bytesused];
+    retBuffer->length = in->bytesused;
+    retBuffer->width = m_currentMode.width;
+    retBuffer->height = m_currentMode.height;
+    retBuffer->sequence = in->sequence;
+    retBuffer->timestamp = (long long)in->timestamp.tv_sec * 1000000LL + in->timestamp.tv_usec;
+    retBuffer->skipped = 0;
+
+    // age only makes sense if the driver stamps frames with the monotonic clock
+    retBuffer->age = -1;
+    if( V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC == (in->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) )
+    {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        retBuffer->age = ((long long)now.tv_sec * 1000000LL + now.tv_nsec / 1000) - retBuffer->timestamp;
+    }
+
+    memcpy( retBuffer->buffer, (unsigned char*)in->m.userptr, in->bytesused );
+
+    return retBuffer;
+}
+
 struct v4l2cam_image_buffer * LinuxCamera::fetch( bool lastOne )
 {
     struct v4l2cam_image_buffer * retBuffer = nullptr;
@@ -274,53 +639,35 @@ struct v4l2cam_image_buffer * LinuxCamera::fetch( bool lastOne )
             case userPtrMode:
                 // dequeue one frame
                 struct v4l2_buffer tmp_buf;
-                memset(&tmp_buf, 0, sizeof(struct v4l2_buffer));
-
-                tmp_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-                tmp_buf.memory = V4L2_MEMORY_USERPTR;
 
-                if( -1 == ioctl(m_fid, VIDIOC_DQBUF, &tmp_buf) ) 
-                {
-                    log( "ioctl(VIDIOC_DQBUF) failed : " + std::string(strerror(errno)), error );
-                    m_healthCounter++;
-                }
-                else
+                if( dequeueWatched( &tmp_buf ) )
                 {
-                    retBuffer = new struct v4l2cam_image_buffer;
-                    // this should have de-queued into the previous buffer we allocated
-                    //retBuffer->buffer = m_frameBuffer->buffer;
-                    //retBuffer->buffer = (unsigned char*)buf.m.userptr;
-                    retBuffer->buffer = new unsigned char[tmp_buf.bytesused];
-                    retBuffer->length = tmp_buf.bytesused;
-                    memcpy( retBuffer->buffer, (unsigned char*)tmp_buf.m.userptr, tmp_buf.bytesused );
+                    int skipped = 0;
 
-                    // only re-queue if we are going to be getting more
-                    if( !lastOne )
+                    // in latest frame mode, keep swapping for newer frames until the queue is empty
+                    if( m_latestOnly )
                     {
-                        // aloocating for this->numBuffers fetch buffers
-                        //m_frameBuffer = new struct v4l2cam_image_buffer;
-                        //m_frameBuffer->length =  m_currentMode.size;
-                        //m_frameBuffer->buffer = new unsigned char[this->m_currentMode.size];
-
-                        // queue up the first buffer
-                        //struct v4l2_buffer buf;
-
-                        //memset(&buf, 0, sizeof(struct v4l2_buffer));
-                        //buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-                        //buf.memory = V4L2_MEMORY_USERPTR;
-                        //buf.index = 0;
-                        //buf.m.userptr = (unsigned long)(this->m_frameBuffer->buffer);
-                        //buf.length = m_frameBuffer->length;
-
-                        // just re-queue the one that was already there
+                        struct v4l2_buffer new_buf;
+                        int flags = setNonBlocking();
 
-                        if( -1 == ioctl(m_fid, VIDIOC_QBUF, &tmp_buf) ) 
+                        while( (-1 != flags) && dequeueBuffer( &new_buf, true ) )
                         {
-                            log( "ioctl(VIDIOC_QBUF) failed : " + std::string(strerror(errno) ), error );
-                            m_healthCounter++;
+                            // hand the stale buffer straight back to the driver
+                            requeueBuffer( &tmp_buf );
+                            tmp_buf = new_buf;
+                            skipped++;
+                        }
+
+                        restoreBlocking( flags );
+                    }
+
+                    // this should have de-queued into one of the buffers we allocated in init()
+                    retBuffer = copyBuffer( &tmp_buf );
+                    retBuffer->skipped = skipped;
 
-                        }else m_healthCounter = 0;
-                    } else m_healthCounter = 0;
+                    // only re-queue if we are going to be getting more
+                    if( !lastOne ) requeueBuffer( &tmp_buf );
+                    else m_healthCounter = 0;
                 }
                 break;
 
@@ -333,6 +680,55 @@ struct v4l2cam_image_buffer * LinuxCamera::fetch( bool lastOne )
     return retBuffer;
 } 
 
+std::vector<struct v4l2cam_image_buffer *> LinuxCamera::fetchBatch( int maxFrames, bool lastOne )
+{
+    std::vector<struct v4l2cam_image_buffer *> ret;
+
+    if( !isOpen() ) log( "Unable to call fetchBatch() as no device is open", warning );
+    else if( maxFrames < 1 ) log( "Invalid frame count for fetchBatch() : " + std::to_string(maxFrames), warning );
+    else
+    {
+        switch( m_bufferMode )
+        {
+            case readMode:
+                // do nothing
+                break;
+
+            case userPtrMode:
+            {
+                // the first frame blocks like fetch(), so the caller always gets at least one frame
+                struct v4l2_buffer tmp_buf;
+                if( !dequeueWatched( &tmp_buf ) ) break;
+
+                ret.push_back( copyBuffer( &tmp_buf ) );
+                if( !lastOne ) requeueBuffer( &tmp_buf );
+                else m_healthCounter = 0;
+
+                // now drain whatever else the driver has already completed, without waiting
+                int flags = setNonBlocking();
+
+                while( (-1 != flags) && ((int)ret.size() < maxFrames) && dequeueBuffer( &tmp_buf, true ) )
+                {
+                    ret.push_back( copyBuffer( &tmp_buf ) );
+                    if( !lastOne ) requeueBuffer( &tmp_buf );
+                }
+
+                restoreBlocking( flags );
+
+                // hand them back oldest first
+                std::sort( ret.begin(), ret.end(), []( struct v4l2cam_image_buffer * a, struct v4l2cam_image_buffer * b ) { return a->sequence < b->sequence; } );
+                break;
+            }
+
+            case mMapMode:
+            case notset:
+                break;
+        }
+    }
+
+    return ret;
+}
+
 //
 // Device Capability routines
 //
@@ -564,6 +960,9 @@ struct v4l2cam_video_mode * LinuxCamera::getFrameFormat()
             ret->width = fmt.fmt.pix.width;
             ret->height = fmt.fmt.pix.height;
             ret->size = fmt.fmt.pix.sizeimage;
+            ret->colorspace = fmt.fmt.pix.colorspace;
+            ret->quantization = fmt.fmt.pix.quantization;
+            ret->ycbcr_enc = fmt.fmt.pix.ycbcr_enc;
             char fStr[256];
             V4l2Camera::fourcc_int_to_charArray(ret->fourcc, fStr);
             ret->format_str = fStr;
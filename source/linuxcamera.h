@@ -17,6 +17,24 @@ private:
     int m_fid;
     std::string m_devName;
     struct v4l2_buffer buf[NUM_QBUF];
+    int m_frameIntervalUs;
+    struct v4l2_fract m_timePerFrame;     // as read back at init(), restored by a re-open
+
+    // low level queue helpers, shared by the fetch methods
+    bool dequeueBuffer( struct v4l2_buffer * out, bool nonBlocking );
+    bool requeueBuffer( struct v4l2_buffer * in );
+    int setNonBlocking();
+    void restoreBlocking( int flags );
+    struct v4l2cam_image_buffer * copyBuffer( struct v4l2_buffer * in );
+    void freeBuffers();
+
+    // stall watchdog helpers
+    bool waitForFrame( int timeoutMs );
+    bool dequeueWatched( struct v4l2_buffer * out );
+    bool recoverStream( int timeoutMs );
+    bool requeueAll();
+    bool restartStream();
+    bool reopenStream();
 
 public:
     LinuxCamera( std::string );
@@ -52,8 +70,10 @@ public:
     virtual bool open() override;
     virtual bool init( enum v4l2cam_fetch_mode ) override;
     virtual void close() override;
+    virtual bool applyStreamConfig() override;
 
     virtual struct v4l2cam_image_buffer * fetch( bool lastOne ) override;
+    virtual std::vector<struct v4l2cam_image_buffer *> fetchBatch( int maxFrames, bool lastOne = false ) override;
     virtual struct v4l2cam_metadata_buffer * fetchMetaData() override;
 
 };
@@ -0,0 +1,536 @@
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "replaycamera.h"
+
+static const unsigned int s_capVideoCapture = 0x00000001;
+static const unsigned int s_capStreaming = 0x04000000;
+
+// frame headers written by v4l2cam captureFrames(), all fields are big endian
+//
+static const size_t s_slapHeaderSize = 8;
+static const size_t s_h264HeaderSize = 36;
+
+static unsigned int replayReadBE( const unsigned char * p )
+{
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | (unsigned int)p[3];
+}
+
+
+ReplayCamera::ReplayCamera( std::string fileName )
+    : V4l2Camera()
+{
+    m_fileName = fileName;
+    m_userName = "Replay Camera";
+    m_cameraType = "recorded stream";
+    m_capabilities = 0;
+    m_fd = -1;
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_streaming = false;
+    m_bufferMode = notset;
+
+    m_speed = 1.0;
+    m_loop = false;
+    m_clockRunning = false;
+    m_playTime = 0;
+    m_sequence = 0;
+    m_next = 0;
+    m_hasH264Header = false;
+
+    // default mode for recordings that do not say what they hold
+    m_fps = 30;
+    m_currentMode.fourcc = fourcc_charArray_to_int( (unsigned char *)"YUYV" );
+    m_currentMode.format_str = "YUYV";
+    m_currentMode.width = 640;
+    m_currentMode.height = 480;
+    m_currentMode.size = 640 * 480 * 2;
+    m_currentMode.fps = { 30 };
+
+    m_healthCounter = 0;
+}
+
+
+ReplayCamera::~ReplayCamera()
+{
+    close();
+}
+
+
+std::string ReplayCamera::getDevName()
+{
+    return m_fileName;
+}
+
+
+//
+// Basic Access routines
+//
+bool ReplayCamera::open()
+{
+    if( isOpen() ) return true;
+
+    m_fd = ::open( m_fileName.c_str(), O_RDONLY );
+    if( m_fd < 0 )
+    {
+        log( "Unable to open recording " + m_fileName + " : " + strerror(errno), error );
+        return false;
+    }
+
+    struct stat st;
+    if( (fstat( m_fd, &st ) < 0) || (st.st_size < (off_t)s_slapHeaderSize) )
+    {
+        log( "Recording " + m_fileName + " is empty or unreadable", error );
+        ::close( m_fd );
+        m_fd = -1;
+        return false;
+    }
+
+    m_mapSize = st.st_size;
+    void * p = mmap( nullptr, m_mapSize, PROT_READ, MAP_PRIVATE, m_fd, 0 );
+    if( MAP_FAILED == p )
+    {
+        log( "Unable to map recording " + m_fileName + " : " + strerror(errno), error );
+        ::close( m_fd );
+        m_fd = -1;
+        return false;
+    }
+
+    m_map = (unsigned char *)p;
+
+    // playback reads front to back
+    madvise( m_map, m_mapSize, MADV_SEQUENTIAL );
+
+    if( !indexFile() )
+    {
+        close();
+        return false;
+    }
+
+    detectFormat();
+
+    m_healthCounter = 0;
+    log( m_fileName + " opened, " + std::to_string(m_index.size()) + " frames", info );
+
+    return true;
+}
+
+
+bool ReplayCamera::isOpen()
+{
+    return (nullptr != m_map);
+}
+
+
+void ReplayCamera::close()
+{
+    if( m_map ) munmap( m_map, m_mapSize );
+    if( m_fd >= 0 ) ::close( m_fd );
+
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_fd = -1;
+    m_streaming = false;
+    m_index.clear();
+}
+
+
+bool ReplayCamera::init( enum v4l2cam_fetch_mode newMode )
+{
+    if( !isOpen() )
+    {
+        log( "Unable to call init() as device is NOT open", info );
+        return false;
+    }
+
+    m_bufferMode = newMode;
+    m_streaming = true;
+    m_healthCounter = 0;
+
+    return rewind();
+}
+
+
+bool ReplayCamera::rewind()
+{
+    // the playback clock starts on the first fetch
+    m_next = 0;
+    m_sequence = 0;
+    m_playTime = 0;
+    m_clockRunning = false;
+
+    return isOpen();
+}
+
+
+//
+// Recording index
+//
+bool ReplayCamera::checkH264Header( size_t pos )
+{
+    if( pos + s_h264HeaderSize > m_mapSize ) return false;
+
+    const unsigned char * p = m_map + pos;
+    unsigned int rate = replayReadBE( p + 4 );
+    unsigned int width = replayReadBE( p + 8 );
+    unsigned int height = replayReadBE( p + 12 );
+    unsigned int size = replayReadBE( p + 32 );
+
+    if( (rate > 1000) || (width == 0) || (width > 16384) || (height == 0) || (height > 16384) ) return false;
+    if( (size_t)size > m_mapSize - pos - s_h264HeaderSize ) return false;
+
+    // the next frame has to follow straight on, or the recording was cut short
+    size_t next = pos + s_h264HeaderSize + size;
+    return (next + 4 > m_mapSize) || (0 == memcmp( m_map + next, "slap", 4 ));
+}
+
+
+bool ReplayCamera::checkSlapHeader( size_t pos )
+{
+    if( pos + s_slapHeaderSize > m_mapSize ) return false;
+
+    unsigned int size = replayReadBE( m_map + pos + 4 );
+    if( (size_t)size > m_mapSize - pos - s_slapHeaderSize ) return false;
+
+    size_t next = pos + s_slapHeaderSize + size;
+    return (next + 4 > m_mapSize) || (0 == memcmp( m_map + next, "slap", 4 ));
+}
+
+
+bool ReplayCamera::indexFile()
+{
+    m_index.clear();
+
+    if( 0 != memcmp( m_map, "slap", 4 ) )
+    {
+        log( m_fileName + " is not a v4l2cam recording, no 'slap' frame header", error );
+        return false;
+    }
+
+    // a recording uses one framing throughout, decide from the first frame
+    m_hasH264Header = checkH264Header( 0 ) && !checkSlapHeader( 0 );
+
+    size_t pos = 0;
+    while( pos + 4 <= m_mapSize )
+    {
+        struct replayFrame f;
+
+        if( 0 != memcmp( m_map + pos, "slap", 4 ) )
+        {
+            log( "Lost frame sync at offset " + std::to_string(pos) + ", ignoring the rest of the recording", warning );
+            break;
+        }
+
+        if( m_hasH264Header )
+        {
+            if( !checkH264Header( pos ) ) break;
+            f.offset = pos + s_h264HeaderSize;
+            f.length = replayReadBE( m_map + pos + 32 );
+            f.rate = replayReadBE( m_map + pos + 4 );
+        } else {
+            if( !checkSlapHeader( pos ) ) break;
+            f.offset = pos + s_slapHeaderSize;
+            f.length = replayReadBE( m_map + pos + 4 );
+            f.rate = 0;
+        }
+
+        m_index.push_back( f );
+        pos = f.offset + f.length;
+    }
+
+    // a recording cut short keeps every complete frame
+    if( pos < m_mapSize ) log( "Recording " + m_fileName + " has " + std::to_string(m_mapSize - pos) + " trailing bytes", warning );
+
+    if( m_index.size() == 0 )
+    {
+        log( m_fileName + " holds no complete frames", error );
+        return false;
+    }
+
+    return true;
+}
+
+
+void ReplayCamera::detectFormat()
+{
+    const unsigned char * p = m_map + m_index[0].offset;
+    size_t len = m_index[0].length;
+
+    if( m_hasH264Header )
+    {
+        const unsigned char * h = m_map + m_index[0].offset - s_h264HeaderSize;
+
+        m_currentMode.fourcc = fourcc_charArray_to_int( (unsigned char *)"H264" );
+        m_currentMode.format_str = "H264";
+        m_currentMode.width = replayReadBE( h + 8 );
+        m_currentMode.height = replayReadBE( h + 12 );
+        if( m_index[0].rate > 0 ) m_fps = m_index[0].rate;
+    }
+    else if( (len > 3) && (p[0] == 0xFF) && (p[1] == 0xD8) && (p[2] == 0xFF) )
+    {
+        m_currentMode.fourcc = fourcc_charArray_to_int( (unsigned char *)"MJPG" );
+        m_currentMode.format_str = "MJPG";
+
+        // frame size comes from the SOFn segment
+        size_t i = 2;
+        while( i + 9 < len )
+        {
+            if( p[i] != 0xFF ) break;
+            unsigned char marker = p[i+1];
+            unsigned int segLen = (p[i+2] << 8) | p[i+3];
+
+            if( (marker >= 0xC0) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC) )
+            {
+                m_currentMode.height = (p[i+5] << 8) | p[i+6];
+                m_currentMode.width = (p[i+7] << 8) | p[i+8];
+                break;
+            }
+            if( marker == 0xDA ) break;
+            i += 2 + segLen;
+        }
+    }
+    else if( (len > 4) && (p[0] == 0) && (p[1] == 0) && ((p[2] == 1) || ((p[2] == 0) && (p[3] == 1))) )
+    {
+        // raw H264 without the frame header, frame size stays as set by the caller
+        m_currentMode.fourcc = fourcc_charArray_to_int( (unsigned char *)"H264" );
+        m_currentMode.format_str = "H264";
+    }
+
+    m_currentMode.fps = { m_fps };
+}
+
+
+//
+// Data Retreiaval routines
+//
+struct v4l2cam_image_buffer * ReplayCamera::fetch( bool lastOne )
+{
+    if( !isOpen() || !m_streaming )
+    {
+        log( "Unable to call fetch() as device is not streaming", warning );
+        return nullptr;
+    }
+
+    if( m_next >= m_index.size() )
+    {
+        if( !m_loop )
+        {
+            log( "End of recording " + m_fileName, info );
+            m_streaming = false;
+            return nullptr;
+        }
+        m_next = 0;
+    }
+
+    if( !m_clockRunning )
+    {
+        m_start = std::chrono::steady_clock::now();
+        m_clockRunning = true;
+    }
+
+    struct replayFrame & f = m_index[m_next];
+    std::chrono::steady_clock::time_point target;
+
+    if( m_speed > 0.0 )
+    {
+        // recorded time, scaled by the playback speed
+        target = m_start + std::chrono::microseconds( (long long)(m_playTime / m_speed) );
+
+        // sleep most of the way, spin for the last bit to hit the deadline precisely
+        std::this_thread::sleep_until( target - std::chrono::microseconds(200) );
+        while( std::chrono::steady_clock::now() < target ) {}
+    }
+    else target = std::chrono::steady_clock::now();
+
+    struct v4l2cam_image_buffer * retBuffer = new struct v4l2cam_image_buffer;
+    retBuffer->buffer = new unsigned char[f.length];
+    retBuffer->length = f.length;
+    retBuffer->width = m_currentMode.width;
+    retBuffer->height = m_currentMode.height;
+    retBuffer->sequence = m_sequence++;
+    retBuffer->timestamp = std::chrono::duration_cast<std::chrono::microseconds>( target.time_since_epoch() ).count();
+    retBuffer->age = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - target ).count();
+    retBuffer->skipped = 0;
+    memcpy( retBuffer->buffer, m_map + f.offset, f.length );
+
+    // H264 headers carry the capture rate measured at the time, plain recordings use the mode rate
+    int rate = (f.rate > 0) ? f.rate : m_fps;
+    m_playTime += 1000000LL / ((rate > 0) ? rate : 30);
+    m_next++;
+
+    if( lastOne ) m_streaming = false;
+
+    return retBuffer;
+}
+
+
+//
+// Device Capability routines
+//
+bool ReplayCamera::enumCapabilities()
+{
+    m_capabilities = s_capVideoCapture | s_capStreaming;
+
+    return true;
+}
+
+
+std::vector<std::string> ReplayCamera::capabilitiesToStr()
+{
+    std::vector<std::string> ret = {};
+
+    if( m_capabilities & s_capStreaming ) ret.push_back("can stream");
+    if( m_capabilities & s_capVideoCapture ) ret.push_back("supports single-planar video capture");
+    ret.push_back("recorded stream playback");
+
+    return ret;
+}
+
+
+bool ReplayCamera::canFetch()
+{
+    return true;
+}
+
+
+bool ReplayCamera::canRead()
+{
+    return false;
+}
+
+
+bool ReplayCamera::hasMetaData()
+{
+    return false;
+}
+
+
+bool ReplayCamera::enumMetadataModes()
+{
+    m_metamode = 0;
+    m_metasize = 0;
+
+    return false;
+}
+
+
+//
+// Camera Control routines, a recording has none
+//
+bool ReplayCamera::enumControls()
+{
+    m_controls.clear();
+
+    return true;
+}
+
+
+int ReplayCamera::setValue( int id, int /*val*/, bool /*openOnDemand*/ )
+{
+    log( "setValue() [" + std::to_string(id) + "] failed : recordings have no controls", info );
+    return -1;
+}
+
+
+int ReplayCamera::getValue( int id, bool /*openOnDemand*/ )
+{
+    log( "getValue() [" + std::to_string(id) + "] failed : recordings have no controls", info );
+    return -1;
+}
+
+
+//
+// Video mode routines
+//
+bool ReplayCamera::enumVideoModes()
+{
+    // the only mode is the recorded one
+    m_modes.clear();
+    m_modes.push_back( m_currentMode );
+
+    return true;
+}
+
+
+bool ReplayCamera::setFrameFormat( std::string mode, int width, int height, int fps )
+{
+    // any mode is accepted, it only describes what the recording holds
+    std::string f = (mode + "    ").substr( 0, 4 );
+
+    struct v4l2cam_video_mode vm;
+    vm.fourcc = fourcc_charArray_to_int( (unsigned char *)f.c_str() );
+    vm.width = width;
+    vm.height = height;
+    vm.size = width * height * 2;
+
+    return setFrameFormat( vm, fps );
+}
+
+
+bool ReplayCamera::setFrameFormat( struct v4l2cam_video_mode vm, int fps )
+{
+    if( m_streaming )
+    {
+        log( "Unable to call setFrameFormat() while streaming", warning );
+        return false;
+    }
+
+    if( (vm.width <= 0) || (vm.height <= 0) )
+    {
+        log( "Invalid frame size requested : " + std::to_string(vm.width) + " x " + std::to_string(vm.height), error );
+        return false;
+    }
+
+    char f[5];
+    fourcc_int_to_charArray( vm.fourcc, f );
+
+    m_currentMode = vm;
+    m_currentMode.format_str = f;
+    if( fps > 0 ) m_fps = fps;
+    m_currentMode.fps = { m_fps };
+
+    return true;
+}
+
+
+struct v4l2cam_video_mode * ReplayCamera::getFrameFormat()
+{
+    struct v4l2cam_video_mode * ret = new struct v4l2cam_video_mode;
+    *ret = m_currentMode;
+
+    // report the largest frame in the recording
+    size_t maxSize = 0;
+    for( auto &x : m_index ) if( x.length > maxSize ) maxSize = x.length;
+    if( maxSize > 0 ) ret->size = maxSize;
+
+    return ret;
+}
+
+
+int ReplayCamera::getFrameRate()
+{
+    return m_fps;
+}
+
+
+bool ReplayCamera::setFrameRate( int fps )
+{
+    if( fps <= 0 )
+    {
+        log( "Invalid frame rate requested : " + std::to_string(fps), error );
+        return false;
+    }
+
+    // only used for recordings without a rate in their frame headers
+    m_fps = fps;
+    m_currentMode.fps = { m_fps };
+
+    return true;
+}
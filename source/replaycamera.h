@@ -0,0 +1,95 @@
+#ifndef REPLAYCAMERA_H
+#define REPLAYCAMERA_H
+
+#include "v4l2camera.h"
+
+#include <vector>
+#include <string>
+#include <chrono>
+
+// ReplayCamera - plays back a recording made by v4l2cam captureFrames() as if it were a live camera
+//
+// - reads both framings : 'slap' + 4 byte length, and the 36 byte H264 frame header (-h option)
+// - the recording is memory mapped and indexed at open(), fetch() only waits and copies a frame out
+// - plain 'slap' recordings do not store the video mode, MJPG and H264 are recognized from the data,
+//   anything else uses the mode given with setFrameFormat() (default YUYV 640x480 at 30 fps)
+//
+class ReplayCamera: public V4l2Camera
+{
+private:
+    struct replayFrame
+    {
+        size_t offset;          // start of the frame data in the file
+        size_t length;          // frame data size, without the header
+        int rate;               // recorded frame rate, 0 if not recorded
+    };
+
+    std::string m_fileName;
+    int m_fd;
+    unsigned char * m_map;
+    size_t m_mapSize;
+    bool m_streaming;
+    int m_fps;
+
+    // playback control
+    double m_speed;
+    bool m_loop;
+    std::chrono::steady_clock::time_point m_start;
+    bool m_clockRunning;
+    long long m_playTime;
+    unsigned int m_sequence;
+    size_t m_next;
+
+    std::vector<struct replayFrame> m_index;
+    bool m_hasH264Header;
+
+    bool indexFile();
+    bool checkH264Header( size_t pos );
+    bool checkSlapHeader( size_t pos );
+    void detectFormat();
+
+public:
+    ReplayCamera( std::string fileName );
+    virtual ~ReplayCamera();
+
+    // Playback control
+    //
+    // - speed is a multiplier on the recorded rate, 0 plays back as fast as possible
+    // - with loop on the recording restarts at the end, otherwise fetch() returns nullptr
+    //
+    void setPlaybackSpeed( double speed ) { m_speed = (speed > 0.0) ? speed : 0.0; };
+    double getPlaybackSpeed() { return m_speed; };
+    void setLoop( bool on ) { m_loop = on; };
+    int getFrameCount() { return m_index.size(); };
+    bool rewind();
+
+    virtual std::string getDevName() override;
+    virtual bool enumCapabilities() override;
+    virtual bool canFetch() override;
+    virtual bool canRead() override;
+    virtual bool hasMetaData() override;
+
+    virtual std::vector<std::string> capabilitiesToStr() override;
+
+    virtual bool enumControls() override;
+    virtual int setValue( int id, int val, bool openOnDemand = false ) override;
+    virtual int getValue( int id, bool openOnDemand = false ) override;
+
+    virtual bool enumVideoModes() override;
+    virtual bool setFrameFormat( std::string mode, int width, int height, int fps = 30 ) override;
+    virtual bool setFrameFormat( struct v4l2cam_video_mode, int fps = 30 ) override;
+    virtual struct v4l2cam_video_mode * getFrameFormat() override;
+    virtual int getFrameRate() override;
+    virtual bool setFrameRate( int fps ) override;
+
+    virtual bool enumMetadataModes() override;
+
+    virtual bool isOpen() override;
+    virtual bool open() override;
+    virtual bool init( enum v4l2cam_fetch_mode ) override;
+    virtual void close() override;
+
+    virtual struct v4l2cam_image_buffer * fetch( bool lastOne ) override;
+};
+
+#endif // REPLAYCAMERA_H
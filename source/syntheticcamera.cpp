@@ -0,0 +1,878 @@
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "syntheticcamera.h"
+
+// control IDs and capability bits, same values as the video4linux2 api so callers can share code
+//
+static const int s_cidBrightness = 0x00980900;
+static const int s_cidContrast = 0x00980901;
+static const int s_ctrlTypeInteger = 1;
+
+static const unsigned int s_capVideoCapture = 0x00000001;
+static const unsigned int s_capStreaming = 0x04000000;
+
+// a real driver only holds a few frames, a slow consumer loses the rest
+static const int s_queueDepth = 5;
+
+// Bit writer shared by the JPEG and H264 encoders
+//
+// - JPEG entropy data needs 0x00 stuffed after every 0xFF
+// - H264 emulation prevention is applied later, when the NAL unit is written out
+//
+struct synthBitWriter
+{
+    std::vector<unsigned char> bytes;
+    unsigned int acc = 0;
+    int count = 0;
+    bool stuffFF = false;
+
+    void put( unsigned int bits, int len )
+    {
+        for( int i=len-1;i>=0;i-- )
+        {
+            acc = (acc << 1) | ((bits >> i) & 1);
+            if( ++count == 8 )
+            {
+                bytes.push_back( (unsigned char)acc );
+                if( stuffFF && (0xFF == acc) ) bytes.push_back( 0x00 );
+                acc = 0;
+                count = 0;
+            }
+        }
+    }
+
+    void ue( unsigned int v )
+    {
+        // exp-golomb, leading zeros then (v+1) in binary
+        unsigned int x = v + 1;
+        int len = 0;
+        while( (x >> len) > 1 ) len++;
+        put( 0, len );
+        put( x, len + 1 );
+    }
+
+    void se( int v )
+    {
+        ue( (v > 0) ? (2 * v - 1) : (-2 * v) );
+    }
+
+    bool aligned() { return (0 == count); }
+
+    void pad( int bit )
+    {
+        while( count ) put( bit, 1 );
+    }
+};
+
+// Annex K standard Huffman tables, BITS (16 counts) followed by HUFFVAL
+//
+static const unsigned char s_dcLumBits[16] = { 0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 };
+static const unsigned char s_dcChrBits[16] = { 0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0 };
+static const unsigned char s_dcVals[12] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
+
+static const unsigned char s_acLumBits[16] = { 0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d };
+static const unsigned char s_acLumVals[162] =
+{
+    0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,
+    0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,
+    0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
+    0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,
+    0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,
+    0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
+    0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,
+    0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,
+    0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
+    0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,
+    0xf9,0xfa
+};
+
+static const unsigned char s_acChrBits[16] = { 0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77 };
+static const unsigned char s_acChrVals[162] =
+{
+    0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,
+    0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,
+    0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+    0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,
+    0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,
+    0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+    0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,
+    0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,
+    0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+    0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,
+    0xf9,0xfa
+};
+
+// canonical Huffman code for symbol, from BITS / HUFFVAL
+//
+static void synthHuffCode( const unsigned char * bits, const unsigned char * vals, int symbol, unsigned int & code, int & len )
+{
+    unsigned int c = 0;
+    int k = 0;
+
+    for( int l=1;l<=16;l++ )
+    {
+        for( int i=0;i<bits[l-1];i++ )
+        {
+            if( vals[k++] == symbol ) { code = c; len = l; return; }
+            c++;
+        }
+        c <<= 1;
+    }
+
+    code = 0;
+    len = 0;
+}
+
+static void synthPutDHT( std::vector<unsigned char> & out, int tableClassId, const unsigned char * bits, const unsigned char * vals )
+{
+    int count = 0;
+    for( int i=0;i<16;i++ ) count += bits[i];
+
+    int len = 2 + 1 + 16 + count;
+    out.insert( out.end(), { 0xFF, 0xC4, (unsigned char)(len >> 8), (unsigned char)len, (unsigned char)tableClassId } );
+    out.insert( out.end(), bits, bits + 16 );
+    out.insert( out.end(), vals, vals + count );
+}
+
+// append one NAL unit, with start code and emulation prevention
+//
+static void synthPutNAL( std::vector<unsigned char> & out, unsigned char header, std::vector<unsigned char> & rbsp )
+{
+    out.insert( out.end(), { 0x00, 0x00, 0x00, 0x01, header } );
+
+    int zeros = 0;
+    for( unsigned char x : rbsp )
+    {
+        if( (zeros >= 2) && (x <= 3) )
+        {
+            out.push_back( 0x03 );
+            zeros = 0;
+        }
+        out.push_back( x );
+        zeros = (0 == x) ? zeros + 1 : 0;
+    }
+}
+
+
+SyntheticCamera::SyntheticCamera( std::string name )
+    : V4l2Camera()
+{
+    m_devName = name;
+    m_userName = "Synthetic Camera";
+    m_cameraType = "synthetic frame source";
+    m_capabilities = 0;
+    m_open = false;
+    m_streaming = false;
+    m_bufferMode = notset;
+
+    m_jitterUs = 0;
+    m_dropRate = 0.0;
+    m_freeRun = false;
+    m_rand.seed( 5489u );
+    m_sequence = 0;
+    m_clockRunning = false;
+    m_dirty = true;
+
+    // default mode, YUYV VGA at 30 fps
+    m_fps = 30;
+    m_currentMode.fourcc = fourcc_charArray_to_int( (unsigned char *)"YUYV" );
+    m_currentMode.format_str = "YUYV";
+    m_currentMode.width = 640;
+    m_currentMode.height = 480;
+    m_currentMode.size = 640 * 480 * 2;
+    m_currentMode.fps = { 15, 30, 60 };
+
+    m_healthCounter = 0;
+}
+
+
+SyntheticCamera::~SyntheticCamera()
+{
+}
+
+
+std::string SyntheticCamera::getDevName()
+{
+    return m_devName;
+}
+
+
+//
+// Basic Access routines
+//
+bool SyntheticCamera::open()
+{
+    m_open = true;
+    m_bufferMode = userPtrMode;
+    m_healthCounter = 0;
+
+    log( m_devName + " opened", info );
+
+    return true;
+}
+
+
+bool SyntheticCamera::isOpen()
+{
+    return m_open;
+}
+
+
+void SyntheticCamera::close()
+{
+    m_open = false;
+    m_streaming = false;
+
+    log( m_devName + " closed", info );
+}
+
+
+bool SyntheticCamera::init( enum v4l2cam_fetch_mode newMode )
+{
+    if( !isOpen() )
+    {
+        log( "Unable to call init() as device is NOT open", info );
+        return false;
+    }
+
+    m_bufferMode = newMode;
+
+    // all the frame generation cost is paid here, not in fetch()
+    if( m_dirty ) renderRing();
+
+    // the frame clock starts on the first fetch, so cameras initialized one after the other still line up
+    m_sequence = 0;
+    m_clockRunning = false;
+    m_streaming = true;
+    m_healthCounter = 0;
+
+    return true;
+}
+
+
+//
+// Data Retreiaval routines
+//
+struct v4l2cam_image_buffer * SyntheticCamera::fetch( bool lastOne )
+{
+    struct v4l2cam_image_buffer * retBuffer = nullptr;
+
+    if( !isOpen() || !m_streaming )
+    {
+        log( "Unable to call fetch() as device is not streaming", warning );
+        return nullptr;
+    }
+
+    if( m_dirty ) renderRing();
+
+    if( !m_clockRunning )
+    {
+        m_start = std::chrono::steady_clock::now();
+        m_clockRunning = true;
+    }
+
+    long long intervalUs = 1000000LL / ((m_fps > 0) ? m_fps : 30);
+    std::chrono::steady_clock::time_point target;
+    unsigned int seq;
+
+    while( true )
+    {
+        seq = m_sequence++;
+
+        if( m_freeRun )
+        {
+            target = std::chrono::steady_clock::now();
+        }
+        else
+        {
+            target = m_start + std::chrono::microseconds( seq * intervalUs );
+
+            if( m_jitterUs > 0 )
+            {
+                std::uniform_int_distribution<int> jitter( -m_jitterUs, m_jitterUs );
+                target += std::chrono::microseconds( jitter(m_rand) );
+            }
+
+            // consumer fell too far behind, the "driver" would have overwritten these frames
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if( now - target > std::chrono::microseconds( s_queueDepth * intervalUs ) ) continue;
+
+            // sleep most of the way, spin for the last bit to hit the deadline precisely
+            std::this_thread::sleep_until( target - std::chrono::microseconds(200) );
+            while( std::chrono::steady_clock::now() < target ) {}
+        }
+
+        // injected drop, the sequence number gap is visible to the caller
+        if( m_dropRate > 0.0 )
+        {
+            std::uniform_real_distribution<double> chance( 0.0, 1.0 );
+            if( chance(m_rand) < m_dropRate ) continue;
+        }
+
+        break;
+    }
+
+    std::vector<unsigned char> & frame = m_ring[seq % m_ring.size()];
+
+    retBuffer = new struct v4l2cam_image_buffer;
+    retBuffer->buffer = new unsigned char[frame.size()];
+    retBuffer->length = frame.size();
+    retBuffer->width = m_currentMode.width;
+    retBuffer->height = m_currentMode.height;
+    retBuffer->sequence = seq;
+    retBuffer->timestamp = std::chrono::duration_cast<std::chrono::microseconds>( target.time_since_epoch() ).count();
+    retBuffer->age = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - target ).count();
+    retBuffer->skipped = 0;
+    memcpy( retBuffer->buffer, frame.data(), frame.size() );
+
+    if( lastOne ) m_streaming = false;
+
+    return retBuffer;
+}
+
+
+//
+// Frame generation
+//
+void SyntheticCamera::patternAt( int x, int y, int index, int & Y, int & U, int & V )
+{
+    int w = m_currentMode.width;
+    int h = m_currentMode.height;
+
+    // diagonal luma ramp that moves with each frame, chroma ramps across and down
+    Y = 16 + (((x + y + index * 8) & 0xFF) * 219) / 255;
+    U = 128 - 64 + (x * 128) / w;
+    V = 128 - 64 + (y * 128) / h;
+
+    // a white box stepping across the frame
+    int box = h / 4;
+    int bx = (index * w) / NUM_SYNTH_FRAMES;
+    if( (x >= bx) && (x < bx + box) && (y >= box) && (y < 2 * box) ) { Y = 235; U = 128; V = 128; }
+
+    // brightness and contrast controls
+    Y = ((Y - 128) * m_controls[s_cidContrast].value) / 32 + 128 + m_controls[s_cidBrightness].value;
+    if( Y < 0 ) Y = 0;
+    if( Y > 255 ) Y = 255;
+}
+
+
+void SyntheticCamera::renderRing()
+{
+    if( m_controls.size() == 0 ) enumControls();
+
+    m_ring.assign( NUM_SYNTH_FRAMES, {} );
+    for( int i=0;i<NUM_SYNTH_FRAMES;i++ ) renderFrame( i, m_ring[i] );
+
+    m_dirty = false;
+}
+
+
+void SyntheticCamera::renderFrame( int index, std::vector<unsigned char> & out )
+{
+    int w = m_currentMode.width;
+    int h = m_currentMode.height;
+    int Y, U, V;
+
+    char f[5];
+    fourcc_int_to_charArray( m_currentMode.fourcc, f );
+    std::string fmt = f;
+
+    out.clear();
+
+    if( (fmt == "YUYV") || (fmt == "YUY2") )
+    {
+        out.resize( w * h * 2 );
+        for( int y=0;y<h;y++ )
+        {
+            for( int x=0;x<w;x+=2 )
+            {
+                unsigned char * p = &out[(y * w + x) * 2];
+                patternAt( x, y, index, Y, U, V );
+                p[0] = Y; p[1] = U; p[3] = V;
+                patternAt( x + 1, y, index, Y, U, V );
+                p[2] = Y;
+            }
+        }
+    }
+    else if( (fmt == "NV12") || (fmt == "YU12") || (fmt == "I420") )
+    {
+        out.resize( w * h + 2 * ((w / 2) * (h / 2)) );
+        unsigned char * uv = &out[w * h];
+        int cw = w / 2;
+        int ch = h / 2;
+
+        for( int y=0;y<h;y++ )
+        {
+            for( int x=0;x<w;x++ )
+            {
+                patternAt( x, y, index, Y, U, V );
+                out[y * w + x] = Y;
+
+                if( ((x & 1) == 0) && ((y & 1) == 0) && (x / 2 < cw) && (y / 2 < ch) )
+                {
+                    if( fmt == "NV12" )
+                    {
+                        uv[(y / 2) * w + x] = U;
+                        uv[(y / 2) * w + x + 1] = V;
+                    } else {
+                        uv[(y / 2) * cw + x / 2] = U;
+                        uv[cw * ch + (y / 2) * cw + x / 2] = V;
+                    }
+                }
+            }
+        }
+    }
+    else if( fmt == "GREY" )
+    {
+        out.resize( w * h );
+        for( int y=0;y<h;y++ )
+            for( int x=0;x<w;x++ ) { patternAt( x, y, index, Y, U, V ); out[y * w + x] = Y; }
+    }
+    else if( fmt == "Y16 " )
+    {
+        // little endian, use the full 16 bit range so low bytes are not all zero
+        out.resize( w * h * 2 );
+        for( int y=0;y<h;y++ )
+        {
+            for( int x=0;x<w;x++ )
+            {
+                patternAt( x, y, index, Y, U, V );
+                int v = (Y << 8) | ((x * 7 + y * 3) & 0xFF);
+                out[(y * w + x) * 2] = v & 0xFF;
+                out[(y * w + x) * 2 + 1] = v >> 8;
+            }
+        }
+    }
+    else if( fmt == "MJPG" ) encodeJPEG( index, out );
+    else if( fmt == "H264" ) encodeH264( index, out );
+    else
+    {
+        log( "Unsupported synthetic format [" + fmt + "], generating blank frames", warning );
+        out.assign( m_currentMode.size > 0 ? m_currentMode.size : w * h * 2, 0 );
+    }
+}
+
+
+void SyntheticCamera::encodeJPEG( int index, std::vector<unsigned char> & out )
+{
+    int w = m_currentMode.width;
+    int h = m_currentMode.height;
+    int mcuX = (w + 15) / 16;
+    int mcuY = (h + 15) / 16;
+
+    // SOI
+    out.insert( out.end(), { 0xFF, 0xD8 } );
+
+    // DQT, all 8s so a quantized DC value is simply the block mean - 128
+    out.insert( out.end(), { 0xFF, 0xDB, 0x00, 0x43, 0x00 } );
+    out.insert( out.end(), 64, 8 );
+
+    // SOF0, 4:2:0
+    out.insert( out.end(), { 0xFF, 0xC0, 0x00, 0x11, 0x08,
+                             (unsigned char)(h >> 8), (unsigned char)h, (unsigned char)(w >> 8), (unsigned char)w,
+                             0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x00, 0x03, 0x11, 0x00 } );
+
+    synthPutDHT( out, 0x00, s_dcLumBits, s_dcVals );
+    synthPutDHT( out, 0x10, s_acLumBits, s_acLumVals );
+    synthPutDHT( out, 0x01, s_dcChrBits, s_dcVals );
+    synthPutDHT( out, 0x11, s_acChrBits, s_acChrVals );
+
+    // DRI, one restart interval per MCU row
+    out.insert( out.end(), { 0xFF, 0xDD, 0x00, 0x04, (unsigned char)(mcuX >> 8), (unsigned char)mcuX } );
+
+    // SOS
+    out.insert( out.end(), { 0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3F, 0x00 } );
+
+    unsigned int eobLum, eobChr;
+    int eobLumLen, eobChrLen;
+    synthHuffCode( s_acLumBits, s_acLumVals, 0x00, eobLum, eobLumLen );
+    synthHuffCode( s_acChrBits, s_acChrVals, 0x00, eobChr, eobChrLen );
+
+    synthBitWriter bw;
+    bw.stuffFF = true;
+
+    for( int my=0;my<mcuY;my++ )
+    {
+        int pred[3] = { 0, 0, 0 };
+
+        for( int mx=0;mx<mcuX;mx++ )
+        {
+            int Y, U, V;
+            int dc[6];
+
+            // four luma blocks, then Cb and Cr, each block is flat
+            for( int b=0;b<4;b++ )
+            {
+                int px = mx * 16 + (b & 1) * 8 + 4;
+                int py = my * 16 + (b >> 1) * 8 + 4;
+                patternAt( (px < w) ? px : w - 1, (py < h) ? py : h - 1, index, Y, U, V );
+                dc[b] = Y - 128;
+            }
+            patternAt( (mx * 16 + 8 < w) ? mx * 16 + 8 : w - 1, (my * 16 + 8 < h) ? my * 16 + 8 : h - 1, index, Y, U, V );
+            dc[4] = U - 128;
+            dc[5] = V - 128;
+
+            for( int b=0;b<6;b++ )
+            {
+                int comp = (b < 4) ? 0 : b - 3;
+                int diff = dc[b] - pred[comp];
+                pred[comp] = dc[b];
+
+                int mag = (diff < 0) ? -diff : diff;
+                int size = 0;
+                while( mag >> size ) size++;
+
+                unsigned int code;
+                int len;
+                synthHuffCode( (0 == comp) ? s_dcLumBits : s_dcChrBits, s_dcVals, size, code, len );
+                bw.put( code, len );
+                if( size ) bw.put( (diff < 0) ? (diff + (1 << size) - 1) : diff, size );
+
+                if( 0 == comp ) bw.put( eobLum, eobLumLen );
+                else bw.put( eobChr, eobChrLen );
+            }
+        }
+
+        // restart marker between rows
+        bw.pad( 1 );
+        if( my < mcuY - 1 ) bw.bytes.insert( bw.bytes.end(), { 0xFF, (unsigned char)(0xD0 + (my & 7)) } );
+    }
+
+    out.insert( out.end(), bw.bytes.begin(), bw.bytes.end() );
+
+    // EOI
+    out.insert( out.end(), { 0xFF, 0xD9 } );
+}
+
+
+void SyntheticCamera::encodeH264( int index, std::vector<unsigned char> & out )
+{
+    int w = m_currentMode.width;
+    int h = m_currentMode.height;
+    int mbW = (w + 15) / 16;
+    int mbH = (h + 15) / 16;
+
+    // SPS, constrained baseline
+    synthBitWriter sps;
+    sps.put( 66, 8 );               // profile_idc
+    sps.put( 0x40, 8 );             // constraint_set1_flag
+    sps.put( 51, 8 );               // level_idc
+    sps.ue( 0 );                    // seq_parameter_set_id
+    sps.ue( 0 );                    // log2_max_frame_num_minus4
+    sps.ue( 2 );                    // pic_order_cnt_type
+    sps.ue( 1 );                    // max_num_ref_frames
+    sps.put( 0, 1 );                // gaps_in_frame_num_value_allowed_flag
+    sps.ue( mbW - 1 );
+    sps.ue( mbH - 1 );
+    sps.put( 1, 1 );                // frame_mbs_only_flag
+    sps.put( 1, 1 );                // direct_8x8_inference_flag
+    if( (mbW * 16 != w) || (mbH * 16 != h) )
+    {
+        sps.put( 1, 1 );            // frame_cropping_flag, offsets are in chroma samples
+        sps.ue( 0 );
+        sps.ue( (mbW * 16 - w) / 2 );
+        sps.ue( 0 );
+        sps.ue( (mbH * 16 - h) / 2 );
+    } else sps.put( 0, 1 );
+    sps.put( 0, 1 );                // vui_parameters_present_flag
+    sps.put( 1, 1 );                // rbsp_stop_one_bit
+    sps.pad( 0 );
+    synthPutNAL( out, 0x67, sps.bytes );
+
+    // PPS
+    synthBitWriter pps;
+    pps.ue( 0 );                    // pic_parameter_set_id
+    pps.ue( 0 );                    // seq_parameter_set_id
+    pps.put( 0, 1 );                // entropy_coding_mode_flag (CAVLC)
+    pps.put( 0, 1 );                // bottom_field_pic_order_in_frame_present_flag
+    pps.ue( 0 );                    // num_slice_groups_minus1
+    pps.ue( 0 );                    // num_ref_idx_l0_default_active_minus1
+    pps.ue( 0 );                    // num_ref_idx_l1_default_active_minus1
+    pps.put( 0, 1 );                // weighted_pred_flag
+    pps.put( 0, 2 );                // weighted_bipred_idc
+    pps.se( 0 );                    // pic_init_qp_minus26
+    pps.se( 0 );                    // pic_init_qs_minus26
+    pps.se( 0 );                    // chroma_qp_index_offset
+    pps.put( 1, 1 );                // deblocking_filter_control_present_flag
+    pps.put( 0, 1 );                // constrained_intra_pred_flag
+    pps.put( 0, 1 );                // redundant_pic_cnt_present_flag
+    pps.put( 1, 1 );
+    pps.pad( 0 );
+    synthPutNAL( out, 0x68, pps.bytes );
+
+    // IDR slice, every macroblock is I_PCM so no transform or prediction is needed
+    synthBitWriter slice;
+    slice.ue( 0 );                  // first_mb_in_slice
+    slice.ue( 7 );                  // slice_type, I (all slices)
+    slice.ue( 0 );                  // pic_parameter_set_id
+    slice.put( 0, 4 );              // frame_num
+    slice.ue( index & 1 );          // idr_pic_id, consecutive IDRs must differ
+    slice.put( 0, 1 );              // no_output_of_prior_pics_flag
+    slice.put( 0, 1 );              // long_term_reference_flag
+    slice.se( 0 );                  // slice_qp_delta
+    slice.ue( 1 );                  // disable_deblocking_filter_idc
+
+    int Y, U, V;
+    for( int my=0;my<mbH;my++ )
+    {
+        for( int mx=0;mx<mbW;mx++ )
+        {
+            slice.ue( 25 );         // mb_type I_PCM
+            slice.pad( 0 );         // pcm_alignment_zero_bit
+
+            // samples are kept above zero, early decoders reject zero PCM samples
+            for( int y=0;y<16;y++ )
+                for( int x=0;x<16;x++ )
+                {
+                    int px = mx * 16 + x, py = my * 16 + y;
+                    patternAt( (px < w) ? px : w - 1, (py < h) ? py : h - 1, index, Y, U, V );
+                    slice.bytes.push_back( (Y > 0) ? Y : 1 );
+                }
+
+            for( int c=0;c<2;c++ )
+                for( int y=0;y<8;y++ )
+                    for( int x=0;x<8;x++ )
+                    {
+                        int px = mx * 16 + x * 2, py = my * 16 + y * 2;
+                        patternAt( (px < w) ? px : w - 1, (py < h) ? py : h - 1, index, Y, U, V );
+                        int s = (0 == c) ? U : V;
+                        slice.bytes.push_back( (s > 0) ? s : 1 );
+                    }
+        }
+    }
+
+    slice.put( 1, 1 );              // rbsp_slice_trailing_bits
+    slice.pad( 0 );
+    synthPutNAL( out, 0x65, slice.bytes );
+}
+
+
+//
+// Device Capability routines
+//
+bool SyntheticCamera::enumCapabilities()
+{
+    m_capabilities = s_capVideoCapture | s_capStreaming;
+
+    return true;
+}
+
+
+std::vector<std::string> SyntheticCamera::capabilitiesToStr()
+{
+    std::vector<std::string> ret = {};
+
+    if( m_capabilities & s_capStreaming ) ret.push_back("can stream");
+    if( m_capabilities & s_capVideoCapture ) ret.push_back("supports single-planar video capture");
+    ret.push_back("synthetic frame source");
+
+    return ret;
+}
+
+
+bool SyntheticCamera::canFetch()
+{
+    return true;
+}
+
+
+bool SyntheticCamera::canRead()
+{
+    return false;
+}
+
+
+bool SyntheticCamera::hasMetaData()
+{
+    return false;
+}
+
+
+bool SyntheticCamera::enumMetadataModes()
+{
+    m_metamode = 0;
+    m_metasize = 0;
+
+    return false;
+}
+
+
+//
+// Camera Control routines
+//
+bool SyntheticCamera::enumControls()
+{
+    m_controls.clear();
+
+    struct v4l2cam_control c;
+    c.type = s_ctrlTypeInteger;
+    c.typeStr = cntrlTypeToString( c.type );
+    c.step = 1;
+
+    c.name = "Brightness";
+    c.id = s_cidBrightness;
+    c.min = -64;
+    c.max = 64;
+    c.value = 0;
+    m_controls[c.id] = c;
+
+    c.name = "Contrast";
+    c.id = s_cidContrast;
+    c.min = 0;
+    c.max = 64;
+    c.value = 32;
+    m_controls[c.id] = c;
+
+    return true;
+}
+
+
+std::string SyntheticCamera::cntrlTypeToString( int type )
+{
+    if( s_ctrlTypeInteger == type ) return "int";
+
+    return "unknown";
+}
+
+
+int SyntheticCamera::setValue( int id, int val, bool /*openOnDemand*/ )
+{
+    if( m_controls.size() == 0 ) enumControls();
+
+    if( m_controls.find(id) == m_controls.end() )
+    {
+        log( "setValue() [" + std::to_string(id) + "] failed : no such control", info );
+        return -1;
+    }
+
+    if( val < m_controls[id].min ) val = m_controls[id].min;
+    if( val > m_controls[id].max ) val = m_controls[id].max;
+
+    m_controls[id].value = val;
+
+    // frames are re-rendered on the next fetch
+    m_dirty = true;
+
+    return val;
+}
+
+
+int SyntheticCamera::getValue( int id, bool /*openOnDemand*/ )
+{
+    if( m_controls.size() == 0 ) enumControls();
+
+    if( m_controls.find(id) == m_controls.end() )
+    {
+        log( "getValue() [" + std::to_string(id) + "] failed : no such control", info );
+        return -1;
+    }
+
+    return m_controls[id].value;
+}
+
+
+//
+// Video mode routines
+//
+bool SyntheticCamera::enumVideoModes()
+{
+    m_modes.clear();
+
+    const char * formats[] = { "YUYV", "NV12", "YU12", "I420", "GREY", "Y16 ", "MJPG", "H264" };
+    const int sizes[][2] = { {320,240}, {640,480}, {1280,720}, {1920,1080}, {3840,2160} };
+
+    for( const char * f : formats )
+    {
+        for( auto &s : sizes )
+        {
+            struct v4l2cam_video_mode vm;
+            vm.fourcc = fourcc_charArray_to_int( (unsigned char *)f );
+            vm.format_str = f;
+            vm.width = s[0];
+            vm.height = s[1];
+            vm.size = s[0] * s[1] * 2;
+            vm.fps = { 15, 30, 60 };
+            m_modes.push_back( vm );
+        }
+    }
+
+    return true;
+}
+
+
+bool SyntheticCamera::setFrameFormat( std::string mode, int width, int height, int fps )
+{
+    if( m_modes.size() == 0 ) enumVideoModes();
+
+    return V4l2Camera::setFrameFormat( mode, width, height, fps );
+}
+
+
+bool SyntheticCamera::setFrameFormat( struct v4l2cam_video_mode vm, int fps )
+{
+    if( m_streaming )
+    {
+        log( "Unable to call setFrameFormat() while streaming", warning );
+        return false;
+    }
+
+    // any size is accepted, the 4:2:0 formats need even dimensions
+    if( (vm.width < 2) || (vm.height < 2) )
+    {
+        log( "Invalid frame size requested : " + std::to_string(vm.width) + " x " + std::to_string(vm.height), error );
+        return false;
+    }
+
+    char f[5];
+    fourcc_int_to_charArray( vm.fourcc, f );
+
+    m_currentMode = vm;
+    m_currentMode.width &= ~1;
+    m_currentMode.height &= ~1;
+    m_currentMode.format_str = f;
+    if( fps > 0 ) m_fps = fps;
+    m_dirty = true;
+
+    return true;
+}
+
+
+struct v4l2cam_video_mode * SyntheticCamera::getFrameFormat()
+{
+    struct v4l2cam_video_mode * ret = new struct v4l2cam_video_mode;
+    *ret = m_currentMode;
+
+    if( m_dirty ) renderRing();
+
+    // report the largest frame for compressed formats
+    size_t maxSize = 0;
+    for( auto &x : m_ring ) if( x.size() > maxSize ) maxSize = x.size();
+    ret->size = maxSize;
+
+    return ret;
+}
+
+
+int SyntheticCamera::getFrameRate()
+{
+    return m_fps;
+}
+
+
+bool SyntheticCamera::setFrameRate( int fps )
+{
+    if( fps <= 0 )
+    {
+        log( "Invalid frame rate requested : " + std::to_string(fps), error );
+        return false;
+    }
+
+    m_fps = fps;
+
+    // keep the sequence continuous, restart the clock from here
+    m_start = std::chrono::steady_clock::now() - std::chrono::microseconds( (long long)m_sequence * (1000000LL / fps) );
+
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef SYNTHETICCAMERA_H
+#define SYNTHETICCAMERA_H
+
+#include "v4l2camera.h"
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+# define NUM_SYNTH_FRAMES 8
+
+// SyntheticCamera - hardware free camera, generates test frames at a precise rate
+//
+// - supports YUYV, NV12, YU12, I420, GREY, Y16, MJPG and H264 (Annex-B)
+// - MJPG frames are baseline JPEG built from flat 8x8 blocks, with a restart marker on every MCU row
+// - H264 frames are IDR access units made of I_PCM macroblocks, each with SPS and PPS
+// - frames are rendered once at init() into a small ring, fetch() only copies them out
+//
+class SyntheticCamera: public V4l2Camera
+{
+private:
+    std::string m_devName;
+    bool m_open;
+    bool m_streaming;
+    int m_fps;
+
+    // timing and fault injection
+    int m_jitterUs;
+    double m_dropRate;
+    bool m_freeRun;
+    std::mt19937 m_rand;
+    std::chrono::steady_clock::time_point m_start;
+    bool m_clockRunning;
+    unsigned int m_sequence;
+
+    // pre-rendered frames
+    std::vector<std::vector<unsigned char>> m_ring;
+    bool m_dirty;
+
+    void renderRing();
+    void renderFrame( int index, std::vector<unsigned char> & out );
+    void patternAt( int x, int y, int index, int & Y, int & U, int & V );
+
+    void encodeJPEG( int index, std::vector<unsigned char> & out );
+    void encodeH264( int index, std::vector<unsigned char> & out );
+
+public:
+    SyntheticCamera( std::string name = "synthetic0" );
+    virtual ~SyntheticCamera();
+
+    // Frame source behaviour
+    //
+    void setJitter( int jitterUs ) { m_jitterUs = (jitterUs > 0) ? jitterUs : 0; };
+    // kept below 1 so fetch() always gets a frame eventually
+    void setDropRate( double probability ) { m_dropRate = (probability > 0.0) ? std::min( probability, 0.99 ) : 0.0; };
+    void setFreeRun( bool on ) { m_freeRun = on; };
+
+    virtual std::string getDevName() override;
+    virtual bool enumCapabilities() override;
+    virtual bool canFetch() override;
+    virtual bool canRead() override;
+    virtual bool hasMetaData() override;
+
+    virtual std::vector<std::string> capabilitiesToStr() override;
+
+    virtual bool enumControls() override;
+    virtual std::string cntrlTypeToString(int type) override;
+    virtual int setValue( int id, int val, bool openOnDemand = false ) override;
+    virtual int getValue( int id, bool openOnDemand = false ) override;
+
+    virtual bool enumVideoModes() override;
+    virtual bool setFrameFormat( std::string mode, int width, int height, int fps = 30 ) override;
+    virtual bool setFrameFormat( struct v4l2cam_video_mode, int fps = 30 ) override;
+    virtual struct v4l2cam_video_mode * getFrameFormat() override;
+    virtual int getFrameRate() override;
+    virtual bool setFrameRate( int fps ) override;
+
+    virtual bool enumMetadataModes() override;
+
+    virtual bool isOpen() override;
+    virtual bool open() override;
+    virtual bool init( enum v4l2cam_fetch_mode ) override;
+    virtual void close() override;
+
+    virtual struct v4l2cam_image_buffer * fetch( bool lastOne ) override;
+};
+
+#endif // SYNTHETICCAMERA_H
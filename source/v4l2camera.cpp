@@ -22,6 +22,19 @@ V4l2Camera::V4l2Camera()
     m_capabilities = 0;
     m_metamode = -1;
     m_metasize = -1;
+    m_latestOnly = false;
+
+    // no real-time tuning unless asked for
+    m_streamConfig.cpuAffinity.clear();
+    m_streamConfig.schedPolicy = schedDefault;
+    m_streamConfig.schedPriority = 0;
+    m_streamConfig.lockMemory = false;
+    m_streamConfig.prefault = false;
+
+    // watchdog is off by default, fetch() blocks until a frame arrives
+    m_watchdogOn = false;
+    m_watchdogFrames = 5;
+    memset( &m_watchdogStats, 0, sizeof(m_watchdogStats) );
 
     // force to unhealthy state
     m_healthCounter = s_healthCountLimit;
@@ -266,6 +279,27 @@ struct v4l2cam_image_buffer * V4l2Camera::fetch( bool lastOne )
 }
 
 
+std::vector<struct v4l2cam_image_buffer *> V4l2Camera::fetchBatch( int maxFrames, bool lastOne )
+{
+    std::vector<struct v4l2cam_image_buffer *> ret;
+
+    // default implementation, sub-classes that can drain their queue should override this
+    if( maxFrames > 0 )
+    {
+        struct v4l2cam_image_buffer * tmp = fetch( lastOne );
+        if( tmp ) ret.push_back( tmp );
+    }
+
+    return ret;
+}
+
+
+bool V4l2Camera::applyStreamConfig()
+{
+    return false;
+}
+
+
 struct v4l2cam_metadata_buffer * V4l2Camera::fetchMetaData()
 {
     struct v4l2cam_metadata_buffer * retBuffer = nullptr;
@@ -55,6 +55,9 @@ struct v4l2cam_control
 
 // v4l2_video_mode - structure to hold a single video mode
 //
+// - colorspace, quantization and ycbcr_enc are the V4L2 values reported by getFrameFormat(),
+//   0 is the driver default, they are not filled in by mode enumeration
+//
 struct v4l2cam_video_mode
 {
     unsigned int fourcc;
@@ -63,6 +66,24 @@ struct v4l2cam_video_mode
     int height;
     int size;
     std::set<int> fps;
+    int colorspace = 0;             // enum v4l2_colorspace
+    int quantization = 0;           // enum v4l2_quantization
+    int ycbcr_enc = 0;              // enum v4l2_ycbcr_encoding
+};
+
+// v4l2cam_frame_stats - luma statistics of a frame, attached by the application (imageStatistics()
+// in image_utils), valid stays false until then
+//
+struct v4l2cam_frame_stats
+{
+    bool valid = false;
+    unsigned int histogram[256] = {};   // 8 bit luma levels
+    unsigned int samples = 0;
+    double mean = 0;
+    double variance = 0;
+    double lowClip = 0;                 // percent of samples at or below 16
+    double highClip = 0;                // percent at or above 235
+    double sharpness = 0;               // Laplacian variance, falls as the image blurs
 };
 
 // v4l2_image_buffer - structure to hold a single image buffer
@@ -73,6 +94,11 @@ struct v4l2cam_image_buffer
     int width;
     int height;
     unsigned char * buffer;
+    unsigned int sequence;          // frame sequence number provided by the driver
+    long long timestamp;            // capture time in microseconds (CLOCK_MONOTONIC on Linux)
+    long long age;                  // microseconds between capture and return to caller, -1 if unknown
+    int skipped;                    // stale frames discarded in front of this one (latest frame mode)
+    struct v4l2cam_frame_stats stats;
 };
 
 // v4l2_metadata_buffer - structure to hold meta data buffer
@@ -91,6 +117,36 @@ enum v4l2cam_fetch_mode
     notset, readMode, userPtrMode, mMapMode
 };
 
+// Scheduling policy for the capture thread
+//
+enum v4l2cam_sched_policy
+{
+    schedDefault, schedFifo, schedRoundRobin
+};
+
+// v4l2cam_stream_config - real-time tuning applied when streaming is initialized
+//
+struct v4l2cam_stream_config
+{
+    std::vector<int> cpuAffinity;               // CPUs the capture thread may run on, empty leaves it unchanged
+    enum v4l2cam_sched_policy schedPolicy;      // schedFifo or schedRoundRobin need CAP_SYS_NICE (or root)
+    int schedPriority;                          // 1..99, only used for schedFifo and schedRoundRobin
+    bool lockMemory;                            // mlock the capture buffers, limited by RLIMIT_MEMLOCK
+    bool prefault;                              // touch every page of the capture buffers at init
+};
+
+// v4l2cam_watchdog_stats - stall detection and recovery counters
+//
+struct v4l2cam_watchdog_stats
+{
+    int stalls;                     // frame deadlines missed
+    int requeues;                   // recovered by re-queueing the capture buffers
+    int restarts;                   // recovered by STREAMOFF / STREAMON
+    int reopens;                    // recovered by closing and re-opening the device
+    int failures;                   // every recovery stage failed
+    long long lastRecoveryUs;       // time from stall detection to the next good frame
+};
+
 // Logging control - indicates where information messages are displayed
 //
 enum v4l2cam_logging_mode
@@ -163,6 +219,11 @@ public:
     struct v4l2cam_video_mode m_currentMode;
     enum v4l2cam_fetch_mode m_bufferMode;
     int m_healthCounter;
+    bool m_latestOnly;
+    struct v4l2cam_stream_config m_streamConfig;
+    bool m_watchdogOn;
+    int m_watchdogFrames;
+    struct v4l2cam_watchdog_stats m_watchdogStats;
 
     // Logging control
     //
@@ -231,6 +292,24 @@ public:
     virtual bool setFrameFormat( struct v4l2cam_video_mode, int fps = 30 );
     virtual bool setFrameRate( int fps );
     virtual struct v4l2cam_image_buffer * fetch( bool lastOne );
+    virtual std::vector<struct v4l2cam_image_buffer *> fetchBatch( int maxFrames, bool lastOne = false );
+
+    // Real-time tuning, applied by init() to the calling thread, so call init() from the capture thread
+    //
+    void setStreamConfig( struct v4l2cam_stream_config cfg ) { m_streamConfig = cfg; };
+    struct v4l2cam_stream_config getStreamConfig() { return m_streamConfig; };
+    virtual bool applyStreamConfig();
+
+    // Stall watchdog, a stall is declared after missedFrames frame intervals with no frame
+    //
+    void setWatchdog( bool on, int missedFrames = 5 ) { m_watchdogOn = on; m_watchdogFrames = (missedFrames > 0) ? missedFrames : 1; };
+    bool getWatchdog() { return m_watchdogOn; };
+    struct v4l2cam_watchdog_stats getWatchdogStats() { return m_watchdogStats; };
+
+    // Latest frame mode, fetch() discards queued stale frames and only returns the newest one
+    //
+    void setLatestFrameOnly( bool on ) { m_latestOnly = on; };
+    bool getLatestFrameOnly() { return m_latestOnly; };
 
     // Meta Data methods
     //
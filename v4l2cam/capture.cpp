@@ -6,6 +6,11 @@
 #include <sstream>
 #include <chrono>
 #include <array>
+#include <vector>
+#include <deque>
+#include <cstdio>
+#include <algorithm>
+#include <cmath>
 
 #include "defines.h"
 #include "image_utils/image_utils.h"
@@ -22,16 +27,227 @@
 #endif
 
 
-void captureFrame( std::string deviceID, std::string fileName, std::string format, std::string addHeader )
+// crop rectangle from the command line, x,y,width,height
+//
+static bool parseCrop( std::string crop, struct imageRect & roi )
+{
+    int v[4];
+    std::stringstream ss( crop );
+    std::string item;
+
+    for( int n=0;n<4;n++ )
+    {
+        if( !std::getline( ss, item, ',' ) || (item.length() == 0) ) return false;
+        if( item.find_first_not_of( "0123456789" ) != std::string::npos ) return false;
+        if( !parseInt( item, v[n] ) ) return false;
+    }
+    if( std::getline( ss, item ) ) return false;
+
+    roi.x = v[0];
+    roi.y = v[1];
+    roi.width = v[2];
+    roi.height = v[3];
+
+    return (roi.width > 0) && (roi.height > 0);
+}
+
+// the part of a frame under the crop rectangle, the whole frame without one
+//
+static bool frameRegion( const struct imageView & frame, struct imageRect * roi, struct imageView & region )
+{
+    if( !roi )
+    {
+        region = frame;
+        return true;
+    }
+
+    if( cropView( frame, *roi, region ) )
+    {
+        outinfo( "   ...cropping to " + std::to_string(roi->width) + " x " + std::to_string(roi->height) +
+                 " at " + std::to_string(roi->x) + "," + std::to_string(roi->y) );
+        return true;
+    }
+
+    outerr( "Crop rectangle is outside the " + std::to_string(frame.width) + " x " + std::to_string(frame.height) + " image" );
+    return false;
+}
+
+// write a frame (or the part of it under the crop rectangle) as a BMP image
+//
+static void saveFrameAsBMP( const struct imageView & frame, imageConvertFn convert, struct imageRect * roi, std::string fileName )
+{
+    struct imageView region;
+    if( frameRegion( frame, roi, region ) ) saveAsBMP( region, convert, fileName );
+}
+
+// or encoded as a JPEG image, straight from the Y, U and V samples
+//
+static void saveFrameAsJPEG( const struct imageView & frame, struct imageRect * roi, int quality, enum yuvRange range, std::string fileName )
+{
+    struct imageView region;
+    if( frameRegion( frame, roi, region ) ) saveAsJPEG( region, fileName, quality, range );
+}
+
+// or losslessly as a QOI image, a null convert encodes the view as it is (grey formats)
+//
+static void saveFrameAsQOI( const struct imageView & frame, imageConvertFn convert, struct imageRect * roi, std::string fileName )
+{
+    struct imageView region;
+    if( frameRegion( frame, roi, region ) ) saveAsQOI( region, convert, fileName );
+}
+
+// the mode's layout over a raw frame, false when the driver handed back fewer bytes than the layout reads
+//
+static bool frameLayout( const struct imageConverter * converter, const struct v4l2cam_video_mode * mode,
+                         const struct v4l2cam_image_buffer * inB, struct imageView & frame )
+{
+    frame = converter->layout( inB->buffer, mode->width, mode->height );
+    return (inB->length > 0) && ((size_t)inB->length >= layoutFrameSize( frame ));
+}
+
+// 1/8 scale RGB24 of a frame, only the DC terms of an MJPEG frame are decoded, other formats are
+// area filtered straight from the camera format
+//
+static bool makeThumbnail( const struct v4l2cam_video_mode * mode, const struct v4l2cam_image_buffer * inB,
+                           std::vector<unsigned char> & rgb, struct imageView & thumb )
+{
+    if( "MJPG" == mode->format_str )
+    {
+        // the frame header has the real size
+        struct jpegInfo info;
+        if( !jpegReadInfo( inB->buffer, inB->length, info ) ) return false;
+
+        rgb.resize( (size_t)((info.width + 7) / 8) * ((info.height + 7) / 8) * 3 );
+        thumb = rgbView( rgb.data(), (info.width + 7) / 8, (info.height + 7) / 8 );
+        return decodeJPEGThumbnail( inB->buffer, inB->length, thumb );
+    }
+
+    struct yuvColor color = yuvColorFromV4L2( mode->colorspace, mode->ycbcr_enc, mode->quantization, mode->height );
+    const struct imageConverter * converter = findConverter( mode->fourcc, color );
+    struct imageView frame;
+    if( !converter || !frameLayout( converter, mode, inB, frame ) ) return false;
+
+    rgb.resize( (size_t)((mode->width + 7) / 8) * ((mode->height + 7) / 8) * 3 );
+    thumb = rgbView( rgb.data(), (mode->width + 7) / 8, (mode->height + 7) / 8 );
+    return converter->scale( frame, thumb, false, scaleAreaFilter );
+}
+
+// fourcc of an nv12 or i420 output format, 0 for any other
+//
+static unsigned int repackFourcc( std::string format )
+{
+    if( format == "nv12" ) return IMAGE_FOURCC('N','V','1','2');
+    if( format == "i420" ) return IMAGE_FOURCC('I','4','2','0');
+    return 0;
+}
+
+// a frame as tightly packed NV12 or I420, YUV modes are repacked without going through RGB and MJPEG
+// frames are decoded straight to the 4:2:0 planes, false for modes with no chroma (grey, Bayer)
+//
+static bool repackFrame( const struct v4l2cam_video_mode * mode, const struct v4l2cam_image_buffer * inB,
+                         unsigned int fourcc, std::vector<unsigned char> & out )
+{
+    const struct imageConverter * target = findConverter( fourcc );
+    if( !target ) return false;
+
+    if( "MJPG" == mode->format_str )
+    {
+        struct jpegInfo info;
+        if( !jpegReadInfo( inB->buffer, inB->length, info ) ) return false;
+
+        out.resize( repackedFrameSize( fourcc, info.width, info.height ) );
+        return decodeJPEGToYUV420( inB->buffer, inB->length, target->layout( out.data(), info.width, info.height ) );
+    }
+
+    const struct imageConverter * converter = findConverter( mode->fourcc );
+    struct imageView frame;
+    if( !converter || !frameLayout( converter, mode, inB, frame ) || !frame.plane[1] ) return false;
+
+    out.resize( repackedFrameSize( fourcc, mode->width, mode->height ) );
+    return repackYUV( frame, target->layout( out.data(), mode->width, mode->height ) );
+}
+
+// luma statistics attached to a frame, MJPEG frames are measured on their 1/8 scale DC image, Bayer and
+// packed grey frames get none
+//
+static bool attachFrameStats( const struct v4l2cam_video_mode * mode, struct v4l2cam_image_buffer * inB,
+                              int subsample, std::vector<unsigned char> & scratch )
+{
+    struct imageStats stats;
+    inB->stats.valid = false;
+
+    if( "MJPG" == mode->format_str )
+    {
+        struct jpegInfo info;
+        if( !jpegReadInfo( inB->buffer, inB->length, info ) ) return false;
+
+        int width = (info.width + 7) / 8, height = (info.height + 7) / 8;
+        scratch.resize( (size_t)width * height );
+        struct imageView thumb = grey8Layout( scratch.data(), width, height );
+        if( !decodeJPEGThumbnail( inB->buffer, inB->length, thumb ) || !imageStatistics( thumb, 8, 1, stats ) ) return false;
+
+    } else {
+        bool packed = false;
+        int bits = greyFormatBits( mode->fourcc, &packed );
+        const struct imageConverter * converter = findConverter( mode->fourcc );
+        if( !converter || packed || isBayerFormat( mode->fourcc ) ) return false;
+
+        struct imageView frame;
+        if( !frameLayout( converter, mode, inB, frame ) || !imageStatistics( frame, bits ? bits : 8, subsample, stats ) ) return false;
+    }
+
+    std::memcpy( inB->stats.histogram, stats.histogram, sizeof( stats.histogram ) );
+    inB->stats.samples = stats.samples;
+    inB->stats.mean = stats.mean;
+    inB->stats.variance = stats.variance;
+    inB->stats.lowClip = stats.lowClip;
+    inB->stats.highClip = stats.highClip;
+    inB->stats.sharpness = stats.sharpness;
+    inB->stats.valid = true;
+
+    return true;
+}
+
+// 1/8 scale luma of a frame for motion gating, MJPEG frames only decode their DC terms, Bayer and
+// packed grey frames have none
+//
+static bool motionThumbnail( const struct v4l2cam_video_mode * mode, const struct v4l2cam_image_buffer * inB,
+                             std::vector<unsigned char> & luma, struct imageView & thumb )
+{
+    if( "MJPG" == mode->format_str )
+    {
+        struct jpegInfo info;
+        if( !jpegReadInfo( inB->buffer, inB->length, info ) ) return false;
+
+        luma.resize( (size_t)((info.width + 7) / 8) * ((info.height + 7) / 8) );
+        thumb = grey8Layout( luma.data(), (info.width + 7) / 8, (info.height + 7) / 8 );
+        return decodeJPEGThumbnail( inB->buffer, inB->length, thumb );
+    }
+
+    bool packed = false;
+    int bits = greyFormatBits( mode->fourcc, &packed );
+    const struct imageConverter * converter = findConverter( mode->fourcc );
+    struct imageView frame;
+    if( !converter || packed || isBayerFormat( mode->fourcc ) || !frameLayout( converter, mode, inB, frame ) ) return false;
+
+    luma.resize( (size_t)((mode->width + 7) / 8) * ((mode->height + 7) / 8) );
+    thumb = grey8Layout( luma.data(), (mode->width + 7) / 8, (mode->height + 7) / 8 );
+    return lumaThumbnail( frame, bits ? bits : 8, thumb );
+}
+
+void captureFrame( std::string deviceID, std::string fileName, std::string format, std::string addHeader, std::string crop, std::string quality )
 {
     bool sendToStdout = true;
+    bool cropImage = false;
+    struct imageRect roi = {};
+    int jpegQuality = 85;
 
     std::ofstream outFile;
 
     // validate imag format
     if (format.length() > 0)
     {
-		if (format == "jpg" || format == "bmp" || format == "raw") {}
+		if (format == "jpg" || format == "bmp" || format == "qoi" || format == "thumb" || format == "raw" || repackFourcc( format )) {}
 		else 
         {
             format = "raw";
@@ -42,6 +258,33 @@ void captureFrame( std::string deviceID, std::string fileName, std::string forma
         outwarn("No format specified, writing <raw> output data");
     }
 
+    // validate the crop rectangle, the bmp and qoi conversion and jpg encoding paths can crop
+    if( crop.length() > 0 )
+    {
+        if( !parseCrop( crop, roi ) )
+        {
+            outerr( "Invalid crop rectangle [" + crop + "], expected x,y,width,height" );
+            return;
+        }
+        if( (format != "bmp") && (format != "qoi") && (format != "jpg") ) outwarn( "Crop rectangle is only applied to <bmp>, <qoi> and <jpg> output, ignoring it" );
+        else cropImage = true;
+    }
+
+    // JPEG quality, only used when a frame has to be encoded
+    if( quality.length() > 0 )
+    {
+        if( !parseInt( quality, jpegQuality ) )
+        {
+            outerr( "Invalid JPEG quality [" + quality + "], expected 1..100" );
+            return;
+        }
+        if( (jpegQuality < 1) || (jpegQuality > 100) )
+        {
+            jpegQuality = std::clamp( jpegQuality, 1, 100 );
+            outwarn( "JPEG quality must be 1..100, using " + std::to_string(jpegQuality) );
+        }
+    }
+
     // check if filename is specified
     if( fileName.length() > 0 ) sendToStdout = false;
     else outwarn( "No filename specified, writing <raw> output data (image frame) to STDOUT");
@@ -105,95 +348,173 @@ void captureFrame( std::string deviceID, std::string fileName, std::string forma
         // initialize the camera
         if( cam->init( v4l2cam_fetch_mode::userPtrMode ) )
         {
-            // grab a single frame
-            struct v4l2cam_image_buffer* inB = cam->fetch(true);
+            // grab a single frame, MJPEG buffers go back to the driver so a damaged frame can be dropped
+            // and the next one taken from the running stream
+            bool isMJPG = data && ("MJPG" == data->format_str);
+            struct v4l2cam_image_buffer* inB = cam->fetch( !isMJPG );
             if( inB && inB->buffer )
             {
-                // check for invalid JPG file (if MJPG imag format)
-                if( "MJPG" == data->format_str )
+                // check for a damaged JPG frame, a truncated one still starts with FF D8 FF
+                if( isMJPG )
                 {
-                    // check the header, should be 0xFF 0xD8 0xFF 
-                    if( (inB->buffer[0] == 0xff) && (inB->buffer[1] == 0xd8) && ((int)inB->buffer[2] == 0xff) ) 
-                    {} else
+                    enum jpegCheck check = jpegValidate( inB->buffer, inB->length );
+                    int dropped = 0;
+
+                    // drop bad frames (10 at most)
+                    while( (check != jpegCheckOk) && (dropped < 10) )
                     {
-                        outwarn( "Invalid JPG header, should be [FFD8FF], it is actually [" 
-                                    + makeHexString(inB->buffer, 3, true )
-                                    + "] : buflen is " 
+                        outwarn( "Dropping bad JPG frame, " + jpegCheckToString( check ) + ", starts with ["
+                                    + makeHexString(inB->buffer, std::min( inB->length, 3 ), true )
+                                    + "] : buflen is "
                                     + std::to_string(inB->length) );
-                        outwarn( "...repeating fetch" );
 
-                        // retry the fetch (10 times at most)
-                        int tries = 0;
-                        bool goodFrame = false;
-                        while( tries < 10 )
+                        delete inB->buffer;
+                        delete inB;
+                        dropped++;
+
+                        inB = cam->fetch( false );
+                        if( !inB || !inB->buffer )
                         {
-                            // re have to re-initialize as we didn't queue up a buffer last time
-                            cam->close();
-                            if( cam->open() && cam->init( v4l2cam_fetch_mode::userPtrMode ) )
-                            {
-                                // free the previous buffers
-                                delete inB->buffer;
-                                delete inB;
-
-                                struct v4l2cam_image_buffer * inB = cam->fetch(true);
-                                if( inB && inB->buffer )
-                                {
-                                    if( (inB->buffer[0] == 0xff) && (inB->buffer[1] == 0xd8) && ((int)inB->buffer[2] == 0xff) ) 
-                                    {
-                                        goodFrame = true;
-                                        break;
-                                    }
-                                    // do it again
-                                    outwarn( "...and again" );
-                                    tries ++;
-                                } else {
-                                    outerr( "...re-fetch failed, giving up" );
-                                    break;
-                                }
-                            } else {
-                                outerr( "...failed to re-init the camera, giving up" );
-                                break;
-                            }
+                            outerr( "...re-fetch failed, giving up" );
+                            delete inB;
+                            inB = nullptr;
+                            break;
                         }
-                        if( goodFrame ) outinfo( "...got good frame" );
+                        check = jpegValidate( inB->buffer, inB->length );
+                    }
+
+                    if( inB && (dropped > 0) )
+                    {
+                        if( check == jpegCheckOk ) outinfo( "...got good frame after dropping " + std::to_string(dropped) );
+                        else outwarn( "...no good frame after dropping " + std::to_string(dropped) + ", writing the last one" );
                     }
                 }
 
-                if (inB)
+                if( inB && inB->buffer )
                 {
+                    // a Bayer crop has to start on a whole 2x2 cell, grow the rectangle to the one before
+                    if( cropImage && data && isBayerFormat( data->fourcc ) )
+                    {
+                        roi.width += roi.x & 1;
+                        roi.height += roi.y & 1;
+                        roi.x &= ~1;
+                        roi.y &= ~1;
+                    }
+
                     // make sure MJPG gets output as <jpg>
                     //
-                    if ("MJPG" == data->format_str)
+                    if( format == "thumb" )
+                    {
+                        // 1/8 scale preview as a BMP image
+                        std::vector<unsigned char> rgb;
+                        struct imageView thumb;
+
+                        if( makeThumbnail( data, inB, rgb, thumb ) )
+                        {
+                            outinfo( "   ...thumbnail : " + std::to_string(thumb.width) + " x " + std::to_string(thumb.height) );
+                            outFile.close();
+                            saveAsBMP( thumb, copyRGB24, fileName );
+                        } else {
+                            outwarn( "Unable to make a thumbnail of the frame, outputting raw image data" );
+                            if (sendToStdout) std::cout.write((char*)inB->buffer, inB->length);
+                            else outFile.write((char*)inB->buffer, inB->length);
+                        }
+
+                    } else if( ("MJPG" == data->format_str) && ((format == "bmp") || (format == "qoi")) )
+                    {
+                        // decode with the built in baseline decoder, the frame header has the real size
+                        struct jpegInfo info;
+                        std::vector<unsigned char> rgb;
+                        bool decoded = false;
+
+                        if( jpegReadInfo( inB->buffer, inB->length, info ) )
+                        {
+                            rgb.resize( (size_t)info.width * info.height * 3 );
+                            decoded = decodeJPEG( inB->buffer, inB->length, rgbView( rgb.data(), info.width, info.height ) );
+                        }
+
+                        if( decoded )
+                        {
+                            // close the current file attempt
+                            outFile.close();
+                            if( format == "qoi" ) saveFrameAsQOI( rgbView( rgb.data(), info.width, info.height ), nullptr, cropImage ? &roi : nullptr, fileName );
+                            else saveFrameAsBMP( rgbView( rgb.data(), info.width, info.height ), copyRGB24, cropImage ? &roi : nullptr, fileName );
+                        } else {
+                            // progressive, arithmetic coded or damaged frames are written as they are
+                            outwarn( "Unable to decode the Motion-JPEG frame, outputting it as <jpg>" );
+                            if (sendToStdout) std::cout.write((char*)inB->buffer, inB->length);
+                            else outFile.write((char*)inB->buffer, inB->length);
+                        }
+
+                    } else if ("MJPG" == data->format_str)
                     {
                         if (format != "jpg")  outwarn("Invalid or no format specified for Motion-JPEG capture, defaulting to <jpg> format");
+                        if( cropImage ) outwarn( "Motion-JPEG frames are written as they are, ignoring the crop rectangle" );
 
                         // output as native JPEG (basically raw output)
                         if (sendToStdout) std::cout.write((char*)inB->buffer, inB->length);
                         else outFile.write((char*)inB->buffer, inB->length);
 
+                    } else if( greyFormatBits( data->fourcc ) && ((format == "bmp") || (format == "qoi") || (format == "jpg")) )
+                    {
+                        // high bit depth grey, packed samples are unpacked to 16 bits first so cropping and qoi
+                        // see plain samples, then the tone curve is built from the whole (cropped) frame at once
+                        bool packed = false;
+                        int bits = greyFormatBits( data->fourcc, &packed );
+                        const struct imageConverter * converter = findConverter( data->fourcc );
+                        struct imageView frame = converter->layout( inB->buffer, data->width, data->height );
+                        std::vector<unsigned char> samples;
+
+                        if( packed )
+                        {
+                            samples.resize( (size_t)data->width * data->height * 2 );
+                            struct imageView unpacked = grey16Layout( samples.data(), data->width, data->height );
+                            unpackGrey( frame, bits, unpacked );
+                            frame = unpacked;
+                        }
+
+                        // close the current file attempt
+                        outFile.close();
+
+                        struct imageView region;
+                        if( frameRegion( frame, cropImage ? &roi : nullptr, region ) )
+                        {
+                            if( format == "qoi" )
+                            {
+                                // lossless, the samples as they are
+                                saveAsQOI( region, nullptr, fileName );
+                            } else if( format == "jpg" )
+                            {
+                                // 8 bit levels as a greyscale JPEG, a palette needs RGB so it is left out
+                                std::vector<unsigned char> levels( (size_t)region.width * region.height );
+                                outinfo( "   ...tone map : " + greyToneMapToString( getGreyToneMap() ) + ", JPEG quality : " + std::to_string(jpegQuality) );
+                                converter->convert( region, grey8Layout( levels.data(), region.width, region.height ), true );
+                                saveAsJPEG( grey8Layout( levels.data(), region.width, region.height ), fileName, jpegQuality, yuvRangeFull );
+                            } else {
+                                std::vector<unsigned char> rgb( (size_t)region.width * region.height * 3 );
+                                outinfo( "   ...tone map : " + greyToneMapToString( getGreyToneMap() ) );
+                                converter->convert( region, rgbView( rgb.data(), region.width, region.height ), false );
+                                saveAsBMP( rgbView( rgb.data(), region.width, region.height ), copyRGB24, fileName );
+                            }
+                        }
+
                     } else if(format == "bmp" )
                     {
-                        // try to convert to RGB24 format
-                        unsigned char* rgbBuffer = nullptr;
-                        if (data->fourcc == cam->fourcc_charArray_to_int((unsigned char*)"YUYV")) rgbBuffer = yuv422ToRGB(inB->buffer, data->width, data->height, false);
-                        else if (data->fourcc == cam->fourcc_charArray_to_int((unsigned char*)"YVYU")) rgbBuffer = yvu422ToRGB(inB->buffer, data->width, data->height, false);
-                        else if (data->fourcc == cam->fourcc_charArray_to_int((unsigned char*)"YUY2")) rgbBuffer = yuy2422ToRGB(inB->buffer, data->width, data->height, false);
-                        else if (data->fourcc == cam->fourcc_charArray_to_int((unsigned char*)"YU12")) rgbBuffer = planarYUV420ToRGB(inB->buffer, data->width, data->height, false);
-                        else if (data->fourcc == cam->fourcc_charArray_to_int((unsigned char*)"I420")) rgbBuffer = planarYVU420ToRGB(inB->buffer, data->width, data->height, false);
-                        else if (data->fourcc == cam->fourcc_charArray_to_int((unsigned char*)"NV12")) rgbBuffer = interleavedYUV420ToRGB(inB->buffer, data->width, data->height, false);
-                        else if (data->fourcc == cam->fourcc_charArray_to_int((unsigned char*)"NV21")) rgbBuffer = interleavedYVU420ToRGB(inB->buffer, data->width, data->height, false);
-                        else if (data->fourcc == cam->fourcc_charArray_to_int((unsigned char*)"Y16 ")) rgbBuffer = gs16ToRGB(inB->buffer, data->width, data->height, false);
-                        else if (data->fourcc == cam->fourcc_charArray_to_int((unsigned char*)"Y8  ")) rgbBuffer = gs8ToRGB(inB->buffer, data->width, data->height, false);
-                        else if (data->fourcc == cam->fourcc_charArray_to_int((unsigned char*)"Y800")) rgbBuffer = gs8ToRGB(inB->buffer, data->width, data->height, false);
-                        else if (data->fourcc == cam->fourcc_charArray_to_int((unsigned char*)"GREY")) rgbBuffer = gs8ToRGB(inB->buffer, data->width, data->height, false);
-
-                        if( rgbBuffer )
+                        // convert and write a block of rows at a time, no full RGB24 frame is needed, using the
+                        // matrix and range of the negotiated format
+                        struct yuvColor color = yuvColorFromV4L2( data->colorspace, data->ycbcr_enc, data->quantization, data->height );
+                        const struct imageConverter * converter = findConverter( data->fourcc, color );
+
+                        if( converter )
                         {
+                            if( converter->convert != findConverter( data->fourcc )->convert )
+                                outinfo( "   ...YUV colour : " + yuvColorToString( color ) );
+
                             // close the current file attempt
                             outFile.close();
                             // output as BMP image, if fileName is blank then will send to stdout
-                            saveRGB24AsBMP(rgbBuffer, data->width, data->height, fileName );
-                            delete rgbBuffer;
+                            struct imageView frame = converter->layout( inB->buffer, data->width, data->height );
+                            saveFrameAsBMP( frame, converter->convert, cropImage ? &roi : nullptr, fileName );
                         }
                         else {
                             // unable to convert, output as raw
@@ -202,6 +523,64 @@ void captureFrame( std::string deviceID, std::string fileName, std::string forma
                             if (sendToStdout) std::cout.write((char*)inB->buffer, inB->length);
                             else outFile.write((char*)inB->buffer, inB->length);
                         }
+                    } else if( format == "qoi" )
+                    {
+                        // lossless, grey formats keep their own samples (16 bit too), the rest (Bayer too) go through RGB24
+                        struct yuvColor color = yuvColorFromV4L2( data->colorspace, data->ycbcr_enc, data->quantization, data->height );
+                        const struct imageConverter * converter = findConverter( data->fourcc, color );
+
+                        if( converter )
+                        {
+                            struct imageView frame = converter->layout( inB->buffer, data->width, data->height );
+                            bool grey = !frame.plane[1] && ((frame.step[0] == 1) || (frame.step[0] == 2)) && !isBayerFormat( data->fourcc );
+
+                            // close the current file attempt
+                            outFile.close();
+                            saveFrameAsQOI( frame, grey ? nullptr : converter->convert, cropImage ? &roi : nullptr, fileName );
+                        }
+                        else {
+                            outwarn("Unable to convert to RGB format, outputting raw image data");
+                            if (sendToStdout) std::cout.write((char*)inB->buffer, inB->length);
+                            else outFile.write((char*)inB->buffer, inB->length);
+                        }
+
+                    } else if( format == "jpg" )
+                    {
+                        // encode the Y, U and V samples of the camera layout, limited range is stretched to full, Bayer
+                        // frames have no YUV to encode
+                        struct yuvColor color = yuvColorFromV4L2( data->colorspace, data->ycbcr_enc, data->quantization, data->height );
+                        const struct imageConverter * converter = isBayerFormat( data->fourcc ) ? nullptr : findConverter( data->fourcc );
+
+                        if( converter )
+                        {
+                            struct imageView frame = converter->layout( inB->buffer, data->width, data->height );
+
+                            outinfo( "   ...JPEG quality : " + std::to_string(jpegQuality) );
+
+                            // close the current file attempt
+                            outFile.close();
+                            saveFrameAsJPEG( frame, cropImage ? &roi : nullptr, jpegQuality, color.range, fileName );
+                        }
+                        else {
+                            outwarn("Unable to encode the video format as JPEG, outputting raw image data");
+                            if (sendToStdout) std::cout.write((char*)inB->buffer, inB->length);
+                            else outFile.write((char*)inB->buffer, inB->length);
+                        }
+                    } else if( repackFourcc( format ) )
+                    {
+                        // Y, U and V samples as they are, only the chroma is resampled to 4:2:0
+                        std::vector<unsigned char> yuv;
+
+                        if( repackFrame( data, inB, repackFourcc( format ), yuv ) )
+                        {
+                            if (sendToStdout) std::cout.write((char*)yuv.data(), yuv.size());
+                            else outFile.write((char*)yuv.data(), yuv.size());
+                        }
+                        else {
+                            outwarn("Unable to repack the video format as " + format + ", outputting raw image data");
+                            if (sendToStdout) std::cout.write((char*)inB->buffer, inB->length);
+                            else outFile.write((char*)inB->buffer, inB->length);
+                        }
                     }  else {
                         // output as raw image data
                         if (sendToStdout) std::cout.write((char*)inB->buffer, inB->length);
@@ -230,7 +609,7 @@ void captureFrame( std::string deviceID, std::string fileName, std::string forma
 
 }
 
-void captureFrames( std::string deviceID, std::string timeDuration, std::string fileName, std::string addHeader )
+void captureFrames( std::string deviceID, std::string timeDuration, std::string fileName, std::string addHeader, std::string previewName, std::string format, std::string statsRows, std::string motion )
 {
     bool sendToStdout = true;
     std::ofstream outFile;
@@ -240,6 +619,7 @@ void captureFrames( std::string deviceID, std::string timeDuration, std::string
     int framesToCapture;
     int actualFps = fpsVideo;
     int actualFrameCount = 0;
+    int droppedFrames[jpegCheckTruncated + 1] = {};
 
     v4l2cam_logging_mode t = v4l2cam_logging_mode::logOff;
     if (verbose) t = v4l2cam_logging_mode::logToStdOut;
@@ -277,6 +657,30 @@ void captureFrames( std::string deviceID, std::string timeDuration, std::string
         timeToCapture = 120;
     }
     
+    // frames are written as they come unless they are to be repacked
+    unsigned int repack = repackFourcc( format );
+    if( (format.length() > 0) && (format != "raw") && !repack ) outwarn( "Only <nv12> and <i420> formats apply to video capture, writing raw frames" );
+
+    // every n-th row is measured for the frame statistics, 0 for none
+    int statsSubsample = 0;
+    if( (statsRows.length() > 0) && !parseInt( statsRows, statsSubsample ) )
+    {
+        outerr( "Invalid statistics row step [" + statsRows + "], expected a whole number" );
+        for( const auto &x : camList ) delete x;
+        return;
+    }
+    if( statsRows.length() > 0 ) statsSubsample = std::max( statsSubsample, 1 );
+
+    // motion gating, only frames around motion are written
+    struct motionConfig motionCfg = {};
+    bool gate = (motion.length() > 0);
+    if( gate && !parseMotionConfig( motion, motionCfg ) )
+    {
+        outerr( "Invalid motion gating [" + motion + "], expected comma separated level=, area=, learn=, pre= and post=" );
+        for( const auto &x : camList ) delete x;
+        return;
+    }
+
     // initiate video (multiple frame) capture
     framesToCapture = timeToCapture * fpsVideo;
 
@@ -333,9 +737,79 @@ void captureFrames( std::string deviceID, std::string timeDuration, std::string
 
             // grab a a bunch of frames
             if( (addHeader.length() > 0) && (data->format_str == "H264") ) outinfo( "Adding H264 header to frames" );
+            if( repack ) outinfo( "   ...repacking frames to : " + format );
+
+            // frame statistics, reported about once a second
+            std::vector<unsigned char> statsScratch;
+            std::chrono::steady_clock::time_point nextStats = start;
+            if( statsSubsample ) outinfo( "   ...measuring frame statistics on every " + std::to_string(statsSubsample) + " row(s)" );
+
+            // frames held back until motion is seen, then written ahead of it
+            struct motionState motionBackground = {};
+            std::vector<unsigned char> motionLuma;
+            std::deque<struct v4l2cam_image_buffer *> preRoll;
+            int postRollLeft = 0;
+            int storedFrames = 0;
+            bool recording = false;
+
+            if( gate && data && (data->format_str == "H264") )
+            {
+                outwarn( "Motion gating needs a luma image, H264 frames can not be gated, writing every frame" );
+                gate = false;
+            }
+            if( gate ) outinfo( "   ...motion gating : " + motionConfigToString( motionCfg ) );
+
+            // the default frame header (4 bytes 'slap' and 4 byte length in little endian), or the H264 one
+            std::vector<unsigned char> repacked;
+            auto writeFrame = [&]( struct v4l2cam_image_buffer * frame )
+            {
+                // add header if requested and this is an H264 frame
+                if( (addHeader.length() > 0) && (data->format_str == "H264") )
+                {
+                    // send the actual FPS to the other side, just in case it skews during capture
+                    char * h264Buffer = addH264Header( frame->buffer, frame->length, actualFps, data->width, data->height ); ;
+                    if( h264Buffer )
+                    {
+                        if (sendToStdout) std::cout.write( h264Buffer, frame->length + sizeof( h264FrameHeader_t) );
+                        else outFile.write( h264Buffer, frame->length + sizeof( h264FrameHeader_t) );
+                        delete h264Buffer;
+                    }
+                } else {
+                    // a frame that can not be repacked (H264, grey) is written as it is
+                    unsigned char * bytes = frame->buffer;
+                    int length = frame->length;
+                    if( repack && data && repackFrame( data, frame, repack, repacked ) )
+                    {
+                        bytes = repacked.data();
+                        length = (int)repacked.size();
+                    }
+
+                    char slap[4] = {'s','l','a','p'};
+                    int len = length;
+                    len = swapEndian( len );
+                    if( sendToStdout )
+                    {
+                        std::cout.write( slap, 4 );
+                        std::cout.write( (char*)&len, 4 );
+                    } else {
+                        outFile.write( slap, 4 );
+                        outFile.write( (char*)&len   , 4 );
+                    }
+                    // write the rest of the buffer out to the file
+                    if( sendToStdout ) std::cout.write( (char*)bytes, length );
+                    else outFile.write( (char *)bytes, length );
+                }
+                storedFrames++;
+            };
+
             // start the calc fps at the requeted fps
             actualFps = fpsVideo;
 
+            // 1/8 scale preview, refreshed about once a second
+            std::vector<unsigned char> previewRGB;
+            std::chrono::steady_clock::time_point nextPreview = start;
+            if( previewName.length() > 0 ) outinfo( "   ...writing a preview image to : " + previewName );
+
             while( framesToCapture > 0 )
             {
                 bool goodFrame = false;
@@ -347,11 +821,12 @@ void captureFrames( std::string deviceID, std::string timeDuration, std::string
                 if( inB && inB->buffer )
                 {
 
-                    // check for invalid JPG file (if Motion-JPEG selected)
+                    // check for a damaged JPG frame (if Motion-JPEG selected), bad ones are dropped and counted
                     if( "MJPG" == data->format_str )
                     {
-                        // check the header, should be 0xFF 0xD8 0xFF 
-                        if( (inB->buffer[0] == 0xff) && (inB->buffer[1] == 0xd8) && ((int)inB->buffer[2] == 0xff) ) goodFrame = true;
+                        enum jpegCheck check = jpegValidate( inB->buffer, inB->length );
+                        goodFrame = (check == jpegCheckOk);
+                        if( !goodFrame ) droppedFrames[check]++;
 
                     } else goodFrame = true;
 
@@ -364,39 +839,76 @@ void captureFrames( std::string deviceID, std::string timeDuration, std::string
                         if( delta.count() > 0 ) actualFps = (1000*actualFrameCount) / delta.count();
                         else actualFps = fpsVideo;
 
-                        // add header if requested and this is an H264 frame
-                        if( (addHeader.length() > 0) && (data->format_str == "H264") )
+                        // measured before anything else touches the frame
+                        if( statsSubsample && data && attachFrameStats( data, inB, statsSubsample, statsScratch ) &&
+                            (std::chrono::steady_clock::now() >= nextStats) )
+                        {
+                            std::ostringstream line;
+                            line << std::fixed << std::setprecision(1) << "   ...frame " << inB->sequence << " : mean " << inB->stats.mean
+                                 << ", sd " << std::sqrt( inB->stats.variance ) << ", low " << inB->stats.lowClip << "%, high "
+                                 << inB->stats.highClip << "%, sharpness " << inB->stats.sharpness;
+                            outinfo( line.str() );
+
+                            nextStats = std::chrono::steady_clock::now() + std::chrono::seconds( 1 );
+                        }
+
+                        // written aside and renamed, so a reader never sees half an image
+                        if( (previewName.length() > 0) && data && (std::chrono::steady_clock::now() >= nextPreview) )
+                        {
+                            struct imageView thumb;
+                            if( makeThumbnail( data, inB, previewRGB, thumb ) && saveAsBMP( thumb, copyRGB24, previewName + ".tmp" ) )
+                                std::rename( (previewName + ".tmp").c_str(), previewName.c_str() );
+
+                            nextPreview = std::chrono::steady_clock::now() + std::chrono::seconds( 1 );
+                        }
+
+                        // a frame gating can not judge is written
+                        bool record = true;
+                        struct imageView thumb;
+                        if( gate && data && motionThumbnail( data, inB, motionLuma, thumb ) )
+                        {
+                            if( detectMotion( motionBackground, thumb, motionCfg ) ) postRollLeft = motionCfg.postRoll;
+                            else if( postRollLeft > 0 ) postRollLeft--;
+                            else record = false;
+                        }
+
+                        if( record )
                         {
-                            // send the actual FPS to the other side, just in case it skews during capture
-                            char * h264Buffer = addH264Header( inB->buffer, inB->length, actualFps, data->width, data->height ); ;
-                            if( h264Buffer )
+                            if( gate && !recording ) outinfo( "   ...motion at frame " + std::to_string(inB->sequence) );
+
+                            // the frames from just before the motion go out first
+                            for( auto * held : preRoll )
                             {
-                                if (sendToStdout) std::cout.write( h264Buffer, inB->length + sizeof( h264FrameHeader_t) );
-                                else outFile.write( h264Buffer, inB->length + sizeof( h264FrameHeader_t) );
-                                delete h264Buffer;
+                                writeFrame( held );
+                                delete held->buffer;
+                                delete held;
                             }
+                            preRoll.clear();
+
+                            writeFrame( inB );
                         } else {
-                            // add the default frame header (4 bytes 'slap' and 4 byte length in little endian)
-                            char slap[4] = {'s','l','a','p'};
-                            int len = inB->length;
-                            len = swapEndian( len );
-                            if( sendToStdout )
+                            if( recording ) outinfo( "   ...motion ended at frame " + std::to_string(inB->sequence) );
+
+                            // kept for the pre-roll, the oldest one falls out
+                            preRoll.push_back( inB );
+                            inB = nullptr;
+                            if( (int)preRoll.size() > motionCfg.preRoll )
                             {
-                                std::cout.write( slap, 4 );
-                                std::cout.write( (char*)&len, 4 );
-                            } else {
-                                outFile.write( slap, 4 );
-                                outFile.write( (char*)&len   , 4 );
+                                delete preRoll.front()->buffer;
+                                delete preRoll.front();
+                                preRoll.pop_front();
                             }
-                            // write the rest of the buffer out to the file
-                            if( sendToStdout ) std::cout.write( (char*)inB->buffer, inB->length );
-                            else outFile.write( (char *)inB->buffer, inB->length );
                         }
+                        recording = record;
+
                     } else outwarn( "Invalid frame returned, skipping" );
 
-                    // delete the returned data
-                    delete inB->buffer;
-                    delete inB;
+                    // delete the returned data, unless it is held for the pre-roll
+                    if( inB )
+                    {
+                        delete inB->buffer;
+                        delete inB;
+                    }
 
                 } else outwarn( "Nothing returned from fetch call for : /dev/video" + deviceID );
 
@@ -407,6 +919,18 @@ void captureFrames( std::string deviceID, std::string timeDuration, std::string
             // print out a summary message
             outinfo( "   ...actual capture rate was : " + std::to_string(actualFps) + " fps" );
             outinfo( "   ...actual frames captured : " + std::to_string(actualFrameCount) );
+            if( gate ) outinfo( "   ...frames stored around motion : " + std::to_string(storedFrames) );
+
+            // a pre-roll that never saw motion is dropped
+            for( auto * held : preRoll )
+            {
+                delete held->buffer;
+                delete held;
+            }
+
+            // damaged MJPEG frames by reason
+            for( int c = jpegCheckNoSOI; c <= jpegCheckTruncated; c++ )
+                if( droppedFrames[c] > 0 ) outwarn( "   ...frames dropped, " + jpegCheckToString( (enum jpegCheck)c ) + " : " + std::to_string(droppedFrames[c]) );
 
         } else outerr( "Failed to initilize fetch mode for : " + cam->getDevName() + " " + cam->getUserName()  );
 
@@ -57,8 +57,8 @@ void getVideoFormat( std::string deviceID );
 
 void runTimingTest( std::string deviceID );
 
-void captureFrame(std::string deviceID, std::string fileName = "", std::string format = "", std::string addHeader = "" );
-void captureFrames( std::string deviceID, std::string timeInSeconds = "10", std::string fileName = "", std::string addHeader = "" );   
+void captureFrame(std::string deviceID, std::string fileName = "", std::string format = "", std::string addHeader = "", std::string crop = "", std::string quality = "" );
+void captureFrames( std::string deviceID, std::string timeInSeconds = "10", std::string fileName = "", std::string addHeader = "", std::string previewName = "", std::string format = "", std::string statsRows = "", std::string motion = "" );   
 
 char * addH264Header( unsigned char * buffer, int length, int rate, int width, int height );
 
@@ -76,6 +76,7 @@ void printExamples();
 
 std::map<std::string, std::string> parseCmdLine( int argc, char** argv );
 bool is_number(const std::string& s);
+bool parseInt( const std::string & text, int & value );
 std::string makeHexString( unsigned char * buf, int len, bool makeCaps );
 
 // Endian Swapping
@@ -0,0 +1,617 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "image_utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define IMAGE_UTILS_SSE2
+#endif
+
+#if defined(__aarch64__) && defined(IMAGE_UTILS_ENABLE_NEON)
+#include <arm_neon.h>
+#define IMAGE_UTILS_NEON
+#endif
+
+// Bayer (raw sensor) demosaicing
+//
+// - samples are brought down to 8 bits as each row is read, 10, 12 and 16 bit formats are little
+//   endian in two bytes, then a window of rows is kept in int16 working rows, mirrored two samples
+//   past every edge so the pattern phase is kept
+// - bayerBilinear averages the nearest samples of each colour, one pass
+// - bayerEdgeAware interpolates green along the direction with the smaller gradient (with a second
+//   derivative correction), then red and blue from the colour differences to green, two passes
+// - the kernels are written once over a lane type, SSE2 / NEON do 8 pixels at a time and the
+//   scalar lane type does one, so every path gives the same bytes
+// - scaleBayerAs() averages whole 2x2 cells, at half size that is plain binning
+//
+
+static enum bayerDemosaic s_demosaic = bayerEdgeAware;
+
+void setBayerDemosaic( enum bayerDemosaic method ) { s_demosaic = method; }
+enum bayerDemosaic getBayerDemosaic() { return s_demosaic; }
+
+
+// working rows have room for a vector and the two mirrored samples past either edge
+#define BAYER_PAD 16
+
+// red position in the 2x2 cell of each pattern
+//
+static inline int redX( enum bayerPattern p ) { return ((p == bayerGRBG) || (p == bayerBGGR)) ? 1 : 0; }
+static inline int redY( enum bayerPattern p ) { return ((p == bayerGBRG) || (p == bayerBGGR)) ? 1 : 0; }
+
+static inline int mirror( int i, int size )
+{
+    if( i < 0 ) i = -i;
+    if( i >= size ) i = 2 * (size - 1) - i;
+    return std::clamp( i, 0, size - 1 );
+}
+
+
+// Lane types, the kernels only use these operations
+//
+struct bayerLanes1
+{
+    typedef int v;
+    static const int lanes = 1;
+
+    static v load( const short * p ) { return *p; }
+    static void store( short * p, v a ) { *p = (short)a; }
+    static v set1( int a ) { return a; }
+    static v add( v a, v b ) { return a + b; }
+    static v sub( v a, v b ) { return a - b; }
+    static v shr1( v a ) { return a >> 1; }
+    static v shr2( v a ) { return a >> 2; }
+    static v abs( v a ) { return std::abs( a ); }
+    static v min( v a, v b ) { return std::min( a, b ); }
+    static v max( v a, v b ) { return std::max( a, b ); }
+    static v lt( v a, v b ) { return (a < b) ? -1 : 0; }
+    static v select( v mask, v a, v b ) { return mask ? a : b; }
+
+    // all ones where x is odd
+    static v oddMask( int x ) { return (x & 1) ? -1 : 0; }
+};
+
+#if defined(IMAGE_UTILS_SSE2)
+struct bayerLanesSSE2
+{
+    typedef __m128i v;
+    static const int lanes = 8;
+
+    static v load( const short * p ) { return _mm_loadu_si128( (const __m128i *)p ); }
+    static void store( short * p, v a ) { _mm_storeu_si128( (__m128i *)p, a ); }
+    static v set1( int a ) { return _mm_set1_epi16( (short)a ); }
+    static v add( v a, v b ) { return _mm_add_epi16( a, b ); }
+    static v sub( v a, v b ) { return _mm_sub_epi16( a, b ); }
+    static v shr1( v a ) { return _mm_srai_epi16( a, 1 ); }
+    static v shr2( v a ) { return _mm_srai_epi16( a, 2 ); }
+    static v abs( v a ) { return _mm_max_epi16( a, _mm_sub_epi16( _mm_setzero_si128(), a ) ); }
+    static v min( v a, v b ) { return _mm_min_epi16( a, b ); }
+    static v max( v a, v b ) { return _mm_max_epi16( a, b ); }
+    static v lt( v a, v b ) { return _mm_cmplt_epi16( a, b ); }
+    static v select( v mask, v a, v b ) { return _mm_or_si128( _mm_and_si128( mask, a ), _mm_andnot_si128( mask, b ) ); }
+
+    // vectors start on an even x
+    static v oddMask( int ) { return _mm_set_epi16( -1, 0, -1, 0, -1, 0, -1, 0 ); }
+};
+#endif
+
+#if defined(IMAGE_UTILS_NEON)
+struct bayerLanesNEON
+{
+    typedef int16x8_t v;
+    static const int lanes = 8;
+
+    static v load( const short * p ) { return vld1q_s16( p ); }
+    static void store( short * p, v a ) { vst1q_s16( p, a ); }
+    static v set1( int a ) { return vdupq_n_s16( (short)a ); }
+    static v add( v a, v b ) { return vaddq_s16( a, b ); }
+    static v sub( v a, v b ) { return vsubq_s16( a, b ); }
+    static v shr1( v a ) { return vshrq_n_s16( a, 1 ); }
+    static v shr2( v a ) { return vshrq_n_s16( a, 2 ); }
+    static v abs( v a ) { return vabsq_s16( a ); }
+    static v min( v a, v b ) { return vminq_s16( a, b ); }
+    static v max( v a, v b ) { return vmaxq_s16( a, b ); }
+    static v lt( v a, v b ) { return vreinterpretq_s16_u16( vcltq_s16( a, b ) ); }
+    static v select( v mask, v a, v b ) { return vbslq_s16( vreinterpretq_u16_s16( mask ), a, b ); }
+
+    static v oddMask( int )
+    {
+        static const short odd[8] = { 0, -1, 0, -1, 0, -1, 0, -1 };
+        return vld1q_s16( odd );
+    }
+};
+#endif
+
+
+// Kernels, x runs from 0 to width in steps of V::lanes, chromaX is the parity of the red or blue
+// samples in the row (the other samples are green), redRow says which of the two it is
+//
+
+// bilinear, rows r[-1..1] of raw samples
+//
+template<class V>
+static void bilinearRow( const short * const * r, int width, int chromaX, bool redRow, short * outR, short * outG, short * outB )
+{
+    const typename V::v one = V::set1( 1 ), two = V::set1( 2 );
+
+    for( int x=0;x<width;x+=V::lanes )
+    {
+        typename V::v c = V::load( r[1] + x );
+        typename V::v w = V::load( r[1] + x - 1 ), e = V::load( r[1] + x + 1 );
+        typename V::v n = V::load( r[0] + x ), s = V::load( r[2] + x );
+
+        typename V::v cross = V::shr2( V::add( V::add( V::add( n, s ), V::add( w, e ) ), two ) );
+        typename V::v diag = V::shr2( V::add( V::add( V::add( V::load( r[0] + x - 1 ), V::load( r[0] + x + 1 ) ),
+                                                      V::add( V::load( r[2] + x - 1 ), V::load( r[2] + x + 1 ) ) ), two ) );
+        typename V::v hor = V::shr1( V::add( V::add( w, e ), one ) );
+        typename V::v ver = V::shr1( V::add( V::add( n, s ), one ) );
+
+        typename V::v odd = V::oddMask( x );
+        typename V::v chroma = chromaX ? odd : V::sub( V::set1( -1 ), odd );
+
+        typename V::v same = V::select( chroma, c, hor );       // the colour of this row's chroma samples
+        typename V::v other = V::select( chroma, diag, ver );   // the other one
+
+        V::store( outG + x, V::select( chroma, cross, c ) );
+        V::store( redRow ? outR + x : outB + x, same );
+        V::store( redRow ? outB + x : outR + x, other );
+    }
+}
+
+// edge aware green, rows r[-2..2] of raw samples
+//
+template<class V>
+static void greenRow( const short * const * r, int width, int chromaX, short * outG )
+{
+    const typename V::v zero = V::set1( 0 ), top = V::set1( 255 );
+
+    for( int x=0;x<width;x+=V::lanes )
+    {
+        typename V::v c = V::load( r[2] + x );
+        typename V::v w = V::load( r[2] + x - 1 ), e = V::load( r[2] + x + 1 );
+        typename V::v ww = V::load( r[2] + x - 2 ), ee = V::load( r[2] + x + 2 );
+        typename V::v n = V::load( r[1] + x ), s = V::load( r[3] + x );
+        typename V::v nn = V::load( r[0] + x ), ss = V::load( r[4] + x );
+
+        // second derivatives of the chroma channel, 2c - ww - ee
+        typename V::v lapH = V::sub( V::add( c, c ), V::add( ww, ee ) );
+        typename V::v lapV = V::sub( V::add( c, c ), V::add( nn, ss ) );
+
+        typename V::v gradH = V::add( V::abs( V::sub( w, e ) ), V::abs( lapH ) );
+        typename V::v gradV = V::add( V::abs( V::sub( n, s ) ), V::abs( lapV ) );
+
+        // (w + e) / 2 + lapH / 4
+        typename V::v estH = V::shr2( V::add( V::add( V::add( w, e ), V::add( w, e ) ), lapH ) );
+        typename V::v estV = V::shr2( V::add( V::add( V::add( n, s ), V::add( n, s ) ), lapV ) );
+        typename V::v estA = V::shr1( V::add( estH, estV ) );
+
+        typename V::v g = V::select( V::lt( gradH, gradV ), estH, V::select( V::lt( gradV, gradH ), estV, estA ) );
+        g = V::min( V::max( g, zero ), top );
+
+        typename V::v odd = V::oddMask( x );
+        typename V::v chroma = chromaX ? odd : V::sub( V::set1( -1 ), odd );
+
+        V::store( outG + x, V::select( chroma, g, c ) );
+    }
+}
+
+// red and blue from the colour differences, rows r[-1..1] of raw samples and g[-1..1] of green
+//
+template<class V>
+static void chromaRow( const short * const * r, const short * const * g, int width, int chromaX, bool redRow,
+                       short * outR, short * outB )
+{
+    const typename V::v zero = V::set1( 0 ), top = V::set1( 255 );
+
+    for( int x=0;x<width;x+=V::lanes )
+    {
+        typename V::v c = V::load( r[1] + x );
+        typename V::v gc = V::load( g[1] + x );
+
+        typename V::v dW = V::sub( V::load( r[1] + x - 1 ), V::load( g[1] + x - 1 ) );
+        typename V::v dE = V::sub( V::load( r[1] + x + 1 ), V::load( g[1] + x + 1 ) );
+        typename V::v dN = V::sub( V::load( r[0] + x ), V::load( g[0] + x ) );
+        typename V::v dS = V::sub( V::load( r[2] + x ), V::load( g[2] + x ) );
+        typename V::v dNW = V::sub( V::load( r[0] + x - 1 ), V::load( g[0] + x - 1 ) );
+        typename V::v dNE = V::sub( V::load( r[0] + x + 1 ), V::load( g[0] + x + 1 ) );
+        typename V::v dSW = V::sub( V::load( r[2] + x - 1 ), V::load( g[2] + x - 1 ) );
+        typename V::v dSE = V::sub( V::load( r[2] + x + 1 ), V::load( g[2] + x + 1 ) );
+
+        typename V::v hor = V::add( gc, V::shr1( V::add( dW, dE ) ) );
+        typename V::v ver = V::add( gc, V::shr1( V::add( dN, dS ) ) );
+        typename V::v diag = V::add( gc, V::shr2( V::add( V::add( dNW, dNE ), V::add( dSW, dSE ) ) ) );
+
+        typename V::v odd = V::oddMask( x );
+        typename V::v chroma = chromaX ? odd : V::sub( V::set1( -1 ), odd );
+
+        typename V::v same = V::min( V::max( V::select( chroma, c, hor ), zero ), top );
+        typename V::v other = V::min( V::max( V::select( chroma, diag, ver ), zero ), top );
+
+        V::store( redRow ? outR + x : outB + x, same );
+        V::store( redRow ? outB + x : outR + x, other );
+    }
+}
+
+
+// One source row into a working row, mirrored past both edges
+//
+static void readRow( const struct imageView & src, int y, int shift, short * out )
+{
+    const unsigned char * in = src.plane[0] + (ptrdiff_t)y * src.stride[0];
+    int x = 0;
+
+    if( src.step[0] == 1 )
+    {
+#if defined(IMAGE_UTILS_SSE2)
+        if( getSimdLevel() != simdNone )
+            for( ;x+8<=src.width;x+=8 )
+                _mm_storeu_si128( (__m128i *)(out + x), _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)(in + x) ), _mm_setzero_si128() ) );
+#elif defined(IMAGE_UTILS_NEON)
+        if( getSimdLevel() != simdNone )
+            for( ;x+8<=src.width;x+=8 )
+                vst1q_s16( out + x, vreinterpretq_s16_u16( vmovl_u8( vld1_u8( in + x ) ) ) );
+#endif
+        for( ;x<src.width;x++ ) out[x] = in[x];
+    } else {
+#if defined(IMAGE_UTILS_SSE2)
+        if( getSimdLevel() != simdNone )
+        {
+            const __m128i count = _mm_cvtsi32_si128( shift );
+            for( ;x+8<=src.width;x+=8 )
+                _mm_storeu_si128( (__m128i *)(out + x), _mm_srl_epi16( _mm_loadu_si128( (const __m128i *)(in + x * 2) ), count ) );
+        }
+#elif defined(IMAGE_UTILS_NEON)
+        if( getSimdLevel() != simdNone )
+        {
+            const int16x8_t count = vdupq_n_s16( (short)-shift );
+            for( ;x+8<=src.width;x+=8 )
+                vst1q_s16( out + x, vreinterpretq_s16_u16( vshlq_u16( vld1q_u16( (const uint16_t *)(in + x * 2) ), count ) ) );
+        }
+#endif
+        for( ;x<src.width;x++ ) out[x] = (short)((in[x * 2] | (in[x * 2 + 1] << 8)) >> shift);
+    }
+
+    // stray bits above the bit depth would not fit 8 bits
+    if( (src.step[0] == 2) && (shift < 8) )
+        for( int i=0;i<src.width;i++ ) out[i] = (short)std::min( (int)out[i], 255 );
+
+    for( int i=1;i<=2;i++ )
+    {
+        out[-i] = out[mirror( -i, src.width )];
+        out[src.width - 1 + i] = out[mirror( src.width - 1 + i, src.width )];
+    }
+}
+
+// one row of R, G, B to RGB24, blue byte first, or to grey
+//
+static void storeRow( const short * r, const short * g, const short * b, int width, bool grey, unsigned char * out )
+{
+    int x = 0;
+
+#if defined(IMAGE_UTILS_SSE2)
+    if( getSimdLevel() != simdNone )
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i kR = _mm_set1_epi16( 19 ), kG = _mm_set1_epi16( 37 ), kB = _mm_set1_epi16( 7 ), half = _mm_set1_epi16( 32 );
+        const __m128i keep0 = _mm_set1_epi64x( 0x0000000000FFFFFFLL );
+        const __m128i keep1 = _mm_set1_epi64x( 0x0000FFFFFF000000LL );
+
+        // the last store writes 2 bytes past the 8th pixel, leave at least one pixel for the scalar tail
+        for( ;x+8<width;x+=8, out+=24 )
+        {
+            __m128i vr = _mm_loadu_si128( (const __m128i *)(r + x) );
+            __m128i vg = _mm_loadu_si128( (const __m128i *)(g + x) );
+            __m128i vb = _mm_loadu_si128( (const __m128i *)(b + x) );
+
+            if( grey )
+            {
+                __m128i y = _mm_add_epi16( _mm_add_epi16( _mm_mullo_epi16( vr, kR ), _mm_mullo_epi16( vg, kG ) ),
+                                           _mm_add_epi16( _mm_mullo_epi16( vb, kB ), half ) );
+                vr = vg = vb = _mm_srli_epi16( y, 6 );
+            }
+
+            // interleave to 4 byte pixels, then squeeze each 64 bit lane down to 6 bytes
+            __m128i bg = _mm_unpacklo_epi8( _mm_packus_epi16( vb, zero ), _mm_packus_epi16( vg, zero ) );
+            __m128i rz = _mm_unpacklo_epi8( _mm_packus_epi16( vr, zero ), zero );
+            __m128i p0 = _mm_unpacklo_epi16( bg, rz );
+            __m128i p1 = _mm_unpackhi_epi16( bg, rz );
+
+            p0 = _mm_or_si128( _mm_and_si128( p0, keep0 ), _mm_and_si128( _mm_srli_epi64( p0, 8 ), keep1 ) );
+            p1 = _mm_or_si128( _mm_and_si128( p1, keep0 ), _mm_and_si128( _mm_srli_epi64( p1, 8 ), keep1 ) );
+
+            // overlapping stores, each one overwrites the 2 spare bytes of the one before
+            _mm_storel_epi64( (__m128i *)(out), p0 );
+            _mm_storel_epi64( (__m128i *)(out + 6), _mm_srli_si128( p0, 8 ) );
+            _mm_storel_epi64( (__m128i *)(out + 12), p1 );
+            _mm_storel_epi64( (__m128i *)(out + 18), _mm_srli_si128( p1, 8 ) );
+        }
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    if( getSimdLevel() != simdNone )
+    {
+        for( ;x+8<=width;x+=8, out+=24 )
+        {
+            int16x8_t vr = vld1q_s16( r + x ), vg = vld1q_s16( g + x ), vb = vld1q_s16( b + x );
+
+            if( grey )
+            {
+                int16x8_t y = vmlaq_n_s16( vmlaq_n_s16( vmlaq_n_s16( vdupq_n_s16( 32 ), vr, 19 ), vg, 37 ), vb, 7 );
+                vr = vg = vb = vshrq_n_s16( y, 6 );
+            }
+
+            uint8x8x3_t px;
+            px.val[0] = vqmovun_s16( vb );
+            px.val[1] = vqmovun_s16( vg );
+            px.val[2] = vqmovun_s16( vr );
+            vst3_u8( out, px );
+        }
+    }
+#endif
+
+    for( ;x<width;x++, out+=3 )
+    {
+        if( grey )
+        {
+            out[0] = out[1] = out[2] = (unsigned char)((r[x] * 19 + g[x] * 37 + b[x] * 7 + 32) >> 6);
+        } else {
+            out[0] = (unsigned char)b[x];
+            out[1] = (unsigned char)g[x];
+            out[2] = (unsigned char)r[x];
+        }
+    }
+}
+
+
+// rows first .. last-1 of the image, a window of working rows slides down the band
+//
+template<class V>
+static void demosaicRows( const struct imageView & src, const struct imageView & dst, enum bayerPattern pattern, int shift,
+                          bool grey, int first, int last )
+{
+    int pitch = (src.width + 2 * BAYER_PAD + 7) & ~7;
+
+    // 8 raw rows and 4 green rows, indexed by row number, and one output row of each colour
+    thread_local std::vector<short> buffer;
+    buffer.assign( (size_t)pitch * 15, 0 );
+
+    auto raw = [&]( int y ) { return buffer.data() + (size_t)((y + 8) & 7) * pitch + BAYER_PAD; };
+    auto green = [&]( int y ) { return buffer.data() + (size_t)(8 + ((y + 4) & 3)) * pitch + BAYER_PAD; };
+    short * outR = buffer.data() + (size_t)12 * pitch + BAYER_PAD;
+    short * outG = outR + pitch;
+    short * outB = outG + pitch;
+
+    int rx = redX( pattern ), ry = redY( pattern );
+    bool edgeAware = (s_demosaic == bayerEdgeAware);
+
+    // green rows need raw rows two either side, the output row one either side of both
+    int rawNext = first - (edgeAware ? 3 : 1);
+    int greenNext = first - 1;
+
+    for( int y=first;y<last;y++ )
+    {
+        int rawNeeded = y + (edgeAware ? 3 : 1);
+        for( ;rawNext<=rawNeeded;rawNext++ ) readRow( src, mirror( rawNext, src.height ), shift, raw( rawNext ) );
+
+        bool redRow = ((y & 1) == ry);
+        int chromaX = redRow ? rx : rx ^ 1;
+
+        if( edgeAware )
+        {
+            for( ;greenNext<=y+1;greenNext++ )
+            {
+                const short * rows[5] = { raw( greenNext - 2 ), raw( greenNext - 1 ), raw( greenNext ), raw( greenNext + 1 ), raw( greenNext + 2 ) };
+                int gx = ((greenNext & 1) == ry) ? rx : rx ^ 1;
+                short * g = green( greenNext );
+                greenRow<V>( rows, src.width, gx, g );
+
+                // the colour differences read one sample past either edge
+                g[-1] = g[mirror( -1, src.width )];
+                g[src.width] = g[mirror( src.width, src.width )];
+            }
+
+            const short * rows[3] = { raw( y - 1 ), raw( y ), raw( y + 1 ) };
+            const short * greens[3] = { green( y - 1 ), green( y ), green( y + 1 ) };
+            chromaRow<V>( rows, greens, src.width, chromaX, redRow, outR, outB );
+            storeRow( outR, green( y ), outB, src.width, grey, dst.plane[0] + (ptrdiff_t)y * dst.stride[0] );
+        } else {
+            const short * rows[3] = { raw( y - 1 ), raw( y ), raw( y + 1 ) };
+            bilinearRow<V>( rows, src.width, chromaX, redRow, outR, outG, outB );
+            storeRow( outR, outG, outB, src.width, grey, dst.plane[0] + (ptrdiff_t)y * dst.stride[0] );
+        }
+    }
+}
+
+
+template<enum bayerPattern P, int BITS>
+bool convertBayerAs( const struct imageView & src, const struct imageView & dst, bool grayScale )
+{
+    if( !imageViewsFit( src, dst ) ) return false;
+
+    runRowBands( src.height, src.width * 3, 2, [&]( int first, int last )
+    {
+        switch( getSimdLevel() )
+        {
+#if defined(IMAGE_UTILS_SSE2)
+            case simdSSE2:
+            case simdAVX2:
+                demosaicRows<bayerLanesSSE2>( src, dst, P, BITS - 8, grayScale, first, last );
+                return;
+#endif
+#if defined(IMAGE_UTILS_NEON)
+            case simdNEON:
+                demosaicRows<bayerLanesNEON>( src, dst, P, BITS - 8, grayScale, first, last );
+                return;
+#endif
+            default:
+                demosaicRows<bayerLanes1>( src, dst, P, BITS - 8, grayScale, first, last );
+                return;
+        }
+    });
+
+    return true;
+}
+
+
+// 2x2 cells averaged over each output pixel, one red, two green and one blue sample per cell
+//
+template<enum bayerPattern P, int BITS>
+bool scaleBayerAs( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter )
+{
+    if( !src.plane[0] || !dst.plane[0] || (src.width < 2) || (src.height < 2) || (dst.width <= 0) || (dst.height <= 0) ) return false;
+    if( std::abs( dst.stride[0] ) < dst.width * 3 ) return false;
+
+    // both filters average cells, a cell already has all three colours so there is nothing to interpolate
+    (void)filter;
+
+    int cellsX = src.width / 2;
+    int cellsY = src.height / 2;
+    int rx = redX( P ), ry = redY( P );
+    int shift = BITS - 8;
+
+    // exactly half size is plain binning, one cell per output pixel
+    if( (dst.width == cellsX) && (dst.height == cellsY) )
+    {
+        runRowBands( dst.height, dst.width * 3, 1, [&]( int first, int last )
+        {
+            for( int y=first;y<last;y++ )
+            {
+                const unsigned char * redLine = src.plane[0] + (ptrdiff_t)(y * 2 + ry) * src.stride[0];
+                const unsigned char * blueLine = src.plane[0] + (ptrdiff_t)(y * 2 + (ry ^ 1)) * src.stride[0];
+                unsigned char * out = dst.plane[0] + (ptrdiff_t)y * dst.stride[0];
+
+                for( int x=0;x<cellsX;x++, out+=3 )
+                {
+                    int r, g, b;
+                    if( BITS == 8 )
+                    {
+                        r = redLine[x * 2 + rx];
+                        g = (redLine[x * 2 + (rx ^ 1)] + blueLine[x * 2 + rx] + 1) >> 1;
+                        b = blueLine[x * 2 + (rx ^ 1)];
+                    } else {
+                        auto sample = [&]( const unsigned char * line, int i )
+                        {
+                            return std::min( (line[i * 2] | (line[i * 2 + 1] << 8)) >> shift, 255 );
+                        };
+                        r = sample( redLine, x * 2 + rx );
+                        g = (sample( redLine, x * 2 + (rx ^ 1) ) + sample( blueLine, x * 2 + rx ) + 1) >> 1;
+                        b = sample( blueLine, x * 2 + (rx ^ 1) );
+                    }
+
+                    if( grayScale ) out[0] = out[1] = out[2] = (unsigned char)((r * 19 + g * 37 + b * 7 + 32) >> 6);
+                    else
+                    {
+                        out[0] = (unsigned char)b;
+                        out[1] = (unsigned char)g;
+                        out[2] = (unsigned char)r;
+                    }
+                }
+            }
+        });
+
+        return true;
+    }
+
+    // cell columns under each output pixel, at least one
+    std::vector<int> x0( dst.width ), x1( dst.width );
+    for( int x=0;x<dst.width;x++ )
+    {
+        x0[x] = (int)((long long)x * cellsX / dst.width);
+        x1[x] = std::max( (int)((long long)(x + 1) * cellsX / dst.width ), x0[x] + 1 );
+    }
+
+    runRowBands( dst.height, dst.width * 3, 1, [&]( int first, int last )
+    {
+        std::vector<int> sum[3] = { std::vector<int>( cellsX ), std::vector<int>( cellsX ), std::vector<int>( cellsX ) };
+
+        for( int y=first;y<last;y++ )
+        {
+            int y0 = (int)((long long)y * cellsY / dst.height);
+            int y1 = std::max( (int)((long long)(y + 1) * cellsY / dst.height ), y0 + 1 );
+
+            for( int c=0;c<3;c++ ) std::fill( sum[c].begin(), sum[c].end(), 0 );
+
+            // red, green and blue of each cell column, summed over the cell rows
+            for( int cy=y0;cy<y1;cy++ )
+            {
+                const unsigned char * row[2] = { src.plane[0] + (ptrdiff_t)(cy * 2) * src.stride[0],
+                                                 src.plane[0] + (ptrdiff_t)(cy * 2 + 1) * src.stride[0] };
+                const unsigned char * redLine = row[ry];
+                const unsigned char * blueLine = row[ry ^ 1];
+
+                for( int cx=0;cx<cellsX;cx++ )
+                {
+                    int r, g0, g1, b;
+                    if( BITS == 8 )
+                    {
+                        r = redLine[cx * 2 + rx];
+                        g0 = redLine[cx * 2 + (rx ^ 1)];
+                        g1 = blueLine[cx * 2 + rx];
+                        b = blueLine[cx * 2 + (rx ^ 1)];
+                    } else {
+                        const unsigned char * p;
+                        p = redLine + (cx * 2 + rx) * 2;        r = (p[0] | (p[1] << 8)) >> shift;
+                        p = redLine + (cx * 2 + (rx ^ 1)) * 2;  g0 = (p[0] | (p[1] << 8)) >> shift;
+                        p = blueLine + (cx * 2 + rx) * 2;       g1 = (p[0] | (p[1] << 8)) >> shift;
+                        p = blueLine + (cx * 2 + (rx ^ 1)) * 2; b = (p[0] | (p[1] << 8)) >> shift;
+                    }
+
+                    sum[0][cx] += std::min( b, 255 );
+                    sum[1][cx] += std::min( g0, 255 ) + std::min( g1, 255 );
+                    sum[2][cx] += std::min( r, 255 );
+                }
+            }
+
+            unsigned char * out = dst.plane[0] + (ptrdiff_t)y * dst.stride[0];
+            for( int x=0;x<dst.width;x++, out+=3 )
+            {
+                int n = (x1[x] - x0[x]) * (y1 - y0);
+                int v[3] = { 0, 0, 0 };
+                for( int cx=x0[x];cx<x1[x];cx++ )
+                    for( int c=0;c<3;c++ ) v[c] += sum[c][cx];
+
+                int b = (v[0] + n / 2) / n;
+                int g = (v[1] + n) / (2 * n);
+                int r = (v[2] + n / 2) / n;
+
+                if( grayScale ) out[0] = out[1] = out[2] = (unsigned char)((r * 19 + g * 37 + b * 7 + 32) >> 6);
+                else
+                {
+                    out[0] = (unsigned char)b;
+                    out[1] = (unsigned char)g;
+                    out[2] = (unsigned char)r;
+                }
+            }
+        }
+    });
+
+    return true;
+}
+
+
+#define BAYER_AS( P, BITS ) \
+    template bool convertBayerAs<P, BITS>( const struct imageView &, const struct imageView &, bool ); \
+    template bool scaleBayerAs<P, BITS>( const struct imageView &, const struct imageView &, bool, enum imageScaleFilter );
+#define BAYER_AS_DEPTHS( P ) BAYER_AS( P, 8 ) BAYER_AS( P, 10 ) BAYER_AS( P, 12 ) BAYER_AS( P, 16 )
+
+BAYER_AS_DEPTHS( bayerRGGB )
+BAYER_AS_DEPTHS( bayerBGGR )
+BAYER_AS_DEPTHS( bayerGRBG )
+BAYER_AS_DEPTHS( bayerGBRG )
+
+
+bool isBayerFormat( unsigned int fourcc )
+{
+    static const unsigned int bayer[] =
+    {
+        IMAGE_FOURCC('B','A','8','1'), IMAGE_FOURCC('G','B','R','G'), IMAGE_FOURCC('G','R','B','G'), IMAGE_FOURCC('R','G','G','B'),
+        IMAGE_FOURCC('B','G','1','0'), IMAGE_FOURCC('G','B','1','0'), IMAGE_FOURCC('B','A','1','0'), IMAGE_FOURCC('R','G','1','0'),
+        IMAGE_FOURCC('B','G','1','2'), IMAGE_FOURCC('G','B','1','2'), IMAGE_FOURCC('B','A','1','2'), IMAGE_FOURCC('R','G','1','2'),
+        IMAGE_FOURCC('B','Y','R','2'), IMAGE_FOURCC('G','B','1','6'), IMAGE_FOURCC('G','R','1','6'), IMAGE_FOURCC('R','G','1','6')
+    };
+
+    return std::find( std::begin( bayer ), std::end( bayer ), fourcc ) != std::end( bayer );
+}
@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+#include "image_utils.h"
+
+// Image views and the fourcc keyed converter registry
+//
+
+struct imageView rgbView( unsigned char * data, int width, int height, int stride )
+{
+    struct imageView v = {};
+
+    v.plane[0] = data;
+    v.stride[0] = (stride != 0) ? stride : width * 3;
+    v.step[0] = 3;
+    v.width = width;
+    v.height = height;
+
+    return v;
+}
+
+
+bool imageViewsFit( const struct imageView & src, const struct imageView & dst )
+{
+    if( !src.plane[0] || !dst.plane[0] ) return false;
+    if( (src.width <= 0) || (src.height <= 0) ) return false;
+    if( (dst.width < src.width) || (dst.height < src.height) ) return false;
+    if( std::abs( dst.stride[0] ) < src.width * 3 ) return false;
+
+    return true;
+}
+
+
+struct imageView rowsView( const struct imageView & v, int first, int rows )
+{
+    struct imageView r = v;
+
+    r.plane[0] += first * v.stride[0];
+    for( int p=1;p<3;p++ )
+        if( r.plane[p] ) r.plane[p] += (first >> v.chromaRowShift) * v.stride[p];
+    r.height = rows;
+
+    return r;
+}
+
+
+int chromaRowSamples( const struct imageView & v, int p )
+{
+    int samples = (v.width + 1) / 2;
+
+    if( (v.width & 1) && (v.step[0] == 2) && (v.step[p] == 4) && (v.plane[p] == v.plane[0] + 3) ) samples--;
+
+    return samples;
+}
+
+
+size_t layoutFrameSize( const struct imageView & v )
+{
+    if( (v.width <= 0) || (v.height <= 0) ) return 0;
+
+    // whole luma rows, then the last sample of each chroma plane, which may sit inside them (packed 4:2:2)
+    size_t size = (size_t)v.height * v.stride[0];
+
+    for( int p=1;p<3;p++ )
+    {
+        int samples = chromaRowSamples( v, p );
+        if( !v.plane[p] || (samples <= 0) ) continue;
+
+        int rows = ((v.height - 1) >> v.chromaRowShift) + 1;
+        size_t end = (size_t)(v.plane[p] - v.plane[0]) + (size_t)(rows - 1) * v.stride[p] + (size_t)(samples - 1) * v.step[p] + 1;
+        size = std::max( size, end );
+    }
+
+    return size;
+}
+
+
+bool cropView( const struct imageView & v, struct imageRect & roi, struct imageView & out )
+{
+    // clip to the frame
+    int x0 = std::max( roi.x, 0 );
+    int y0 = std::max( roi.y, 0 );
+    int x1 = std::min( roi.x + roi.width, v.width );
+    int y1 = std::min( roi.y + roi.height, v.height );
+    if( (x1 <= x0) || (y1 <= y0) ) return false;
+
+    // chroma alignment, two pixels share a chroma sample and 4:2:0 row pairs share a chroma row
+    bool chroma = v.plane[1] && v.plane[2];
+    int alignX = chroma ? 2 : 1;
+    int alignY = chroma ? (1 << v.chromaRowShift) : 1;
+
+    x0 -= x0 % alignX;
+    y0 -= y0 % alignY;
+    x1 = std::min( x1 + (alignX - x1 % alignX) % alignX, v.width );
+    y1 = std::min( y1 + (alignY - y1 % alignY) % alignY, v.height );
+
+    out = v;
+    out.plane[0] += y0 * v.stride[0] + x0 * v.step[0];
+    for( int p=1;p<3;p++ )
+        if( out.plane[p] ) out.plane[p] += (y0 >> v.chromaRowShift) * v.stride[p] + (x0 / 2) * v.step[p];
+    out.width = x1 - x0;
+    out.height = y1 - y0;
+
+    roi.x = x0;
+    roi.y = y0;
+    roi.width = out.width;
+    roi.height = out.height;
+
+    return true;
+}
+
+
+// single plane layouts
+//
+static struct imageView singlePlane( unsigned char * frame, int width, int height, int bytesPerPixel )
+{
+    struct imageView v = {};
+
+    v.plane[0] = frame;
+    v.stride[0] = width * bytesPerPixel;
+    v.step[0] = bytesPerPixel;
+    v.width = width;
+    v.height = height;
+
+    return v;
+}
+
+// packed 4:2:2, the chroma planes point into the pixel pairs, U at byte 1 and V at byte 3 (or the reverse)
+//
+static struct imageView packed422( unsigned char * frame, int width, int height, bool uFirst )
+{
+    struct imageView v = singlePlane( frame, width, height, 2 );
+
+    v.plane[1] = frame + (uFirst ? 1 : 3);
+    v.plane[2] = frame + (uFirst ? 3 : 1);
+    v.stride[1] = v.stride[2] = width * 2;
+    v.step[1] = v.step[2] = 4;
+
+    return v;
+}
+
+struct imageView packed422Layout( unsigned char * frame, int width, int height ) { return packed422( frame, width, height, true ); }
+struct imageView packedYVU422Layout( unsigned char * frame, int width, int height ) { return packed422( frame, width, height, false ); }
+struct imageView grey8Layout( unsigned char * frame, int width, int height ) { return singlePlane( frame, width, height, 1 ); }
+struct imageView grey16Layout( unsigned char * frame, int width, int height ) { return singlePlane( frame, width, height, 2 ); }
+
+
+// 4:2:0 layouts, chroma planes are (width+1)/2 x (height+1)/2 samples
+//
+static struct imageView planar420( unsigned char * frame, int width, int height, bool uFirst )
+{
+    struct imageView v = singlePlane( frame, width, height, 1 );
+
+    int widthUV = (width + 1) / 2;
+    unsigned char * first = frame + width * height;
+    unsigned char * second = first + widthUV * ((height + 1) / 2);
+
+    v.plane[1] = uFirst ? first : second;
+    v.plane[2] = uFirst ? second : first;
+    v.stride[1] = v.stride[2] = widthUV;
+    v.step[1] = v.step[2] = 1;
+    v.chromaRowShift = 1;
+
+    return v;
+}
+
+static struct imageView interleaved420( unsigned char * frame, int width, int height, bool uFirst )
+{
+    struct imageView v = singlePlane( frame, width, height, 1 );
+
+    unsigned char * uv = frame + width * height;
+
+    v.plane[1] = uFirst ? uv : uv + 1;
+    v.plane[2] = uFirst ? uv + 1 : uv;
+    v.stride[1] = v.stride[2] = ((width + 1) / 2) * 2;
+    v.step[1] = v.step[2] = 2;
+    v.chromaRowShift = 1;
+
+    return v;
+}
+
+struct imageView planarYUV420Layout( unsigned char * frame, int width, int height ) { return planar420( frame, width, height, true ); }
+struct imageView planarYVU420Layout( unsigned char * frame, int width, int height ) { return planar420( frame, width, height, false ); }
+struct imageView interleavedYUV420Layout( unsigned char * frame, int width, int height ) { return interleaved420( frame, width, height, true ); }
+struct imageView interleavedYVU420Layout( unsigned char * frame, int width, int height ) { return interleaved420( frame, width, height, false ); }
+
+
+// specialized converters indexed by [matrix][range]
+//
+static const imageConvertFn s_packed422As[3][2] =
+{
+    { convertPacked422As<yuvMatrixBT601, yuvRangeFull>, convertPacked422As<yuvMatrixBT601, yuvRangeLimited> },
+    { convertPacked422As<yuvMatrixBT709, yuvRangeFull>, convertPacked422As<yuvMatrixBT709, yuvRangeLimited> },
+    { convertPacked422As<yuvMatrixBT2020, yuvRangeFull>, convertPacked422As<yuvMatrixBT2020, yuvRangeLimited> }
+};
+
+static const imageConvertFn s_yuv420As[3][2] =
+{
+    { convertYUV420As<yuvMatrixBT601, yuvRangeFull>, convertYUV420As<yuvMatrixBT601, yuvRangeLimited> },
+    { convertYUV420As<yuvMatrixBT709, yuvRangeFull>, convertYUV420As<yuvMatrixBT709, yuvRangeLimited> },
+    { convertYUV420As<yuvMatrixBT2020, yuvRangeFull>, convertYUV420As<yuvMatrixBT2020, yuvRangeLimited> }
+};
+
+static const imageScaleFn s_scaleYUVAs[3][2] =
+{
+    { scaleYUVAs<yuvMatrixBT601, yuvRangeFull>, scaleYUVAs<yuvMatrixBT601, yuvRangeLimited> },
+    { scaleYUVAs<yuvMatrixBT709, yuvRangeFull>, scaleYUVAs<yuvMatrixBT709, yuvRangeLimited> },
+    { scaleYUVAs<yuvMatrixBT2020, yuvRangeFull>, scaleYUVAs<yuvMatrixBT2020, yuvRangeLimited> }
+};
+
+// the original converter and one per matrix and range
+//
+struct registryEntry
+{
+    struct imageConverter converter;
+    struct imageConverter colour[3][2];
+};
+
+static void setColourVariants( struct registryEntry & e, const imageConvertFn (*convertAs)[2] )
+{
+    for( int m=0;m<3;m++ )
+    {
+        for( int r=0;r<2;r++ )
+        {
+            e.colour[m][r] = e.converter;
+            if( !convertAs ) continue;
+
+            e.colour[m][r].convert = convertAs[m][r];
+            e.colour[m][r].scale = s_scaleYUVAs[m][r];
+        }
+    }
+}
+
+
+// the registry, filled with the built in converters on first use
+//
+static std::mutex s_registryLock;
+
+static std::map<unsigned int, struct registryEntry> & registry()
+{
+    static std::map<unsigned int, struct registryEntry> converters = []
+    {
+        std::map<unsigned int, struct registryEntry> m;
+
+        auto add = [&]( unsigned int fourcc, const char * name, imageLayoutFn layout, imageConvertFn convert, imageScaleFn scale,
+                        const imageConvertFn (*convertAs)[2] )
+        {
+            struct registryEntry & e = m[fourcc];
+            e.converter = { fourcc, name, layout, convert, scale };
+            setColourVariants( e, convertAs );
+        };
+
+        add( IMAGE_FOURCC('Y','U','Y','V'), "YUYV 4:2:2", packed422Layout, convertYUYV, scaleYUV, s_packed422As );
+        add( IMAGE_FOURCC('Y','V','Y','U'), "YVYU 4:2:2", packedYVU422Layout, convertYVYU, scaleYUV, s_packed422As );
+        add( IMAGE_FOURCC('Y','U','Y','2'), "YUY2 4:2:2", packed422Layout, convertYUY2, scaleYUY2, s_packed422As );
+
+        // YU12 and I420 are the same layout, U plane first
+        add( IMAGE_FOURCC('Y','U','1','2'), "Planar YUV 4:2:0", planarYUV420Layout, convertYUV420, scaleYUV, s_yuv420As );
+        add( IMAGE_FOURCC('I','4','2','0'), "Planar YUV 4:2:0", planarYUV420Layout, convertYUV420, scaleYUV, s_yuv420As );
+        add( IMAGE_FOURCC('Y','V','1','2'), "Planar YVU 4:2:0", planarYVU420Layout, convertYUV420, scaleYUV, s_yuv420As );
+        add( IMAGE_FOURCC('N','V','1','2'), "Interleaved YUV 4:2:0", interleavedYUV420Layout, convertYUV420, scaleYUV, s_yuv420As );
+        add( IMAGE_FOURCC('N','V','2','1'), "Interleaved YVU 4:2:0", interleavedYVU420Layout, convertYUV420, scaleYUV, s_yuv420As );
+
+        // high bit depth grey goes through the tone curve set with setGreyToneMap()
+        add( IMAGE_FOURCC('Y','1','0',' '), "10 bit grey", grey16Layout, convertGreyToneAs<10>, scaleGreyToneAs<10>, nullptr );
+        add( IMAGE_FOURCC('Y','1','2',' '), "12 bit grey", grey16Layout, convertGreyToneAs<12>, scaleGreyToneAs<12>, nullptr );
+        add( IMAGE_FOURCC('Y','1','4',' '), "14 bit grey", grey16Layout, convertGreyToneAs<14>, scaleGreyToneAs<14>, nullptr );
+        add( IMAGE_FOURCC('Y','1','6',' '), "16 bit grey", grey16Layout, convertGreyToneAs<16>, scaleGreyToneAs<16>, nullptr );
+        add( IMAGE_FOURCC('Y','1','0','P'), "10 bit packed grey", greyPacked10Layout, convertGreyToneAs<10>, scaleGreyToneAs<10>, nullptr );
+        add( IMAGE_FOURCC('Y','1','2','P'), "12 bit packed grey", greyPacked12Layout, convertGreyToneAs<12>, scaleGreyToneAs<12>, nullptr );
+
+        add( IMAGE_FOURCC('Y','8',' ',' '), "8 bit grey", grey8Layout, convertGrey8, scaleGrey, nullptr );
+        add( IMAGE_FOURCC('Y','8','0','0'), "8 bit grey", grey8Layout, convertGrey8, scaleGrey, nullptr );
+        add( IMAGE_FOURCC('G','R','E','Y'), "8 bit grey", grey8Layout, convertGrey8, scaleGrey, nullptr );
+
+        // Bayer, named by the colours of the first two rows
+        add( IMAGE_FOURCC('R','G','G','B'), "8 bit Bayer RGGB", grey8Layout, convertBayerAs<bayerRGGB, 8>, scaleBayerAs<bayerRGGB, 8>, nullptr );
+        add( IMAGE_FOURCC('B','A','8','1'), "8 bit Bayer BGGR", grey8Layout, convertBayerAs<bayerBGGR, 8>, scaleBayerAs<bayerBGGR, 8>, nullptr );
+        add( IMAGE_FOURCC('G','R','B','G'), "8 bit Bayer GRBG", grey8Layout, convertBayerAs<bayerGRBG, 8>, scaleBayerAs<bayerGRBG, 8>, nullptr );
+        add( IMAGE_FOURCC('G','B','R','G'), "8 bit Bayer GBRG", grey8Layout, convertBayerAs<bayerGBRG, 8>, scaleBayerAs<bayerGBRG, 8>, nullptr );
+
+        add( IMAGE_FOURCC('R','G','1','0'), "10 bit Bayer RGGB", grey16Layout, convertBayerAs<bayerRGGB, 10>, scaleBayerAs<bayerRGGB, 10>, nullptr );
+        add( IMAGE_FOURCC('B','G','1','0'), "10 bit Bayer BGGR", grey16Layout, convertBayerAs<bayerBGGR, 10>, scaleBayerAs<bayerBGGR, 10>, nullptr );
+        add( IMAGE_FOURCC('B','A','1','0'), "10 bit Bayer GRBG", grey16Layout, convertBayerAs<bayerGRBG, 10>, scaleBayerAs<bayerGRBG, 10>, nullptr );
+        add( IMAGE_FOURCC('G','B','1','0'), "10 bit Bayer GBRG", grey16Layout, convertBayerAs<bayerGBRG, 10>, scaleBayerAs<bayerGBRG, 10>, nullptr );
+
+        add( IMAGE_FOURCC('R','G','1','2'), "12 bit Bayer RGGB", grey16Layout, convertBayerAs<bayerRGGB, 12>, scaleBayerAs<bayerRGGB, 12>, nullptr );
+        add( IMAGE_FOURCC('B','G','1','2'), "12 bit Bayer BGGR", grey16Layout, convertBayerAs<bayerBGGR, 12>, scaleBayerAs<bayerBGGR, 12>, nullptr );
+        add( IMAGE_FOURCC('B','A','1','2'), "12 bit Bayer GRBG", grey16Layout, convertBayerAs<bayerGRBG, 12>, scaleBayerAs<bayerGRBG, 12>, nullptr );
+        add( IMAGE_FOURCC('G','B','1','2'), "12 bit Bayer GBRG", grey16Layout, convertBayerAs<bayerGBRG, 12>, scaleBayerAs<bayerGBRG, 12>, nullptr );
+
+        add( IMAGE_FOURCC('R','G','1','6'), "16 bit Bayer RGGB", grey16Layout, convertBayerAs<bayerRGGB, 16>, scaleBayerAs<bayerRGGB, 16>, nullptr );
+        add( IMAGE_FOURCC('B','Y','R','2'), "16 bit Bayer BGGR", grey16Layout, convertBayerAs<bayerBGGR, 16>, scaleBayerAs<bayerBGGR, 16>, nullptr );
+        add( IMAGE_FOURCC('G','R','1','6'), "16 bit Bayer GRBG", grey16Layout, convertBayerAs<bayerGRBG, 16>, scaleBayerAs<bayerGRBG, 16>, nullptr );
+        add( IMAGE_FOURCC('G','B','1','6'), "16 bit Bayer GBRG", grey16Layout, convertBayerAs<bayerGBRG, 16>, scaleBayerAs<bayerGBRG, 16>, nullptr );
+
+        return m;
+    }();
+
+    return converters;
+}
+
+
+const struct imageConverter * findConverter( unsigned int fourcc )
+{
+    std::lock_guard<std::mutex> lk( s_registryLock );
+
+    // map nodes never move so the pointer stays valid, register custom converters before streaming starts
+    auto it = registry().find( fourcc );
+    if( it == registry().end() ) return nullptr;
+
+    return &it->second.converter;
+}
+
+
+const struct imageConverter * findConverter( unsigned int fourcc, struct yuvColor color )
+{
+    std::lock_guard<std::mutex> lk( s_registryLock );
+
+    auto it = registry().find( fourcc );
+    if( it == registry().end() ) return nullptr;
+
+    int m = std::clamp( (int)color.matrix, 0, 2 );
+    int r = std::clamp( (int)color.range, 0, 1 );
+
+    return &it->second.colour[m][r];
+}
+
+
+void registerConverter( const struct imageConverter & converter )
+{
+    std::lock_guard<std::mutex> lk( s_registryLock );
+
+    // a custom converter knows its own colour handling
+    struct registryEntry & e = registry()[converter.fourcc];
+    e.converter = converter;
+    setColourVariants( e, nullptr );
+}
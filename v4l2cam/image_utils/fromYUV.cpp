@@ -1,34 +1,198 @@
 #include "image_utils.h"
 
-unsigned char R_fromYUV( int Y, int U, int V )
+// The basic conversion factors, with U and V in the order the caller passes them
+//
+//  R = Y + (1.4065 * (U - 128))
+//  G = Y - (0.3455 * (V - 128)) - (0.7169 * (U - 128))
+//  B = Y + (1.7790 * (V - 128))
+//
+struct yuvCoeffs classicYUVCoeffs( bool uFirst, bool grayScale )
 {
-    double R = Y + (1.4065 * (U - 128));
+    int kU[3] = { YUV_FIX(1.4065), YUV_FIX(-0.7169), 0 };
+    int kV[3] = { 0, YUV_FIX(-0.3455), YUV_FIX(1.7790) };
 
-    // This prevents colour distortions in your rgb image
-    if (R < 0) R = 0;
-    else if (R > 255) R = 255;
+    struct yuvCoeffs k;
+    for( int n=0;n<3;n++ )
+    {
+        k.ch[n][0] = uFirst ? kU[n] : kV[n];
+        k.ch[n][1] = uFirst ? kV[n] : kU[n];
+    }
+    k.grey = grayScale;
+    k.y = YUV_FIX(1.0);
+    k.yOffset = 0;
 
-    return (unsigned char)R;
+    return k;
 }
 
-unsigned char G_fromYUV( int Y, int U, int V )
+
+void buildYUVTables( const struct yuvCoeffs & k, struct yuvTables & t )
 {
-    double G = Y - (0.3455 * (V - 128)) - (0.7169 * (U - 128));
+    for( int c=0;c<256;c++ )
+    {
+        t.y[c] = (c - k.yOffset) * k.y;
 
-    // This prevents colour distortions in your rgb image
-    if (G < 0) G = 0;
-    else if (G > 255) G = 255;
+        for( int n=0;n<3;n++ )
+        {
+            t.c0[n][c] = k.ch[n][0] * (c - 128);
+            t.c1[n][c] = k.ch[n][1] * (c - 128);
+        }
+    }
+}
+
+
+// U first, built on first use (thread safe static initialization)
+//
+const struct yuvTables & classicYUVTables()
+{
+    static const struct yuvTables tables = []()
+    {
+        struct yuvTables t;
+        buildYUVTables( classicYUVCoeffs( true, false ), t );
+        return t;
+    }();
 
-    return (unsigned char)G;
+    return tables;
+}
+
+
+void yuvRowToRGB( const unsigned char * y, int yStep, const unsigned char * c0, const unsigned char * c1, int cStep,
+                  int pixels, const struct yuvTables & t, bool grey, unsigned char * out )
+{
+    int pairs = pixels / 2;
+
+    if( grey )
+    {
+        // only output byte 0 is needed
+        for( int i=0;i<pairs;i++, y+=2*yStep, c0+=cStep, c1+=cStep, out+=6 )
+        {
+            int t0 = t.c0[0][*c0] + t.c1[0][*c1];
+
+            out[0] = out[1] = out[2] = yuvSaturate( t.y[y[0]] + t0 );
+            out[3] = out[4] = out[5] = yuvSaturate( t.y[y[yStep]] + t0 );
+        }
+    } else {
+        for( int i=0;i<pairs;i++, y+=2*yStep, c0+=cStep, c1+=cStep, out+=6 )
+        {
+            // chroma terms are shared by both pixels of the pair
+            int t0 = t.c0[0][*c0] + t.c1[0][*c1];
+            int t1 = t.c0[1][*c0] + t.c1[1][*c1];
+            int t2 = t.c0[2][*c0] + t.c1[2][*c1];
+
+            int Y0 = t.y[y[0]];
+            int Y1 = t.y[y[yStep]];
+
+            out[0] = yuvSaturate( Y0 + t0 );
+            out[1] = yuvSaturate( Y0 + t1 );
+            out[2] = yuvSaturate( Y0 + t2 );
+            out[3] = yuvSaturate( Y1 + t0 );
+            out[4] = yuvSaturate( Y1 + t1 );
+            out[5] = yuvSaturate( Y1 + t2 );
+        }
+    }
+
+    // odd width, the last pixel uses the next chroma pair on its own
+    if( pixels & 1 )
+    {
+        int Y = t.y[*y];
+
+        out[0] = yuvSaturate( Y + t.c0[0][*c0] + t.c1[0][*c1] );
+        out[1] = grey ? out[0] : yuvSaturate( Y + t.c0[1][*c0] + t.c1[1][*c1] );
+        out[2] = grey ? out[0] : yuvSaturate( Y + t.c0[2][*c0] + t.c1[2][*c1] );
+    }
+}
+
+
+unsigned char R_fromYUV( int Y, int U, int V )
+{
+    const struct yuvTables & t = classicYUVTables();
+
+    return yuvSaturate( (Y << YUV_FIX_SHIFT) + t.c0[0][U & 0xFF] + t.c1[0][V & 0xFF] );
+}
+
+unsigned char G_fromYUV( int Y, int U, int V )
+{
+    const struct yuvTables & t = classicYUVTables();
+
+    return yuvSaturate( (Y << YUV_FIX_SHIFT) + t.c0[1][U & 0xFF] + t.c1[1][V & 0xFF] );
 }
 
 unsigned char B_fromYUV( int Y, int U, int V )
 {
-    double B = Y + (1.7790 * (V - 128));
+    const struct yuvTables & t = classicYUVTables();
+
+    return yuvSaturate( (Y << YUV_FIX_SHIFT) + t.c0[2][U & 0xFF] + t.c1[2][V & 0xFF] );
+}
+
+
+// V4L2 values (linux/videodev2.h), kept here so image_utils does not need the kernel headers
+//
+enum
+{
+    v4l2ColorspaceDefault = 0, v4l2ColorspaceSMPTE170M = 1, v4l2ColorspaceSMPTE240M = 2, v4l2ColorspaceREC709 = 3,
+    v4l2ColorspaceJPEG = 7, v4l2ColorspaceBT2020 = 10, v4l2ColorspaceDCIP3 = 12
+};
+
+enum
+{
+    v4l2EncDefault = 0, v4l2Enc601 = 1, v4l2Enc709 = 2, v4l2EncXV601 = 3, v4l2EncXV709 = 4, v4l2EncSYCC = 5,
+    v4l2EncBT2020 = 6, v4l2EncBT2020ConstLum = 7, v4l2EncSMPTE240M = 8
+};
+
+enum
+{
+    v4l2QuantDefault = 0, v4l2QuantFull = 1, v4l2QuantLimited = 2
+};
 
-    // This prevents colour distortions in your rgb image
-    if (B < 0) B = 0;
-    else if (B > 255) B = 255;
+struct yuvColor yuvColorFromV4L2( int colorspace, int ycbcrEnc, int quantization, int height )
+{
+    // no colorspace, SD or HD video going by the frame height
+    if( colorspace == v4l2ColorspaceDefault )
+        colorspace = (height >= 720) ? v4l2ColorspaceREC709 : v4l2ColorspaceSMPTE170M;
+
+    if( ycbcrEnc == v4l2EncDefault )
+    {
+        switch( colorspace )
+        {
+            case v4l2ColorspaceREC709:
+            case v4l2ColorspaceDCIP3: ycbcrEnc = v4l2Enc709; break;
+            case v4l2ColorspaceBT2020: ycbcrEnc = v4l2EncBT2020; break;
+            case v4l2ColorspaceSMPTE240M: ycbcrEnc = v4l2EncSMPTE240M; break;
+            default: ycbcrEnc = v4l2Enc601; break;
+        }
+    }
+
+    // only JPEG defaults to full range for Y'CbCr
+    if( quantization == v4l2QuantDefault )
+        quantization = (colorspace == v4l2ColorspaceJPEG) ? v4l2QuantFull : v4l2QuantLimited;
+
+    struct yuvColor c;
+
+    switch( ycbcrEnc )
+    {
+        // SMPTE 240M is close enough to 709 for a snapshot
+        case v4l2Enc709:
+        case v4l2EncXV709:
+        case v4l2EncSMPTE240M: c.matrix = yuvMatrixBT709; break;
+        case v4l2EncBT2020:
+        case v4l2EncBT2020ConstLum: c.matrix = yuvMatrixBT2020; break;
+        default: c.matrix = yuvMatrixBT601; break;
+    }
+    c.range = (quantization == v4l2QuantFull) ? yuvRangeFull : yuvRangeLimited;
+
+    return c;
+}
+
+
+std::string yuvColorToString( struct yuvColor color )
+{
+    std::string s;
+
+    switch( color.matrix )
+    {
+        case yuvMatrixBT709: s = "BT.709"; break;
+        case yuvMatrixBT2020: s = "BT.2020"; break;
+        default: s = "BT.601"; break;
+    }
 
-    return (unsigned char)B;
-}
\ No newline at end of file
+    return s + ((color.range == yuvRangeFull) ? " full range" : " limited range");
+}
@@ -2,56 +2,84 @@
 
 // linear 16 bit grey scale values
 //
-unsigned char * gs16ToRGB( unsigned char * yuv_image, int width, int height, bool grayScale )
+bool convertGrey16( const struct imageView & src, const struct imageView & dst, bool grayScale )
 {
-    unsigned char* rgb_image = new unsigned char[width * height * 3];
+    if( !imageViewsFit( src, dst ) ) return false;
 
-    //width and height of the image to be converted
+    runRowBands( src.height, src.width * 3, 1, [&]( int first, int last )
+    {
+        for( int row = first; row < last; row++ )
+        {
+            const unsigned char * in = src.plane[0] + row * src.stride[0];
+            unsigned char * out = dst.plane[0] + row * dst.stride[0];
 
-    int outIndex = 0;
+            // increment across two bytes for each sample
+            //
+            for( int x = 0; x < src.width; x++, in += src.step[0] )
+            {
+                // just use the upper byte, samples are little endian so it is the second one
+                // we could convert and then downscale but you would end up with the upper byte anyway
+                //
+                // (byte1*256 + byte0 ) / 256 => byte1
+                //
+                int R = in[1];
 
-    // increment across two bytes for each sample
-    //
-    for( int ii = 0; ii < width*height*2; ii+=2 )
-    {
-        // just use the upper byte
-        // we could convert and then downscale but you would end up with the upper byte anyway
-        //
-        // (byte1*256 + byte2 ) / 256 => byte1
-        //
-        int R = yuv_image[ii];
-
-        rgb_image[outIndex++] = R;
-        rgb_image[outIndex++] = R;
-        rgb_image[outIndex++] = R;
-    }
+                *out++ = R;
+                *out++ = R;
+                *out++ = R;
+            }
+        }
+    });
 
-    return rgb_image;
+    return true;
 }
 
 
 // linear 8-bit grey scale values
 //
-unsigned char * gs8ToRGB( unsigned char * yuv_image, int width, int height, bool grayScale )
+bool convertGrey8( const struct imageView & src, const struct imageView & dst, bool grayScale )
+{
+    if( !imageViewsFit( src, dst ) ) return false;
+
+    runRowBands( src.height, src.width * 3, 1, [&]( int first, int last )
+    {
+        for( int row = first; row < last; row++ )
+        {
+            const unsigned char * in = src.plane[0] + row * src.stride[0];
+            unsigned char * out = dst.plane[0] + row * dst.stride[0];
+
+            // single grey scale byte to R and G and B
+            //
+            for( int x = 0; x < src.width; x++, in += src.step[0] )
+            {
+                int R = in[0];
+
+                *out++ = R;
+                *out++ = R;
+                *out++ = R;
+            }
+        }
+    });
+
+    return true;
+}
+
+
+unsigned char * gs16ToRGB( unsigned char * yuv_image, int width, int height, bool grayScale )
 {
     unsigned char* rgb_image = new unsigned char[width * height * 3];
 
-    //width and height of the image to be converted
+    convertGrey16( grey16Layout( yuv_image, width, height ), rgbView( rgb_image, width, height ), grayScale );
+
+    return rgb_image;
+}
 
-    int outIndex = 0;
 
-    // increment by 1 byte
-    //
-    for( int ii = 0; ii < width*height*2; ii++ )
-    {
-        // single grey scale byte to R and G and B
-        //
-        int R = yuv_image[ii];
+unsigned char * gs8ToRGB( unsigned char * yuv_image, int width, int height, bool grayScale )
+{
+    unsigned char* rgb_image = new unsigned char[width * height * 3];
 
-        rgb_image[outIndex++] = R;
-        rgb_image[outIndex++] = R;
-        rgb_image[outIndex++] = R;
-    }
+    convertGrey8( grey8Layout( yuv_image, width, height ), rgbView( rgb_image, width, height ), grayScale );
 
     return rgb_image;
-}
\ No newline at end of file
+}
@@ -0,0 +1,554 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "image_utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define IMAGE_UTILS_SSE2
+#endif
+
+#if defined(__aarch64__) && defined(IMAGE_UTILS_ENABLE_NEON)
+#include <arm_neon.h>
+#define IMAGE_UTILS_NEON
+#endif
+
+// High bit depth grey through a tone curve
+//
+// - every row is read into 16 bit samples first, little endian ones as they are and the MIPI packed
+//   ones (Y10P, Y12P) unpacked, samples above the bit depth are clamped to it
+// - the curve is a 64K entry table indexed by the sample, built once per frame, and its 8 bit level
+//   either goes out as grey or picks a colour from the palette
+// - the histogram (for auto levels and equalization) is taken in a vector pass that shifts 8 samples
+//   at a time down to bin numbers, counted in 4 interleaved sub histograms so repeated bins do not
+//   stall on each other, one set of counts per row band is then summed
+//
+
+static struct greyToneMap s_toneMap = { greyToneLinear, false, 0, 0, 2.2, greyPaletteGrey };
+
+void setGreyToneMap( const struct greyToneMap & map ) { s_toneMap = map; }
+struct greyToneMap getGreyToneMap() { return s_toneMap; }
+
+
+// MIPI packed layouts, step 0, the bit depth tells the converter the packing
+//
+static struct imageView packedGrey( unsigned char * frame, int width, int height, int stride )
+{
+    struct imageView v = {};
+
+    v.plane[0] = frame;
+    v.stride[0] = stride;
+    v.step[0] = 0;
+    v.width = width;
+    v.height = height;
+
+    return v;
+}
+
+struct imageView greyPacked10Layout( unsigned char * frame, int width, int height ) { return packedGrey( frame, width, height, ((width + 3) / 4) * 5 ); }
+struct imageView greyPacked12Layout( unsigned char * frame, int width, int height ) { return packedGrey( frame, width, height, ((width + 1) / 2) * 3 ); }
+
+
+int greyFormatBits( unsigned int fourcc, bool * packed )
+{
+    if( packed ) *packed = false;
+
+    switch( fourcc )
+    {
+        case IMAGE_FOURCC('Y','1','0',' '): return 10;
+        case IMAGE_FOURCC('Y','1','2',' '): return 12;
+        case IMAGE_FOURCC('Y','1','4',' '): return 14;
+        case IMAGE_FOURCC('Y','1','6',' '): return 16;
+        default: break;
+    }
+
+    if( packed ) *packed = true;
+
+    switch( fourcc )
+    {
+        case IMAGE_FOURCC('Y','1','0','P'): return 10;
+        case IMAGE_FOURCC('Y','1','2','P'): return 12;
+        default: break;
+    }
+
+    if( packed ) *packed = false;
+    return 0;
+}
+
+
+// one row of samples, clamped to the bit depth
+//
+static void readGreyRow( const struct imageView & src, int bits, int y, unsigned short * out )
+{
+    const unsigned char * in = src.plane[0] + (ptrdiff_t)y * src.stride[0];
+    const int top = (1 << bits) - 1;
+    int w = src.width;
+
+    if( src.step[0] != 0 )
+    {
+        int x = 0;
+
+#if defined(IMAGE_UTILS_SSE2)
+        // unsigned min as a - max( a - top, 0 ), SSE2 has no unsigned 16 bit min
+        if( (getSimdLevel() != simdNone) && (src.step[0] == 2) )
+        {
+            const __m128i limit = _mm_set1_epi16( (short)top );
+            for( ;x+8<=w;x+=8 )
+            {
+                __m128i v = _mm_loadu_si128( (const __m128i *)(in + x * 2) );
+                _mm_storeu_si128( (__m128i *)(out + x), _mm_sub_epi16( v, _mm_subs_epu16( v, limit ) ) );
+            }
+        }
+#elif defined(IMAGE_UTILS_NEON)
+        if( (getSimdLevel() != simdNone) && (src.step[0] == 2) )
+        {
+            const uint16x8_t limit = vdupq_n_u16( (unsigned short)top );
+            for( ;x+8<=w;x+=8 ) vst1q_u16( out + x, vminq_u16( vld1q_u16( (const uint16_t *)(in + x * 2) ), limit ) );
+        }
+#endif
+
+        for( in+=x*src.step[0];x<w;x++, in+=src.step[0] ) out[x] = (unsigned short)std::min( in[0] | (in[1] << 8), top );
+    } else if( bits == 10 )
+    {
+        // 4 samples in 5 bytes, the high 8 bits of each then their low 2 bits in one byte
+        for( int x=0;x<w;x+=4, in+=5 )
+            for( int i=0;(i<4) && (x + i < w);i++ ) out[x + i] = (unsigned short)((in[i] << 2) | ((in[4] >> (i * 2)) & 3));
+    } else {
+        // 2 samples in 3 bytes, the high 8 bits of each then their low 4 bits in one byte
+        for( int x=0;x<w;x+=2, in+=3 )
+        {
+            out[x] = (unsigned short)((in[0] << 4) | (in[2] & 15));
+            if( x + 1 < w ) out[x + 1] = (unsigned short)((in[1] << 4) | (in[2] >> 4));
+        }
+    }
+}
+
+bool unpackGrey( const struct imageView & src, int bits, const struct imageView & dst )
+{
+    if( !src.plane[0] || !dst.plane[0] || (bits < 9) || (bits > 16) ) return false;
+    if( (dst.width < src.width) || (dst.height < src.height) || (dst.step[0] != 2) ) return false;
+
+    runRowBands( src.height, src.width * 2, 1, [&]( int first, int last )
+    {
+        std::vector<unsigned short> row( src.width );
+        for( int y=first;y<last;y++ )
+        {
+            readGreyRow( src, bits, y, row.data() );
+
+            unsigned char * out = dst.plane[0] + (ptrdiff_t)y * dst.stride[0];
+            for( int x=0;x<src.width;x++ )
+            {
+                out[x * 2] = (unsigned char)row[x];
+                out[x * 2 + 1] = (unsigned char)(row[x] >> 8);
+            }
+        }
+    });
+
+    return true;
+}
+
+
+// Histogram, 1 << min( bits, GREY_HISTOGRAM_BITS ) bins
+//
+static void histogramRow( const unsigned short * in, int width, int shift, unsigned int * sub, int bins )
+{
+    int x = 0;
+
+#if defined(IMAGE_UTILS_SSE2)
+    if( getSimdLevel() != simdNone )
+    {
+        const __m128i count = _mm_cvtsi32_si128( shift );
+        alignas(16) unsigned short idx[8];
+
+        for( ;x+8<=width;x+=8 )
+        {
+            _mm_store_si128( (__m128i *)idx, _mm_srl_epi16( _mm_loadu_si128( (const __m128i *)(in + x) ), count ) );
+
+            sub[idx[0]]++;  sub[bins + idx[1]]++;  sub[2 * bins + idx[2]]++;  sub[3 * bins + idx[3]]++;
+            sub[idx[4]]++;  sub[bins + idx[5]]++;  sub[2 * bins + idx[6]]++;  sub[3 * bins + idx[7]]++;
+        }
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    if( getSimdLevel() != simdNone )
+    {
+        const int16x8_t count = vdupq_n_s16( (short)-shift );
+        unsigned short idx[8];
+
+        for( ;x+8<=width;x+=8 )
+        {
+            vst1q_u16( idx, vshlq_u16( vld1q_u16( in + x ), count ) );
+
+            sub[idx[0]]++;  sub[bins + idx[1]]++;  sub[2 * bins + idx[2]]++;  sub[3 * bins + idx[3]]++;
+            sub[idx[4]]++;  sub[bins + idx[5]]++;  sub[2 * bins + idx[6]]++;  sub[3 * bins + idx[7]]++;
+        }
+    }
+#endif
+
+    for( ;x<width;x++ ) sub[(x & 3) * bins + (in[x] >> shift)]++;
+}
+
+bool greyHistogram( const struct imageView & src, int bits, std::vector<unsigned int> & bins )
+{
+    if( !src.plane[0] || (src.width <= 0) || (src.height <= 0) || (bits < 9) || (bits > 16) ) return false;
+
+    int binBits = std::min( bits, GREY_HISTOGRAM_BITS );
+    int size = 1 << binBits;
+    std::mutex lock;
+
+    bins.assign( size, 0 );
+
+    runRowBands( src.height, src.width * 2, 1, [&]( int first, int last )
+    {
+        std::vector<unsigned short> row( src.width );
+        std::vector<unsigned int> sub( (size_t)size * 4, 0 );
+
+        for( int y=first;y<last;y++ )
+        {
+            readGreyRow( src, bits, y, row.data() );
+            histogramRow( row.data(), src.width, bits - binBits, sub.data(), size );
+        }
+
+        std::lock_guard<std::mutex> hold( lock );
+        for( int i=0;i<size;i++ ) bins[i] += sub[i] + sub[size + i] + sub[2 * size + i] + sub[3 * size + i];
+    });
+
+    return true;
+}
+
+
+// False colour palettes, 256 BGR entries spread between a few RGB stops
+//
+struct paletteStop
+{
+    int at;
+    unsigned char r, g, b;
+};
+
+static void buildPalette( const struct paletteStop * stops, int count, unsigned char * bgr )
+{
+    for( int s=0;s+1<count;s++ )
+    {
+        const struct paletteStop & a = stops[s];
+        const struct paletteStop & b = stops[s + 1];
+
+        for( int i=a.at;i<=b.at;i++ )
+        {
+            int t = i - a.at, n = b.at - a.at;
+            bgr[i * 3 + 0] = (unsigned char)((a.b * (n - t) + b.b * t + n / 2) / n);
+            bgr[i * 3 + 1] = (unsigned char)((a.g * (n - t) + b.g * t + n / 2) / n);
+            bgr[i * 3 + 2] = (unsigned char)((a.r * (n - t) + b.r * t + n / 2) / n);
+        }
+    }
+}
+
+static const unsigned char * palette( enum greyPalette p )
+{
+    static unsigned char tables[3][256 * 3];
+    static std::once_flag once;
+
+    std::call_once( once, []
+    {
+        static const struct paletteStop grey[] = { { 0, 0, 0, 0 }, { 255, 255, 255, 255 } };
+
+        // black through purple, red and yellow to white, the usual thermal look
+        static const struct paletteStop iron[] =
+        {
+            { 0, 0, 0, 0 }, { 40, 30, 0, 110 }, { 90, 140, 0, 150 }, { 140, 220, 60, 40 },
+            { 190, 250, 160, 0 }, { 230, 255, 225, 80 }, { 255, 255, 255, 255 }
+        };
+
+        // dark blue through cyan, yellow and red
+        static const struct paletteStop rainbow[] =
+        {
+            { 0, 0, 0, 128 }, { 32, 0, 0, 255 }, { 96, 0, 255, 255 }, { 160, 255, 255, 0 },
+            { 224, 255, 0, 0 }, { 255, 128, 0, 0 }
+        };
+
+        buildPalette( grey, 2, tables[greyPaletteGrey] );
+        buildPalette( iron, 7, tables[greyPaletteIron] );
+        buildPalette( rainbow, 6, tables[greyPaletteRainbow] );
+    });
+
+    return tables[std::clamp( (int)p, 0, 2 )];
+}
+
+
+// The 64K entry curve for one frame
+//
+static void buildToneCurve( const struct imageView & src, int bits, const struct greyToneMap & map, unsigned char * lut )
+{
+    const int top = (1 << bits) - 1;
+    int low = map.low, high = (map.high > 0) ? map.high : top;
+
+    std::vector<unsigned int> bins;
+    int shift = bits - std::min( bits, GREY_HISTOGRAM_BITS );
+    bool needHistogram = map.autoLevels || (map.curve == greyToneEqualize);
+
+    if( needHistogram ) greyHistogram( src, bits, bins );
+
+    // the window that leaves 0.5% of the samples clipped at each end
+    if( map.autoLevels && !bins.empty() )
+    {
+        unsigned long long total = (unsigned long long)src.width * src.height;
+        unsigned long long clip = total / 200, sum = 0;
+        int b0 = 0, b1 = (int)bins.size() - 1;
+
+        while( (b0 < b1) && (sum + bins[b0] <= clip) ) sum += bins[b0++];
+        sum = 0;
+        while( (b1 > b0) && (sum + bins[b1] <= clip) ) sum += bins[b1--];
+
+        low = b0 << shift;
+        high = ((b1 + 1) << shift) - 1;
+    }
+
+    low = std::clamp( low, 0, top - 1 );
+    high = std::clamp( high, low + 1, top );
+
+    if( map.curve == greyToneEqualize && !bins.empty() )
+    {
+        // cumulative count at the start of each bin inside the window, samples within a bin are
+        // spread linearly over its count
+        int b0 = low >> shift, b1 = high >> shift;
+        std::vector<double> start( b1 - b0 + 2, 0.0 );
+        for( int b=b0;b<=b1;b++ ) start[b - b0 + 1] = start[b - b0] + bins[b];
+        double total = std::max( start[b1 - b0 + 1], 1.0 );
+
+        for( int v=0;v<=top;v++ )
+        {
+            int s = std::clamp( v, low, high );
+            int b = s >> shift;
+            double within = (double)(s - (b << shift) + 1) / (1 << shift);
+            double c = start[b - b0] + within * bins[b];
+            lut[v] = (unsigned char)std::lround( 255.0 * c / total );
+        }
+    } else if( map.curve == greyToneGamma )
+    {
+        double g = (map.gamma > 0.0) ? 1.0 / map.gamma : 1.0;
+
+        // pow() on 1025 points, the rest interpolated
+        double curve[1025];
+        for( int i=0;i<=1024;i++ ) curve[i] = 255.0 * std::pow( i / 1024.0, g );
+
+        for( int v=0;v<=top;v++ )
+        {
+            double t = (double)(std::clamp( v, low, high ) - low) * 1024.0 / (high - low);
+            int i = std::min( (int)t, 1023 );
+            lut[v] = (unsigned char)std::lround( curve[i] + (t - i) * (curve[i + 1] - curve[i]) );
+        }
+    } else {
+        int range = high - low;
+        for( int v=0;v<=top;v++ ) lut[v] = (unsigned char)(((std::clamp( v, low, high ) - low) * 255 + range / 2) / range);
+    }
+
+    std::memset( lut + top + 1, lut[top], 65536 - (top + 1) );
+}
+
+
+// level of each pixel as grey or false colour, dst is RGB24 or 8 bit grey
+//
+static void writeLevels( const unsigned short * in, int width, const unsigned char * lut, const unsigned char * colours, bool greyOut,
+                         unsigned char * out )
+{
+    if( greyOut )
+    {
+        for( int x=0;x<width;x++ ) out[x] = lut[in[x]];
+    } else {
+        for( int x=0;x<width;x++, out+=3 )
+        {
+            const unsigned char * c = colours + lut[in[x]] * 3;
+            out[0] = c[0];
+            out[1] = c[1];
+            out[2] = c[2];
+        }
+    }
+}
+
+static bool toneViewsFit( const struct imageView & src, const struct imageView & dst )
+{
+    if( !src.plane[0] || !dst.plane[0] ) return false;
+    if( (src.width <= 0) || (src.height <= 0) ) return false;
+    if( (dst.width < src.width) || (dst.height < src.height) ) return false;
+    if( std::abs( dst.stride[0] ) < src.width * ((dst.step[0] == 1) ? 1 : 3) ) return false;
+
+    return true;
+}
+
+
+template<int BITS>
+bool convertGreyToneAs( const struct imageView & src, const struct imageView & dst, bool grayScale )
+{
+    if( !toneViewsFit( src, dst ) ) return false;
+
+    struct greyToneMap map = s_toneMap;
+    std::vector<unsigned char> lut( 65536 );
+    buildToneCurve( src, BITS, map, lut.data() );
+
+    const unsigned char * colours = palette( grayScale ? greyPaletteGrey : map.palette );
+    bool greyOut = (dst.step[0] == 1);
+
+    runRowBands( src.height, src.width * 3, 1, [&]( int first, int last )
+    {
+        std::vector<unsigned short> row( src.width );
+        for( int y=first;y<last;y++ )
+        {
+            readGreyRow( src, BITS, y, row.data() );
+            writeLevels( row.data(), src.width, lut.data(), colours, greyOut, dst.plane[0] + (ptrdiff_t)y * dst.stride[0] );
+        }
+    });
+
+    return true;
+}
+
+
+// samples averaged over the area of each output pixel, then through the curve
+//
+template<int BITS>
+bool scaleGreyToneAs( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter )
+{
+    if( !src.plane[0] || !dst.plane[0] || (src.width <= 0) || (src.height <= 0) || (dst.width <= 0) || (dst.height <= 0) ) return false;
+    if( std::abs( dst.stride[0] ) < dst.width * ((dst.step[0] == 1) ? 1 : 3) ) return false;
+
+    // the averages are of high bit depth samples, both filters take the area
+    (void)filter;
+
+    struct greyToneMap map = s_toneMap;
+    std::vector<unsigned char> lut( 65536 );
+    buildToneCurve( src, BITS, map, lut.data() );
+
+    const unsigned char * colours = palette( grayScale ? greyPaletteGrey : map.palette );
+    bool greyOut = (dst.step[0] == 1);
+
+    // source columns under each output pixel, at least one
+    std::vector<int> x0( dst.width ), x1( dst.width );
+    for( int x=0;x<dst.width;x++ )
+    {
+        x0[x] = (int)((long long)x * src.width / dst.width);
+        x1[x] = std::max( (int)((long long)(x + 1) * src.width / dst.width ), x0[x] + 1 );
+    }
+
+    runRowBands( dst.height, dst.width * 3, 1, [&]( int first, int last )
+    {
+        std::vector<unsigned short> row( src.width ), level( dst.width );
+        std::vector<unsigned int> sum( src.width );
+
+        for( int y=first;y<last;y++ )
+        {
+            int y0 = (int)((long long)y * src.height / dst.height);
+            int y1 = std::max( (int)((long long)(y + 1) * src.height / dst.height ), y0 + 1 );
+
+            std::fill( sum.begin(), sum.end(), 0 );
+            for( int sy=y0;sy<y1;sy++ )
+            {
+                readGreyRow( src, BITS, sy, row.data() );
+                for( int x=0;x<src.width;x++ ) sum[x] += row[x];
+            }
+
+            for( int x=0;x<dst.width;x++ )
+            {
+                unsigned long long v = 0;
+                for( int sx=x0[x];sx<x1[x];sx++ ) v += sum[sx];
+
+                unsigned long long n = (unsigned long long)(x1[x] - x0[x]) * (y1 - y0);
+                level[x] = (unsigned short)((v + n / 2) / n);
+            }
+
+            writeLevels( level.data(), dst.width, lut.data(), colours, greyOut, dst.plane[0] + (ptrdiff_t)y * dst.stride[0] );
+        }
+    });
+
+    return true;
+}
+
+
+#define GREY_TONE_AS( BITS ) \
+    template bool convertGreyToneAs<BITS>( const struct imageView &, const struct imageView &, bool ); \
+    template bool scaleGreyToneAs<BITS>( const struct imageView &, const struct imageView &, bool, enum imageScaleFilter );
+
+GREY_TONE_AS( 10 )
+GREY_TONE_AS( 12 )
+GREY_TONE_AS( 14 )
+GREY_TONE_AS( 16 )
+
+
+// Command line form, comma separated words in any order
+//
+// - linear, gamma[=value] or equalize picks the curve, auto sets the window from the histogram
+// - low:high is a fixed window in sample units
+// - grey, iron or rainbow picks the palette
+//
+bool parseGreyToneMap( std::string spec, struct greyToneMap & map )
+{
+    struct greyToneMap m = { greyToneLinear, false, 0, 0, 2.2, greyPaletteGrey };
+    std::stringstream ss( spec );
+    std::string item;
+
+    while( std::getline( ss, item, ',' ) )
+    {
+        if( item == "linear" ) m.curve = greyToneLinear;
+        else if( (item == "equalize") || (item == "eq") ) m.curve = greyToneEqualize;
+        else if( item.compare( 0, 5, "gamma" ) == 0 )
+        {
+            m.curve = greyToneGamma;
+            if( item.length() > 5 )
+            {
+                if( item[5] != '=' ) return false;
+                char * end = nullptr;
+                m.gamma = std::strtod( item.c_str() + 6, &end );
+                if( (*end != 0) || !(m.gamma > 0.0) ) return false;
+            }
+        }
+        else if( item == "auto" ) m.autoLevels = true;
+        else if( (item == "grey") || (item == "gray") ) m.palette = greyPaletteGrey;
+        else if( item == "iron" ) m.palette = greyPaletteIron;
+        else if( item == "rainbow" ) m.palette = greyPaletteRainbow;
+        else
+        {
+            size_t colon = item.find( ':' );
+            if( (colon == std::string::npos) || (colon == 0) || (colon + 1 == item.length()) ) return false;
+            if( item.find_first_not_of( "0123456789:" ) != std::string::npos ) return false;
+
+            m.low = std::stoi( item.substr( 0, colon ) );
+            m.high = std::stoi( item.substr( colon + 1 ) );
+            if( (m.high <= m.low) || (m.high > 65535) ) return false;
+        }
+    }
+
+    map = m;
+    return true;
+}
+
+std::string greyToneMapToString( const struct greyToneMap & map )
+{
+    std::string s;
+
+    switch( map.curve )
+    {
+        case greyToneGamma:
+        {
+            std::stringstream g;
+            g << map.gamma;
+            s = "gamma " + g.str();
+            break;
+        }
+        case greyToneEqualize: s = "equalized"; break;
+        default: s = "linear"; break;
+    }
+
+    if( map.autoLevels ) s += ", auto levels";
+    else if( map.high > 0 ) s += ", window " + std::to_string( map.low ) + ".." + std::to_string( map.high );
+
+    switch( map.palette )
+    {
+        case greyPaletteIron: s += ", iron"; break;
+        case greyPaletteRainbow: s += ", rainbow"; break;
+        default: s += ", grey"; break;
+    }
+
+    return s;
+}
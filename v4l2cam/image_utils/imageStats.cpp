@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "image_utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define IMAGE_UTILS_SSE2
+#endif
+
+#if defined(__aarch64__) && defined(IMAGE_UTILS_ENABLE_NEON)
+#include <arm_neon.h>
+#define IMAGE_UTILS_NEON
+#endif
+
+// Luma statistics straight from the camera layout, no conversion
+//
+// - each sampled row is read to 8 bit levels (the low byte of packed 4:2:2, the top 8 bits of deeper
+//   grey), its levels counted in 4 interleaved sub histograms and the Laplacian taken against the rows
+//   above and below it
+// - mean, variance and the clipped counts all come from the histogram, the Laplacian sums are kept in
+//   32 bit vector lanes and moved to 64 bit before they can overflow, so the vector and scalar paths
+//   give the same numbers
+//
+
+// 8 bit levels of row y, a pointer into the frame when it already is one
+//
+static const unsigned char * readLumaRow( const struct imageView & src, int bits, int y, unsigned char * row )
+{
+    const unsigned char * in = src.plane[0] + (ptrdiff_t)y * src.stride[0];
+    int width = src.width;
+    int x = 0;
+
+    if( (src.step[0] == 1) && (bits == 8) ) return in;
+
+    if( bits == 8 )
+    {
+#if defined(IMAGE_UTILS_SSE2)
+        if( getSimdLevel() != simdNone )
+        {
+            // the last block reads one byte past the last sample, leave it to the scalar tail
+            const __m128i low = _mm_set1_epi16( 0x00FF );
+            for( ;x+16<width;x+=16 )
+            {
+                __m128i a = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(in + x * 2) ), low );
+                __m128i b = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(in + x * 2 + 16) ), low );
+                _mm_storeu_si128( (__m128i *)(row + x), _mm_packus_epi16( a, b ) );
+            }
+        }
+#elif defined(IMAGE_UTILS_NEON)
+        if( getSimdLevel() != simdNone )
+            for( ;x+16<width;x+=16 ) vst1q_u8( row + x, vld2q_u8( in + x * 2 ).val[0] );
+#endif
+        for( ;x<width;x++ ) row[x] = in[x * 2];
+
+    } else {
+        // little endian samples, anything above the bit depth saturates at 255
+        const unsigned short * in16 = (const unsigned short *)in;
+        int shift = bits - 8;
+
+#if defined(IMAGE_UTILS_SSE2)
+        if( getSimdLevel() != simdNone )
+        {
+            const __m128i count = _mm_cvtsi32_si128( shift );
+            const __m128i top = _mm_set1_epi16( 255 );
+            for( ;x+16<=width;x+=16 )
+            {
+                __m128i a = _mm_srl_epi16( _mm_loadu_si128( (const __m128i *)(in16 + x) ), count );
+                __m128i b = _mm_srl_epi16( _mm_loadu_si128( (const __m128i *)(in16 + x + 8) ), count );
+
+                // saturate as unsigned, packus would read a 16 bit sample shifted by one as negative
+                a = _mm_sub_epi16( a, _mm_subs_epu16( a, top ) );
+                b = _mm_sub_epi16( b, _mm_subs_epu16( b, top ) );
+                _mm_storeu_si128( (__m128i *)(row + x), _mm_packus_epi16( a, b ) );
+            }
+        }
+#elif defined(IMAGE_UTILS_NEON)
+        if( getSimdLevel() != simdNone )
+        {
+            const int16x8_t count = vdupq_n_s16( (short)-shift );
+            for( ;x+16<=width;x+=16 )
+            {
+                uint8x8_t a = vqmovn_u16( vshlq_u16( vld1q_u16( in16 + x ), count ) );
+                uint8x8_t b = vqmovn_u16( vshlq_u16( vld1q_u16( in16 + x + 8 ), count ) );
+                vst1q_u8( row + x, vcombine_u8( a, b ) );
+            }
+        }
+#endif
+        for( ;x<width;x++ ) row[x] = (unsigned char)std::min( in16[x] >> shift, 255 );
+    }
+
+    return row;
+}
+
+// sum and sum of squares of 4 * b[x] - b[x-1] - b[x+1] - a[x] - c[x] over x = 1 .. width-2
+//
+static void laplacianRow( const unsigned char * a, const unsigned char * b, const unsigned char * c, int width,
+                          long long & sum, long long & sum2 )
+{
+    int x = 1;
+
+#if defined(IMAGE_UTILS_SSE2)
+    if( getSimdLevel() != simdNone )
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i ones = _mm_set1_epi16( 1 );
+
+        // |L| <= 1020, so a lane of squares takes 1000 blocks before it overflows, 512 to be safe
+        while( x+8<=width-1 )
+        {
+            __m128i s = zero, s2 = zero;
+            int end = std::min( x + 8 * 512, width - 1 );
+
+            for( ;x+8<=end;x+=8 )
+            {
+                __m128i centre = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)(b + x) ), zero );
+                __m128i around = _mm_add_epi16(
+                    _mm_add_epi16( _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)(b + x - 1) ), zero ),
+                                   _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)(b + x + 1) ), zero ) ),
+                    _mm_add_epi16( _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)(a + x) ), zero ),
+                                   _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)(c + x) ), zero ) ) );
+                __m128i l = _mm_sub_epi16( _mm_slli_epi16( centre, 2 ), around );
+
+                s = _mm_add_epi32( s, _mm_madd_epi16( l, ones ) );
+                s2 = _mm_add_epi32( s2, _mm_madd_epi16( l, l ) );
+            }
+
+            int lanes[4], lanes2[4];
+            _mm_storeu_si128( (__m128i *)lanes, s );
+            _mm_storeu_si128( (__m128i *)lanes2, s2 );
+            for( int i=0;i<4;i++ )
+            {
+                sum += lanes[i];
+                sum2 += (unsigned int)lanes2[i];
+            }
+        }
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    if( getSimdLevel() != simdNone )
+    {
+        while( x+8<=width-1 )
+        {
+            int32x4_t s = vdupq_n_s32( 0 );
+            uint32x4_t s2 = vdupq_n_u32( 0 );
+            int end = std::min( x + 8 * 512, width - 1 );
+
+            for( ;x+8<=end;x+=8 )
+            {
+                uint16x8_t around = vaddq_u16( vaddl_u8( vld1_u8( b + x - 1 ), vld1_u8( b + x + 1 ) ),
+                                               vaddl_u8( vld1_u8( a + x ), vld1_u8( c + x ) ) );
+                int16x8_t l = vreinterpretq_s16_u16( vsubq_u16( vshll_n_u8( vld1_u8( b + x ), 2 ), around ) );
+
+                s = vpadalq_s16( s, l );
+                s2 = vaddq_u32( s2, vreinterpretq_u32_s32( vmull_s16( vget_low_s16( l ), vget_low_s16( l ) ) ) );
+                s2 = vaddq_u32( s2, vreinterpretq_u32_s32( vmull_s16( vget_high_s16( l ), vget_high_s16( l ) ) ) );
+            }
+
+            sum += vaddvq_s32( s );
+            sum2 += vaddvq_u32( s2 );
+        }
+    }
+#endif
+
+    for( ;x<width-1;x++ )
+    {
+        int l = 4 * b[x] - b[x - 1] - b[x + 1] - a[x] - c[x];
+        sum += l;
+        sum2 += l * l;
+    }
+}
+
+bool imageStatistics( const struct imageView & src, int bits, int subsample, struct imageStats & stats )
+{
+    stats = {};
+
+    if( !src.plane[0] || (src.width <= 0) || (src.height <= 0) ) return false;
+    if( (src.step[0] != 1) && (src.step[0] != 2) ) return false;
+    if( (bits < 8) || (bits > 16) || ((bits > 8) && (src.step[0] != 2)) ) return false;
+
+    int step = std::max( subsample, 1 );
+    int rows = (src.height + step - 1) / step;
+    long long sum = 0, sum2 = 0, count = 0;
+    std::mutex lock;
+
+    runRowBands( rows, src.width * 3, 1, [&]( int first, int last )
+    {
+        std::vector<unsigned char> buffer( (size_t)src.width * 3 );
+        std::vector<unsigned int> sub( 256 * 4, 0 );
+        long long bandSum = 0, bandSum2 = 0, bandCount = 0;
+
+        for( int r=first;r<last;r++ )
+        {
+            int y = r * step;
+            const unsigned char * row = readLumaRow( src, bits, y, buffer.data() );
+
+            int x = 0;
+            for( ;x+4<=src.width;x+=4 )
+            {
+                sub[row[x]]++;
+                sub[256 + row[x + 1]]++;
+                sub[512 + row[x + 2]]++;
+                sub[768 + row[x + 3]]++;
+            }
+            for( ;x<src.width;x++ ) sub[row[x]]++;
+
+            // the Laplacian needs a row on either side, and three columns
+            if( (y > 0) && (y + 1 < src.height) && (src.width > 2) )
+            {
+                const unsigned char * above = readLumaRow( src, bits, y - 1, buffer.data() + src.width );
+                const unsigned char * below = readLumaRow( src, bits, y + 1, buffer.data() + src.width * 2 );
+                laplacianRow( above, row, below, src.width, bandSum, bandSum2 );
+                bandCount += src.width - 2;
+            }
+        }
+
+        std::lock_guard<std::mutex> hold( lock );
+        for( int i=0;i<256;i++ ) stats.histogram[i] += sub[i] + sub[256 + i] + sub[512 + i] + sub[768 + i];
+        sum += bandSum;
+        sum2 += bandSum2;
+        count += bandCount;
+    });
+
+    double total = 0.0, levels = 0.0, levels2 = 0.0, low = 0.0, high = 0.0;
+    for( int i=0;i<256;i++ )
+    {
+        double n = stats.histogram[i];
+        total += n;
+        levels += n * i;
+        levels2 += n * i * i;
+        if( i <= IMAGE_STATS_LOW ) low += n;
+        if( i >= IMAGE_STATS_HIGH ) high += n;
+    }
+
+    stats.samples = (unsigned int)total;
+    stats.mean = levels / total;
+    stats.variance = std::max( levels2 / total - stats.mean * stats.mean, 0.0 );
+    stats.lowClip = 100.0 * low / total;
+    stats.highClip = 100.0 * high / total;
+
+    if( count > 0 )
+    {
+        double m = (double)sum / count;
+        stats.sharpness = std::max( (double)sum2 / count - m * m, 0.0 );
+    }
+
+    return true;
+}
+
+
+// 1/8 scale luma, the mean of each 8x8 cell like the DC image of an MJPEG frame
+//
+bool lumaThumbnail( const struct imageView & src, int bits, const struct imageView & dst )
+{
+    if( !src.plane[0] || !dst.plane[0] || (src.width <= 0) || (src.height <= 0) || (dst.step[0] != 1) ) return false;
+    if( (src.step[0] != 1) && (src.step[0] != 2) ) return false;
+    if( (bits < 8) || (bits > 16) || ((bits > 8) && (src.step[0] != 2)) ) return false;
+
+    int cols = (src.width + 7) / 8, rows = (src.height + 7) / 8;
+    if( (dst.width < cols) || (dst.height < rows) ) return false;
+
+    runRowBands( rows, src.width * 8, 1, [&]( int first, int last )
+    {
+        std::vector<unsigned char> buffer( src.width );
+        std::vector<unsigned int> sums( cols );
+
+        for( int ty=first;ty<last;ty++ )
+        {
+            int y0 = ty * 8, y1 = std::min( y0 + 8, src.height );
+            std::fill( sums.begin(), sums.end(), 0 );
+
+            for( int y=y0;y<y1;y++ )
+            {
+                const unsigned char * row = readLumaRow( src, bits, y, buffer.data() );
+                int x = 0;
+
+#if defined(IMAGE_UTILS_SSE2)
+                // the sum of each 8 bytes is a SAD against zero
+                if( getSimdLevel() != simdNone )
+                {
+                    const __m128i zero = _mm_setzero_si128();
+                    for( ;x+16<=src.width;x+=16 )
+                    {
+                        __m128i s = _mm_sad_epu8( _mm_loadu_si128( (const __m128i *)(row + x) ), zero );
+                        sums[x / 8] += _mm_cvtsi128_si32( s );
+                        sums[x / 8 + 1] += _mm_extract_epi16( s, 4 );
+                    }
+                }
+#elif defined(IMAGE_UTILS_NEON)
+                if( getSimdLevel() != simdNone )
+                {
+                    for( ;x+16<=src.width;x+=16 )
+                    {
+                        uint64x2_t s = vpaddlq_u32( vpaddlq_u16( vpaddlq_u8( vld1q_u8( row + x ) ) ) );
+                        sums[x / 8] += (unsigned int)vgetq_lane_u64( s, 0 );
+                        sums[x / 8 + 1] += (unsigned int)vgetq_lane_u64( s, 1 );
+                    }
+                }
+#endif
+                for( ;x<src.width;x++ ) sums[x / 8] += row[x];
+            }
+
+            unsigned char * out = dst.plane[0] + (ptrdiff_t)ty * dst.stride[0];
+            for( int tx=0;tx<cols;tx++ )
+            {
+                unsigned int n = (unsigned int)(y1 - y0) * (std::min( tx * 8 + 8, src.width ) - tx * 8);
+                out[tx] = (unsigned char)((sums[tx] + n / 2) / n);
+            }
+        }
+    });
+
+    return true;
+}
@@ -1,4 +1,120 @@
+#ifndef IMAGE_UTILS_H
+#define IMAGE_UTILS_H
+
 #include <string>
+#include <functional>
+#include <vector>
+
+// Fixed point YUV to RGB core, shared by all the YUV converters
+//
+// - each output byte n is (Y - yOffset) * y + ch[n][0] * (C0 - 128) + ch[n][1] * (C1 - 128), with the
+//   coefficients scaled by 1 << YUV_FIX_SHIFT, rounded down and clamped to 0..255
+// - C0 and C1 are the chroma samples in the order the caller passes them, so swapping U and V
+//   is just a matter of swapping the coefficient columns
+// - grey copies output byte 0 to the other two
+// - 13 bits keep every coefficient (limited range BT.2020 blue is 2.14) inside the int16 the
+//   vector kernels multiply with
+//
+#define YUV_FIX_SHIFT 13
+#define YUV_FIX(x) ((int)((x) * (1 << YUV_FIX_SHIFT) + (((x) < 0) ? -0.5 : 0.5)))
+
+struct yuvCoeffs
+{
+    int ch[3][2];
+    bool grey;
+    int y;
+    int yOffset;
+};
+
+// per sample contribution to each output byte, built once per coefficient set
+//
+struct yuvTables
+{
+    int y[256];
+    int c0[3][256];
+    int c1[3][256];
+};
+
+struct yuvCoeffs classicYUVCoeffs( bool uFirst, bool grayScale );
+void buildYUVTables( const struct yuvCoeffs & k, struct yuvTables & t );
+const struct yuvTables & classicYUVTables();
+
+// branchless clamp of a fixed point value to 0..255
+//
+inline unsigned char yuvSaturate( int v )
+{
+    v >>= YUV_FIX_SHIFT;
+    v &= ~(v >> 31);
+    return (unsigned char)((v | ((255 - v) >> 31)) & 0xFF);
+}
+
+// one row of pixels, two pixels share each chroma pair
+//
+void yuvRowToRGB( const unsigned char * y, int yStep, const unsigned char * c0, const unsigned char * c1, int cStep,
+                  int pixels, const struct yuvTables & t, bool grey, unsigned char * out );
+
+// Colour matrix and range of the YUV data
+//
+// - BT.601 is SD video, BT.709 HD and BT.2020 UHD, limited range puts black at Y 16 and white at 235
+// - yuvColorFromV4L2() takes the colorspace, ycbcr_enc and quantization of the negotiated format and
+//   falls back on the V4L2 defaults for any field the driver leaves at 0
+//
+enum yuvMatrix
+{
+    yuvMatrixBT601, yuvMatrixBT709, yuvMatrixBT2020
+};
+
+enum yuvRange
+{
+    yuvRangeFull, yuvRangeLimited
+};
+
+struct yuvColor
+{
+    enum yuvMatrix matrix;
+    enum yuvRange range;
+};
+
+struct yuvColor yuvColorFromV4L2( int colorspace, int ycbcrEnc, int quantization, int height );
+std::string yuvColorToString( struct yuvColor color );
+
+// Coefficients of one matrix and range, worked out by the compiler
+//
+//  B = (Y - yOffset) * y + bU * (U - 128)
+//  G = (Y - yOffset) * y + gU * (U - 128) + gV * (V - 128)
+//  R = (Y - yOffset) * y + rV * (V - 128)
+//
+// - blue is output byte 0 like the rest of the converters, grey keeps only the luma term
+//
+template<enum yuvMatrix M, enum yuvRange R>
+struct yuvColorSpace
+{
+    static constexpr double kr = (M == yuvMatrixBT709) ? 0.2126 : (M == yuvMatrixBT2020) ? 0.2627 : 0.299;
+    static constexpr double kb = (M == yuvMatrixBT709) ? 0.0722 : (M == yuvMatrixBT2020) ? 0.0593 : 0.114;
+    static constexpr double kg = 1.0 - kr - kb;
+    static constexpr double yGain = (R == yuvRangeLimited) ? 255.0 / 219.0 : 1.0;
+    static constexpr double cGain = (R == yuvRangeLimited) ? 255.0 / 224.0 : 1.0;
+
+    static constexpr int y = YUV_FIX(yGain);
+    static constexpr int yOffset = (R == yuvRangeLimited) ? 16 : 0;
+    static constexpr int bU = YUV_FIX(2.0 * (1.0 - kb) * cGain);
+    static constexpr int gU = YUV_FIX(-2.0 * kb * (1.0 - kb) / kg * cGain);
+    static constexpr int gV = YUV_FIX(-2.0 * kr * (1.0 - kr) / kg * cGain);
+    static constexpr int rV = YUV_FIX(2.0 * (1.0 - kr) * cGain);
+
+    static constexpr struct yuvCoeffs coeffs( bool grayScale )
+    {
+        return grayScale ? yuvCoeffs{ { { 0, 0 }, { 0, 0 }, { 0, 0 } }, true, y, yOffset }
+                         : yuvCoeffs{ { { bU, 0 }, { gU, gV }, { 0, rV } }, false, y, yOffset };
+    }
+};
+
+// every matrix and range pair, X( matrix, range ) is expanded once for each
+//
+#define YUV_COLOR_VARIANTS( X ) \
+    X( yuvMatrixBT601, yuvRangeFull ) X( yuvMatrixBT601, yuvRangeLimited ) \
+    X( yuvMatrixBT709, yuvRangeFull ) X( yuvMatrixBT709, yuvRangeLimited ) \
+    X( yuvMatrixBT2020, yuvRangeFull ) X( yuvMatrixBT2020, yuvRangeLimited )
 
 unsigned char R_fromYUV( int Y, int U, int V );
 unsigned char G_fromYUV( int Y, int U, int V );
@@ -13,9 +129,429 @@ unsigned char * interleavedYVU420ToRGB( unsigned char * yuv_image, int width, in
 unsigned char * planarYUV420ToRGB( unsigned char * yuv_image, int width, int height, bool grayScale );
 unsigned char * planarYVU420ToRGB( unsigned char * yuv_image, int width, int height, bool grayScale );
 
-bool saveRGB24AsBMP( unsigned char * rgbData, int width, int height, std::string fid );
 
 unsigned char * yvu422ToRGB( unsigned char * yuyv_image, int width, int height, bool grayScale );
 unsigned char * yuv422ToRGB( unsigned char * yuyv_image, int width, int height, bool grayScale );
 unsigned char * yuy2422ToRGB( unsigned char * yuyv_image, int width, int height, bool grayScale );
 
+// Vector kernels, picked at run time from what the CPU supports
+//
+// - the NEON kernels are only built with -DIMAGE_UTILS_ENABLE_NEON, they have not been compiled and
+//   checked on aarch64 yet, so an ARM build runs the scalar code unless asked for them
+//
+enum imageSimdLevel
+{
+    simdNone, simdSSE2, simdAVX2, simdNEON
+};
+
+enum imageSimdLevel getSimdLevel();
+bool setSimdLevel( enum imageSimdLevel level );
+std::string simdLevelToString( enum imageSimdLevel level );
+
+// Multi-threaded conversion, frames are split into bands of rows over a persistent thread pool
+//
+// - threads <= 0 uses one thread per core, 1 converts on the calling thread only
+// - fn( first, last ) converts rows first .. last-1, bands are a multiple of rowAlign rows
+//
+void setConversionThreads( int threads );
+int getConversionThreads();
+void runRowBands( int rows, int rowBytes, int rowAlign, const std::function<void(int, int)> & fn );
+
+// Packed 4:2:2 (Y0 C1 Y1 C3) to RGB
+//
+void convertPacked422( const unsigned char * src, unsigned char * dst, int pixels, const struct yuvCoeffs & k );
+
+// Image views, a frame described by up to three planes in memory owned by the caller
+//
+// - plane[0] is Y, the packed data or the RGB24 output, plane[1] and plane[2] are always U and V
+//   whatever their order in memory
+// - stride is the byte distance from one row to the next, step the byte distance between two
+//   samples of a plane within a row, a negative stride walks the rows bottom up
+// - chromaRowShift is 1 when two rows share a chroma row (4:2:0), 0 otherwise
+//
+struct imageView
+{
+    unsigned char * plane[3];
+    int stride[3];
+    int step[3];
+    int width;
+    int height;
+    int chromaRowShift;
+};
+
+// RGB24 destination, stride 0 means tightly packed rows, imageViewsFit() checks dst can hold src
+//
+struct imageView rgbView( unsigned char * data, int width, int height, int stride = 0 );
+bool imageViewsFit( const struct imageView & src, const struct imageView & dst );
+
+// rows first .. first+rows-1 of a view, first must be even for 4:2:0
+//
+struct imageView rowsView( const struct imageView & v, int first, int rows );
+
+// chroma samples each row of plane p really holds, (width+1)/2 except for packed 4:2:2 of odd width
+// whose rows end on a half pair, Y and the chroma byte next to it, so the plane at byte 3 is one short
+//
+int chromaRowSamples( const struct imageView & v, int p );
+
+// Region of interest, a view of part of a frame that every converter accepts as is
+//
+// - with chroma planes x (and width) are moved to whole pixel pairs, and for 4:2:0 y (and height)
+//   to whole row pairs, the rectangle grows outwards so the requested area is still covered
+// - roi is updated to the rectangle actually used, false if it is empty or outside the frame
+//
+struct imageRect
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+bool cropView( const struct imageView & v, struct imageRect & roi, struct imageView & out );
+
+// View based converters, RGB24 is written into dst which must be at least as large as src
+//
+typedef bool (*imageConvertFn)( const struct imageView & src, const struct imageView & dst, bool grayScale );
+
+bool convertYUYV( const struct imageView & src, const struct imageView & dst, bool grayScale );
+bool convertYVYU( const struct imageView & src, const struct imageView & dst, bool grayScale );
+bool convertYUY2( const struct imageView & src, const struct imageView & dst, bool grayScale );
+bool convertYUV420( const struct imageView & src, const struct imageView & dst, bool grayScale );
+bool convertGrey8( const struct imageView & src, const struct imageView & dst, bool grayScale );
+bool convertGrey16( const struct imageView & src, const struct imageView & dst, bool grayScale );
+
+// Converters specialized on one matrix and range, instantiated for every YUV_COLOR_VARIANTS pair
+//
+// - convertPacked422As() takes the chroma order from the view, so it covers YUYV, YVYU and YUY2
+// - findConverter( fourcc, color ) hands out the right one, the plain converters above keep the
+//   original coefficients
+//
+template<enum yuvMatrix M, enum yuvRange R>
+bool convertPacked422As( const struct imageView & src, const struct imageView & dst, bool grayScale );
+template<enum yuvMatrix M, enum yuvRange R>
+bool convertYUV420As( const struct imageView & src, const struct imageView & dst, bool grayScale );
+
+// Fused downscale and conversion, the size of dst sets the output size
+//
+// - scaleAreaFilter averages every source pixel under an output pixel, scaleBilinearFilter reads
+//   four luma and four chroma samples per output pixel and is far cheaper for big reductions
+// - any factor works, up or down
+//
+enum imageScaleFilter
+{
+    scaleAreaFilter, scaleBilinearFilter
+};
+
+typedef bool (*imageScaleFn)( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter );
+
+bool scaleYUV( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter );
+bool scaleYUY2( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter );
+bool scaleGrey( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter );
+
+template<enum yuvMatrix M, enum yuvRange R>
+bool scaleYUVAs( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter );
+
+// Bayer (raw sensor) converters, one per pattern and bit depth, registered for the V4L2 fourccs
+//
+// - 8 bit formats use grey8Layout, 10, 12 and 16 bit ones grey16Layout (little endian, low bits used)
+// - setBayerDemosaic() picks bilinear or edge aware (the default) interpolation for every converter
+// - scaleBayerAs() averages whole 2x2 cells, so a half size dst is a fast binned preview
+// - crops of a Bayer frame have to start on an even row and column to keep the pattern
+//
+enum bayerPattern
+{
+    bayerRGGB, bayerBGGR, bayerGRBG, bayerGBRG
+};
+
+enum bayerDemosaic
+{
+    bayerBilinear, bayerEdgeAware
+};
+
+void setBayerDemosaic( enum bayerDemosaic method );
+enum bayerDemosaic getBayerDemosaic();
+bool isBayerFormat( unsigned int fourcc );
+
+template<enum bayerPattern P, int BITS>
+bool convertBayerAs( const struct imageView & src, const struct imageView & dst, bool grayScale );
+template<enum bayerPattern P, int BITS>
+bool scaleBayerAs( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter );
+
+// High bit depth grey (Y10, Y12, Y14, Y16 and the MIPI packed Y10P, Y12P), thermal cameras mostly
+//
+// - the sample goes through a 64K entry tone curve to an 8 bit level, out as grey or false colour
+// - greyToneLinear maps the window low .. high onto 0 .. 255, greyToneGamma bends it by 1 / gamma and
+//   greyToneEqualize spreads it by the histogram of the frame
+// - autoLevels takes the window from the histogram, 0.5% of the samples clip at each end, otherwise
+//   high 0 is the top of the bit depth
+// - the curve is built from the view the converter is handed, so convert frames whole, not in blocks of
+//   rows, dst may be RGB24 or 8 bit grey (step 1), grayScale ignores the palette
+// - packed layouts have step 0, the bit depth tells the packing, unpackGrey() makes a grey16 copy
+//
+#define GREY_HISTOGRAM_BITS 12
+
+enum greyToneCurve
+{
+    greyToneLinear, greyToneGamma, greyToneEqualize
+};
+
+enum greyPalette
+{
+    greyPaletteGrey, greyPaletteIron, greyPaletteRainbow
+};
+
+struct greyToneMap
+{
+    enum greyToneCurve curve;
+    bool autoLevels;
+    int low;
+    int high;
+    double gamma;
+    enum greyPalette palette;
+};
+
+void setGreyToneMap( const struct greyToneMap & map );
+struct greyToneMap getGreyToneMap();
+bool parseGreyToneMap( std::string spec, struct greyToneMap & map );
+std::string greyToneMapToString( const struct greyToneMap & map );
+
+// bit depth of a tone mapped grey fourcc, 0 for any other
+int greyFormatBits( unsigned int fourcc, bool * packed = nullptr );
+
+// 1 << min( bits, GREY_HISTOGRAM_BITS ) bins of the samples
+bool greyHistogram( const struct imageView & src, int bits, std::vector<unsigned int> & bins );
+bool unpackGrey( const struct imageView & src, int bits, const struct imageView & dst );
+
+template<int BITS>
+bool convertGreyToneAs( const struct imageView & src, const struct imageView & dst, bool grayScale );
+template<int BITS>
+bool scaleGreyToneAs( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter );
+
+// YUV to YUV repacking, packed 4:2:2 and planar or interleaved 4:2:0 in any chroma order both ways
+//
+// - feeds an encoder from a YUYV camera (NV12, I420) or swaps NV21 to NV12 without going through RGB,
+//   luma is copied as is
+// - chromaFilter picks how 4:2:2 chroma rows are brought down to 4:2:0, drop keeps the top row of each
+//   pair, average takes their mean and smooth a 1 3 3 1 filter over four rows, going up from 4:2:0
+//   drop repeats each row and the other two interpolate
+// - dst must be at least as large as src, any view from the layouts (or cropView()) works on either side
+// - repackedFrameSize() is the size of a tightly packed frame of a 4:2:2 or 4:2:0 fourcc, 0 for any other
+//
+enum chromaFilter
+{
+    chromaFilterDrop,
+    chromaFilterAverage,
+    chromaFilterSmooth
+};
+
+bool repackYUV( const struct imageView & src, const struct imageView & dst, enum chromaFilter filter = chromaFilterAverage );
+size_t repackedFrameSize( unsigned int fourcc, int width, int height );
+
+// Frame statistics from the luma of the camera layout, for spotting a blinded, covered or out of focus camera
+//
+// - plane[0] is read as it is, bits 8 for 8 bit luma (step 1, or the Y bytes of packed 4:2:2), 9 .. 16 for
+//   little endian grey (step 2) which is brought down to its top 8 bits
+// - subsample n reads every n-th row (with the rows either side for the Laplacian), 1 reads them all
+// - lowClip and highClip are the percent of samples at or below IMAGE_STATS_LOW and at or above
+//   IMAGE_STATS_HIGH, the limited range black and white, so they suit full range frames too
+// - sharpness is the variance of the 4 neighbour Laplacian, it only means something compared between
+//   frames of the same scene and mode, it drops as the image blurs
+//
+#define IMAGE_STATS_LOW 16
+#define IMAGE_STATS_HIGH 235
+
+struct imageStats
+{
+    unsigned int histogram[256];    // 8 bit levels
+    unsigned int samples;
+    double mean;
+    double variance;
+    double lowClip;
+    double highClip;
+    double sharpness;
+};
+
+bool imageStatistics( const struct imageView & src, int bits, int subsample, struct imageStats & stats );
+
+// Motion gating, frames are compared with a running background at 1/8 scale
+//
+// - lumaThumbnail() takes the mean of every 8x8 cell of the luma (bits as for imageStatistics()) into a
+//   (width + 7) / 8 x (height + 7) / 8 grey8Layout() view, the same image decodeJPEGThumbnail() gives for
+//   an MJPEG frame, so every mode is judged alike
+// - detectMotion() sums the absolute differences to the background over blocks of MOTION_BLOCK x
+//   MOTION_BLOCK thumbnail pixels (SSE2 / NEON SAD), a block changes when its mean difference is above
+//   level, and the frame is motion when more than area percent of the blocks change
+// - the background moves 1 / (1 << learnShift) of the way to every frame, so slow light changes fade
+//   into it, the first frame (or one of another size) only sets it and is never motion
+// - preRoll and postRoll are the frames a recorder keeps from before the motion and after it stops,
+//   parseMotionConfig() reads them with the rest from comma separated words, level=10, area=0.5,
+//   learn=5, pre=15 and post=60 when left out
+//
+#define MOTION_BLOCK 8
+
+struct motionConfig
+{
+    int level;              // mean absolute difference of a block, in 8 bit levels
+    double area;            // percent of the blocks
+    int learnShift;
+    int preRoll;            // frames
+    int postRoll;
+};
+
+struct motionState
+{
+    int width;
+    int height;
+    std::vector<unsigned short> background;     // 8.8 fixed point
+    std::vector<unsigned char> reference;       // its 8 bit levels, what frames are compared with
+};
+
+bool lumaThumbnail( const struct imageView & src, int bits, const struct imageView & dst );
+bool detectMotion( struct motionState & state, const struct imageView & thumb, const struct motionConfig & cfg, double * changed = nullptr );
+bool parseMotionConfig( std::string spec, struct motionConfig & cfg );
+std::string motionConfigToString( const struct motionConfig & cfg );
+
+// Converter registry, keyed by fourcc (same byte order as V4l2Camera::fourcc_charArray_to_int)
+//
+// - look the converter up once per stream, layout() describes a frame as the camera delivers it
+// - scale() converts into a smaller (or larger) dst in the same pass
+// - registering a fourcc that is already known replaces its converter, for every colour variant
+// - the yuvColor lookup gives the converter for that matrix and range, grey and custom converters
+//   are the same for all of them
+//
+#define IMAGE_FOURCC(a, b, c, d) ((unsigned int)(a) | ((unsigned int)(b) << 8) | ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+
+typedef struct imageView (*imageLayoutFn)( unsigned char * frame, int width, int height );
+
+struct imageConverter
+{
+    unsigned int fourcc;
+    std::string name;
+    imageLayoutFn layout;
+    imageConvertFn convert;
+    imageScaleFn scale;
+};
+
+const struct imageConverter * findConverter( unsigned int fourcc );
+const struct imageConverter * findConverter( unsigned int fourcc, struct yuvColor color );
+void registerConverter( const struct imageConverter & converter );
+
+// layouts of the tightly packed frames the registry knows about
+//
+struct imageView packed422Layout( unsigned char * frame, int width, int height );
+struct imageView packedYVU422Layout( unsigned char * frame, int width, int height );
+struct imageView grey8Layout( unsigned char * frame, int width, int height );
+struct imageView grey16Layout( unsigned char * frame, int width, int height );
+struct imageView greyPacked10Layout( unsigned char * frame, int width, int height );
+struct imageView greyPacked12Layout( unsigned char * frame, int width, int height );
+struct imageView planarYUV420Layout( unsigned char * frame, int width, int height );
+struct imageView planarYVU420Layout( unsigned char * frame, int width, int height );
+struct imageView interleavedYUV420Layout( unsigned char * frame, int width, int height );
+struct imageView interleavedYVU420Layout( unsigned char * frame, int width, int height );
+
+// bytes a tightly packed frame of a layout spans, for checking a buffer from the driver before it is read
+//
+size_t layoutFrameSize( const struct imageView & v );
+
+// BMP output, an empty fid writes to stdout
+//
+// - saveAsBMP() converts a block of rows at a time, bottom row first, into a small buffer and writes
+//   each block while the next one is converted, no full RGB24 frame is ever held
+// - rows are padded to a multiple of 4 bytes as BMP requires
+//
+bool saveAsBMP( const struct imageView & src, imageConvertFn convert, std::string fid, bool grayScale = false );
+bool saveRGB24AsBMP( unsigned char * rgbData, int width, int height, std::string fid );
+
+// RGB24 rows copied as they are, for saving an rgbView (or part of one) with saveAsBMP()
+//
+bool copyRGB24( const struct imageView & src, const struct imageView & dst, bool grayScale );
+
+// Lossless QOI output, an empty fid writes to stdout
+//
+// - RGB24 views are written as standard QOI files, grey views (grey8Layout, or grey16Layout for
+//   16 bit little endian samples) as single channel files with a "qoig" magic and ops for one sample
+// - saveAsQOI() with a converter encodes RGB24 a block of rows at a time like saveAsBMP(), without
+//   one it encodes the view as it is
+// - decodeQOI() reads both back into a view of the same kind, alpha is dropped
+//
+struct qoiInfo
+{
+    int width;
+    int height;
+    int channels;           // 3 or 4 for QOI, 1 for grey
+    int bits;               // per sample, 8 or 16
+};
+
+bool encodeQOI( const struct imageView & src, std::vector<unsigned char> & out );
+bool saveAsQOI( const struct imageView & src, imageConvertFn convert, std::string fid );
+bool qoiReadInfo( const unsigned char * data, size_t length, struct qoiInfo & info );
+bool decodeQOI( const unsigned char * data, size_t length, const struct imageView & dst );
+
+// Baseline JPEG decoder for MJPEG frames, no external library
+//
+// - 8 bit sequential Huffman frames, grey or YCbCr with 4:4:4, 4:2:2, 4:4:0 or 4:2:0 chroma
+// - UVC cameras usually leave out the Huffman tables, the standard ones (JPEG Annex K) are used then
+// - restart intervals are decoded in parallel on the conversion threads
+// - the IDCT gives the same samples as the libjpeg integer IDCT, with SSE2 / NEON when getSimdLevel() allows
+// - decodeJPEG() writes RGB24 (blue byte first, JFIF BT.601 full range) into dst, rows sharing a chroma
+//   row get a 3:1 blend of the two nearest chroma rows
+// - 4:4:4 and 4:4:0 keep a chroma sample per pixel, 4:2:2 and 4:2:0 share one between the two pixels of
+//   a pair rather than interpolating across like libjpeg's default (fancy) upsampling, so at sharp colour
+//   edges RGB can be tens of levels from libjpeg, 4:2:2 is within 1 of libjpeg without fancy upsampling
+// - decodeJPEGToYUV420() writes the Y, U and V planes of any 4:2:0 view, chroma is averaged down
+//   where the frame has more of it
+// - decodeJPEGThumbnail() decodes only the DC term of each block, one pixel per 8x8 block, so the
+//   image is (width + 7) / 8 x (height + 7) / 8, RGB24 into an rgbView or luma into a one byte per
+//   pixel view (grey8Layout)
+// - all return false for an unsupported or damaged frame, what did decode is still written
+//
+struct jpegInfo
+{
+    int width;
+    int height;
+    int components;
+    int hSamp;              // luma samples per chroma sample across
+    int vSamp;              // and down
+    int restartInterval;    // MCUs between restart markers, 0 without
+};
+
+bool jpegReadInfo( const unsigned char * data, size_t length, struct jpegInfo & info );
+bool decodeJPEG( const unsigned char * data, size_t length, const struct imageView & dst, bool grayScale = false );
+bool decodeJPEGToYUV420( const unsigned char * data, size_t length, const struct imageView & dst );
+bool decodeJPEGThumbnail( const unsigned char * data, size_t length, const struct imageView & dst, bool grayScale = false );
+
+// MJPEG frame validation, without decoding
+//
+// - walks the marker segments from SOI to EOI, every segment length has to reach the next marker
+// - the entropy coded data is searched for 0xFF with SSE2 / NEON, restart markers have to come in
+//   order and as many as the frame size and restart interval ask for
+// - catches the truncated frames a saturated USB bus delivers, which still start with FF D8 FF
+//
+enum jpegCheck
+{
+    jpegCheckOk,
+    jpegCheckNoSOI,             // does not start with FF D8
+    jpegCheckBadSegment,        // a segment length does not land on a marker
+    jpegCheckNoScan,            // EOI before a frame header and scan
+    jpegCheckBadRestart,        // restart markers out of order or missing
+    jpegCheckTruncated          // the data ends before EOI
+};
+
+enum jpegCheck jpegValidate( const unsigned char * data, size_t length );
+std::string jpegCheckToString( enum jpegCheck check );
+
+// Baseline JPEG encoder, no external library
+//
+// - takes the Y, U and V samples of a frame layout directly, packed or planar 4:2:2 is written as
+//   4:2:2, 4:2:0 as 4:2:0 and a view without chroma planes as greyscale
+// - quality is the libjpeg 1..100 scale applied to the standard tables, limited range is stretched
+//   to the full range JFIF readers expect, the matrix is written as it is
+// - restartRows puts a restart marker every so many MCU rows, the intervals are encoded in
+//   parallel on the conversion threads (setConversionThreads()), 0 gives one interval
+// - the forward DCT and quantization use SSE2 / NEON when getSimdLevel() allows
+//
+bool encodeJPEG( const struct imageView & src, std::vector<unsigned char> & out, int quality = 85,
+                 enum yuvRange range = yuvRangeFull, int restartRows = 1 );
+bool saveAsJPEG( const struct imageView & src, std::string fid, int quality = 85, enum yuvRange range = yuvRangeFull );
+
+#endif // IMAGE_UTILS_H
@@ -26,55 +26,14 @@
 // U/V - size/2 bytes, followed by
 //
 //
+// converted by convertYUV420(), the interleaved layout steps over every second chroma byte
+//
 unsigned char * interleavedYUV420ToRGB( unsigned char * yuv_image, int width, int height, bool grayScale )
 {
     // output buffer
     unsigned char* rgb_image = new unsigned char[width * height * 3];
 
-    // width and height of the image to be converted
-    int size = width * height;
-
-    int outIndex = 0;
-
-    int Y, U, V;
-    double R, G, B;
-
-    for( int ii = 0; ii < size; ii++ )
-    {
-        // get mappings from    00 01       (width = 8, size = width*height)
-        //                      08 09
-        //                                  to  U = size + 00
-        //                                  and V = size + 01
-        //
-        // get mappings from    02 03       (width = 8, size = width*height)
-        //                      10 11
-        //                                  to  U = size + 02
-        //                                  and V = size + 03
-        //
-        // offsetU = size + (ii%width) / 2
-        //
-
-        Y = yuv_image[ii];
-        int offsetUV = (ii%2)*2;
-
-        U = yuv_image[size + offsetUV];
-        V = yuv_image[size + offsetUV + 1];
-
-        R = R_fromYUV( Y, U, V );
-        G = R;
-        B = R;
-
-        if( !grayScale )
-        {
-            G = G_fromYUV( Y, U, V );
-            B = B_fromYUV( Y, U, V );
-        }
-
-        rgb_image[outIndex++] = R;
-        rgb_image[outIndex++] = G;
-        rgb_image[outIndex++] = B;
-
-    }
+    convertYUV420( interleavedYUV420Layout( yuv_image, width, height ), rgbView( rgb_image, width, height ), grayScale );
 
     return rgb_image;
 }
@@ -87,50 +46,7 @@ unsigned char * interleavedYVU420ToRGB( unsigned char * yuv_image, int width, in
     // output buffer
     unsigned char* rgb_image = new unsigned char[width * height * 3];
 
-    // width and height of the image to be converted
-    int size = width * height;
-
-    int outIndex = 0;
-
-    int Y, U, V;
-    double R, G, B;
-
-    for( int ii = 0; ii < size; ii++ )
-    {
-        // get mappings from    00 01       (width = 8, size = width*height)
-        //                      08 09
-        //                                  to  U = size + 00
-        //                                  and V = size + 01
-        //
-        // get mappings from    02 03       (width = 8, size = width*height)
-        //                      10 11
-        //                                  to  U = size + 02
-        //                                  and V = size + 03
-        //
-        // offsetU = size + (ii%width) / 2
-        //
-
-        Y = yuv_image[ii];
-        int offsetUV = (ii%2)*2;
-
-        V = yuv_image[size + offsetUV];
-        U = yuv_image[size + offsetUV + 1];
-
-        R = R_fromYUV( Y, U, V );
-        G = R;
-        B = R;
-
-        if( !grayScale )
-        {
-            G = G_fromYUV( Y, U, V );
-            B = B_fromYUV( Y, U, V );
-        }
-
-        rgb_image[outIndex++] = R;
-        rgb_image[outIndex++] = G;
-        rgb_image[outIndex++] = B;
-
-    }
+    convertYUV420( interleavedYVU420Layout( yuv_image, width, height ), rgbView( rgb_image, width, height ), grayScale );
 
     return rgb_image;
-}
\ No newline at end of file
+}
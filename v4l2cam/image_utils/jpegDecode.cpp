@@ -0,0 +1,1431 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "image_utils.h"
+#include "jpegTables.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define IMAGE_UTILS_SSE2
+#endif
+
+#if defined(__aarch64__) && defined(IMAGE_UTILS_ENABLE_NEON)
+#include <arm_neon.h>
+#define IMAGE_UTILS_NEON
+#endif
+
+// Baseline JPEG decoder for MJPEG frames
+//
+// - the headers are read into a jpegFrame, then the entropy coded data is cut at the restart
+//   markers, each restart interval decodes on its own into the component planes
+// - the planes are kept at their own sampling and padded out to whole MCUs, the output pass
+//   reads them a row at a time
+// - RGB output packs each row of Y, Cb and Cr into Y0 Cb Y1 Cr pairs and hands it to the packed
+//   4:2:2 kernels, with the JFIF (BT.601 full range) coefficients
+// - a frame that does not decode cleanly returns false, whatever was decoded is still written
+//
+
+// bits looked up in one go when decoding a Huffman code
+#define JPEG_FAST_BITS 9
+
+
+struct jpegHuffman
+{
+    unsigned char fastLength[1 << JPEG_FAST_BITS];      // code length of the first JPEG_FAST_BITS bits, 0 = longer code
+    unsigned char fastValue[1 << JPEG_FAST_BITS];
+    int fastAC[1 << JPEG_FAST_BITS];                    // value << 8 | run << 4 | bits used, 0 if code and value do not both fit
+    int maxCode[17];                                    // largest code of each length, -1 if none
+    int valueOffset[17];                                // code to index in values[]
+    unsigned char values[256];
+    bool present;
+};
+
+struct jpegComponent
+{
+    int id;
+    int h;
+    int v;
+    int quant;
+    int dcTable;
+    int acTable;
+
+    // decoded samples, padded to whole MCUs
+    unsigned char * plane;
+    int stride;
+    int rows;
+};
+
+struct jpegFrame
+{
+    int width;
+    int height;
+    int components;
+    struct jpegComponent comp[3];
+    unsigned short quant[4][64];                        // natural order
+    struct jpegHuffman dc[4];
+    struct jpegHuffman ac[4];
+    int restartInterval;
+
+    int hMax;
+    int vMax;
+    int mcusX;
+    int mcusY;
+
+    // entropy coded data, up to the end of the buffer
+    const unsigned char * scan;
+    const unsigned char * end;
+};
+
+// one restart interval of entropy coded data
+//
+struct jpegSegment
+{
+    const unsigned char * start;
+    const unsigned char * end;
+    int firstMcu;
+    int lastMcu;
+};
+
+
+static bool buildHuffman( struct jpegHuffman & h, const unsigned char bits[16], const unsigned char * values, int count )
+{
+    memset( h.fastLength, 0, sizeof(h.fastLength) );
+    if( (count < 0) || (count > 256) ) return false;
+
+    int code = 0;
+    int k = 0;
+    for( int len=1;len<=16;len++ )
+    {
+        h.valueOffset[len] = k - code;
+
+        for( int i=0;i<bits[len - 1];i++, k++, code++ )
+        {
+            if( k >= count ) return false;
+
+            // more codes than the length allows, checked before the code indexes the fast tables
+            if( code >= (1 << len) ) return false;
+
+            // every JPEG_FAST_BITS pattern starting with this code
+            if( len <= JPEG_FAST_BITS )
+            {
+                int shift = JPEG_FAST_BITS - len;
+                for( int s=0;s<(1 << shift);s++ )
+                {
+                    h.fastLength[(code << shift) | s] = len;
+                    h.fastValue[(code << shift) | s] = values[k];
+                }
+            }
+        }
+
+        h.maxCode[len] = bits[len - 1] ? code - 1 : -1;
+        code <<= 1;
+    }
+
+    memcpy( h.values, values, count );
+    h.present = true;
+
+    // AC codes short enough to read the coefficient value from the same lookup
+    for( int i=0;i<(1 << JPEG_FAST_BITS);i++ )
+    {
+        h.fastAC[i] = 0;
+
+        int len = h.fastLength[i];
+        int run = h.fastValue[i] >> 4;
+        int size = h.fastValue[i] & 15;
+        if( !len || !size || (len + size > JPEG_FAST_BITS) ) continue;
+
+        int v = (i >> (JPEG_FAST_BITS - len - size)) & ((1 << size) - 1);
+        if( v < (1 << (size - 1)) ) v += 1 - (1 << size);
+
+        h.fastAC[i] = (v * 256) | (run << 4) | (len + size);
+    }
+
+    return true;
+}
+
+
+// entropy coded data reader, the bits are kept left aligned in a 64 bit buffer
+//
+struct jpegBits
+{
+    const unsigned char * p;
+    const unsigned char * end;
+    uint64_t buf;
+    int count;
+    int padding;
+
+    jpegBits( const unsigned char * start, const unsigned char * stop )
+    {
+        p = start;
+        end = stop;
+        buf = 0;
+        count = 0;
+        padding = 0;
+    }
+
+    // at least 57 bits in the buffer, zeros once the data runs out
+    inline void fill()
+    {
+        if( count > 56 ) return;
+
+        // whole bytes at once while there is no 0xFF among the next 8
+        if( end - p >= 8 )
+        {
+            uint64_t w;
+            memcpy( &w, p, 8 );
+            if( !((~w - 0x0101010101010101ULL) & w & 0x8080808080808080ULL) )
+            {
+                w = __builtin_bswap64( w );
+
+                int n = (64 - count) >> 3;
+                uint64_t keep = (count + n * 8 < 64) ? ~((1ULL << (64 - count - n * 8)) - 1) : ~0ULL;
+                buf |= (w >> count) & keep;
+                p += n;
+                count += n * 8;
+                return;
+            }
+        }
+
+        while( count <= 56 )
+        {
+            unsigned int b = 0;
+            if( p < end )
+            {
+                b = *p++;
+
+                // 0xFF is followed by a stuffed 0x00, anything else is a marker and ends the data
+                if( b == 0xFF )
+                {
+                    if( (p < end) && (*p == 0x00) ) p++;
+                    else { p = end; b = 0; padding += 8; }
+                }
+            } else padding += 8;
+
+            buf |= (uint64_t)b << (56 - count);
+            count += 8;
+        }
+    }
+
+    inline void skip( int n )
+    {
+        buf <<= n;
+        count -= n;
+    }
+
+    // n bits as a signed coefficient value (JPEG F.2.2.1 EXTEND), n is 1..16
+    inline int receiveExtend( int n )
+    {
+        int v = (int)(buf >> (64 - n));
+        skip( n );
+
+        return (v < (1 << (n - 1))) ? v - (1 << n) + 1 : v;
+    }
+
+    // true if more bits were used than the data held
+    bool overrun() const { return count < padding; }
+};
+
+
+static inline int decodeHuffman( struct jpegBits & b, const struct jpegHuffman & h )
+{
+    unsigned int peek = (unsigned int)(b.buf >> 48);
+
+    int fast = peek >> (16 - JPEG_FAST_BITS);
+    int len = h.fastLength[fast];
+    if( len )
+    {
+        b.skip( len );
+        return h.fastValue[fast];
+    }
+
+    for( len = JPEG_FAST_BITS + 1; len <= 16; len++ )
+    {
+        int code = peek >> (16 - len);
+        if( code <= h.maxCode[len] )
+        {
+            b.skip( len );
+            return h.values[(h.valueOffset[len] + code) & 0xFF];
+        }
+    }
+
+    return -1;
+}
+
+
+// one 8x8 block into dequantized natural order coefficients, last is the zigzag index of the last
+// non zero coefficient (0 for a DC only block)
+//
+static inline bool decodeBlock( struct jpegBits & b, const struct jpegHuffman & dc, const struct jpegHuffman & ac,
+                                const unsigned short * q, int & pred, short * coef, int & last )
+{
+    b.fill();
+
+    int t = decodeHuffman( b, dc );
+    if( (t < 0) || (t > 11) ) return false;
+    if( t ) pred += b.receiveExtend( t );
+
+    coef[0] = (short)(pred * q[0]);
+    last = 0;
+
+    for( int k=1;k<64; )
+    {
+        b.fill();
+
+        // short code and value in one lookup
+        int fast = ac.fastAC[b.buf >> (64 - JPEG_FAST_BITS)];
+        if( fast )
+        {
+            b.skip( fast & 15 );
+            k += (fast >> 4) & 15;
+            if( k > 63 ) return false;
+
+            int z = s_zigzag[k];
+            coef[z] = (short)((fast >> 8) * q[z]);
+            last = k++;
+            continue;
+        }
+
+        int rs = decodeHuffman( b, ac );
+        if( rs < 0 ) return false;
+
+        int run = rs >> 4;
+        int size = rs & 15;
+        if( size == 0 )
+        {
+            // end of block, or a run of 16 zeros
+            if( run != 15 ) break;
+            k += 16;
+            continue;
+        }
+
+        k += run;
+        if( k > 63 ) return false;
+
+        int z = s_zigzag[k];
+        coef[z] = (short)(b.receiveExtend( size ) * q[z]);
+        last = k++;
+    }
+
+    return true;
+}
+
+
+// the DC term of one block, the AC codes are read past without being dequantized or stored
+//
+static inline bool decodeBlockDC( struct jpegBits & b, const struct jpegHuffman & dc, const struct jpegHuffman & ac, int & pred )
+{
+    b.fill();
+
+    int t = decodeHuffman( b, dc );
+    if( (t < 0) || (t > 11) ) return false;
+    if( t ) pred += b.receiveExtend( t );
+
+    int k = 1;
+    while( k < 64 )
+    {
+        b.fill();
+
+        // a refill holds at least five short codes and their values, so take them in one run
+        int fast = ac.fastAC[b.buf >> (64 - JPEG_FAST_BITS)];
+        if( fast )
+        {
+            int n = 0;
+            do {
+                b.skip( fast & 15 );
+                k += ((fast >> 4) & 15) + 1;
+                fast = ac.fastAC[b.buf >> (64 - JPEG_FAST_BITS)];
+            } while( fast && (++n < 5) && (k < 64) );
+            continue;
+        }
+
+        int rs = decodeHuffman( b, ac );
+        if( rs < 0 ) return false;
+
+        int run = rs >> 4;
+        int size = rs & 15;
+        if( size == 0 )
+        {
+            if( run != 15 ) break;
+            k += 16;
+            continue;
+        }
+
+        b.skip( size );
+        k += run + 1;
+    }
+
+    // a run past the end of the block
+    return k <= 64;
+}
+
+
+// Inverse DCT, the libjpeg "islow" integer algorithm, so every kernel gives the same bytes as libjpeg
+//
+static inline unsigned char idctClamp( int v )
+{
+    v += 128;
+    return (unsigned char)((v < 0) ? 0 : (v > 255) ? 255 : v);
+}
+
+// the IDCT of a block with only its DC term, every sample is the same
+static inline unsigned char dcSample( int coef )
+{
+    return idctClamp( (coef * (1 << IDCT_PASS1_BITS) + (1 << (IDCT_PASS1_BITS + 2))) >> (IDCT_PASS1_BITS + 3) );
+}
+
+static void idctBlockScalar( const short * in, unsigned char * out, int stride )
+{
+    int ws[64];
+
+    // columns, results scaled up by PASS1_BITS
+    for( int c=0;c<8;c++ )
+    {
+        const short * p = in + c;
+        int * w = ws + c;
+
+        if( !(p[8] | p[16] | p[24] | p[32] | p[40] | p[48] | p[56]) )
+        {
+            int dc = p[0] * (1 << IDCT_PASS1_BITS);
+            for( int r=0;r<8;r++ ) w[r * 8] = dc;
+            continue;
+        }
+
+        // even part
+        int z1 = (p[16] + p[48]) * FIX_0_541196100;
+        int tmp2 = z1 - p[48] * FIX_1_847759065;
+        int tmp3 = z1 + p[16] * FIX_0_765366865;
+        int tmp0 = (p[0] + p[32]) * (1 << IDCT_CONST_BITS);
+        int tmp1 = (p[0] - p[32]) * (1 << IDCT_CONST_BITS);
+
+        int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+        int tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+
+        // odd part
+        int o0 = p[56], o1 = p[40], o2 = p[24], o3 = p[8];
+        int za = o0 + o3, zb = o1 + o2, zc = o0 + o2, zd = o1 + o3;
+        int z5 = (zc + zd) * FIX_1_175875602;
+
+        o0 *= FIX_0_298631336;
+        o1 *= FIX_2_053119869;
+        o2 *= FIX_3_072711026;
+        o3 *= FIX_1_501321110;
+        za *= -FIX_0_899976223;
+        zb *= -FIX_2_562915447;
+        zc = zc * -FIX_1_961570560 + z5;
+        zd = zd * -FIX_0_390180644 + z5;
+
+        o0 += za + zc;
+        o1 += zb + zd;
+        o2 += zb + zc;
+        o3 += za + zd;
+
+        const int shift = IDCT_CONST_BITS - IDCT_PASS1_BITS;
+        const int round = 1 << (shift - 1);
+
+        w[0]  = (tmp10 + o3 + round) >> shift;
+        w[56] = (tmp10 - o3 + round) >> shift;
+        w[8]  = (tmp11 + o2 + round) >> shift;
+        w[48] = (tmp11 - o2 + round) >> shift;
+        w[16] = (tmp12 + o1 + round) >> shift;
+        w[40] = (tmp12 - o1 + round) >> shift;
+        w[24] = (tmp13 + o0 + round) >> shift;
+        w[32] = (tmp13 - o0 + round) >> shift;
+    }
+
+    // rows, scaled back down by PASS1_BITS and the 8 of the DCT
+    for( int r=0;r<8;r++, out+=stride )
+    {
+        const int * w = ws + r * 8;
+
+        const int shift = IDCT_CONST_BITS + IDCT_PASS1_BITS + 3;
+        const int round = 1 << (shift - 1);
+
+        int z1 = (w[2] + w[6]) * FIX_0_541196100;
+        int tmp2 = z1 - w[6] * FIX_1_847759065;
+        int tmp3 = z1 + w[2] * FIX_0_765366865;
+        int tmp0 = (w[0] + w[4]) * (1 << IDCT_CONST_BITS);
+        int tmp1 = (w[0] - w[4]) * (1 << IDCT_CONST_BITS);
+
+        int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+        int tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+
+        int o0 = w[7], o1 = w[5], o2 = w[3], o3 = w[1];
+        int za = o0 + o3, zb = o1 + o2, zc = o0 + o2, zd = o1 + o3;
+        int z5 = (zc + zd) * FIX_1_175875602;
+
+        o0 *= FIX_0_298631336;
+        o1 *= FIX_2_053119869;
+        o2 *= FIX_3_072711026;
+        o3 *= FIX_1_501321110;
+        za *= -FIX_0_899976223;
+        zb *= -FIX_2_562915447;
+        zc = zc * -FIX_1_961570560 + z5;
+        zd = zd * -FIX_0_390180644 + z5;
+
+        o0 += za + zc;
+        o1 += zb + zd;
+        o2 += zb + zc;
+        o3 += za + zd;
+
+        out[0] = idctClamp( (tmp10 + o3 + round) >> shift );
+        out[7] = idctClamp( (tmp10 - o3 + round) >> shift );
+        out[1] = idctClamp( (tmp11 + o2 + round) >> shift );
+        out[6] = idctClamp( (tmp11 - o2 + round) >> shift );
+        out[2] = idctClamp( (tmp12 + o1 + round) >> shift );
+        out[5] = idctClamp( (tmp12 - o1 + round) >> shift );
+        out[3] = idctClamp( (tmp13 + o0 + round) >> shift );
+        out[4] = idctClamp( (tmp13 - o0 + round) >> shift );
+    }
+}
+
+
+#if defined(IMAGE_UTILS_SSE2)
+
+static inline __m128i idctPair( int a, int b )
+{
+    return _mm_set1_epi32( (b << 16) | (a & 0xFFFF) );
+}
+
+// one 1-D pass over 8 vectors of 8 lanes, pmaddwd on interleaved pairs keeps every product in 32 bits,
+// the odd part is the libjpeg one with the shared terms multiplied out
+//
+static inline void idct8SSE2( const __m128i in[8], __m128i lo[8], __m128i hi[8] )
+{
+    const int A = FIX_1_175875602;
+
+    __m128i p26l = _mm_unpacklo_epi16( in[2], in[6] ), p26h = _mm_unpackhi_epi16( in[2], in[6] );
+    __m128i p04l = _mm_unpacklo_epi16( in[0], in[4] ), p04h = _mm_unpackhi_epi16( in[0], in[4] );
+    __m128i p13l = _mm_unpacklo_epi16( in[1], in[3] ), p13h = _mm_unpackhi_epi16( in[1], in[3] );
+    __m128i p57l = _mm_unpacklo_epi16( in[5], in[7] ), p57h = _mm_unpackhi_epi16( in[5], in[7] );
+
+    const __m128i k3 = idctPair( FIX_0_541196100 + FIX_0_765366865, FIX_0_541196100 );
+    const __m128i k2 = idctPair( FIX_0_541196100, FIX_0_541196100 - FIX_1_847759065 );
+    const __m128i kSum = idctPair( 1 << IDCT_CONST_BITS, 1 << IDCT_CONST_BITS );
+    const __m128i kDiff = idctPair( 1 << IDCT_CONST_BITS, -(1 << IDCT_CONST_BITS) );
+
+    const __m128i k0a = idctPair( A - FIX_0_899976223, A - FIX_1_961570560 );
+    const __m128i k0b = idctPair( A, FIX_0_298631336 - FIX_0_899976223 + A - FIX_1_961570560 );
+    const __m128i k1a = idctPair( A - FIX_0_390180644, A - FIX_2_562915447 );
+    const __m128i k1b = idctPair( FIX_2_053119869 - FIX_2_562915447 + A - FIX_0_390180644, A );
+    const __m128i k2a = idctPair( A, FIX_3_072711026 - FIX_2_562915447 + A - FIX_1_961570560 );
+    const __m128i k2b = idctPair( A - FIX_2_562915447, A - FIX_1_961570560 );
+    const __m128i k3a = idctPair( FIX_1_501321110 - FIX_0_899976223 + A - FIX_0_390180644, A );
+    const __m128i k3b = idctPair( A - FIX_0_390180644, A - FIX_0_899976223 );
+
+    __m128i half[2][8];
+    for( int h=0;h<2;h++ )
+    {
+        __m128i p26 = h ? p26h : p26l;
+        __m128i p04 = h ? p04h : p04l;
+        __m128i p13 = h ? p13h : p13l;
+        __m128i p57 = h ? p57h : p57l;
+
+        __m128i tmp3 = _mm_madd_epi16( p26, k3 );
+        __m128i tmp2 = _mm_madd_epi16( p26, k2 );
+        __m128i tmp0 = _mm_madd_epi16( p04, kSum );
+        __m128i tmp1 = _mm_madd_epi16( p04, kDiff );
+
+        __m128i tmp10 = _mm_add_epi32( tmp0, tmp3 ), tmp13 = _mm_sub_epi32( tmp0, tmp3 );
+        __m128i tmp11 = _mm_add_epi32( tmp1, tmp2 ), tmp12 = _mm_sub_epi32( tmp1, tmp2 );
+
+        __m128i o0 = _mm_add_epi32( _mm_madd_epi16( p13, k0a ), _mm_madd_epi16( p57, k0b ) );
+        __m128i o1 = _mm_add_epi32( _mm_madd_epi16( p13, k1a ), _mm_madd_epi16( p57, k1b ) );
+        __m128i o2 = _mm_add_epi32( _mm_madd_epi16( p13, k2a ), _mm_madd_epi16( p57, k2b ) );
+        __m128i o3 = _mm_add_epi32( _mm_madd_epi16( p13, k3a ), _mm_madd_epi16( p57, k3b ) );
+
+        half[h][0] = _mm_add_epi32( tmp10, o3 );
+        half[h][7] = _mm_sub_epi32( tmp10, o3 );
+        half[h][1] = _mm_add_epi32( tmp11, o2 );
+        half[h][6] = _mm_sub_epi32( tmp11, o2 );
+        half[h][2] = _mm_add_epi32( tmp12, o1 );
+        half[h][5] = _mm_sub_epi32( tmp12, o1 );
+        half[h][3] = _mm_add_epi32( tmp13, o0 );
+        half[h][4] = _mm_sub_epi32( tmp13, o0 );
+    }
+
+    for( int n=0;n<8;n++ )
+    {
+        lo[n] = half[0][n];
+        hi[n] = half[1][n];
+    }
+}
+
+static inline void transpose8x8SSE2( __m128i r[8] )
+{
+    __m128i a0 = _mm_unpacklo_epi16( r[0], r[1] ), a1 = _mm_unpackhi_epi16( r[0], r[1] );
+    __m128i a2 = _mm_unpacklo_epi16( r[2], r[3] ), a3 = _mm_unpackhi_epi16( r[2], r[3] );
+    __m128i a4 = _mm_unpacklo_epi16( r[4], r[5] ), a5 = _mm_unpackhi_epi16( r[4], r[5] );
+    __m128i a6 = _mm_unpacklo_epi16( r[6], r[7] ), a7 = _mm_unpackhi_epi16( r[6], r[7] );
+
+    __m128i b0 = _mm_unpacklo_epi32( a0, a2 ), b1 = _mm_unpackhi_epi32( a0, a2 );
+    __m128i b2 = _mm_unpacklo_epi32( a1, a3 ), b3 = _mm_unpackhi_epi32( a1, a3 );
+    __m128i b4 = _mm_unpacklo_epi32( a4, a6 ), b5 = _mm_unpackhi_epi32( a4, a6 );
+    __m128i b6 = _mm_unpacklo_epi32( a5, a7 ), b7 = _mm_unpackhi_epi32( a5, a7 );
+
+    r[0] = _mm_unpacklo_epi64( b0, b4 ); r[1] = _mm_unpackhi_epi64( b0, b4 );
+    r[2] = _mm_unpacklo_epi64( b1, b5 ); r[3] = _mm_unpackhi_epi64( b1, b5 );
+    r[4] = _mm_unpacklo_epi64( b2, b6 ); r[5] = _mm_unpackhi_epi64( b2, b6 );
+    r[6] = _mm_unpacklo_epi64( b3, b7 ); r[7] = _mm_unpackhi_epi64( b3, b7 );
+}
+
+// the whole block in registers, columns first as libjpeg does, the 32 bit results of each pass are
+// rounded and narrowed with the same shifts as the scalar code
+//
+static void idctBlockSSE2( const short * in, unsigned char * out, int stride )
+{
+    __m128i r[8], lo[8], hi[8];
+    for( int n=0;n<8;n++ ) r[n] = _mm_load_si128( (const __m128i *)(in + n * 8) );
+
+    // lanes are columns, so this pass works down each column
+    idct8SSE2( r, lo, hi );
+
+    const __m128i round1 = _mm_set1_epi32( 1 << (IDCT_CONST_BITS - IDCT_PASS1_BITS - 1) );
+    for( int n=0;n<8;n++ )
+        r[n] = _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( lo[n], round1 ), IDCT_CONST_BITS - IDCT_PASS1_BITS ),
+                                _mm_srai_epi32( _mm_add_epi32( hi[n], round1 ), IDCT_CONST_BITS - IDCT_PASS1_BITS ) );
+
+    transpose8x8SSE2( r );
+    idct8SSE2( r, lo, hi );
+
+    const __m128i round2 = _mm_set1_epi32( 1 << (IDCT_CONST_BITS + IDCT_PASS1_BITS + 2) );
+    const __m128i c128 = _mm_set1_epi16( 128 );
+    for( int n=0;n<8;n++ )
+        r[n] = _mm_adds_epi16( _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( lo[n], round2 ), IDCT_CONST_BITS + IDCT_PASS1_BITS + 3 ),
+                                                _mm_srai_epi32( _mm_add_epi32( hi[n], round2 ), IDCT_CONST_BITS + IDCT_PASS1_BITS + 3 ) ), c128 );
+
+    // lanes are rows again after this, two rows per saturating pack
+    transpose8x8SSE2( r );
+    for( int n=0;n<8;n+=2 )
+    {
+        __m128i px = _mm_packus_epi16( r[n], r[n + 1] );
+        _mm_storel_epi64( (__m128i *)(out + n * stride), px );
+        _mm_storel_epi64( (__m128i *)(out + (n + 1) * stride), _mm_srli_si128( px, 8 ) );
+    }
+}
+
+#endif // IMAGE_UTILS_SSE2
+
+
+#if defined(IMAGE_UTILS_NEON)
+
+static inline int32x4_t idctMac4( int16x4_t a, int ka, int16x4_t b, int kb, int16x4_t c, int kc, int16x4_t d, int kd )
+{
+    return vmlal_n_s16( vmlal_n_s16( vmlal_n_s16( vmull_n_s16( a, ka ), b, kb ), c, kc ), d, kd );
+}
+
+// same arithmetic as the SSE2 pass, four lanes at a time
+//
+static inline void idct8NEON( const int16x8_t in[8], int32x4_t lo[8], int32x4_t hi[8] )
+{
+    const int A = FIX_1_175875602;
+
+    for( int h=0;h<2;h++ )
+    {
+        int16x4_t v[8];
+        for( int n=0;n<8;n++ ) v[n] = h ? vget_high_s16( in[n] ) : vget_low_s16( in[n] );
+
+        int32x4_t tmp3 = vmlal_n_s16( vmull_n_s16( v[2], FIX_0_541196100 + FIX_0_765366865 ), v[6], FIX_0_541196100 );
+        int32x4_t tmp2 = vmlal_n_s16( vmull_n_s16( v[2], FIX_0_541196100 ), v[6], FIX_0_541196100 - FIX_1_847759065 );
+        int32x4_t tmp0 = vshlq_n_s32( vaddl_s16( v[0], v[4] ), IDCT_CONST_BITS );
+        int32x4_t tmp1 = vshlq_n_s32( vsubl_s16( v[0], v[4] ), IDCT_CONST_BITS );
+
+        int32x4_t tmp10 = vaddq_s32( tmp0, tmp3 ), tmp13 = vsubq_s32( tmp0, tmp3 );
+        int32x4_t tmp11 = vaddq_s32( tmp1, tmp2 ), tmp12 = vsubq_s32( tmp1, tmp2 );
+
+        int32x4_t o0 = idctMac4( v[1], A - FIX_0_899976223, v[3], A - FIX_1_961570560,
+                                 v[5], A, v[7], FIX_0_298631336 - FIX_0_899976223 + A - FIX_1_961570560 );
+        int32x4_t o1 = idctMac4( v[1], A - FIX_0_390180644, v[3], A - FIX_2_562915447,
+                                 v[5], FIX_2_053119869 - FIX_2_562915447 + A - FIX_0_390180644, v[7], A );
+        int32x4_t o2 = idctMac4( v[1], A, v[3], FIX_3_072711026 - FIX_2_562915447 + A - FIX_1_961570560,
+                                 v[5], A - FIX_2_562915447, v[7], A - FIX_1_961570560 );
+        int32x4_t o3 = idctMac4( v[1], FIX_1_501321110 - FIX_0_899976223 + A - FIX_0_390180644, v[3], A,
+                                 v[5], A - FIX_0_390180644, v[7], A - FIX_0_899976223 );
+
+        int32x4_t * out = h ? hi : lo;
+        out[0] = vaddq_s32( tmp10, o3 );
+        out[7] = vsubq_s32( tmp10, o3 );
+        out[1] = vaddq_s32( tmp11, o2 );
+        out[6] = vsubq_s32( tmp11, o2 );
+        out[2] = vaddq_s32( tmp12, o1 );
+        out[5] = vsubq_s32( tmp12, o1 );
+        out[3] = vaddq_s32( tmp13, o0 );
+        out[4] = vsubq_s32( tmp13, o0 );
+    }
+}
+
+static inline void transpose8x8NEON( int16x8_t r[8] )
+{
+    int16x8x2_t t01 = vtrnq_s16( r[0], r[1] );
+    int16x8x2_t t23 = vtrnq_s16( r[2], r[3] );
+    int16x8x2_t t45 = vtrnq_s16( r[4], r[5] );
+    int16x8x2_t t67 = vtrnq_s16( r[6], r[7] );
+
+    int32x4x2_t u02 = vtrnq_s32( vreinterpretq_s32_s16( t01.val[0] ), vreinterpretq_s32_s16( t23.val[0] ) );
+    int32x4x2_t u13 = vtrnq_s32( vreinterpretq_s32_s16( t01.val[1] ), vreinterpretq_s32_s16( t23.val[1] ) );
+    int32x4x2_t u46 = vtrnq_s32( vreinterpretq_s32_s16( t45.val[0] ), vreinterpretq_s32_s16( t67.val[0] ) );
+    int32x4x2_t u57 = vtrnq_s32( vreinterpretq_s32_s16( t45.val[1] ), vreinterpretq_s32_s16( t67.val[1] ) );
+
+    r[0] = vcombine_s16( vget_low_s16( vreinterpretq_s16_s32( u02.val[0] ) ), vget_low_s16( vreinterpretq_s16_s32( u46.val[0] ) ) );
+    r[1] = vcombine_s16( vget_low_s16( vreinterpretq_s16_s32( u13.val[0] ) ), vget_low_s16( vreinterpretq_s16_s32( u57.val[0] ) ) );
+    r[2] = vcombine_s16( vget_low_s16( vreinterpretq_s16_s32( u02.val[1] ) ), vget_low_s16( vreinterpretq_s16_s32( u46.val[1] ) ) );
+    r[3] = vcombine_s16( vget_low_s16( vreinterpretq_s16_s32( u13.val[1] ) ), vget_low_s16( vreinterpretq_s16_s32( u57.val[1] ) ) );
+    r[4] = vcombine_s16( vget_high_s16( vreinterpretq_s16_s32( u02.val[0] ) ), vget_high_s16( vreinterpretq_s16_s32( u46.val[0] ) ) );
+    r[5] = vcombine_s16( vget_high_s16( vreinterpretq_s16_s32( u13.val[0] ) ), vget_high_s16( vreinterpretq_s16_s32( u57.val[0] ) ) );
+    r[6] = vcombine_s16( vget_high_s16( vreinterpretq_s16_s32( u02.val[1] ) ), vget_high_s16( vreinterpretq_s16_s32( u46.val[1] ) ) );
+    r[7] = vcombine_s16( vget_high_s16( vreinterpretq_s16_s32( u13.val[1] ) ), vget_high_s16( vreinterpretq_s16_s32( u57.val[1] ) ) );
+}
+
+static void idctBlockNEON( const short * in, unsigned char * out, int stride )
+{
+    int16x8_t r[8];
+    int32x4_t lo[8], hi[8];
+    for( int n=0;n<8;n++ ) r[n] = vld1q_s16( in + n * 8 );
+
+    idct8NEON( r, lo, hi );
+    for( int n=0;n<8;n++ )
+        r[n] = vcombine_s16( vrshrn_n_s32( lo[n], IDCT_CONST_BITS - IDCT_PASS1_BITS ), vrshrn_n_s32( hi[n], IDCT_CONST_BITS - IDCT_PASS1_BITS ) );
+
+    transpose8x8NEON( r );
+    idct8NEON( r, lo, hi );
+
+    // the final shift is wider than a narrowing shift allows
+    const int16x8_t c128 = vdupq_n_s16( 128 );
+    for( int n=0;n<8;n++ )
+        r[n] = vqaddq_s16( vcombine_s16( vqmovn_s32( vrshrq_n_s32( lo[n], IDCT_CONST_BITS + IDCT_PASS1_BITS + 3 ) ),
+                                         vqmovn_s32( vrshrq_n_s32( hi[n], IDCT_CONST_BITS + IDCT_PASS1_BITS + 3 ) ) ), c128 );
+
+    transpose8x8NEON( r );
+    for( int n=0;n<8;n++ ) vst1_u8( out + n * stride, vqmovun_s16( r[n] ) );
+}
+
+#endif // IMAGE_UTILS_NEON
+
+
+typedef void (*jpegIdctFn)( const short * in, unsigned char * out, int stride );
+
+static jpegIdctFn pickIdct()
+{
+    switch( getSimdLevel() )
+    {
+#if defined(IMAGE_UTILS_SSE2)
+        case simdSSE2:
+        case simdAVX2: return idctBlockSSE2;
+#endif
+#if defined(IMAGE_UTILS_NEON)
+        case simdNEON: return idctBlockNEON;
+#endif
+        default: break;
+    }
+
+    return idctBlockScalar;
+}
+
+
+// Header parsing
+//
+static bool parseDQT( struct jpegFrame & f, const unsigned char * p, int len )
+{
+    while( len > 0 )
+    {
+        int precision = p[0] >> 4;
+        int id = p[0] & 15;
+        int size = precision ? 129 : 65;
+        if( (id > 3) || (len < size) ) return false;
+
+        for( int k=0;k<64;k++ )
+            f.quant[id][s_zigzag[k]] = precision ? ((p[1 + k * 2] << 8) | p[2 + k * 2]) : p[1 + k];
+
+        p += size;
+        len -= size;
+    }
+
+    return true;
+}
+
+static bool parseDHT( struct jpegFrame & f, const unsigned char * p, int len )
+{
+    while( len > 17 )
+    {
+        int tableClass = p[0] >> 4;
+        int id = p[0] & 15;
+        if( (tableClass > 1) || (id > 3) ) return false;
+
+        int count = 0;
+        for( int i=0;i<16;i++ ) count += p[1 + i];
+        if( len < 17 + count ) return false;
+
+        if( !buildHuffman( tableClass ? f.ac[id] : f.dc[id], p + 1, p + 17, count ) ) return false;
+
+        p += 17 + count;
+        len -= 17 + count;
+    }
+
+    return len == 0;
+}
+
+static bool parseSOF( struct jpegFrame & f, const unsigned char * p, int len )
+{
+    if( (len < 6) || (p[0] != 8) ) return false;
+
+    f.height = (p[1] << 8) | p[2];
+    f.width = (p[3] << 8) | p[4];
+    f.components = p[5];
+
+    // grey or YCbCr, DNL (height 0) is not supported
+    if( (f.components != 1) && (f.components != 3) ) return false;
+    if( (f.width <= 0) || (f.height <= 0) || (len < 6 + f.components * 3) ) return false;
+
+    f.hMax = f.vMax = 1;
+    for( int c=0;c<f.components;c++ )
+    {
+        struct jpegComponent & comp = f.comp[c];
+        comp.id = p[6 + c * 3];
+        comp.h = p[7 + c * 3] >> 4;
+        comp.v = p[7 + c * 3] & 15;
+        comp.quant = p[8 + c * 3];
+        if( (comp.h < 1) || (comp.h > 4) || (comp.v < 1) || (comp.v > 4) || (comp.quant > 3) ) return false;
+
+        f.hMax = std::max( f.hMax, comp.h );
+        f.vMax = std::max( f.vMax, comp.v );
+    }
+
+    // a grey scan is not interleaved, one block per MCU whatever the sampling says
+    if( f.components == 1 )
+    {
+        f.comp[0].h = f.comp[0].v = 1;
+        f.hMax = f.vMax = 1;
+    }
+
+    f.mcusX = (f.width + 8 * f.hMax - 1) / (8 * f.hMax);
+    f.mcusY = (f.height + 8 * f.vMax - 1) / (8 * f.vMax);
+
+    return true;
+}
+
+static bool parseSOS( struct jpegFrame & f, const unsigned char * p, int len )
+{
+    // one scan holding every component, in frame order
+    if( (len < 1) || (p[0] != f.components) || (len < 4 + f.components * 2) ) return false;
+
+    for( int c=0;c<f.components;c++ )
+    {
+        if( p[1 + c * 2] != f.comp[c].id ) return false;
+        f.comp[c].dcTable = p[2 + c * 2] >> 4;
+        f.comp[c].acTable = p[2 + c * 2] & 15;
+        if( (f.comp[c].dcTable > 3) || (f.comp[c].acTable > 3) ) return false;
+    }
+
+    // spectral selection and approximation must be the sequential defaults
+    const unsigned char * s = p + 1 + f.components * 2;
+    if( (s[0] != 0) || (s[1] != 63) || (s[2] != 0) ) return false;
+
+    return true;
+}
+
+// the standard tables, built once
+//
+static const struct jpegHuffman & defaultHuffman( int n )
+{
+    static const std::vector<struct jpegHuffman> tables = []
+    {
+        std::vector<struct jpegHuffman> t( 4 );
+        buildHuffman( t[0], s_dcLumaBits, s_dcValues, 12 );
+        buildHuffman( t[1], s_dcChromaBits, s_dcValues, 12 );
+        buildHuffman( t[2], s_acLumaBits, s_acLumaValues, 162 );
+        buildHuffman( t[3], s_acChromaBits, s_acChromaValues, 162 );
+        return t;
+    }();
+
+    return tables[n];
+}
+
+static bool parseJPEG( const unsigned char * data, size_t length, struct jpegFrame & f )
+{
+    if( !data || (length < 4) || (data[0] != 0xFF) || (data[1] != 0xD8) ) return false;
+
+    f.width = f.height = f.components = 0;
+    f.restartInterval = 0;
+    for( int n=0;n<4;n++ ) f.dc[n].present = f.ac[n].present = false;
+
+    bool haveFrame = false;
+    const unsigned char * p = data + 2;
+    const unsigned char * end = data + length;
+
+    while( p + 4 <= end )
+    {
+        if( p[0] != 0xFF ) return false;
+
+        int marker = p[1];
+        if( marker == 0xFF ) { p++; continue; }
+        p += 2;
+
+        // markers without a length
+        if( (marker == 0x01) || ((marker >= 0xD0) && (marker <= 0xD8)) ) continue;
+        if( marker == 0xD9 ) return false;
+
+        int len = (p[0] << 8) | p[1];
+        if( (len < 2) || (p + len > end) ) return false;
+        const unsigned char * seg = p + 2;
+
+        switch( marker )
+        {
+            case 0xDB:
+                if( !parseDQT( f, seg, len - 2 ) ) return false;
+                break;
+
+            case 0xC4:
+                if( !parseDHT( f, seg, len - 2 ) ) return false;
+                break;
+
+            // baseline and extended sequential Huffman
+            case 0xC0:
+            case 0xC1:
+                if( !parseSOF( f, seg, len - 2 ) ) return false;
+                haveFrame = true;
+                break;
+
+            // progressive, lossless, hierarchical and arithmetic coding
+            case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+            case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+                return false;
+
+            case 0xDD:
+                if( len < 4 ) return false;
+                f.restartInterval = (seg[0] << 8) | seg[1];
+                break;
+
+            case 0xDA:
+                if( !haveFrame || !parseSOS( f, seg, len - 2 ) ) return false;
+
+                // UVC frames leave the Huffman tables out, use the standard ones
+                for( int c=0;c<f.components;c++ )
+                {
+                    struct jpegHuffman & dc = f.dc[f.comp[c].dcTable];
+                    struct jpegHuffman & ac = f.ac[f.comp[c].acTable];
+                    if( !dc.present ) dc = defaultHuffman( f.comp[c].dcTable ? 1 : 0 );
+                    if( !ac.present ) ac = defaultHuffman( f.comp[c].acTable ? 3 : 2 );
+                }
+
+                f.scan = p + len;
+                f.end = end;
+                return true;
+
+            // APPn, COM and the rest are skipped
+            default:
+                break;
+        }
+
+        p += len;
+    }
+
+    return false;
+}
+
+
+bool jpegReadInfo( const unsigned char * data, size_t length, struct jpegInfo & info )
+{
+    struct jpegFrame * f = new struct jpegFrame();
+    bool ok = parseJPEG( data, length, *f );
+
+    if( ok )
+    {
+        info.width = f->width;
+        info.height = f->height;
+        info.components = f->components;
+        info.hSamp = (f->components == 3) ? f->hMax / f->comp[1].h : 1;
+        info.vSamp = (f->components == 3) ? f->vMax / f->comp[1].v : 1;
+        info.restartInterval = f->restartInterval;
+    }
+
+    delete f;
+    return ok;
+}
+
+
+// Entropy decoding
+//
+
+// restart intervals of the scan, split at the RSTn markers
+//
+static void findSegments( const struct jpegFrame & f, std::vector<struct jpegSegment> & segments )
+{
+    int total = f.mcusX * f.mcusY;
+    int interval = (f.restartInterval > 0) ? f.restartInterval : total;
+
+    const unsigned char * p = f.scan;
+    const unsigned char * start = p;
+    int first = 0;
+
+    segments.clear();
+    while( first < total )
+    {
+        const unsigned char * ff = (const unsigned char *)memchr( p, 0xFF, f.end - p );
+        if( !ff || (ff + 1 >= f.end) )
+        {
+            segments.push_back( { start, f.end, first, std::min( first + interval, total ) } );
+            break;
+        }
+
+        int marker = ff[1];
+
+        // stuffed zero or fill byte
+        if( (marker == 0x00) || (marker == 0xFF) )
+        {
+            p = ff + 1;
+            continue;
+        }
+
+        segments.push_back( { start, ff, first, std::min( first + interval, total ) } );
+
+        // anything but a restart marker ends the scan
+        if( (marker < 0xD0) || (marker > 0xD7) || (f.restartInterval <= 0) ) break;
+
+        first += interval;
+        start = p = ff + 2;
+    }
+}
+
+static bool decodeSegment( const struct jpegFrame & f, const struct jpegSegment & s, jpegIdctFn idct )
+{
+    struct jpegBits b( s.start, s.end );
+    int pred[3] = { 0, 0, 0 };
+
+    alignas(16) short coef[64];
+
+    for( int m = s.firstMcu; m < s.lastMcu; m++ )
+    {
+        int mx = m % f.mcusX;
+        int my = m / f.mcusX;
+
+        for( int c=0;c<f.components;c++ )
+        {
+            const struct jpegComponent & comp = f.comp[c];
+            const unsigned short * q = f.quant[comp.quant];
+
+            for( int by=0;by<comp.v;by++ )
+            {
+                for( int bx=0;bx<comp.h;bx++ )
+                {
+                    memset( coef, 0, sizeof(coef) );
+
+                    int last;
+                    if( !decodeBlock( b, f.dc[comp.dcTable], f.ac[comp.acTable], q, pred[c], coef, last ) ) return false;
+
+                    unsigned char * out = comp.plane + (size_t)((my * comp.v + by) * 8) * comp.stride + (mx * comp.h + bx) * 8;
+
+                    // a flat block, the IDCT of the DC term alone
+                    if( last == 0 )
+                    {
+                        unsigned char v = dcSample( coef[0] );
+                        for( int r=0;r<8;r++ ) memset( out + r * comp.stride, v, 8 );
+                    }
+                    else idct( coef, out, comp.stride );
+                }
+            }
+        }
+    }
+
+    return !b.overrun();
+}
+
+// one sample per block, for the 1/8 scale planes, components past stored are read but not kept
+//
+static bool decodeSegmentDC( const struct jpegFrame & f, const struct jpegSegment & s, int stored )
+{
+    struct jpegBits b( s.start, s.end );
+    int pred[3] = { 0, 0, 0 };
+
+    for( int m = s.firstMcu; m < s.lastMcu; m++ )
+    {
+        int mx = m % f.mcusX;
+        int my = m / f.mcusX;
+
+        for( int c=0;c<f.components;c++ )
+        {
+            const struct jpegComponent & comp = f.comp[c];
+            int q = f.quant[comp.quant][0];
+
+            for( int by=0;by<comp.v;by++ )
+            {
+                for( int bx=0;bx<comp.h;bx++ )
+                {
+                    if( !decodeBlockDC( b, f.dc[comp.dcTable], f.ac[comp.acTable], pred[c] ) ) return false;
+
+                    if( c < stored )
+                        comp.plane[(size_t)(my * comp.v + by) * comp.stride + mx * comp.h + bx] = dcSample( pred[c] * q );
+                }
+            }
+        }
+    }
+
+    return !b.overrun();
+}
+
+// headers, component planes and every restart interval, the planes are kept per thread so a stream
+// of frames does not allocate, dcStored > 0 decodes that many components at 1/8 scale instead
+//
+static bool decodePlanes( const unsigned char * data, size_t length, struct jpegFrame & f, int dcStored = 0 )
+{
+    thread_local std::vector<unsigned char> planes[3];
+    thread_local std::vector<struct jpegSegment> segments;
+
+    if( !parseJPEG( data, length, f ) ) return false;
+
+    // chroma has to be a whole fraction of luma, 1 or 2 each way
+    if( f.components == 3 )
+    {
+        if( (f.comp[1].h != f.comp[2].h) || (f.comp[1].v != f.comp[2].v) ) return false;
+        if( (f.comp[0].h != f.hMax) || (f.comp[0].v != f.vMax) ) return false;
+
+        int hs = f.hMax / f.comp[1].h;
+        int vs = f.vMax / f.comp[1].v;
+        if( (f.hMax % f.comp[1].h) || (f.vMax % f.comp[1].v) || (hs > 2) || (vs > 2) ) return false;
+    }
+
+    for( int c=0;c<f.components;c++ )
+    {
+        struct jpegComponent & comp = f.comp[c];
+        int blockSize = dcStored ? 1 : 8;
+        comp.stride = f.mcusX * comp.h * blockSize;
+        comp.rows = f.mcusY * comp.v * blockSize;
+
+        // 16 spare bytes for the vector loads at the end of a row
+        planes[c].resize( (size_t)comp.stride * comp.rows + 16 );
+        comp.plane = planes[c].data();
+    }
+
+    findSegments( f, segments );
+    jpegIdctFn idct = pickIdct();
+
+    // restart intervals share nothing, so they decode in parallel
+    std::atomic<bool> ok( true );
+    int mcuBytes = f.hMax * f.vMax * 64 * 3;
+    int segmentBytes = mcuBytes * ((f.restartInterval > 0) ? f.restartInterval : f.mcusX * f.mcusY);
+
+    // a lambda does not capture a thread_local, the pool threads get the segments through a pointer
+    const struct jpegSegment * segs = segments.data();
+
+    runRowBands( segments.size(), segmentBytes, 1, [&]( int first, int last )
+    {
+        for( int s = first; s < last; s++ )
+        {
+            bool decoded = dcStored ? decodeSegmentDC( f, segs[s], dcStored ) : decodeSegment( f, segs[s], idct );
+            if( !decoded ) ok = false;
+        }
+    });
+
+    // a short frame leaves MCUs undecoded
+    if( segments.empty() || (segments.back().lastMcu < f.mcusX * f.mcusY) ) ok = false;
+
+    return ok;
+}
+
+
+// Output
+//
+
+// 3/4 of the nearer chroma row and 1/4 of the further one, for rows sharing a chroma row
+//
+static void blendRows( const unsigned char * nearRow, const unsigned char * farRow, int n, unsigned char * out )
+{
+    int i = 0;
+
+#if defined(IMAGE_UTILS_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16( 2 );
+
+    for( ;i+16<=n;i+=16 )
+    {
+        __m128i a = _mm_loadu_si128( (const __m128i *)(nearRow + i) );
+        __m128i b = _mm_loadu_si128( (const __m128i *)(farRow + i) );
+
+        __m128i alo = _mm_unpacklo_epi8( a, zero ), ahi = _mm_unpackhi_epi8( a, zero );
+        __m128i blo = _mm_unpacklo_epi8( b, zero ), bhi = _mm_unpackhi_epi8( b, zero );
+
+        __m128i lo = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( _mm_add_epi16( alo, alo ), alo ), _mm_add_epi16( blo, two ) ), 2 );
+        __m128i hi = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( _mm_add_epi16( ahi, ahi ), ahi ), _mm_add_epi16( bhi, two ) ), 2 );
+
+        _mm_storeu_si128( (__m128i *)(out + i), _mm_packus_epi16( lo, hi ) );
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    const uint8x8_t three = vdup_n_u8( 3 );
+
+    for( ;i+8<=n;i+=8 )
+    {
+        uint16x8_t s = vmlal_u8( vmovl_u8( vld1_u8( farRow + i ) ), vld1_u8( nearRow + i ), three );
+        vst1_u8( out + i, vrshrn_n_u16( s, 2 ) );
+    }
+#endif
+
+    for( ;i<n;i++ ) out[i] = (3 * nearRow[i] + farRow[i] + 2) >> 2;
+}
+
+// Y0 Cb Y1 Cr for the packed 4:2:2 kernels
+//
+static void packRow( const unsigned char * y, const unsigned char * cb, const unsigned char * cr, int pairs, unsigned char * out )
+{
+    int i = 0;
+
+#if defined(IMAGE_UTILS_SSE2)
+    for( ;i+8<=pairs;i+=8 )
+    {
+        __m128i yv = _mm_loadu_si128( (const __m128i *)(y + i * 2) );
+        __m128i c = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)(cb + i) ), _mm_loadl_epi64( (const __m128i *)(cr + i) ) );
+
+        _mm_storeu_si128( (__m128i *)(out + i * 4), _mm_unpacklo_epi8( yv, c ) );
+        _mm_storeu_si128( (__m128i *)(out + i * 4 + 16), _mm_unpackhi_epi8( yv, c ) );
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    for( ;i+8<=pairs;i+=8 )
+    {
+        uint8x8x2_t yy = vld2_u8( y + i * 2 );
+        uint8x8x4_t px = { { yy.val[0], vld1_u8( cb + i ), yy.val[1], vld1_u8( cr + i ) } };
+        vst4_u8( out + i * 4, px );
+    }
+#endif
+
+    for( ;i<pairs;i++ )
+    {
+        out[i * 4] = y[i * 2];
+        out[i * 4 + 1] = cb[i];
+        out[i * 4 + 2] = y[i * 2 + 1];
+        out[i * 4 + 3] = cr[i];
+    }
+}
+
+// the chroma samples of one output row, one per pixel pair, or one per pixel for full width chroma
+// when halved is nullptr
+//
+static const unsigned char * chromaRow( const struct jpegFrame & f, int c, int row, int pairs,
+                                        unsigned char * blended, unsigned char * halved )
+{
+    const struct jpegComponent & comp = f.comp[c];
+    int hs = f.hMax / comp.h;
+    int vs = f.vMax / comp.v;
+    int samples = (hs == 2) ? pairs : pairs * 2;
+
+    const unsigned char * line = comp.plane + (size_t)row * comp.stride;
+
+    if( vs == 2 )
+    {
+        int rows = (f.height + 1) / 2;
+        int nearRow = row >> 1;
+        int farRow = (row & 1) ? nearRow + 1 : nearRow - 1;
+        farRow = std::min( std::max( farRow, 0 ), rows - 1 );
+
+        blendRows( comp.plane + (size_t)nearRow * comp.stride, comp.plane + (size_t)farRow * comp.stride, samples, blended );
+        line = blended;
+    }
+
+    // full width chroma, average each pair
+    if( (hs == 1) && halved )
+    {
+        for( int i=0;i<pairs;i++ ) halved[i] = (line[i * 2] + line[i * 2 + 1] + 1) >> 1;
+        line = halved;
+    }
+
+    return line;
+}
+
+// one row of 4:4:4 or 4:4:0, every pixel converted with its own Cb and Cr
+//
+static void fullChromaRowToRGB( const unsigned char * y, const unsigned char * cb, const unsigned char * cr, int pixels,
+                                const struct yuvTables & t, bool grey, unsigned char * out )
+{
+    for( int i=0;i<pixels;i++, out+=3 )
+    {
+        int Y = t.y[y[i]];
+
+        out[0] = yuvSaturate( Y + t.c0[0][cb[i]] + t.c1[0][cr[i]] );
+        out[1] = grey ? out[0] : yuvSaturate( Y + t.c0[1][cb[i]] + t.c1[1][cr[i]] );
+        out[2] = grey ? out[0] : yuvSaturate( Y + t.c0[2][cb[i]] + t.c1[2][cr[i]] );
+    }
+}
+
+
+// the decoded planes to RGB24, f.width x f.height samples of the luma plane
+//
+// - 4:2:2 and 4:2:0 go through the packed 4:2:2 kernels, 4:4:4 and 4:4:0 keep their full width chroma
+//   and are converted a pixel at a time
+//
+static void planesToRGB( const struct jpegFrame & f, const struct imageView & dst, bool grayScale )
+{
+    struct yuvCoeffs k = yuvColorSpace<yuvMatrixBT601, yuvRangeFull>::coeffs( grayScale );
+    int pairs = (f.width + 1) / 2;
+    int chromaWidth = (f.components == 3) ? f.comp[1].stride : 0;
+
+    bool fullChroma = (f.components == 3) && (f.comp[1].h == f.hMax);
+    struct yuvTables t;
+    if( fullChroma ) buildYUVTables( k, t );
+
+    runRowBands( f.height, f.width * 3, 1, [&]( int first, int last )
+    {
+        thread_local std::vector<unsigned char> packed, blended[2], halved[2], neutral;
+        packed.resize( pairs * 4 + 16 );
+        for( int n=0;n<2;n++ )
+        {
+            blended[n].resize( std::max( chromaWidth, pairs ) + 16 );
+            halved[n].resize( pairs + 16 );
+        }
+        neutral.assign( pairs + 16, 128 );
+
+        for( int row = first; row < last; row++ )
+        {
+            const unsigned char * y = f.comp[0].plane + (size_t)row * f.comp[0].stride;
+
+            if( fullChroma )
+            {
+                fullChromaRowToRGB( y, chromaRow( f, 1, row, pairs, blended[0].data(), nullptr ), chromaRow( f, 2, row, pairs, blended[1].data(), nullptr ),
+                                    f.width, t, k.grey, dst.plane[0] + row * dst.stride[0] );
+                continue;
+            }
+
+            const unsigned char * cb = neutral.data();
+            const unsigned char * cr = neutral.data();
+
+            if( f.components == 3 )
+            {
+                cb = chromaRow( f, 1, row, pairs, blended[0].data(), halved[0].data() );
+                cr = chromaRow( f, 2, row, pairs, blended[1].data(), halved[1].data() );
+            }
+            packRow( y, cb, cr, pairs, packed.data() );
+
+            unsigned char * out = dst.plane[0] + row * dst.stride[0];
+            convertPacked422( packed.data(), out, f.width & ~1, k );
+
+            // odd width, the last pixel still has both chroma samples
+            if( f.width & 1 )
+            {
+                unsigned char last[6];
+                convertPacked422( packed.data() + (f.width & ~1) * 2, last, 2, k );
+                memcpy( out + (f.width - 1) * 3, last, 3 );
+            }
+        }
+    });
+}
+
+
+bool decodeJPEG( const unsigned char * data, size_t length, const struct imageView & dst, bool grayScale )
+{
+    struct jpegFrame * pf = new struct jpegFrame();
+    struct jpegFrame & f = *pf;
+
+    bool ok = decodePlanes( data, length, f );
+    bool fits = f.comp[0].plane && dst.plane[0] && (dst.width >= f.width) && (dst.height >= f.height) && (std::abs( dst.stride[0] ) >= f.width * 3);
+
+    if( fits ) planesToRGB( f, dst, grayScale );
+
+    delete pf;
+    return ok && fits;
+}
+
+
+bool decodeJPEGThumbnail( const unsigned char * data, size_t length, const struct imageView & dst, bool grayScale )
+{
+    struct jpegFrame * pf = new struct jpegFrame();
+    struct jpegFrame & f = *pf;
+
+    // one byte per pixel is luma only, the chroma blocks are still read past
+    bool luma = (dst.step[0] == 1);
+    bool ok = decodePlanes( data, length, f, luma ? 1 : 3 );
+
+    // one sample per 8x8 block of the frame
+    f.width = (f.width + 7) / 8;
+    f.height = (f.height + 7) / 8;
+
+    bool fits = f.comp[0].plane && dst.plane[0] && (dst.width >= f.width) && (dst.height >= f.height) &&
+                (std::abs( dst.stride[0] ) >= f.width * dst.step[0]);
+
+    if( fits && luma )
+    {
+        for( int row=0;row<f.height;row++ )
+            memcpy( dst.plane[0] + row * dst.stride[0], f.comp[0].plane + (size_t)row * f.comp[0].stride, f.width );
+    }
+    else if( fits ) planesToRGB( f, dst, grayScale );
+
+    delete pf;
+    return ok && fits;
+}
+
+
+bool decodeJPEGToYUV420( const unsigned char * data, size_t length, const struct imageView & dst )
+{
+    struct jpegFrame * pf = new struct jpegFrame();
+    struct jpegFrame & f = *pf;
+
+    bool ok = decodePlanes( data, length, f );
+    bool fits = f.comp[0].plane && dst.plane[0] && dst.plane[1] && dst.plane[2] && (dst.width >= f.width) && (dst.height >= f.height);
+
+    if( !fits )
+    {
+        delete pf;
+        return false;
+    }
+
+    // luma as it is
+    runRowBands( f.height, f.width, 1, [&]( int first, int last )
+    {
+        for( int row = first; row < last; row++ )
+        {
+            const unsigned char * in = f.comp[0].plane + (size_t)row * f.comp[0].stride;
+            unsigned char * out = dst.plane[0] + row * dst.stride[0];
+
+            if( dst.step[0] == 1 ) memcpy( out, in, f.width );
+            else for( int x=0;x<f.width;x++ ) out[x * dst.step[0]] = in[x];
+        }
+    });
+
+    // chroma brought to one sample per 2x2 pixels, averaging where the frame has more
+    int chromaWidth = (f.width + 1) / 2;
+    int chromaHeight = (f.height + 1) / 2;
+
+    runRowBands( chromaHeight, chromaWidth * 2, 1, [&]( int first, int last )
+    {
+        for( int row = first; row < last; row++ )
+        {
+            for( int p=1;p<3;p++ )
+            {
+                unsigned char * out = dst.plane[p] + row * dst.stride[p];
+                int step = dst.step[p];
+
+                if( f.components != 3 )
+                {
+                    for( int x=0;x<chromaWidth;x++ ) out[x * step] = 128;
+                    continue;
+                }
+
+                const struct jpegComponent & comp = f.comp[p];
+                int hs = f.hMax / comp.h;
+                int vs = f.vMax / comp.v;
+
+                // rows of the component that make up this chroma row
+                int r0 = (vs == 2) ? row : row * 2;
+                int r1 = (vs == 2) ? row : std::min( row * 2 + 1, f.height - 1 );
+                const unsigned char * a = comp.plane + (size_t)r0 * comp.stride;
+                const unsigned char * b = comp.plane + (size_t)r1 * comp.stride;
+
+                if( hs == 2 )
+                {
+                    int x = 0;
+#if defined(IMAGE_UTILS_SSE2)
+                    if( step == 1 )
+                        for( ;x+16<=chromaWidth;x+=16 )
+                            _mm_storeu_si128( (__m128i *)(out + x), _mm_avg_epu8( _mm_loadu_si128( (const __m128i *)(a + x) ),
+                                                                                   _mm_loadu_si128( (const __m128i *)(b + x) ) ) );
+#endif
+                    for( ;x<chromaWidth;x++ ) out[x * step] = (a[x] + b[x] + 1) >> 1;
+                } else {
+                    for( int x=0;x<chromaWidth;x++ )
+                        out[x * step] = (a[x * 2] + a[x * 2 + 1] + b[x * 2] + b[x * 2 + 1] + 2) >> 2;
+                }
+            }
+        }
+    });
+
+    delete pf;
+    return ok;
+}
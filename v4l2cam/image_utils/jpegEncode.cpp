@@ -0,0 +1,986 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "image_utils.h"
+#include "jpegTables.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define IMAGE_UTILS_SSE2
+#endif
+
+#if defined(__aarch64__) && defined(IMAGE_UTILS_ENABLE_NEON)
+#include <arm_neon.h>
+#define IMAGE_UTILS_NEON
+#endif
+
+// Baseline JPEG encoder for snapshots of uncompressed frames
+//
+// - the Y, U and V samples are read straight from the camera layout, 4:2:2 frames are written as
+//   4:2:2 and 4:2:0 frames as 4:2:0, so chroma is never resampled and there is no RGB step
+// - a band of MCU rows at a time is gathered into planar rows, then each 8x8 block goes through
+//   the libjpeg integer forward DCT (islow) and is quantized with libjpeg's rounding
+// - limited range frames are stretched to the full range JFIF expects inside the quantizer, the
+//   DCT is linear so it is a scale on every coefficient and an offset on the luma DC
+// - the standard Huffman tables are used, restart intervals are encoded in parallel on the
+//   conversion threads and joined with the RSTn markers
+//
+
+// the standard quantization tables (JPEG Annex K.1), natural order, scaled by the quality
+//
+static const unsigned char s_lumaQuant[64] =
+{
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99
+};
+
+static const unsigned char s_chromaQuant[64] =
+{
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Huffman code and length of each symbol
+//
+struct jpegHuffCode
+{
+    unsigned short code[256];
+    unsigned char size[256];
+};
+
+// everything a frame needs, built once per call
+//
+struct jpegEncoder
+{
+    int width;
+    int height;
+    int components;
+    int hMax;
+    int vMax;
+    int mcusX;
+    int mcusY;
+    int restartRows;
+
+    unsigned char quant[2][64];             // natural order, as written to DQT
+
+    // quantizer per table, natural order: |c * scale + offset| + half, truncated, with the sign put back
+    alignas(16) float scale[2][64];
+    alignas(16) float offset[2][64];
+    alignas(16) float half[2][64];
+
+    struct jpegHuffCode dc[2];
+    struct jpegHuffCode ac[2];
+};
+
+
+static void buildHuffCodes( struct jpegHuffCode & h, const unsigned char bits[16], const unsigned char * values )
+{
+    memset( &h, 0, sizeof(h) );
+
+    // canonical codes, JPEG Annex C
+    int code = 0;
+    int k = 0;
+    for( int len=1;len<=16;len++ )
+    {
+        for( int i=0;i<bits[len - 1];i++ )
+        {
+            h.code[values[k]] = (unsigned short)code;
+            h.size[values[k]] = (unsigned char)len;
+            code++;
+            k++;
+        }
+        code <<= 1;
+    }
+}
+
+static void buildQuantizer( struct jpegEncoder & e, int quality, enum yuvRange range )
+{
+    // libjpeg's quality scaling, 50 gives the tables as they are
+    quality = std::clamp( quality, 1, 100 );
+    int percent = (quality < 50) ? 5000 / quality : 200 - quality * 2;
+
+    for( int t=0;t<2;t++ )
+    {
+        const unsigned char * base = t ? s_chromaQuant : s_lumaQuant;
+
+        // limited range is stretched to full range, 16..235 for luma and 16..240 for chroma
+        bool limited = (range == yuvRangeLimited);
+        float stretch = limited ? (t ? 255.0f / 224.0f : 255.0f / 219.0f) : 1.0f;
+
+        for( int i=0;i<64;i++ )
+        {
+            int q = std::clamp( (base[i] * percent + 50) / 100, 1, 255 );
+            e.quant[t][i] = (unsigned char)q;
+
+            // the DCT output is 8x the coefficient, adding half a step and 0.5 then truncating gives
+            // libjpeg's round half away from zero for whole numbers
+            float divisor = q * 8.0f;
+            e.scale[t][i] = stretch / divisor;
+            e.offset[t][i] = 0.0f;
+            e.half[t][i] = (divisor * 0.5f + 0.5f) / divisor;
+        }
+
+        // the luma DC also moves, (Y - 16) * stretch - 128 = (Y - 128) * stretch + 112 * stretch - 128,
+        // times the 64 of a constant block in the DCT output
+        if( limited && (t == 0) ) e.offset[0][0] = (112.0f * stretch - 128.0f) * 64.0f / (e.quant[0][0] * 8.0f);
+    }
+}
+
+
+// Forward DCT, the libjpeg "islow" integer algorithm, rows then columns, the output is 8x the
+// coefficient
+//
+static void fdctBlockScalar( const unsigned char * in, int stride, short * out )
+{
+    int ws[64];
+
+    for( int r=0;r<8;r++, in+=stride )
+    {
+        int d[8];
+        for( int c=0;c<8;c++ ) d[c] = in[c] - 128;
+
+        int tmp0 = d[0] + d[7], tmp7 = d[0] - d[7];
+        int tmp1 = d[1] + d[6], tmp6 = d[1] - d[6];
+        int tmp2 = d[2] + d[5], tmp5 = d[2] - d[5];
+        int tmp3 = d[3] + d[4], tmp4 = d[3] - d[4];
+
+        int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+        int tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+
+        const int shift = IDCT_CONST_BITS - IDCT_PASS1_BITS;
+        const int round = 1 << (shift - 1);
+        int * w = ws + r * 8;
+
+        w[0] = (tmp10 + tmp11) * (1 << IDCT_PASS1_BITS);
+        w[4] = (tmp10 - tmp11) * (1 << IDCT_PASS1_BITS);
+
+        int z1 = (tmp12 + tmp13) * FIX_0_541196100;
+        w[2] = (z1 + tmp13 * FIX_0_765366865 + round) >> shift;
+        w[6] = (z1 - tmp12 * FIX_1_847759065 + round) >> shift;
+
+        z1 = tmp4 + tmp7;
+        int z2 = tmp5 + tmp6, z3 = tmp4 + tmp6, z4 = tmp5 + tmp7;
+        int z5 = (z3 + z4) * FIX_1_175875602;
+
+        tmp4 *= FIX_0_298631336;
+        tmp5 *= FIX_2_053119869;
+        tmp6 *= FIX_3_072711026;
+        tmp7 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 = z3 * -FIX_1_961570560 + z5;
+        z4 = z4 * -FIX_0_390180644 + z5;
+
+        w[7] = (tmp4 + z1 + z3 + round) >> shift;
+        w[5] = (tmp5 + z2 + z4 + round) >> shift;
+        w[3] = (tmp6 + z2 + z3 + round) >> shift;
+        w[1] = (tmp7 + z1 + z4 + round) >> shift;
+    }
+
+    for( int c=0;c<8;c++ )
+    {
+        const int * w = ws + c;
+
+        int tmp0 = w[0] + w[56], tmp7 = w[0] - w[56];
+        int tmp1 = w[8] + w[48], tmp6 = w[8] - w[48];
+        int tmp2 = w[16] + w[40], tmp5 = w[16] - w[40];
+        int tmp3 = w[24] + w[32], tmp4 = w[24] - w[32];
+
+        int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+        int tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+
+        const int shift = IDCT_CONST_BITS + IDCT_PASS1_BITS;
+        const int round = 1 << (shift - 1);
+
+        out[c] = (short)((tmp10 + tmp11 + (1 << (IDCT_PASS1_BITS - 1))) >> IDCT_PASS1_BITS);
+        out[c + 32] = (short)((tmp10 - tmp11 + (1 << (IDCT_PASS1_BITS - 1))) >> IDCT_PASS1_BITS);
+
+        int z1 = (tmp12 + tmp13) * FIX_0_541196100;
+        out[c + 16] = (short)((z1 + tmp13 * FIX_0_765366865 + round) >> shift);
+        out[c + 48] = (short)((z1 - tmp12 * FIX_1_847759065 + round) >> shift);
+
+        z1 = tmp4 + tmp7;
+        int z2 = tmp5 + tmp6, z3 = tmp4 + tmp6, z4 = tmp5 + tmp7;
+        int z5 = (z3 + z4) * FIX_1_175875602;
+
+        tmp4 *= FIX_0_298631336;
+        tmp5 *= FIX_2_053119869;
+        tmp6 *= FIX_3_072711026;
+        tmp7 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 = z3 * -FIX_1_961570560 + z5;
+        z4 = z4 * -FIX_0_390180644 + z5;
+
+        out[c + 56] = (short)((tmp4 + z1 + z3 + round) >> shift);
+        out[c + 40] = (short)((tmp5 + z2 + z4 + round) >> shift);
+        out[c + 24] = (short)((tmp6 + z2 + z3 + round) >> shift);
+        out[c + 8] = (short)((tmp7 + z1 + z4 + round) >> shift);
+    }
+}
+
+static void quantizeScalar( const short * coef, const float * scale, const float * offset, const float * half, short * out )
+{
+    for( int i=0;i<64;i++ )
+    {
+        float v = coef[i] * scale[i] + offset[i];
+        int q = (int)(std::abs( v ) + half[i]);
+        out[i] = (short)((v < 0) ? -q : q);
+    }
+}
+
+
+#if defined(IMAGE_UTILS_SSE2)
+
+static inline __m128i fdctPair( int a, int b )
+{
+    return _mm_set1_epi32( (b << 16) | (a & 0xFFFF) );
+}
+
+// one 1-D pass over 8 vectors of 8 lanes, every output in 32 bits at 13 bit scale (the even
+// outputs too, so every one descales the same way), the odd part with the shared terms multiplied out
+//
+static inline void fdct8SSE2( const __m128i in[8], __m128i lo[8], __m128i hi[8] )
+{
+    const int A = FIX_1_175875602;
+
+    __m128i tmp0 = _mm_add_epi16( in[0], in[7] ), tmp7 = _mm_sub_epi16( in[0], in[7] );
+    __m128i tmp1 = _mm_add_epi16( in[1], in[6] ), tmp6 = _mm_sub_epi16( in[1], in[6] );
+    __m128i tmp2 = _mm_add_epi16( in[2], in[5] ), tmp5 = _mm_sub_epi16( in[2], in[5] );
+    __m128i tmp3 = _mm_add_epi16( in[3], in[4] ), tmp4 = _mm_sub_epi16( in[3], in[4] );
+
+    __m128i tmp10 = _mm_add_epi16( tmp0, tmp3 ), tmp13 = _mm_sub_epi16( tmp0, tmp3 );
+    __m128i tmp11 = _mm_add_epi16( tmp1, tmp2 ), tmp12 = _mm_sub_epi16( tmp1, tmp2 );
+
+    const __m128i kSum = fdctPair( 1 << IDCT_CONST_BITS, 1 << IDCT_CONST_BITS );
+    const __m128i kDiff = fdctPair( 1 << IDCT_CONST_BITS, -(1 << IDCT_CONST_BITS) );
+    const __m128i k2 = fdctPair( FIX_0_541196100 + FIX_0_765366865, FIX_0_541196100 );
+    const __m128i k6 = fdctPair( FIX_0_541196100, FIX_0_541196100 - FIX_1_847759065 );
+
+    const __m128i k7a = fdctPair( FIX_0_298631336 - FIX_0_899976223 - FIX_1_961570560 + A, A );
+    const __m128i k7b = fdctPair( A - FIX_1_961570560, A - FIX_0_899976223 );
+    const __m128i k5a = fdctPair( A, FIX_2_053119869 - FIX_2_562915447 - FIX_0_390180644 + A );
+    const __m128i k5b = fdctPair( A - FIX_2_562915447, A - FIX_0_390180644 );
+    const __m128i k3a = fdctPair( A - FIX_1_961570560, A - FIX_2_562915447 );
+    const __m128i k3b = fdctPair( FIX_3_072711026 - FIX_2_562915447 - FIX_1_961570560 + A, A );
+    const __m128i k1a = fdctPair( A - FIX_0_899976223, A - FIX_0_390180644 );
+    const __m128i k1b = fdctPair( A, FIX_1_501321110 - FIX_0_899976223 - FIX_0_390180644 + A );
+
+    for( int h=0;h<2;h++ )
+    {
+        __m128i p1011 = h ? _mm_unpackhi_epi16( tmp10, tmp11 ) : _mm_unpacklo_epi16( tmp10, tmp11 );
+        __m128i p1312 = h ? _mm_unpackhi_epi16( tmp13, tmp12 ) : _mm_unpacklo_epi16( tmp13, tmp12 );
+        __m128i p45 = h ? _mm_unpackhi_epi16( tmp4, tmp5 ) : _mm_unpacklo_epi16( tmp4, tmp5 );
+        __m128i p67 = h ? _mm_unpackhi_epi16( tmp6, tmp7 ) : _mm_unpacklo_epi16( tmp6, tmp7 );
+
+        __m128i * out = h ? hi : lo;
+        out[0] = _mm_madd_epi16( p1011, kSum );
+        out[4] = _mm_madd_epi16( p1011, kDiff );
+        out[2] = _mm_madd_epi16( p1312, k2 );
+        out[6] = _mm_madd_epi16( p1312, k6 );
+        out[7] = _mm_add_epi32( _mm_madd_epi16( p45, k7a ), _mm_madd_epi16( p67, k7b ) );
+        out[5] = _mm_add_epi32( _mm_madd_epi16( p45, k5a ), _mm_madd_epi16( p67, k5b ) );
+        out[3] = _mm_add_epi32( _mm_madd_epi16( p45, k3a ), _mm_madd_epi16( p67, k3b ) );
+        out[1] = _mm_add_epi32( _mm_madd_epi16( p45, k1a ), _mm_madd_epi16( p67, k1b ) );
+    }
+}
+
+static inline void transposeFdctSSE2( __m128i r[8] )
+{
+    __m128i a0 = _mm_unpacklo_epi16( r[0], r[1] ), a1 = _mm_unpackhi_epi16( r[0], r[1] );
+    __m128i a2 = _mm_unpacklo_epi16( r[2], r[3] ), a3 = _mm_unpackhi_epi16( r[2], r[3] );
+    __m128i a4 = _mm_unpacklo_epi16( r[4], r[5] ), a5 = _mm_unpackhi_epi16( r[4], r[5] );
+    __m128i a6 = _mm_unpacklo_epi16( r[6], r[7] ), a7 = _mm_unpackhi_epi16( r[6], r[7] );
+
+    __m128i b0 = _mm_unpacklo_epi32( a0, a2 ), b1 = _mm_unpackhi_epi32( a0, a2 );
+    __m128i b2 = _mm_unpacklo_epi32( a1, a3 ), b3 = _mm_unpackhi_epi32( a1, a3 );
+    __m128i b4 = _mm_unpacklo_epi32( a4, a6 ), b5 = _mm_unpackhi_epi32( a4, a6 );
+    __m128i b6 = _mm_unpacklo_epi32( a5, a7 ), b7 = _mm_unpackhi_epi32( a5, a7 );
+
+    r[0] = _mm_unpacklo_epi64( b0, b4 ); r[1] = _mm_unpackhi_epi64( b0, b4 );
+    r[2] = _mm_unpacklo_epi64( b1, b5 ); r[3] = _mm_unpackhi_epi64( b1, b5 );
+    r[4] = _mm_unpacklo_epi64( b2, b6 ); r[5] = _mm_unpackhi_epi64( b2, b6 );
+    r[6] = _mm_unpacklo_epi64( b3, b7 ); r[7] = _mm_unpackhi_epi64( b3, b7 );
+}
+
+// rows first as libjpeg does, so the lanes start out as rows, the same bytes as the scalar code
+//
+static void fdctBlockSSE2( const unsigned char * in, int stride, short * out )
+{
+    __m128i r[8], lo[8], hi[8];
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c128 = _mm_set1_epi16( 128 );
+    for( int n=0;n<8;n++ )
+        r[n] = _mm_sub_epi16( _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)(in + n * stride) ), zero ), c128 );
+
+    transposeFdctSSE2( r );
+    fdct8SSE2( r, lo, hi );
+
+    const int shift1 = IDCT_CONST_BITS - IDCT_PASS1_BITS;
+    const __m128i round1 = _mm_set1_epi32( 1 << (shift1 - 1) );
+    for( int n=0;n<8;n++ )
+        r[n] = _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( lo[n], round1 ), shift1 ),
+                                _mm_srai_epi32( _mm_add_epi32( hi[n], round1 ), shift1 ) );
+
+    transposeFdctSSE2( r );
+    fdct8SSE2( r, lo, hi );
+
+    const int shift2 = IDCT_CONST_BITS + IDCT_PASS1_BITS;
+    const __m128i round2 = _mm_set1_epi32( 1 << (shift2 - 1) );
+    for( int n=0;n<8;n++ )
+        _mm_store_si128( (__m128i *)(out + n * 8), _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( lo[n], round2 ), shift2 ),
+                                                                    _mm_srai_epi32( _mm_add_epi32( hi[n], round2 ), shift2 ) ) );
+}
+
+static void quantizeSSE2( const short * coef, const float * scale, const float * offset, const float * half, short * out )
+{
+    const __m128 signBit = _mm_set1_ps( -0.0f );
+
+    for( int i=0;i<64;i+=8 )
+    {
+        __m128i c = _mm_load_si128( (const __m128i *)(coef + i) );
+        __m128i q[2];
+
+        for( int h=0;h<2;h++ )
+        {
+            // sign extend four coefficients to 32 bits
+            __m128i c32 = _mm_srai_epi32( h ? _mm_unpackhi_epi16( c, c ) : _mm_unpacklo_epi16( c, c ), 16 );
+            __m128 v = _mm_add_ps( _mm_mul_ps( _mm_cvtepi32_ps( c32 ), _mm_load_ps( scale + i + h * 4 ) ), _mm_load_ps( offset + i + h * 4 ) );
+
+            __m128i sign = _mm_srai_epi32( _mm_castps_si128( v ), 31 );
+            __m128i m = _mm_cvttps_epi32( _mm_add_ps( _mm_andnot_ps( signBit, v ), _mm_load_ps( half + i + h * 4 ) ) );
+            q[h] = _mm_sub_epi32( _mm_xor_si128( m, sign ), sign );
+        }
+
+        _mm_store_si128( (__m128i *)(out + i), _mm_packs_epi32( q[0], q[1] ) );
+    }
+}
+
+#endif // IMAGE_UTILS_SSE2
+
+
+#if defined(IMAGE_UTILS_NEON)
+
+static inline int32x4_t fdctMac2( int16x4_t a, int ka, int16x4_t b, int kb )
+{
+    return vmlal_n_s16( vmull_n_s16( a, ka ), b, kb );
+}
+
+// same arithmetic as the SSE2 pass, four lanes at a time
+//
+static inline void fdct8NEON( const int16x8_t in[8], int32x4_t lo[8], int32x4_t hi[8] )
+{
+    const int A = FIX_1_175875602;
+
+    int16x8_t tmp0 = vaddq_s16( in[0], in[7] ), tmp7 = vsubq_s16( in[0], in[7] );
+    int16x8_t tmp1 = vaddq_s16( in[1], in[6] ), tmp6 = vsubq_s16( in[1], in[6] );
+    int16x8_t tmp2 = vaddq_s16( in[2], in[5] ), tmp5 = vsubq_s16( in[2], in[5] );
+    int16x8_t tmp3 = vaddq_s16( in[3], in[4] ), tmp4 = vsubq_s16( in[3], in[4] );
+
+    int16x8_t tmp10 = vaddq_s16( tmp0, tmp3 ), tmp13 = vsubq_s16( tmp0, tmp3 );
+    int16x8_t tmp11 = vaddq_s16( tmp1, tmp2 ), tmp12 = vsubq_s16( tmp1, tmp2 );
+
+    for( int h=0;h<2;h++ )
+    {
+        int16x4_t t10 = h ? vget_high_s16( tmp10 ) : vget_low_s16( tmp10 );
+        int16x4_t t11 = h ? vget_high_s16( tmp11 ) : vget_low_s16( tmp11 );
+        int16x4_t t12 = h ? vget_high_s16( tmp12 ) : vget_low_s16( tmp12 );
+        int16x4_t t13 = h ? vget_high_s16( tmp13 ) : vget_low_s16( tmp13 );
+        int16x4_t t4 = h ? vget_high_s16( tmp4 ) : vget_low_s16( tmp4 );
+        int16x4_t t5 = h ? vget_high_s16( tmp5 ) : vget_low_s16( tmp5 );
+        int16x4_t t6 = h ? vget_high_s16( tmp6 ) : vget_low_s16( tmp6 );
+        int16x4_t t7 = h ? vget_high_s16( tmp7 ) : vget_low_s16( tmp7 );
+
+        int32x4_t * out = h ? hi : lo;
+        out[0] = vshlq_n_s32( vaddl_s16( t10, t11 ), IDCT_CONST_BITS );
+        out[4] = vshlq_n_s32( vsubl_s16( t10, t11 ), IDCT_CONST_BITS );
+        out[2] = fdctMac2( t13, FIX_0_541196100 + FIX_0_765366865, t12, FIX_0_541196100 );
+        out[6] = fdctMac2( t13, FIX_0_541196100, t12, FIX_0_541196100 - FIX_1_847759065 );
+        out[7] = vaddq_s32( fdctMac2( t4, FIX_0_298631336 - FIX_0_899976223 - FIX_1_961570560 + A, t5, A ),
+                            fdctMac2( t6, A - FIX_1_961570560, t7, A - FIX_0_899976223 ) );
+        out[5] = vaddq_s32( fdctMac2( t4, A, t5, FIX_2_053119869 - FIX_2_562915447 - FIX_0_390180644 + A ),
+                            fdctMac2( t6, A - FIX_2_562915447, t7, A - FIX_0_390180644 ) );
+        out[3] = vaddq_s32( fdctMac2( t4, A - FIX_1_961570560, t5, A - FIX_2_562915447 ),
+                            fdctMac2( t6, FIX_3_072711026 - FIX_2_562915447 - FIX_1_961570560 + A, t7, A ) );
+        out[1] = vaddq_s32( fdctMac2( t4, A - FIX_0_899976223, t5, A - FIX_0_390180644 ),
+                            fdctMac2( t6, A, t7, FIX_1_501321110 - FIX_0_899976223 - FIX_0_390180644 + A ) );
+    }
+}
+
+static inline void transposeFdctNEON( int16x8_t r[8] )
+{
+    int16x8x2_t t01 = vtrnq_s16( r[0], r[1] );
+    int16x8x2_t t23 = vtrnq_s16( r[2], r[3] );
+    int16x8x2_t t45 = vtrnq_s16( r[4], r[5] );
+    int16x8x2_t t67 = vtrnq_s16( r[6], r[7] );
+
+    int32x4x2_t u02 = vtrnq_s32( vreinterpretq_s32_s16( t01.val[0] ), vreinterpretq_s32_s16( t23.val[0] ) );
+    int32x4x2_t u13 = vtrnq_s32( vreinterpretq_s32_s16( t01.val[1] ), vreinterpretq_s32_s16( t23.val[1] ) );
+    int32x4x2_t u46 = vtrnq_s32( vreinterpretq_s32_s16( t45.val[0] ), vreinterpretq_s32_s16( t67.val[0] ) );
+    int32x4x2_t u57 = vtrnq_s32( vreinterpretq_s32_s16( t45.val[1] ), vreinterpretq_s32_s16( t67.val[1] ) );
+
+    r[0] = vcombine_s16( vget_low_s16( vreinterpretq_s16_s32( u02.val[0] ) ), vget_low_s16( vreinterpretq_s16_s32( u46.val[0] ) ) );
+    r[1] = vcombine_s16( vget_low_s16( vreinterpretq_s16_s32( u13.val[0] ) ), vget_low_s16( vreinterpretq_s16_s32( u57.val[0] ) ) );
+    r[2] = vcombine_s16( vget_low_s16( vreinterpretq_s16_s32( u02.val[1] ) ), vget_low_s16( vreinterpretq_s16_s32( u46.val[1] ) ) );
+    r[3] = vcombine_s16( vget_low_s16( vreinterpretq_s16_s32( u13.val[1] ) ), vget_low_s16( vreinterpretq_s16_s32( u57.val[1] ) ) );
+    r[4] = vcombine_s16( vget_high_s16( vreinterpretq_s16_s32( u02.val[0] ) ), vget_high_s16( vreinterpretq_s16_s32( u46.val[0] ) ) );
+    r[5] = vcombine_s16( vget_high_s16( vreinterpretq_s16_s32( u13.val[0] ) ), vget_high_s16( vreinterpretq_s16_s32( u57.val[0] ) ) );
+    r[6] = vcombine_s16( vget_high_s16( vreinterpretq_s16_s32( u02.val[1] ) ), vget_high_s16( vreinterpretq_s16_s32( u46.val[1] ) ) );
+    r[7] = vcombine_s16( vget_high_s16( vreinterpretq_s16_s32( u13.val[1] ) ), vget_high_s16( vreinterpretq_s16_s32( u57.val[1] ) ) );
+}
+
+static void fdctBlockNEON( const unsigned char * in, int stride, short * out )
+{
+    int16x8_t r[8];
+    int32x4_t lo[8], hi[8];
+
+    for( int n=0;n<8;n++ )
+        r[n] = vsubq_s16( vreinterpretq_s16_u16( vmovl_u8( vld1_u8( in + n * stride ) ) ), vdupq_n_s16( 128 ) );
+
+    transposeFdctNEON( r );
+    fdct8NEON( r, lo, hi );
+    for( int n=0;n<8;n++ )
+        r[n] = vcombine_s16( vrshrn_n_s32( lo[n], IDCT_CONST_BITS - IDCT_PASS1_BITS ), vrshrn_n_s32( hi[n], IDCT_CONST_BITS - IDCT_PASS1_BITS ) );
+
+    transposeFdctNEON( r );
+    fdct8NEON( r, lo, hi );
+    for( int n=0;n<8;n++ )
+        vst1q_s16( out + n * 8, vcombine_s16( vqmovn_s32( vrshrq_n_s32( lo[n], IDCT_CONST_BITS + IDCT_PASS1_BITS ) ),
+                                              vqmovn_s32( vrshrq_n_s32( hi[n], IDCT_CONST_BITS + IDCT_PASS1_BITS ) ) ) );
+}
+
+static void quantizeNEON( const short * coef, const float * scale, const float * offset, const float * half, short * out )
+{
+    for( int i=0;i<64;i+=8 )
+    {
+        int16x8_t c = vld1q_s16( coef + i );
+        int32x4_t q[2];
+
+        for( int h=0;h<2;h++ )
+        {
+            int32x4_t c32 = vmovl_s16( h ? vget_high_s16( c ) : vget_low_s16( c ) );
+            float32x4_t v = vmlaq_f32( vld1q_f32( offset + i + h * 4 ), vcvtq_f32_s32( c32 ), vld1q_f32( scale + i + h * 4 ) );
+
+            int32x4_t m = vcvtq_s32_f32( vaddq_f32( vabsq_f32( v ), vld1q_f32( half + i + h * 4 ) ) );
+            q[h] = vbslq_s32( vcltq_f32( v, vdupq_n_f32( 0.0f ) ), vnegq_s32( m ), m );
+        }
+
+        vst1q_s16( out + i, vcombine_s16( vmovn_s32( q[0] ), vmovn_s32( q[1] ) ) );
+    }
+}
+
+#endif // IMAGE_UTILS_NEON
+
+
+typedef void (*jpegFdctFn)( const unsigned char * in, int stride, short * out );
+typedef void (*jpegQuantizeFn)( const short * coef, const float * scale, const float * offset, const float * half, short * out );
+
+static void pickKernels( jpegFdctFn & fdct, jpegQuantizeFn & quantize )
+{
+    fdct = fdctBlockScalar;
+    quantize = quantizeScalar;
+
+    switch( getSimdLevel() )
+    {
+#if defined(IMAGE_UTILS_SSE2)
+        case simdSSE2:
+        case simdAVX2:
+            fdct = fdctBlockSSE2;
+            quantize = quantizeSSE2;
+            break;
+#endif
+#if defined(IMAGE_UTILS_NEON)
+        case simdNEON:
+            fdct = fdctBlockNEON;
+            quantize = quantizeNEON;
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+
+// Entropy coding
+//
+
+// bits are collected in a 64 bit accumulator and go out 32 at a time, with a zero stuffed after
+// every 0xFF
+//
+struct jpegBitWriter
+{
+    std::vector<unsigned char> & out;
+    size_t pos;
+    uint64_t acc;
+    int bits;
+
+    jpegBitWriter( std::vector<unsigned char> & buffer ) : out( buffer ), pos( 0 ), acc( 0 ), bits( 0 ) {}
+
+    // room for one block at its worst, 64 codes of 27 bits, every byte stuffed
+    inline void reserve()
+    {
+        if( pos + 512 > out.size() ) out.resize( std::max( out.size() * 2, pos + 4096 ) );
+    }
+
+    inline void emit( unsigned int b )
+    {
+        out[pos++] = (unsigned char)b;
+        if( b == 0xFF ) out[pos++] = 0;
+    }
+
+    // n is at most 27 and fewer than 32 bits are waiting, so the accumulator never overflows
+    inline void put( unsigned int v, int n )
+    {
+        acc = (acc << n) | v;
+        bits += n;
+        if( bits < 32 ) return;
+
+        bits -= 32;
+        uint32_t w = (uint32_t)(acc >> bits);
+
+        if( !((~w - 0x01010101u) & w & 0x80808080u) )
+        {
+            out[pos] = (unsigned char)(w >> 24);
+            out[pos + 1] = (unsigned char)(w >> 16);
+            out[pos + 2] = (unsigned char)(w >> 8);
+            out[pos + 3] = (unsigned char)w;
+            pos += 4;
+        } else {
+            emit( w >> 24 );
+            emit( (w >> 16) & 0xFF );
+            emit( (w >> 8) & 0xFF );
+            emit( w & 0xFF );
+        }
+    }
+
+    // the last byte is padded with one bits
+    void flush()
+    {
+        reserve();
+        int pad = (8 - (bits & 7)) & 7;
+        acc = (acc << pad) | ((1u << pad) - 1);
+        bits += pad;
+
+        while( bits >= 8 )
+        {
+            bits -= 8;
+            emit( (acc >> bits) & 0xFF );
+        }
+        out.resize( pos );
+    }
+};
+
+// bits needed for a coefficient value, 0 for zero
+static inline int valueBits( int v )
+{
+    return v ? 32 - __builtin_clz( (unsigned int)std::abs( v ) ) : 0;
+}
+
+// the quantized block in natural order
+//
+static inline void encodeBlock( struct jpegBitWriter & w, const short * q, int & pred, const struct jpegHuffCode & dc, const struct jpegHuffCode & ac )
+{
+    alignas(16) short zz[64];
+    for( int k=0;k<64;k++ ) zz[k] = q[s_zigzag[k]];
+
+    // the AC coefficients that are not zero, one bit each in zigzag order
+    uint64_t nonZero = 0;
+#if defined(IMAGE_UTILS_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for( int k=0;k<64;k+=16 )
+    {
+        __m128i a = _mm_cmpeq_epi16( _mm_load_si128( (const __m128i *)(zz + k) ), zero );
+        __m128i b = _mm_cmpeq_epi16( _mm_load_si128( (const __m128i *)(zz + k + 8) ), zero );
+        nonZero |= (uint64_t)(~_mm_movemask_epi8( _mm_packs_epi16( a, b ) ) & 0xFFFF) << k;
+    }
+#else
+    for( int k=0;k<64;k++ )
+        if( zz[k] ) nonZero |= 1ULL << k;
+#endif
+    nonZero &= ~1ULL;
+
+    w.reserve();
+
+    int diff = zz[0] - pred;
+    pred = zz[0];
+    int n = valueBits( diff );
+    w.put( ((unsigned int)dc.code[n] << n) | ((diff < 0 ? diff - 1 : diff) & ((1 << n) - 1)), dc.size[n] + n );
+
+    int last = 0;
+    while( nonZero )
+    {
+        int k = __builtin_ctzll( nonZero );
+        nonZero &= nonZero - 1;
+
+        // runs of 16 zeros
+        int run = k - last - 1;
+        for( ;run>15;run-=16 ) w.put( ac.code[0xF0], ac.size[0xF0] );
+
+        int v = zz[k];
+        n = valueBits( v );
+        int symbol = (run << 4) | n;
+        w.put( ((unsigned int)ac.code[symbol] << n) | ((v < 0 ? v - 1 : v) & ((1 << n) - 1)), ac.size[symbol] + n );
+        last = k;
+    }
+
+    // end of block
+    if( last != 63 ) w.put( ac.code[0x00], ac.size[0x00] );
+}
+
+
+// Sample gathering
+//
+
+// n samples step bytes apart into a packed row, padded out to width with the last one (mid grey if none)
+//
+static void gatherRow( const unsigned char * src, int step, int n, unsigned char * dst, int width )
+{
+    int x = 0;
+
+    if( step == 1 )
+    {
+        memcpy( dst, src, n );
+        x = n;
+    }
+#if defined(IMAGE_UTILS_SSE2)
+    // the loads stop a whole vector short of the last sample, so they never read past the row
+    else if( step == 2 )
+    {
+        const __m128i mask = _mm_set1_epi16( 0x00FF );
+        for( ;x+16<n;x+=16 )
+        {
+            __m128i a = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(src + x * 2) ), mask );
+            __m128i b = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(src + x * 2 + 16) ), mask );
+            _mm_storeu_si128( (__m128i *)(dst + x), _mm_packus_epi16( a, b ) );
+        }
+    }
+    else if( step == 4 )
+    {
+        const __m128i mask = _mm_set1_epi32( 0x000000FF );
+        for( ;x+16<n;x+=16 )
+        {
+            __m128i a = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(src + x * 4) ), mask );
+            __m128i b = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(src + x * 4 + 16) ), mask );
+            __m128i c = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(src + x * 4 + 32) ), mask );
+            __m128i d = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(src + x * 4 + 48) ), mask );
+            _mm_storeu_si128( (__m128i *)(dst + x), _mm_packus_epi16( _mm_packs_epi32( a, b ), _mm_packs_epi32( c, d ) ) );
+        }
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    else if( step == 2 )
+    {
+        for( ;x+16<n;x+=16 ) vst1q_u8( dst + x, vld2q_u8( src + x * 2 ).val[0] );
+    }
+    else if( step == 4 )
+    {
+        for( ;x+16<n;x+=16 ) vst1q_u8( dst + x, vld4q_u8( src + x * 4 ).val[0] );
+    }
+#endif
+
+    for( ;x<n;x++ ) dst[x] = src[x * step];
+    if( n < width ) memset( dst + n, n ? dst[n - 1] : 128, width - n );
+}
+
+
+// One restart interval, a band of MCU rows
+//
+static void encodeSegment( const struct jpegEncoder & e, const struct imageView & src, int firstRow, int lastRow,
+                           std::vector<unsigned char> & out )
+{
+    // planar rows of one MCU row, luma padded to whole MCUs, chroma to whole blocks
+    thread_local std::vector<unsigned char> band[3];
+    thread_local std::vector<unsigned char> ws;
+
+    int lumaWidth = e.mcusX * e.hMax * 8;
+    int lumaRows = e.vMax * 8;
+    int chromaWidth = e.mcusX * 8;
+    // an odd packed 4:2:2 row lacks the last sample of one chroma plane, the padding repeats the one before
+    int chromaSamples[3] = { 0, chromaRowSamples( src, 1 ), chromaRowSamples( src, 2 ) };
+    int chromaHeight = (src.height + (1 << src.chromaRowShift) - 1) >> src.chromaRowShift;
+    int lumaBlocksX = (src.width + 7) / 8;
+    int lumaBlocksY = (src.height + 7) / 8;
+
+    band[0].resize( (size_t)lumaWidth * lumaRows );
+    if( e.components == 3 )
+    {
+        band[1].resize( (size_t)chromaWidth * 8 );
+        band[2].resize( (size_t)chromaWidth * 8 );
+    }
+
+    jpegFdctFn fdct;
+    jpegQuantizeFn quantize;
+    pickKernels( fdct, quantize );
+
+    alignas(16) short coef[64];
+    alignas(16) short q[64];
+    int pred[3] = { 0, 0, 0 };
+
+    out.clear();
+    struct jpegBitWriter w( out );
+
+    for( int mcuRow = firstRow; mcuRow < lastRow; mcuRow++ )
+    {
+        // the rows below the frame repeat its last row
+        int y0 = mcuRow * lumaRows;
+        for( int r=0;r<lumaRows;r++ )
+        {
+            int y = std::min( y0 + r, src.height - 1 );
+            gatherRow( src.plane[0] + (size_t)y * src.stride[0], src.step[0], src.width, band[0].data() + r * lumaWidth, lumaWidth );
+        }
+
+        if( e.components == 3 )
+        {
+            for( int p=1;p<3;p++ )
+            {
+                for( int r=0;r<8;r++ )
+                {
+                    int y = std::min( mcuRow * 8 + r, chromaHeight - 1 );
+                    gatherRow( src.plane[p] + (size_t)y * src.stride[p], src.step[p], chromaSamples[p], band[p].data() + r * chromaWidth, chromaWidth );
+                }
+            }
+        }
+
+        for( int mx=0;mx<e.mcusX;mx++ )
+        {
+            for( int c=0;c<e.components;c++ )
+            {
+                int t = c ? 1 : 0;
+                int blocksX = c ? 1 : e.hMax;
+                int blocksY = c ? 1 : e.vMax;
+                int width = c ? chromaWidth : lumaWidth;
+
+                for( int by=0;by<blocksY;by++ )
+                {
+                    for( int bx=0;bx<blocksX;bx++ )
+                    {
+                        // luma blocks wholly past the right or bottom edge repeat the previous DC
+                        // with no AC, as libjpeg writes them
+                        if( !c && ((mx * blocksX + bx >= lumaBlocksX) || (mcuRow * blocksY + by >= lumaBlocksY)) )
+                        {
+                            w.reserve();
+                            w.put( e.dc[0].code[0], e.dc[0].size[0] );
+                            w.put( e.ac[0].code[0], e.ac[0].size[0] );
+                            continue;
+                        }
+
+                        fdct( band[c].data() + (size_t)by * 8 * width + (mx * blocksX + bx) * 8, width, coef );
+                        quantize( coef, e.scale[t], e.offset[t], e.half[t], q );
+                        encodeBlock( w, q, pred[c], e.dc[t], e.ac[t] );
+                    }
+                }
+            }
+        }
+    }
+
+    w.flush();
+}
+
+
+// Headers
+//
+static void putMarker( std::vector<unsigned char> & out, int marker, int length )
+{
+    out.push_back( 0xFF );
+    out.push_back( (unsigned char)marker );
+    if( length > 0 )
+    {
+        out.push_back( (unsigned char)(length >> 8) );
+        out.push_back( (unsigned char)length );
+    }
+}
+
+static void putWord( std::vector<unsigned char> & out, int v )
+{
+    out.push_back( (unsigned char)(v >> 8) );
+    out.push_back( (unsigned char)v );
+}
+
+static void writeHeaders( const struct jpegEncoder & e, std::vector<unsigned char> & out )
+{
+    putMarker( out, 0xD8, 0 );
+
+    // JFIF 1.01, no thumbnail
+    static const unsigned char jfif[14] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    putMarker( out, 0xE0, 16 );
+    out.insert( out.end(), jfif, jfif + 14 );
+
+    // quantization tables in zigzag order
+    int tables = (e.components == 3) ? 2 : 1;
+    putMarker( out, 0xDB, 2 + 65 * tables );
+    for( int t=0;t<tables;t++ )
+    {
+        out.push_back( (unsigned char)t );
+        for( int k=0;k<64;k++ ) out.push_back( e.quant[t][s_zigzag[k]] );
+    }
+
+    // baseline frame
+    putMarker( out, 0xC0, 8 + 3 * e.components );
+    out.push_back( 8 );
+    putWord( out, e.height );
+    putWord( out, e.width );
+    out.push_back( (unsigned char)e.components );
+    for( int c=0;c<e.components;c++ )
+    {
+        out.push_back( (unsigned char)(c + 1) );
+        out.push_back( c ? 0x11 : (unsigned char)((e.hMax << 4) | e.vMax) );
+        out.push_back( c ? 1 : 0 );
+    }
+
+    // the standard Huffman tables
+    const unsigned char * bits[4] = { s_dcLumaBits, s_acLumaBits, s_dcChromaBits, s_acChromaBits };
+    const unsigned char * values[4] = { s_dcValues, s_acLumaValues, s_dcValues, s_acChromaValues };
+    const int classId[4] = { 0x00, 0x10, 0x01, 0x11 };
+
+    int length = 2;
+    for( int n=0;n<tables * 2;n++ )
+    {
+        int count = 0;
+        for( int i=0;i<16;i++ ) count += bits[n][i];
+        length += 17 + count;
+    }
+
+    putMarker( out, 0xC4, length );
+    for( int n=0;n<tables * 2;n++ )
+    {
+        int count = 0;
+        for( int i=0;i<16;i++ ) count += bits[n][i];
+
+        out.push_back( (unsigned char)classId[n] );
+        out.insert( out.end(), bits[n], bits[n] + 16 );
+        out.insert( out.end(), values[n], values[n] + count );
+    }
+
+    if( e.restartRows > 0 )
+    {
+        putMarker( out, 0xDD, 4 );
+        putWord( out, e.restartRows * e.mcusX );
+    }
+
+    // one interleaved scan
+    putMarker( out, 0xDA, 6 + 2 * e.components );
+    out.push_back( (unsigned char)e.components );
+    for( int c=0;c<e.components;c++ )
+    {
+        out.push_back( (unsigned char)(c + 1) );
+        out.push_back( c ? 0x11 : 0x00 );
+    }
+    out.push_back( 0 );
+    out.push_back( 63 );
+    out.push_back( 0 );
+}
+
+
+bool encodeJPEG( const struct imageView & src, std::vector<unsigned char> & out, int quality, enum yuvRange range, int restartRows )
+{
+    if( !src.plane[0] || (src.width <= 0) || (src.height <= 0) || (src.width > 65535) || (src.height > 65535) ) return false;
+
+    struct jpegEncoder * pe = new struct jpegEncoder();
+    struct jpegEncoder & e = *pe;
+
+    // 4:2:2 layouts stay 4:2:2 and 4:2:0 stay 4:2:0, grey formats have only luma
+    bool chroma = src.plane[1] && src.plane[2];
+    e.width = src.width;
+    e.height = src.height;
+    e.components = chroma ? 3 : 1;
+    e.hMax = chroma ? 2 : 1;
+    e.vMax = chroma ? (1 << src.chromaRowShift) : 1;
+    e.mcusX = (e.width + e.hMax * 8 - 1) / (e.hMax * 8);
+    e.mcusY = (e.height + e.vMax * 8 - 1) / (e.vMax * 8);
+
+    // the interval is counted in MCUs and has to fit in 16 bits
+    e.restartRows = std::clamp( restartRows, 0, e.mcusY );
+    if( e.restartRows * e.mcusX > 65535 ) e.restartRows = 65535 / e.mcusX;
+
+    buildQuantizer( e, quality, chroma ? range : yuvRangeFull );
+    buildHuffCodes( e.dc[0], s_dcLumaBits, s_dcValues );
+    buildHuffCodes( e.ac[0], s_acLumaBits, s_acLumaValues );
+    buildHuffCodes( e.dc[1], s_dcChromaBits, s_dcValues );
+    buildHuffCodes( e.ac[1], s_acChromaBits, s_acChromaValues );
+
+    // restart intervals share nothing, so they encode in parallel
+    int rowsPerSegment = (e.restartRows > 0) ? e.restartRows : e.mcusY;
+    int segments = (e.mcusY + rowsPerSegment - 1) / rowsPerSegment;
+    std::vector<std::vector<unsigned char>> parts( segments );
+
+    runRowBands( segments, rowsPerSegment * e.vMax * 8 * e.width * 2, 1, [&]( int first, int last )
+    {
+        for( int s = first; s < last; s++ )
+            encodeSegment( e, src, s * rowsPerSegment, std::min( (s + 1) * rowsPerSegment, e.mcusY ), parts[s] );
+    });
+
+    out.clear();
+    writeHeaders( e, out );
+    for( int s=0;s<segments;s++ )
+    {
+        out.insert( out.end(), parts[s].begin(), parts[s].end() );
+        if( s + 1 < segments ) putMarker( out, 0xD0 + (s & 7), 0 );
+    }
+    putMarker( out, 0xD9, 0 );
+
+    delete pe;
+    return true;
+}
+
+
+bool saveAsJPEG( const struct imageView & src, std::string fid, int quality, enum yuvRange range )
+{
+    std::vector<unsigned char> jpeg;
+    if( !encodeJPEG( src, jpeg, quality, range ) )
+    {
+        std::cerr << "[\x1b[1;31mwarning\x1b[0m] JPEG encoding failed" << std::endl;
+        return false;
+    }
+
+    if( fid.length() == 0 )
+    {
+        std::cout.write( (const char *)jpeg.data(), jpeg.size() );
+        std::cout.flush();
+
+        std::cerr << "[\x1b[1;33minfo\x1b[0m] Image output to STDOUT" << std::endl;
+        return true;
+    }
+
+    std::ofstream pFile( fid, std::ios::trunc | std::ios::binary );
+    if( !pFile.is_open() )
+    {
+#ifdef _WIN32
+        std::array<char, 256> errorBuffer;
+        strerror_s(errorBuffer.data(), errorBuffer.size(), errno);
+        std::cerr << "Failed to open output file : " << fid << " - " + std::string(errorBuffer.data()) << std::endl;
+#else
+        std::cerr << "[\x1b[1;31mwarning\x1b[0m] Failed to open file for writing : " << strerror(errno) << std::endl;
+#endif
+        return false;
+    }
+
+    pFile.write( (const char *)jpeg.data(), jpeg.size() );
+    pFile.close();
+    if( pFile.fail() )
+    {
+        std::cerr << "[\x1b[1;31mwarning\x1b[0m] Failed writing image to : " << fid << std::endl;
+        return false;
+    }
+
+    std::cerr << "[\x1b[1;33minfo\x1b[0m] Image saved to : " << fid << std::endl;
+    return true;
+}
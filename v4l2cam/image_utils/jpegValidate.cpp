@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "image_utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define IMAGE_UTILS_SSE2
+#endif
+
+#if defined(__aarch64__) && defined(IMAGE_UTILS_ENABLE_NEON)
+#include <arm_neon.h>
+#define IMAGE_UTILS_NEON
+#endif
+
+// MJPEG frame validation
+//
+// - the marker segments are walked from SOI, every length has to land on the next marker
+// - the entropy coded data is scanned 16 bytes at a time for 0xFF, only those bytes are looked at,
+//   stuffed zeros and fill bytes are stepped over, restart markers have to count RST0..RST7 in turn
+// - the frame is good once EOI is reached after a frame header and a scan, with the number of
+//   restart markers the frame size asks for
+//
+
+// next 0xFF at or after p, end if there is none
+//
+static const unsigned char * findFF( const unsigned char * p, const unsigned char * end )
+{
+#if defined(IMAGE_UTILS_SSE2)
+    if( getSimdLevel() != simdNone )
+    {
+        const __m128i ff = _mm_set1_epi8( (char)0xFF );
+        for( ;p+16<=end;p+=16 )
+        {
+            int mask = _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i *)p ), ff ) );
+            if( mask ) return p + __builtin_ctz( mask );
+        }
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    if( getSimdLevel() != simdNone )
+    {
+        for( ;p+16<=end;p+=16 )
+        {
+            uint8x16_t eq = vceqq_u8( vld1q_u8( p ), vdupq_n_u8( 0xFF ) );
+
+            // a nibble per byte, the first set one is the first 0xFF
+            uint64_t mask = vget_lane_u64( vreinterpret_u64_u8( vshrn_n_u16( vreinterpretq_u16_u8( eq ), 4 ) ), 0 );
+            if( mask ) return p + (__builtin_ctzll( mask ) >> 2);
+        }
+    }
+#endif
+
+    for( ;p<end;p++ )
+        if( *p == 0xFF ) return p;
+
+    return end;
+}
+
+static inline int readLength( const unsigned char * p ) { return (p[0] << 8) | p[1]; }
+
+
+enum jpegCheck jpegValidate( const unsigned char * data, size_t length )
+{
+    if( !data || (length < 4) || (data[0] != 0xFF) || (data[1] != 0xD8) ) return jpegCheckNoSOI;
+
+    const unsigned char * p = data + 2;
+    const unsigned char * end = data + length;
+
+    bool frameHeader = false;
+    bool scan = false;
+    int mcus = 0;
+    int restartInterval = 0;
+    int restarts = 0;
+
+    while( p < end )
+    {
+        // every segment starts with a marker, any number of 0xFF fill bytes may come first
+        if( *p != 0xFF ) return jpegCheckBadSegment;
+        while( (p < end) && (*p == 0xFF) ) p++;
+        if( p >= end ) break;
+
+        int marker = *p++;
+
+        if( marker == 0xD9 )
+        {
+            if( !frameHeader || !scan ) return jpegCheckNoScan;
+
+            // a restart marker goes between each interval, a lost USB packet usually takes one with it
+            if( (restartInterval > 0) && (restarts != (mcus + restartInterval - 1) / restartInterval - 1) ) return jpegCheckBadRestart;
+
+            return jpegCheckOk;
+        }
+
+        // markers without a length
+        if( (marker == 0x01) || ((marker >= 0xD0) && (marker <= 0xD7)) ) continue;
+        if( (marker == 0x00) || (marker == 0xD8) ) return jpegCheckBadSegment;
+
+        if( end - p < 2 ) return jpegCheckTruncated;
+        int len = readLength( p );
+        if( len < 2 ) return jpegCheckBadSegment;
+        if( end - p < len ) return jpegCheckTruncated;
+
+        // frame header, any SOFn, the MCU count is only needed for the restart markers
+        if( (marker >= 0xC0) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC) )
+        {
+            if( len < 8 ) return jpegCheckBadSegment;
+
+            int height = readLength( p + 3 );
+            int width = readLength( p + 5 );
+            int components = p[7];
+            if( (width == 0) || (components == 0) || (len < 8 + components * 3) ) return jpegCheckBadSegment;
+
+            int hMax = 1, vMax = 1;
+            for( int c=0;c<components;c++ )
+            {
+                hMax = std::max( hMax, p[9 + c * 3] >> 4 );
+                vMax = std::max( vMax, p[9 + c * 3] & 15 );
+            }
+            mcus = ((width + hMax * 8 - 1) / (hMax * 8)) * ((height + vMax * 8 - 1) / (vMax * 8));
+            frameHeader = true;
+        }
+
+        if( marker == 0xDD )
+        {
+            if( len < 4 ) return jpegCheckBadSegment;
+            restartInterval = readLength( p + 2 );
+        }
+
+        p += len;
+        if( marker != 0xDA ) continue;
+
+        if( !frameHeader ) return jpegCheckNoScan;
+        scan = true;
+
+        // entropy coded data, up to the first marker that is not a restart
+        for( ;; )
+        {
+            p = findFF( p, end );
+            if( end - p < 2 ) return jpegCheckTruncated;
+
+            int next = p[1];
+            if( next == 0x00 ) { p += 2; continue; }
+            if( next == 0xFF ) { p += 1; continue; }
+
+            if( (next >= 0xD0) && (next <= 0xD7) )
+            {
+                if( next != 0xD0 + (restarts & 7) ) return jpegCheckBadRestart;
+                restarts++;
+                p += 2;
+                continue;
+            }
+
+            break;
+        }
+    }
+
+    // ran out of data before EOI
+    return jpegCheckTruncated;
+}
+
+
+std::string jpegCheckToString( enum jpegCheck check )
+{
+    switch( check )
+    {
+        case jpegCheckOk:           return "ok";
+        case jpegCheckNoSOI:        return "no SOI marker";
+        case jpegCheckBadSegment:   return "bad marker segment";
+        case jpegCheckNoScan:       return "no frame header or scan";
+        case jpegCheckBadRestart:   return "missing restart marker";
+        case jpegCheckTruncated:    return "truncated, no EOI marker";
+    }
+
+    return "unknown";
+}
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+#include "image_utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define IMAGE_UTILS_SSE2
+#endif
+
+#if defined(__aarch64__) && defined(IMAGE_UTILS_ENABLE_NEON)
+#include <arm_neon.h>
+#define IMAGE_UTILS_NEON
+#endif
+
+// Motion gating against a running background
+//
+// - the frame is a 1/8 scale luma thumbnail, a 1080p frame is 240 x 135 samples, so the whole test is
+//   cheap next to fetching the frame and runs on the calling thread
+// - each thumbnail row adds its absolute differences to the sums of the blocks it crosses, 16 samples
+//   (two blocks) at a time with SSE2 / NEON
+// - the background is kept in 8.8 fixed point so a small learning rate still moves it, frames are
+//   compared with its 8 bit levels
+//
+
+static_assert( MOTION_BLOCK == 8, "the vector SAD covers two blocks of 8" );
+
+// SAD of one thumbnail row, added to the sum of each MOTION_BLOCK wide block
+//
+static void blockSADRow( const unsigned char * a, const unsigned char * b, int width, unsigned int * sums )
+{
+    int x = 0;
+
+#if defined(IMAGE_UTILS_SSE2)
+    if( getSimdLevel() != simdNone )
+    {
+        for( ;x+16<=width;x+=16 )
+        {
+            __m128i s = _mm_sad_epu8( _mm_loadu_si128( (const __m128i *)(a + x) ), _mm_loadu_si128( (const __m128i *)(b + x) ) );
+            sums[x / MOTION_BLOCK] += _mm_cvtsi128_si32( s );
+            sums[x / MOTION_BLOCK + 1] += _mm_extract_epi16( s, 4 );
+        }
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    if( getSimdLevel() != simdNone )
+    {
+        for( ;x+16<=width;x+=16 )
+        {
+            uint64x2_t s = vpaddlq_u32( vpaddlq_u16( vpaddlq_u8( vabdq_u8( vld1q_u8( a + x ), vld1q_u8( b + x ) ) ) ) );
+            sums[x / MOTION_BLOCK] += (unsigned int)vgetq_lane_u64( s, 0 );
+            sums[x / MOTION_BLOCK + 1] += (unsigned int)vgetq_lane_u64( s, 1 );
+        }
+    }
+#endif
+
+    for( ;x<width;x++ ) sums[x / MOTION_BLOCK] += std::abs( a[x] - b[x] );
+}
+
+bool detectMotion( struct motionState & state, const struct imageView & thumb, const struct motionConfig & cfg, double * changed )
+{
+    if( changed ) *changed = 0.0;
+    if( !thumb.plane[0] || (thumb.step[0] != 1) || (thumb.width <= 0) || (thumb.height <= 0) ) return false;
+
+    int width = thumb.width, height = thumb.height;
+
+    // a new size starts the background again from this frame
+    if( (state.width != width) || (state.height != height) || (state.reference.size() != (size_t)width * height) )
+    {
+        state.width = width;
+        state.height = height;
+        state.background.resize( (size_t)width * height );
+        state.reference.resize( (size_t)width * height );
+
+        for( int y=0;y<height;y++ )
+        {
+            const unsigned char * in = thumb.plane[0] + (ptrdiff_t)y * thumb.stride[0];
+            for( int x=0;x<width;x++ )
+            {
+                state.background[(size_t)y * width + x] = (unsigned short)(in[x] << 8);
+                state.reference[(size_t)y * width + x] = in[x];
+            }
+        }
+        return false;
+    }
+
+    int cols = (width + MOTION_BLOCK - 1) / MOTION_BLOCK;
+    int rows = (height + MOTION_BLOCK - 1) / MOTION_BLOCK;
+    int changedBlocks = 0;
+    std::vector<unsigned int> sums( cols );
+
+    for( int by=0;by<rows;by++ )
+    {
+        int y0 = by * MOTION_BLOCK, y1 = std::min( y0 + MOTION_BLOCK, height );
+        std::fill( sums.begin(), sums.end(), 0 );
+
+        for( int y=y0;y<y1;y++ )
+            blockSADRow( thumb.plane[0] + (ptrdiff_t)y * thumb.stride[0], state.reference.data() + (size_t)y * width, width, sums.data() );
+
+        // a block changes when its mean difference is above level, partial blocks at the edges by their own size
+        for( int bx=0;bx<cols;bx++ )
+        {
+            unsigned int n = (unsigned int)(y1 - y0) * (std::min( bx * MOTION_BLOCK + MOTION_BLOCK, width ) - bx * MOTION_BLOCK);
+            if( sums[bx] > (unsigned int)cfg.level * n ) changedBlocks++;
+        }
+    }
+
+    // move the background towards this frame
+    int shift = std::clamp( cfg.learnShift, 0, 8 );
+    for( int y=0;y<height;y++ )
+    {
+        const unsigned char * in = thumb.plane[0] + (ptrdiff_t)y * thumb.stride[0];
+        unsigned short * bg = state.background.data() + (size_t)y * width;
+        unsigned char * ref = state.reference.data() + (size_t)y * width;
+
+        for( int x=0;x<width;x++ )
+        {
+            int b = bg[x] + (((in[x] << 8) - bg[x]) >> shift);
+            bg[x] = (unsigned short)b;
+            ref[x] = (unsigned char)((b + 128) >> 8);
+        }
+    }
+
+    double percent = 100.0 * changedBlocks / (cols * rows);
+    if( changed ) *changed = percent;
+
+    return (changedBlocks > 0) && (percent >= cfg.area);
+}
+
+
+bool parseMotionConfig( std::string spec, struct motionConfig & cfg )
+{
+    struct motionConfig m = { 10, 0.5, 5, 15, 60 };
+    std::stringstream ss( spec );
+    std::string item;
+
+    while( std::getline( ss, item, ',' ) )
+    {
+        if( item == "on" ) continue;
+
+        size_t equals = item.find( '=' );
+        if( (equals == std::string::npos) || (equals == 0) || (equals + 1 == item.length()) ) return false;
+
+        std::string key = item.substr( 0, equals );
+        char * end = nullptr;
+        double value = std::strtod( item.c_str() + equals + 1, &end );
+        if( *end != 0 ) return false;
+
+        if( key == "level" ) m.level = (int)value;
+        else if( key == "area" ) m.area = value;
+        else if( key == "learn" ) m.learnShift = (int)value;
+        else if( key == "pre" ) m.preRoll = (int)value;
+        else if( key == "post" ) m.postRoll = (int)value;
+        else return false;
+    }
+
+    if( (m.level < 1) || (m.level > 255) || (m.area < 0.0) || (m.area > 100.0) ) return false;
+    if( (m.learnShift < 0) || (m.learnShift > 8) || (m.preRoll < 0) || (m.postRoll < 0) ) return false;
+
+    cfg = m;
+    return true;
+}
+
+std::string motionConfigToString( const struct motionConfig & cfg )
+{
+    std::stringstream s;
+
+    s << "level " << cfg.level << ", area " << cfg.area << "%, learn 1/" << (1 << cfg.learnShift)
+      << ", " << cfg.preRoll << " frames before, " << cfg.postRoll << " after";
+
+    return s.str();
+}
@@ -33,57 +33,44 @@
 // V - size/4 bytes
 //
 //
-unsigned char * planarYUV420ToRGB( unsigned char * yuv_image, int width, int height, bool grayScale )
+// 4:2:0 views, planar or interleaved, the chroma step tells them apart
+//
+bool convertYUV420( const struct imageView & src, const struct imageView & dst, bool grayScale )
 {
-    // output buffer
-    unsigned char* rgb_image = new unsigned char[width * height * 3];
-
-    // width and height of the image to be converted
-    int size = width * height;
-    int sizeU = size/4;
+    if( !imageViewsFit( src, dst ) || !src.plane[1] || !src.plane[2] ) return false;
 
-    int outIndex = 0;
+    const struct yuvTables & tables = classicYUVTables();
 
-    int Y, U, V;
-    double R, G, B;
-
-    for( int ii = 0; ii < size; ii++ )
+    // bands start on even rows, so a chroma row is never shared between two bands
+    runRowBands( src.height, src.width * 3, 2, [&]( int first, int last )
     {
-        // get mappings from    00 01       (width = 8, size = width*height)
-        //                      08 09
-        //                                  to U = size + 00
-        //                                  and V = size + (sizeU) + 00
-        //
-        // offsetU = size + (ii%width) / 2
-        // offsetV = sizeU + (ii%width) / 2
-        //
-
-        Y = yuv_image[ii];
-        int offsetUV = (ii%width) / 2;
-
-        U = yuv_image[size + offsetUV];
-        V = yuv_image[size + sizeU + offsetUV];
-
-        R = R_fromYUV( Y, U, V );
-        G = R;
-        B = R;
-
-        if( !grayScale )
+        for( int row = first; row < last; row++ )
         {
-            G = G_fromYUV( Y, U, V );
-            B = B_fromYUV( Y, U, V );
+            // each chroma row is shared by two rows of Y
+            //
+            // offsetU = (row / 2) * strideU
+            // offsetV = (row / 2) * strideV
+            //
+            yuvRowToRGB( src.plane[0] + row * src.stride[0], src.step[0],
+                         src.plane[1] + (row / 2) * src.stride[1], src.plane[2] + (row / 2) * src.stride[2], src.step[1],
+                         src.width, tables, grayScale, dst.plane[0] + row * dst.stride[0] );
         }
+    });
 
-        rgb_image[outIndex++] = R;
-        rgb_image[outIndex++] = G;
-        rgb_image[outIndex++] = B;
+    return true;
+}
 
-    }
+unsigned char * planarYUV420ToRGB( unsigned char * yuv_image, int width, int height, bool grayScale )
+{
+    // output buffer
+    unsigned char* rgb_image = new unsigned char[width * height * 3];
+
+    convertYUV420( planarYUV420Layout( yuv_image, width, height ), rgbView( rgb_image, width, height ), grayScale );
 
     return rgb_image;
 }
 
-// same as bove but U and V samples are reversed
+// same as above but U and V samples are reversed
 //
 
 unsigned char * planarYVU420ToRGB( unsigned char * yuv_image, int width, int height, bool grayScale )
@@ -91,47 +78,85 @@ unsigned char * planarYVU420ToRGB( unsigned char * yuv_image, int width, int hei
     // output buffer
     unsigned char* rgb_image = new unsigned char[width * height * 3];
 
-    // width and height of the image to be converted
-    int size = width * height;
-    int sizeUV = size/4;
+    convertYUV420( planarYVU420Layout( yuv_image, width, height ), rgbView( rgb_image, width, height ), grayScale );
 
-    int outIndex = 0;
+    return rgb_image;
+}
+
+// one row with the coefficients of a single matrix and range folded in as constants, no tables
+// and no run time choices left in the loop
+//
+template<enum yuvMatrix M, enum yuvRange R, bool Grey>
+static void yuvRowToRGBAs( const unsigned char * y, int yStep, const unsigned char * u, const unsigned char * v, int cStep,
+                           int pixels, unsigned char * out )
+{
+    typedef yuvColorSpace<M, R> cs;
 
-    int Y, U, V;
-    double R, G, B;
+    int pairs = pixels / 2;
 
-    for( int ii = 0; ii < size; ii++ )
+    for( int i=0;i<pairs;i++, y+=2*yStep, u+=cStep, v+=cStep, out+=6 )
     {
-        // get mappings from    00 01       (width = 8, size = width*height)
-        //                      08 09
-        //                                  to V = size + 00
-        //                                  and U = size + (sizeU) + 00
-        //
-        // offsetV = size + (ii%width) / 2
-        // offsetU = sizeV + (ii%width) / 2
-        //
-
-        Y = yuv_image[ii];
-        int offsetUV = (ii%width) / 2;
-
-        V = yuv_image[size + offsetUV];
-        U = yuv_image[size + sizeUV + offsetUV];
-
-        R = R_fromYUV( Y, U, V );
-        G = R;
-        B = R;
-
-        if( !grayScale )
+        int Y0 = (y[0] - cs::yOffset) * cs::y;
+        int Y1 = (y[yStep] - cs::yOffset) * cs::y;
+
+        if constexpr( Grey )
         {
-            G = G_fromYUV( Y, U, V );
-            B = B_fromYUV( Y, U, V );
+            out[0] = out[1] = out[2] = yuvSaturate( Y0 );
+            out[3] = out[4] = out[5] = yuvSaturate( Y1 );
+        } else {
+            int U = *u - 128;
+            int V = *v - 128;
+
+            // chroma terms are shared by both pixels of the pair
+            int tb = cs::bU * U;
+            int tg = cs::gU * U + cs::gV * V;
+            int tr = cs::rV * V;
+
+            out[0] = yuvSaturate( Y0 + tb );
+            out[1] = yuvSaturate( Y0 + tg );
+            out[2] = yuvSaturate( Y0 + tr );
+            out[3] = yuvSaturate( Y1 + tb );
+            out[4] = yuvSaturate( Y1 + tg );
+            out[5] = yuvSaturate( Y1 + tr );
         }
+    }
 
-        rgb_image[outIndex++] = R;
-        rgb_image[outIndex++] = G;
-        rgb_image[outIndex++] = B;
+    if( pixels & 1 )
+    {
+        int Y = (*y - cs::yOffset) * cs::y;
 
+        if constexpr( Grey )
+        {
+            out[0] = out[1] = out[2] = yuvSaturate( Y );
+        } else {
+            out[0] = yuvSaturate( Y + cs::bU * (*u - 128) );
+            out[1] = yuvSaturate( Y + cs::gU * (*u - 128) + cs::gV * (*v - 128) );
+            out[2] = yuvSaturate( Y + cs::rV * (*v - 128) );
+        }
     }
+}
 
-    return rgb_image;
-}
\ No newline at end of file
+template<enum yuvMatrix M, enum yuvRange R>
+bool convertYUV420As( const struct imageView & src, const struct imageView & dst, bool grayScale )
+{
+    if( !imageViewsFit( src, dst ) || !src.plane[1] || !src.plane[2] ) return false;
+
+    runRowBands( src.height, src.width * 3, 2, [&]( int first, int last )
+    {
+        for( int row = first; row < last; row++ )
+        {
+            const unsigned char * y = src.plane[0] + row * src.stride[0];
+            const unsigned char * u = src.plane[1] + (row / 2) * src.stride[1];
+            const unsigned char * v = src.plane[2] + (row / 2) * src.stride[2];
+            unsigned char * out = dst.plane[0] + row * dst.stride[0];
+
+            if( grayScale ) yuvRowToRGBAs<M, R, true>( y, src.step[0], u, v, src.step[1], src.width, out );
+            else yuvRowToRGBAs<M, R, false>( y, src.step[0], u, v, src.step[1], src.width, out );
+        }
+    });
+
+    return true;
+}
+
+#define YUV420_AS( M, R ) template bool convertYUV420As<M, R>( const struct imageView &, const struct imageView &, bool );
+YUV_COLOR_VARIANTS( YUV420_AS )
@@ -0,0 +1,544 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "image_utils.h"
+
+// Lossless snapshots in the QOI format (qoiformat.org) and a single channel variant of it
+//
+// - RGB24 views are written as standard 3 channel QOI files, any QOI reader opens them
+// - grey views (one byte per sample, or two bytes little endian for 16 bit) use the same framing
+//   with a "qoig" magic, byte 12 is 1 and byte 13 the bits per sample, and a set of ops sized for
+//   one channel:
+//
+//      00aaabbb            two samples of a row, each -4..3 from the one before
+//      01dddddd            difference from the previous sample, -32..31
+//      10dddddd dddddddd   difference from the previous sample, -8192..8191
+//      11rrrrrr            run of the previous sample, 1..62
+//      11111110 v v        the sample as it is, 16 bit only (8 bit differences always fit)
+//
+// - the samples are one stream from the top left, runs carry over from one row to the next
+// - both end with seven 0x00 and a 0x01
+//
+
+static const unsigned char QOI_OP_INDEX = 0x00;
+static const unsigned char QOI_OP_DIFF = 0x40;
+static const unsigned char QOI_OP_LUMA = 0x80;
+static const unsigned char QOI_OP_RUN = 0xC0;
+static const unsigned char QOI_OP_RGB = 0xFE;
+static const unsigned char QOI_OP_RGBA = 0xFF;
+
+static const unsigned char QOIG_OP_PAIR = 0x00;
+static const unsigned char QOIG_OP_DIFF6 = 0x40;
+static const unsigned char QOIG_OP_DIFF14 = 0x80;
+static const unsigned char QOIG_OP_RUN = 0xC0;
+static const unsigned char QOIG_OP_FULL = 0xFE;
+
+static const int QOI_HEADER_SIZE = 14;
+static const unsigned char s_qoiEnd[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+// pixels are r | g << 8 | b << 16 | a << 24, so a compare is one instruction
+//
+static inline int qoiHash( uint32_t px )
+{
+    return ((px & 0xFF) * 3 + ((px >> 8) & 0xFF) * 5 + ((px >> 16) & 0xFF) * 7 + (px >> 24) * 11) & 63;
+}
+
+static inline void putBE32( unsigned char * p, unsigned int v )
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static inline unsigned int readBE32( const unsigned char * p )
+{
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static bool isRGBView( const struct imageView & v ) { return (v.step[0] == 3) && !v.plane[1]; }
+static bool isGreyView( const struct imageView & v ) { return ((v.step[0] == 1) || (v.step[0] == 2)) && !v.plane[1]; }
+
+
+// Encoder state, kept across blocks of rows so a frame can be fed in pieces
+//
+struct qoiEncoder
+{
+    bool grey;
+    int bits;
+    uint64_t pixels;        // left in the image
+    uint32_t prev;
+    int run;
+    uint32_t index[64];
+
+    // worst case bytes for a number of pixels, every one written in full
+    size_t worstCase( uint64_t n ) const { return (size_t)(n * (grey ? 3 : 4)) + sizeof(s_qoiEnd); }
+};
+
+static void qoiStart( struct qoiEncoder & e, const struct imageView & src, unsigned char * header )
+{
+    e.grey = isGreyView( src );
+    e.bits = (src.step[0] == 2) ? 16 : 8;
+    e.pixels = (uint64_t)src.width * src.height;
+    e.prev = e.grey ? 0 : 0xFF000000;
+    e.run = 0;
+    memset( e.index, 0, sizeof(e.index) );
+
+    memcpy( header, e.grey ? "qoig" : "qoif", 4 );
+    putBE32( header + 4, src.width );
+    putBE32( header + 8, src.height );
+    header[12] = e.grey ? 1 : 3;
+    header[13] = e.grey ? (unsigned char)e.bits : 0;     // sRGB with linear alpha for QOI
+}
+
+// RGB24 rows, blue byte first as everywhere in image_utils, into out, returns the bytes written
+//
+static size_t qoiEncodeRGB( struct qoiEncoder & e, const struct imageView & src, unsigned char * out )
+{
+    unsigned char * p = out;
+    uint32_t prev = e.prev;
+    int run = e.run;
+
+    for( int row=0;row<src.height;row++ )
+    {
+        const unsigned char * in = src.plane[0] + (ptrdiff_t)row * src.stride[0];
+        const unsigned char * end = in + src.width * 3;
+
+        for( ;in<end;in+=3 )
+        {
+            uint32_t px = in[2] | (in[1] << 8) | (in[0] << 16) | 0xFF000000u;
+            e.pixels--;
+
+            if( px == prev )
+            {
+                run++;
+                if( (run == 62) || !e.pixels )
+                {
+                    *p++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if( run )
+            {
+                *p++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            int h = qoiHash( px );
+            if( e.index[h] == px )
+            {
+                *p++ = QOI_OP_INDEX | h;
+                prev = px;
+                continue;
+            }
+            e.index[h] = px;
+
+            // alpha is always 255, so only the colour ops are needed
+            signed char vr = (signed char)((px & 0xFF) - (prev & 0xFF));
+            signed char vg = (signed char)(((px >> 8) & 0xFF) - ((prev >> 8) & 0xFF));
+            signed char vb = (signed char)(((px >> 16) & 0xFF) - ((prev >> 16) & 0xFF));
+            signed char vgr = (signed char)(vr - vg);
+            signed char vgb = (signed char)(vb - vg);
+
+            if( (vr > -3) && (vr < 2) && (vg > -3) && (vg < 2) && (vb > -3) && (vb < 2) )
+            {
+                *p++ = QOI_OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2);
+            }
+            else if( (vgr > -9) && (vgr < 8) && (vg > -33) && (vg < 32) && (vgb > -9) && (vgb < 8) )
+            {
+                p[0] = QOI_OP_LUMA | (vg + 32);
+                p[1] = (unsigned char)(((vgr + 8) << 4) | (vgb + 8));
+                p += 2;
+            } else {
+                p[0] = QOI_OP_RGB;
+                p[1] = (unsigned char)px;
+                p[2] = (unsigned char)(px >> 8);
+                p[3] = (unsigned char)(px >> 16);
+                p += 4;
+            }
+            prev = px;
+        }
+    }
+
+    e.prev = prev;
+    e.run = run;
+    return p - out;
+}
+
+// 8 or 16 bit grey rows
+//
+static size_t qoiEncodeGrey( struct qoiEncoder & e, const struct imageView & src, unsigned char * out )
+{
+    unsigned char * p = out;
+    unsigned int prev = e.prev;
+    int run = e.run;
+    bool wide = (e.bits == 16);
+    unsigned int mask = wide ? 0xFFFF : 0xFF;
+    int half = wide ? 0x8000 : 0x80;
+
+    for( int row=0;row<src.height;row++ )
+    {
+        const unsigned char * in = src.plane[0] + (ptrdiff_t)row * src.stride[0];
+
+        for( int x=0;x<src.width;x++ )
+        {
+            unsigned int v = wide ? (in[x * 2] | (in[x * 2 + 1] << 8)) : in[x];
+            e.pixels--;
+
+            if( v == prev )
+            {
+                run++;
+                if( (run == 62) || !e.pixels )
+                {
+                    *p++ = QOIG_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if( run )
+            {
+                *p++ = QOIG_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            // the difference wraps, for 8 bit samples it always fits in 14 bits
+            int d = (int)((v - prev + half) & mask) - half;
+            prev = v;
+
+            if( (d >= -4) && (d < 4) && (x + 1 < src.width) )
+            {
+                // the next sample too, if it is just as close
+                unsigned int next = wide ? (in[x * 2 + 2] | (in[x * 2 + 3] << 8)) : in[x + 1];
+                int d2 = (int)((next - v + half) & mask) - half;
+                if( (d2 >= -4) && (d2 < 4) )
+                {
+                    *p++ = QOIG_OP_PAIR | ((d & 7) << 3) | (d2 & 7);
+                    prev = next;
+                    e.pixels--;
+                    x++;
+                    continue;
+                }
+            }
+
+            if( (d >= -32) && (d < 32) )
+            {
+                *p++ = QOIG_OP_DIFF6 | (d & 63);
+            }
+            else if( (d >= -8192) && (d < 8192) )
+            {
+                p[0] = QOIG_OP_DIFF14 | ((d >> 8) & 63);
+                p[1] = (unsigned char)d;
+                p += 2;
+            } else {
+                p[0] = QOIG_OP_FULL;
+                p[1] = (unsigned char)(v >> 8);
+                p[2] = (unsigned char)v;
+                p += 3;
+            }
+        }
+    }
+
+    e.prev = prev;
+    e.run = run;
+    return p - out;
+}
+
+static size_t qoiEncodeRows( struct qoiEncoder & e, const struct imageView & src, unsigned char * out )
+{
+    size_t n = e.grey ? qoiEncodeGrey( e, src, out ) : qoiEncodeRGB( e, src, out );
+
+    // the end marker follows the last pixel
+    if( !e.pixels )
+    {
+        memcpy( out + n, s_qoiEnd, sizeof(s_qoiEnd) );
+        n += sizeof(s_qoiEnd);
+    }
+
+    return n;
+}
+
+
+bool encodeQOI( const struct imageView & src, std::vector<unsigned char> & out )
+{
+    if( !src.plane[0] || (src.width <= 0) || (src.height <= 0) ) return false;
+    if( !isRGBView( src ) && !isGreyView( src ) ) return false;
+
+    struct qoiEncoder e;
+    out.resize( QOI_HEADER_SIZE );
+    qoiStart( e, src, out.data() );
+
+    out.resize( QOI_HEADER_SIZE + e.worstCase( e.pixels ) );
+    out.resize( QOI_HEADER_SIZE + qoiEncodeRows( e, src, out.data() + QOI_HEADER_SIZE ) );
+
+    return true;
+}
+
+
+bool qoiReadInfo( const unsigned char * data, size_t length, struct qoiInfo & info )
+{
+    if( !data || (length < QOI_HEADER_SIZE + sizeof(s_qoiEnd)) ) return false;
+
+    bool grey = !memcmp( data, "qoig", 4 );
+    if( !grey && memcmp( data, "qoif", 4 ) ) return false;
+
+    info.width = (int)readBE32( data + 4 );
+    info.height = (int)readBE32( data + 8 );
+    info.channels = data[12];
+    info.bits = grey ? data[13] : 8;
+
+    if( (info.width <= 0) || (info.height <= 0) ) return false;
+    if( grey ) return (info.channels == 1) && ((info.bits == 8) || (info.bits == 16));
+
+    return (info.channels == 3) || (info.channels == 4);
+}
+
+
+// the decoders stop at the end of the data, what was decoded is kept
+//
+static bool qoiDecodeRGB( const unsigned char * p, const unsigned char * end, const struct imageView & dst )
+{
+    uint32_t index[64] = {};
+    uint32_t px = 0xFF000000u;
+    int run = 0;
+
+    for( int row=0;row<dst.height;row++ )
+    {
+        unsigned char * out = dst.plane[0] + (ptrdiff_t)row * dst.stride[0];
+
+        for( int x=0;x<dst.width;x++, out+=3 )
+        {
+            if( run > 0 )
+            {
+                run--;
+            } else {
+                if( p >= end ) return false;
+                int op = *p++;
+
+                if( op == QOI_OP_RGB )
+                {
+                    if( end - p < 3 ) return false;
+                    px = (px & 0xFF000000u) | p[0] | (p[1] << 8) | (p[2] << 16);
+                    p += 3;
+                }
+                else if( op == QOI_OP_RGBA )
+                {
+                    if( end - p < 4 ) return false;
+                    px = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+                    p += 4;
+                }
+                else if( (op & 0xC0) == QOI_OP_INDEX )
+                {
+                    px = index[op];
+                }
+                else if( (op & 0xC0) == QOI_OP_DIFF )
+                {
+                    int r = ((px & 0xFF) + ((op >> 4) & 3) - 2) & 0xFF;
+                    int g = (((px >> 8) & 0xFF) + ((op >> 2) & 3) - 2) & 0xFF;
+                    int b = (((px >> 16) & 0xFF) + (op & 3) - 2) & 0xFF;
+                    px = (px & 0xFF000000u) | r | (g << 8) | (b << 16);
+                }
+                else if( (op & 0xC0) == QOI_OP_LUMA )
+                {
+                    if( p >= end ) return false;
+                    int vg = (op & 63) - 32;
+                    int r = ((px & 0xFF) + vg - 8 + ((*p >> 4) & 15)) & 0xFF;
+                    int g = (((px >> 8) & 0xFF) + vg) & 0xFF;
+                    int b = (((px >> 16) & 0xFF) + vg - 8 + (*p & 15)) & 0xFF;
+                    p++;
+                    px = (px & 0xFF000000u) | r | (g << 8) | (b << 16);
+                } else {
+                    run = op & 63;
+                }
+
+                index[qoiHash( px )] = px;
+            }
+
+            // alpha is dropped
+            out[0] = (unsigned char)(px >> 16);
+            out[1] = (unsigned char)(px >> 8);
+            out[2] = (unsigned char)px;
+        }
+    }
+
+    return true;
+}
+
+static bool qoiDecodeGrey( const unsigned char * p, const unsigned char * end, const struct imageView & dst, int bits )
+{
+    unsigned int v = 0;
+    int run = 0;
+    bool wide = (bits == 16);
+    unsigned int mask = wide ? 0xFFFF : 0xFF;
+
+    for( int row=0;row<dst.height;row++ )
+    {
+        unsigned char * out = dst.plane[0] + (ptrdiff_t)row * dst.stride[0];
+
+        for( int x=0;x<dst.width;x++ )
+        {
+            if( run > 0 )
+            {
+                run--;
+            } else {
+                if( p >= end ) return false;
+                int op = *p++;
+
+                if( op == QOIG_OP_FULL )
+                {
+                    if( end - p < 2 ) return false;
+                    v = (p[0] << 8) | p[1];
+                    p += 2;
+                }
+                else if( (op & 0xC0) == QOIG_OP_PAIR )
+                {
+                    // the first of the two is written here, the second below
+                    if( x + 1 >= dst.width ) return false;
+                    v = (v + ((op >> 3) & 7) - ((op & 0x20) ? 8 : 0)) & mask;
+                    if( wide )
+                    {
+                        out[x * 2] = (unsigned char)v;
+                        out[x * 2 + 1] = (unsigned char)(v >> 8);
+                    }
+                    else out[x] = (unsigned char)v;
+
+                    v = (v + (op & 7) - ((op & 4) ? 8 : 0)) & mask;
+                    x++;
+                }
+                else if( (op & 0xC0) == QOIG_OP_DIFF6 )
+                {
+                    v = (v + ((op & 63) ^ 32) - 32) & mask;
+                }
+                else if( (op & 0xC0) == QOIG_OP_DIFF14 )
+                {
+                    if( p >= end ) return false;
+                    int d = ((((op & 63) << 8) | *p++) ^ 0x2000) - 0x2000;
+                    v = (v + d) & mask;
+                } else {
+                    run = op & 63;
+                }
+            }
+
+            if( wide )
+            {
+                out[x * 2] = (unsigned char)v;
+                out[x * 2 + 1] = (unsigned char)(v >> 8);
+            }
+            else out[x] = (unsigned char)v;
+        }
+    }
+
+    return true;
+}
+
+
+bool decodeQOI( const unsigned char * data, size_t length, const struct imageView & dst )
+{
+    struct qoiInfo info;
+    if( !qoiReadInfo( data, length, info ) ) return false;
+
+    // RGB files need an rgbView, grey files a view with the same bytes per sample
+    bool grey = (info.channels == 1);
+    if( !dst.plane[0] || (dst.width != info.width) || (dst.height != info.height) ) return false;
+    if( grey ? (dst.step[0] != info.bits / 8) : !isRGBView( dst ) ) return false;
+
+    const unsigned char * p = data + QOI_HEADER_SIZE;
+    const unsigned char * end = data + length;
+
+    return grey ? qoiDecodeGrey( p, end, dst, info.bits ) : qoiDecodeRGB( p, end, dst );
+}
+
+
+bool saveAsQOI( const struct imageView & src, imageConvertFn convert, std::string fid )
+{
+    bool streamToStdout = (fid.length() == 0 );
+
+    if( !src.plane[0] || (src.width <= 0) || (src.height <= 0) ) return false;
+    if( !convert && !isRGBView( src ) && !isGreyView( src ) ) return false;
+
+    std::ofstream pFile;
+    if( !streamToStdout )
+    {
+        pFile.open(fid, std::ios::trunc | std::ios::binary );
+        if( !pFile.is_open() )
+        {
+#ifdef _WIN32
+            std::array<char, 256> errorBuffer;
+            strerror_s(errorBuffer.data(), errorBuffer.size(), errno);
+            std::cerr << "Failed to open output file : " << fid << " - " + std::string(errorBuffer.data()) << std::endl;
+#else
+            std::cerr << "[\x1b[1;31mwarning\x1b[0m] Failed to open file for writing : " << strerror(errno) << std::endl;
+#endif
+            return false;
+        }
+    }
+    std::ostream & out = streamToStdout ? std::cout : pFile;
+
+    // without a converter the view is encoded as it is, otherwise blocks of rows are converted to
+    // RGB24 and encoded as they come, so no full RGB24 frame is held
+    struct imageView rgbShape = rgbView( nullptr, src.width, src.height );
+    struct qoiEncoder e;
+    unsigned char header[QOI_HEADER_SIZE];
+    qoiStart( e, convert ? rgbShape : src, header );
+    out.write( (const char *)header, sizeof(header) );
+
+    int blockRows = convert ? std::max( 2, (256 * 1024 / (src.width * 3)) & ~1 ) : src.height;
+    std::vector<unsigned char> rgb;
+    if( convert ) rgb.resize( (size_t)blockRows * src.width * 3 );
+
+    std::vector<unsigned char> encoded;
+    bool converted = true;
+
+    for( int first=0;first<src.height;first+=blockRows )
+    {
+        int rows = std::min( blockRows, src.height - first );
+        struct imageView block = rowsView( src, first, rows );
+
+        if( convert )
+        {
+            struct imageView dst = rgbView( rgb.data(), src.width, rows );
+            if( !convert( block, dst, false ) )
+            {
+                converted = false;
+                break;
+            }
+            block = dst;
+        }
+
+        encoded.resize( e.worstCase( (uint64_t)rows * src.width ) );
+        out.write( (const char *)encoded.data(), qoiEncodeRows( e, block, encoded.data() ) );
+    }
+
+    if( !converted )
+    {
+        std::cerr << "[\x1b[1;31mwarning\x1b[0m] Image conversion failed, QOI output is incomplete" << std::endl;
+        return false;
+    }
+
+    if( streamToStdout )
+    {
+        std::cout.flush();
+
+        std::cerr << "[\x1b[1;33minfo\x1b[0m] Image output to STDOUT" << std::endl;
+
+    } else {
+        pFile.close();
+        if( pFile.fail() )
+        {
+            std::cerr << "[\x1b[1;31mwarning\x1b[0m] Failed writing image to : " << fid << std::endl;
+            return false;
+        }
+
+        std::cerr << "[\x1b[1;33minfo\x1b[0m] Image saved to : " << fid << std::endl;
+    }
+
+    return true;
+}
@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "image_utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define IMAGE_UTILS_SSE2
+#endif
+
+#if defined(__aarch64__) && defined(IMAGE_UTILS_ENABLE_NEON)
+#include <arm_neon.h>
+#define IMAGE_UTILS_NEON
+#endif
+
+// YUV to YUV repacking, no RGB step
+//
+// - every plane is described by the views, so one routine covers packed 4:2:2 and planar or interleaved
+//   4:2:0 in either chroma order, on both sides
+// - a row of samples is gathered from its step into a contiguous row, filtered down (or up) between
+//   4:2:2 and 4:2:0, then scattered to the step of the destination, SSE2 / NEON handle steps 1, 2 and 4
+//   and write interleaved U V pairs in one go
+// - 4:2:0 chroma sits between two rows, so going down chromaFilterAverage takes the mean of the pair and
+//   chromaFilterSmooth a 1 3 3 1 filter over four rows, going up both interpolate 3:1 from the two
+//   nearest chroma rows, chromaFilterDrop keeps the top row of each pair or repeats rows
+//
+
+// samples step bytes apart to a contiguous row
+//
+static void gatherRow( const unsigned char * in, int step, unsigned char * out, int n )
+{
+    int x = 0;
+
+    if( step == 1 )
+    {
+        std::memcpy( out, in, n );
+        return;
+    }
+
+#if defined(IMAGE_UTILS_SSE2)
+    if( getSimdLevel() != simdNone )
+    {
+        if( step == 2 )
+        {
+            // the last block reads one byte past the last sample, leave it to the scalar tail
+            const __m128i low = _mm_set1_epi16( 0x00FF );
+            for( ;x+16<n;x+=16 )
+            {
+                __m128i a = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(in + x * 2) ), low );
+                __m128i b = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(in + x * 2 + 16) ), low );
+                _mm_storeu_si128( (__m128i *)(out + x), _mm_packus_epi16( a, b ) );
+            }
+        } else if( step == 4 )
+        {
+            const __m128i low = _mm_set1_epi32( 0x000000FF );
+            for( ;x+16<n;x+=16 )
+            {
+                const __m128i * p = (const __m128i *)(in + x * 4);
+                __m128i a = _mm_packs_epi32( _mm_and_si128( _mm_loadu_si128( p ), low ), _mm_and_si128( _mm_loadu_si128( p + 1 ), low ) );
+                __m128i b = _mm_packs_epi32( _mm_and_si128( _mm_loadu_si128( p + 2 ), low ), _mm_and_si128( _mm_loadu_si128( p + 3 ), low ) );
+                _mm_storeu_si128( (__m128i *)(out + x), _mm_packus_epi16( a, b ) );
+            }
+        }
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    if( getSimdLevel() != simdNone )
+    {
+        if( step == 2 )
+            for( ;x+16<n;x+=16 ) vst1q_u8( out + x, vld2q_u8( in + x * 2 ).val[0] );
+        else if( step == 4 )
+            for( ;x+16<n;x+=16 ) vst1q_u8( out + x, vld4q_u8( in + x * 4 ).val[0] );
+    }
+#endif
+
+    for( ;x<n;x++ ) out[x] = in[x * step];
+}
+
+// a contiguous row to samples step bytes apart, the bytes in between are kept
+//
+static void scatterRow( const unsigned char * in, unsigned char * out, int step, int n )
+{
+    int x = 0;
+
+    if( step == 1 )
+    {
+        std::memcpy( out, in, n );
+        return;
+    }
+
+#if defined(IMAGE_UTILS_SSE2)
+    if( getSimdLevel() != simdNone )
+    {
+        const __m128i zero = _mm_setzero_si128();
+
+        if( step == 2 )
+        {
+            const __m128i keep = _mm_set1_epi16( (short)0xFF00 );
+            for( ;x+16<n;x+=16 )
+            {
+                __m128i v = _mm_loadu_si128( (const __m128i *)(in + x) );
+                __m128i * p = (__m128i *)(out + x * 2);
+                _mm_storeu_si128( p, _mm_or_si128( _mm_and_si128( _mm_loadu_si128( p ), keep ), _mm_unpacklo_epi8( v, zero ) ) );
+                _mm_storeu_si128( p + 1, _mm_or_si128( _mm_and_si128( _mm_loadu_si128( p + 1 ), keep ), _mm_unpackhi_epi8( v, zero ) ) );
+            }
+        } else if( step == 4 )
+        {
+            const __m128i keep = _mm_set1_epi32( (int)0xFFFFFF00 );
+            for( ;x+16<n;x+=16 )
+            {
+                __m128i v = _mm_loadu_si128( (const __m128i *)(in + x) );
+                __m128i lo = _mm_unpacklo_epi8( v, zero ), hi = _mm_unpackhi_epi8( v, zero );
+                __m128i q[4] = { _mm_unpacklo_epi16( lo, zero ), _mm_unpackhi_epi16( lo, zero ), _mm_unpacklo_epi16( hi, zero ), _mm_unpackhi_epi16( hi, zero ) };
+                __m128i * p = (__m128i *)(out + x * 4);
+                for( int i=0;i<4;i++ ) _mm_storeu_si128( p + i, _mm_or_si128( _mm_and_si128( _mm_loadu_si128( p + i ), keep ), q[i] ) );
+            }
+        }
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    if( getSimdLevel() != simdNone )
+    {
+        if( step == 2 )
+        {
+            for( ;x+16<n;x+=16 )
+            {
+                uint8x16x2_t v = vld2q_u8( out + x * 2 );
+                v.val[0] = vld1q_u8( in + x );
+                vst2q_u8( out + x * 2, v );
+            }
+        } else if( step == 4 )
+        {
+            for( ;x+16<n;x+=16 )
+            {
+                uint8x16x4_t v = vld4q_u8( out + x * 4 );
+                v.val[0] = vld1q_u8( in + x );
+                vst4q_u8( out + x * 4, v );
+            }
+        }
+    }
+#endif
+
+    for( ;x<n;x++ ) out[x * step] = in[x];
+}
+
+// U and V rows to one interleaved row, first byte from a
+//
+static void interleaveRows( const unsigned char * a, const unsigned char * b, unsigned char * out, int n )
+{
+    int x = 0;
+
+#if defined(IMAGE_UTILS_SSE2)
+    if( getSimdLevel() != simdNone )
+    {
+        for( ;x+16<=n;x+=16 )
+        {
+            __m128i va = _mm_loadu_si128( (const __m128i *)(a + x) );
+            __m128i vb = _mm_loadu_si128( (const __m128i *)(b + x) );
+            _mm_storeu_si128( (__m128i *)(out + x * 2), _mm_unpacklo_epi8( va, vb ) );
+            _mm_storeu_si128( (__m128i *)(out + x * 2 + 16), _mm_unpackhi_epi8( va, vb ) );
+        }
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    if( getSimdLevel() != simdNone )
+    {
+        for( ;x+16<=n;x+=16 )
+        {
+            uint8x16x2_t v = { { vld1q_u8( a + x ), vld1q_u8( b + x ) } };
+            vst2q_u8( out + x * 2, v );
+        }
+    }
+#endif
+
+    for( ;x<n;x++ )
+    {
+        out[x * 2] = a[x];
+        out[x * 2 + 1] = b[x];
+    }
+}
+
+
+// Vertical chroma filters, rows r[0..3] of n samples
+//
+
+// (a + b + 1) / 2
+static void averageRows( const unsigned char * a, const unsigned char * b, unsigned char * out, int n )
+{
+    int x = 0;
+
+#if defined(IMAGE_UTILS_SSE2)
+    if( getSimdLevel() != simdNone )
+        for( ;x+16<=n;x+=16 )
+            _mm_storeu_si128( (__m128i *)(out + x), _mm_avg_epu8( _mm_loadu_si128( (const __m128i *)(a + x) ), _mm_loadu_si128( (const __m128i *)(b + x) ) ) );
+#elif defined(IMAGE_UTILS_NEON)
+    if( getSimdLevel() != simdNone )
+        for( ;x+16<=n;x+=16 ) vst1q_u8( out + x, vrhaddq_u8( vld1q_u8( a + x ), vld1q_u8( b + x ) ) );
+#endif
+
+    for( ;x<n;x++ ) out[x] = (unsigned char)((a[x] + b[x] + 1) >> 1);
+}
+
+// (wa * a + wb * b + wc * c + wd * d + round) >> shift, the weights sum to 1 << shift
+static void weightRows( const unsigned char * const * r, const int * w, int shift, unsigned char * out, int n )
+{
+    int x = 0;
+
+#if defined(IMAGE_UTILS_SSE2)
+    if( getSimdLevel() != simdNone )
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16( (short)(1 << (shift - 1)) );
+        const __m128i count = _mm_cvtsi32_si128( shift );
+        __m128i k[4];
+        for( int i=0;i<4;i++ ) k[i] = _mm_set1_epi16( (short)w[i] );
+
+        for( ;x+16<=n;x+=16 )
+        {
+            __m128i lo = round, hi = round;
+            for( int i=0;i<4;i++ )
+            {
+                __m128i v = _mm_loadu_si128( (const __m128i *)(r[i] + x) );
+                lo = _mm_add_epi16( lo, _mm_mullo_epi16( _mm_unpacklo_epi8( v, zero ), k[i] ) );
+                hi = _mm_add_epi16( hi, _mm_mullo_epi16( _mm_unpackhi_epi8( v, zero ), k[i] ) );
+            }
+            _mm_storeu_si128( (__m128i *)(out + x), _mm_packus_epi16( _mm_srl_epi16( lo, count ), _mm_srl_epi16( hi, count ) ) );
+        }
+    }
+#elif defined(IMAGE_UTILS_NEON)
+    if( getSimdLevel() != simdNone )
+    {
+        const int16x8_t count = vdupq_n_s16( (short)-shift );
+
+        for( ;x+16<=n;x+=16 )
+        {
+            uint16x8_t lo = vdupq_n_u16( (unsigned short)(1 << (shift - 1)) ), hi = lo;
+            for( int i=0;i<4;i++ )
+            {
+                uint8x16_t v = vld1q_u8( r[i] + x );
+                lo = vmlal_u8( lo, vget_low_u8( v ), vdup_n_u8( (unsigned char)w[i] ) );
+                hi = vmlal_u8( hi, vget_high_u8( v ), vdup_n_u8( (unsigned char)w[i] ) );
+            }
+            vst1q_u8( out + x, vcombine_u8( vmovn_u16( vshlq_u16( lo, count ) ), vmovn_u16( vshlq_u16( hi, count ) ) ) );
+        }
+    }
+#endif
+
+    for( ;x<n;x++ ) out[x] = (unsigned char)((r[0][x] * w[0] + r[1][x] * w[1] + r[2][x] * w[2] + r[3][x] * w[3] + (1 << (shift - 1))) >> shift);
+}
+
+
+// one plane of chroma rows, with a cache of gathered source rows
+//
+struct chromaPlane
+{
+    const unsigned char * plane;
+    int stride;
+    int step;
+    int rows;
+    int width;
+    int samples;
+
+    std::vector<unsigned char> cache;
+    int cached[4];
+
+    const unsigned char * row( int r )
+    {
+        r = std::clamp( r, 0, rows - 1 );
+
+        // the filters walk down the rows, four slots cover any window they use
+        int slot = r & 3;
+        unsigned char * out = cache.data() + (size_t)slot * width;
+        if( cached[slot] != r )
+        {
+            // an odd packed 4:2:2 row ends on a half pair, the plane missing its last sample repeats the one before
+            gatherRow( plane + (ptrdiff_t)r * stride, step, out, samples );
+            if( samples < width ) std::memset( out + samples, samples ? out[samples - 1] : 128, width - samples );
+            cached[slot] = r;
+        }
+        return out;
+    }
+};
+
+// chroma row c of the destination from the source plane
+//
+static void chromaRow( struct chromaPlane & src, int srcShift, int dstShift, int c, enum chromaFilter filter, unsigned char * out )
+{
+    int n = src.width;
+
+    if( srcShift == dstShift )
+    {
+        std::memcpy( out, src.row( c ), n );
+    } else if( srcShift < dstShift )
+    {
+        // 4:2:2 down to 4:2:0
+        if( filter == chromaFilterDrop ) std::memcpy( out, src.row( c * 2 ), n );
+        else if( filter == chromaFilterAverage ) averageRows( src.row( c * 2 ), src.row( c * 2 + 1 ), out, n );
+        else
+        {
+            static const int w[4] = { 1, 3, 3, 1 };
+            const unsigned char * r[4] = { src.row( c * 2 - 1 ), src.row( c * 2 ), src.row( c * 2 + 1 ), src.row( c * 2 + 2 ) };
+            weightRows( r, w, 3, out, n );
+        }
+    } else {
+        // 4:2:0 up to 4:2:2, an even row is nearer the chroma row above
+        if( filter == chromaFilterDrop ) std::memcpy( out, src.row( c >> 1 ), n );
+        else
+        {
+            static const int w[4] = { 3, 1, 0, 0 };
+            int near = c >> 1, far = (c & 1) ? near + 1 : near - 1;
+            const unsigned char * r[4] = { src.row( near ), src.row( far ), src.row( near ), src.row( near ) };
+            weightRows( r, w, 2, out, n );
+        }
+    }
+}
+
+
+bool repackYUV( const struct imageView & src, const struct imageView & dst, enum chromaFilter filter )
+{
+    if( !src.plane[0] || !src.plane[1] || !src.plane[2] ) return false;
+    if( !dst.plane[0] || !dst.plane[1] || !dst.plane[2] ) return false;
+    if( (src.width <= 0) || (src.height <= 0) || (dst.width < src.width) || (dst.height < src.height) ) return false;
+    if( (src.chromaRowShift > 1) || (dst.chromaRowShift > 1) ) return false;
+
+    int w = src.width, h = src.height;
+    int cw = (w + 1) / 2;
+
+    // an odd width packed dst has no room for the last sample of one chroma plane
+    int dstU = std::min( cw, chromaRowSamples( dst, 1 ) );
+    int dstV = std::min( cw, chromaRowSamples( dst, 2 ) );
+
+    // dst chroma pairs written together when V follows U (or U follows V) in the same bytes
+    bool pairs = (dst.step[1] == 2) && (dst.step[2] == 2) && (std::abs( dst.plane[2] - dst.plane[1] ) == 1);
+
+    runRowBands( h, w * 2, 2, [&]( int first, int last )
+    {
+        std::vector<unsigned char> luma( w ), u( cw ), v( cw ), uv( cw * 2 );
+
+        struct chromaPlane cu = { src.plane[1], src.stride[1], src.step[1], (h + src.chromaRowShift) >> src.chromaRowShift, cw,
+                                  chromaRowSamples( src, 1 ), std::vector<unsigned char>( (size_t)cw * 4 ), { -1, -1, -1, -1 } };
+        struct chromaPlane cv = { src.plane[2], src.stride[2], src.step[2], cu.rows, cw,
+                                  chromaRowSamples( src, 2 ), std::vector<unsigned char>( (size_t)cw * 4 ), { -1, -1, -1, -1 } };
+
+        for( int y=first;y<last;y++ )
+        {
+            const unsigned char * in = src.plane[0] + (ptrdiff_t)y * src.stride[0];
+            unsigned char * out = dst.plane[0] + (ptrdiff_t)y * dst.stride[0];
+
+            if( dst.step[0] == 1 ) gatherRow( in, src.step[0], out, w );
+            else if( src.step[0] == 1 ) scatterRow( in, out, dst.step[0], w );
+            else
+            {
+                gatherRow( in, src.step[0], luma.data(), w );
+                scatterRow( luma.data(), out, dst.step[0], w );
+            }
+        }
+
+        // the band starts on an even row, so its 4:2:0 chroma rows are its own
+        int c0 = first >> dst.chromaRowShift;
+        int c1 = (last + dst.chromaRowShift) >> dst.chromaRowShift;
+
+        for( int c=c0;c<c1;c++ )
+        {
+            chromaRow( cu, src.chromaRowShift, dst.chromaRowShift, c, filter, u.data() );
+            chromaRow( cv, src.chromaRowShift, dst.chromaRowShift, c, filter, v.data() );
+
+            unsigned char * outU = dst.plane[1] + (ptrdiff_t)c * dst.stride[1];
+            unsigned char * outV = dst.plane[2] + (ptrdiff_t)c * dst.stride[2];
+
+            if( pairs )
+            {
+                if( outU < outV ) interleaveRows( u.data(), v.data(), outU, cw );
+                else interleaveRows( v.data(), u.data(), outV, cw );
+            } else {
+                scatterRow( u.data(), outU, dst.step[1], dstU );
+                scatterRow( v.data(), outV, dst.step[2], dstV );
+            }
+        }
+    });
+
+    return true;
+}
+
+
+// Tightly packed destination frames
+//
+size_t repackedFrameSize( unsigned int fourcc, int width, int height )
+{
+    size_t luma = (size_t)width * height;
+    size_t chroma420 = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+
+    switch( fourcc )
+    {
+        case IMAGE_FOURCC('N','V','1','2'):
+        case IMAGE_FOURCC('N','V','2','1'):
+        case IMAGE_FOURCC('I','4','2','0'):
+        case IMAGE_FOURCC('Y','U','1','2'):
+        case IMAGE_FOURCC('Y','V','1','2'):
+            return luma + chroma420 * 2;
+
+        case IMAGE_FOURCC('Y','U','Y','V'):
+        case IMAGE_FOURCC('Y','V','Y','U'):
+        case IMAGE_FOURCC('Y','U','Y','2'):
+            return luma * 2;
+
+        default: break;
+    }
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "image_utils.h"
+
+// Row band execution for the image converters
+//
+// - a frame is cut into bands of whole rows, sized so one band of output stays in the L2 cache
+// - bands are handed out from a shared counter to a persistent pool, the calling thread works too
+// - one frame at a time, concurrent callers wait their turn
+//
+
+// output bytes per band, roughly half a typical L2
+static const int s_bandBytes = 256 * 1024;
+
+// below this much output a frame is converted on the calling thread
+static const int s_minThreadedBytes = 512 * 1024;
+
+class rowBandPool
+{
+private:
+    std::vector<std::thread> m_workers;
+    std::mutex m_runLock;
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    bool m_quit;
+    unsigned int m_generation;
+    int m_busy;
+
+    // current job
+    const std::function<void(int, int)> * m_job;
+    int m_rows;
+    int m_bandRows;
+    int m_bands;
+    std::atomic<int> m_next;
+
+    void runBands()
+    {
+        int b;
+        while( (b = m_next.fetch_add( 1 )) < m_bands )
+        {
+            int first = b * m_bandRows;
+            int last = first + m_bandRows;
+            if( last > m_rows ) last = m_rows;
+
+            (*m_job)( first, last );
+        }
+    }
+
+    void worker()
+    {
+        unsigned int seen = 0;
+
+        while( true )
+        {
+            {
+                std::unique_lock<std::mutex> lk( m_lock );
+                m_wake.wait( lk, [&]{ return m_quit || (m_generation != seen); } );
+                if( m_quit ) return;
+                seen = m_generation;
+            }
+
+            runBands();
+
+            {
+                std::lock_guard<std::mutex> lk( m_lock );
+                if( --m_busy == 0 ) m_idle.notify_one();
+            }
+        }
+    }
+
+public:
+    rowBandPool( int threads )
+    {
+        m_quit = false;
+        m_generation = 0;
+        m_busy = 0;
+        m_job = nullptr;
+        m_rows = m_bandRows = m_bands = 0;
+        m_next = 0;
+
+        // the calling thread is one of the workers
+        for( int i=1;i<threads;i++ ) m_workers.emplace_back( &rowBandPool::worker, this );
+    }
+
+    ~rowBandPool()
+    {
+        {
+            std::lock_guard<std::mutex> lk( m_lock );
+            m_quit = true;
+        }
+        m_wake.notify_all();
+
+        for( auto &t : m_workers ) t.join();
+    }
+
+    int size() { return m_workers.size() + 1; }
+
+    void run( int rows, int bandRows, const std::function<void(int, int)> & fn )
+    {
+        std::lock_guard<std::mutex> run( m_runLock );
+
+        {
+            std::lock_guard<std::mutex> lk( m_lock );
+            m_job = &fn;
+            m_rows = rows;
+            m_bandRows = bandRows;
+            m_bands = (rows + bandRows - 1) / bandRows;
+            m_next = 0;
+            m_busy = m_workers.size();
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        runBands();
+
+        // the job lives on the caller's stack, wait until no worker can touch it
+        std::unique_lock<std::mutex> lk( m_lock );
+        m_idle.wait( lk, [&]{ return m_busy == 0; } );
+        m_job = nullptr;
+    }
+};
+
+static std::mutex s_poolLock;
+static std::shared_ptr<rowBandPool> s_pool;
+static int s_threads = 0;
+
+
+static int defaultThreads()
+{
+    int n = std::thread::hardware_concurrency();
+    return (n > 0) ? n : 1;
+}
+
+
+void setConversionThreads( int threads )
+{
+    std::lock_guard<std::mutex> lk( s_poolLock );
+
+    if( threads <= 0 ) threads = defaultThreads();
+    if( threads == s_threads ) return;
+
+    // the pool is rebuilt on the next conversion, a conversion still running keeps the old one alive
+    s_pool.reset();
+    s_threads = threads;
+}
+
+
+int getConversionThreads()
+{
+    std::lock_guard<std::mutex> lk( s_poolLock );
+
+    return (s_threads > 0) ? s_threads : defaultThreads();
+}
+
+
+void runRowBands( int rows, int rowBytes, int rowAlign, const std::function<void(int, int)> & fn )
+{
+    if( rows <= 0 ) return;
+    if( rowAlign < 1 ) rowAlign = 1;
+
+    long long total = (long long)rows * rowBytes;
+
+    // bands are whole multiples of rowAlign, so 4:2:0 chroma row pairs are never split
+    int bandRows = s_bandBytes / ((rowBytes > 0) ? rowBytes : 1);
+    bandRows -= bandRows % rowAlign;
+    if( bandRows < rowAlign ) bandRows = rowAlign;
+
+    std::shared_ptr<rowBandPool> pool;
+    {
+        std::lock_guard<std::mutex> lk( s_poolLock );
+
+        if( s_threads <= 0 ) s_threads = defaultThreads();
+        if( (s_threads > 1) && (total >= s_minThreadedBytes) && (rows > bandRows) )
+        {
+            if( !s_pool ) s_pool = std::make_shared<rowBandPool>( s_threads );
+            pool = s_pool;
+        }
+    }
+
+    if( pool ) pool->run( rows, bandRows, fn );
+    else fn( 0, rows );
+}
@@ -5,34 +5,73 @@
 #include <string>
 #include <array>
 #include <cstring>
+#include <vector>
+#include <future>
+#include <algorithm>
 
+// output bytes converted per block, two blocks are in flight (one converting, one writing)
+static const int s_bmpBlockBytes = 256 * 1024;
 
-bool saveRGB24AsBMP( unsigned char * rgbData, int width, int height, std::string fid )
+typedef struct                       /**** BMP file header structure ****/
 {
-    bool streamToStdout = (fid.length() == 0 );
+    unsigned int   bfSize;           /* Size of file */
+    unsigned short bfReserved1;      /* Reserved */
+    unsigned short bfReserved2;      /* ... */
+    unsigned int   bfOffBits;        /* Offset to bitmap data */
+} bmpFileHeader;
 
-    typedef struct                       /**** BMP file header structure ****/
-    {
-        unsigned int   bfSize;           /* Size of file */
-        unsigned short bfReserved1;      /* Reserved */
-        unsigned short bfReserved2;      /* ... */
-        unsigned int   bfOffBits;        /* Offset to bitmap data */
-    } bmpFileHeader;
+typedef struct                       /**** BMP file info structure ****/
+{
+    unsigned int   biSize;           /* Size of info header */
+    int            biWidth;          /* Width of image */
+    int            biHeight;         /* Height of image */
+    unsigned short biPlanes;         /* Number of color planes */
+    unsigned short biBitCount;       /* Number of bits per pixel */
+    unsigned int   biCompression;    /* Type of compression to use */
+    unsigned int   biSizeImage;      /* Size of image data */
+    int            biXPelsPerMeter;  /* X pixels per meter */
+    int            biYPelsPerMeter;  /* Y pixels per meter */
+    unsigned int   biClrUsed;        /* Number of colors used */
+    unsigned int   biClrImportant;   /* Number of important colors */
+} bmpInfoHeader;
+
+
+static void writeBMPHeaders( std::ostream & out, int width, int height, int rowBytes )
+{
+    bmpFileHeader bfh;
+    bmpInfoHeader bih;
 
-    typedef struct                       /**** BMP file info structure ****/
-    {
-        unsigned int   biSize;           /* Size of info header */
-        int            biWidth;          /* Width of image */
-        int            biHeight;         /* Height of image */
-        unsigned short biPlanes;         /* Number of color planes */
-        unsigned short biBitCount;       /* Number of bits per pixel */
-        unsigned int   biCompression;    /* Type of compression to use */
-        unsigned int   biSizeImage;      /* Size of image data */
-        int            biXPelsPerMeter;  /* X pixels per meter */
-        int            biYPelsPerMeter;  /* Y pixels per meter */
-        unsigned int   biClrUsed;        /* Number of colors used */
-        unsigned int   biClrImportant;   /* Number of important colors */
-    } bmpInfoHeader;
+    /* Magic number for file. It does not fit in the header structure due to alignment requirements, so put it outside */
+    unsigned short bfType = 0x4d42;
+    bfh.bfReserved1 = 0;
+    bfh.bfReserved2 = 0;
+    bfh.bfSize = 2 + sizeof(bmpFileHeader) + sizeof(bmpInfoHeader) + rowBytes * height;
+    bfh.bfOffBits = 0x36;
+
+    // positive height, the rows are stored bottom up
+    bih.biSize = sizeof(bmpInfoHeader);
+    bih.biWidth = width;
+    bih.biHeight = height;
+    bih.biPlanes = 1;
+    bih.biBitCount = 24;
+    bih.biCompression = 0;
+    bih.biSizeImage = rowBytes * height;
+    bih.biXPelsPerMeter = 5000;
+    bih.biYPelsPerMeter = 5000;
+    bih.biClrUsed = 0;
+    bih.biClrImportant = 0;
+
+    out.write( (const char *)&bfType, sizeof(bfType) );
+    out.write( (const char *)&bfh, sizeof(bfh) );
+    out.write( (const char *)&bih, sizeof(bih) );
+}
+
+
+bool saveAsBMP( const struct imageView & src, imageConvertFn convert, std::string fid, bool grayScale )
+{
+    bool streamToStdout = (fid.length() == 0 );
+
+    if( !convert || !src.plane[0] || (src.width <= 0) || (src.height <= 0) ) return false;
 
     std::ofstream pFile;
     if( !streamToStdout )
@@ -50,57 +89,88 @@ bool saveRGB24AsBMP( unsigned char * rgbData, int width, int height, std::string
             return false;
         }
     }
+    std::ostream & out = streamToStdout ? std::cout : pFile;
 
-    bmpFileHeader bfh;
-    bmpInfoHeader bih;
+    // each row is padded to a multiple of 4 bytes, the padding stays zero in the block buffers
+    int rowBytes = (src.width * 3 + 3) & ~3;
+    int blockRows = s_bmpBlockBytes / rowBytes;
+    blockRows &= ~1;
+    if( blockRows < 2 ) blockRows = 2;
 
-    /* Magic number for file. It does not fit in the header structure due to alignment requirements, so put it outside */
-    unsigned short bfType = 0x4d42;
-    bfh.bfReserved1 = 0;
-    bfh.bfReserved2 = 0;
-    bfh.bfSize = 2 + sizeof(bmpFileHeader) + sizeof(bmpInfoHeader) + width * height * 3;
-    bfh.bfOffBits = 0x36;
+    writeBMPHeaders( out, src.width, src.height, rowBytes );
 
-    bih.biSize = sizeof(bmpInfoHeader);
-    bih.biWidth = width;
-    bih.biHeight = height;
-    bih.biPlanes = 1;
-    bih.biBitCount = 24;
-    bih.biCompression = 0;
-    bih.biSizeImage = 0;
-    bih.biXPelsPerMeter = 5000;
-    bih.biYPelsPerMeter = 5000;
-    bih.biClrUsed = 0;
-    bih.biClrImportant = 0;
+    std::vector<unsigned char> blocks[2];
+    blocks[0].assign( (size_t)blockRows * rowBytes, 0 );
+    blocks[1].assign( (size_t)blockRows * rowBytes, 0 );
 
-    /* Write headers */
-    if( streamToStdout )
+    std::future<void> pending;
+    int which = 0;
+    bool converted = true;
+
+    // blocks start on even rows counted from the top, so 4:2:0 chroma rows are never split,
+    // and go out bottom block first
+    for( int first = ((src.height - 1) / blockRows) * blockRows; first >= 0; first -= blockRows )
     {
-        std::cout.write((const char *) &bfType, sizeof(bfType));
-        std::cout.write((const char *) &bfh, sizeof(bfh));
-        std::cout.write((const char *) &bih, sizeof(bih));
-        // now write the bitmap
-        std::cout.write((const char *)rgbData, width* height * 3);
+        int rows = std::min( blockRows, src.height - first );
+        std::vector<unsigned char> & block = blocks[which];
+
+        // a negative stride puts the bottom row of the block first
+        struct imageView dst = rgbView( block.data() + (size_t)(rows - 1) * rowBytes, src.width, rows, -rowBytes );
+        if( !convert( rowsView( src, first, rows ), dst, grayScale ) )
+        {
+            converted = false;
+            break;
+        }
 
+        // the other block is free once its write is done, then this one goes out while the next converts
+        if( pending.valid() ) pending.wait();
+        size_t bytes = (size_t)rows * rowBytes;
+        pending = std::async( std::launch::async, [&out, &block, bytes]{ out.write( (const char *)block.data(), bytes ); } );
+
+        which ^= 1;
+    }
+    if( pending.valid() ) pending.wait();
+
+    if( !converted )
+    {
+        std::cerr << "[\x1b[1;31mwarning\x1b[0m] Image conversion failed, BMP output is incomplete" << std::endl;
+        return false;
+    }
+
+    if( streamToStdout )
+    {
         // fluch the stream
         std::cout.flush();
 
         std::cerr << "[\x1b[1;33minfo\x1b[0m] Image output to STDOUT" << std::endl;
 
     } else {
-        pFile.write( (char *)&bfType, sizeof(bfType) );
-        pFile.write( (char *)& bfh, sizeof(bfh) );
-        pFile.write( (char *)& bih, sizeof(bih) );
-
-        /* Write bitmap */
-        pFile.write((char *)rgbData, width* height * 3);
-
         pFile.close();
+        if( pFile.fail() )
+        {
+            std::cerr << "[\x1b[1;31mwarning\x1b[0m] Failed writing image to : " << fid << std::endl;
+            return false;
+        }
 
         std::cerr << "[\x1b[1;33minfo\x1b[0m] Image saved to : " << fid << std::endl;
     }
 
-    
+    return true;
+}
+
+
+bool copyRGB24( const struct imageView & src, const struct imageView & dst, bool grayScale )
+{
+    if( !imageViewsFit( src, dst ) ) return false;
+
+    for( int row = 0; row < src.height; row++ )
+        memcpy( dst.plane[0] + row * dst.stride[0], src.plane[0] + row * src.stride[0], src.width * 3 );
 
     return true;
-}
\ No newline at end of file
+}
+
+
+bool saveRGB24AsBMP( unsigned char * rgbData, int width, int height, std::string fid )
+{
+    return saveAsBMP( rgbView( rgbData, width, height ), copyRGB24, fid );
+}
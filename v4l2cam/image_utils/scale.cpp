@@ -0,0 +1,365 @@
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#include "image_utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define IMAGE_UTILS_SSE2
+#endif
+
+// Fused downscale and conversion
+//
+// - Y, U and V are filtered in YUV space, one output row at a time, then converted through the same
+//   fixed point tables as the full size converters
+// - chroma is addressed through plane[1] / plane[2], two pixels share a chroma column and
+//   chromaRowShift says how many rows share a chroma row
+// - a view without chroma planes is grey scale, Y goes to all three output bytes
+//
+
+// fraction bits of the bilinear weights
+#define SCALE_FRAC_BITS 8
+#define SCALE_ONE (1 << SCALE_FRAC_BITS)
+
+static bool scaleViewsFit( const struct imageView & src, const struct imageView & dst )
+{
+    if( !src.plane[0] || !dst.plane[0] ) return false;
+    if( (src.width <= 0) || (src.height <= 0) || (dst.width <= 0) || (dst.height <= 0) ) return false;
+    if( std::abs( dst.stride[0] ) < dst.width * 3 ) return false;
+
+    return true;
+}
+
+
+// one output row of averaged Y, U, V to RGB24
+//
+static void yuv444RowToRGB( const int * y, const int * u, const int * v, int pixels, const struct yuvTables & t, bool grey, unsigned char * out )
+{
+    if( !u )
+    {
+        for( int i=0;i<pixels;i++, out+=3 ) out[0] = out[1] = out[2] = (unsigned char)y[i];
+        return;
+    }
+
+    if( grey )
+    {
+        for( int i=0;i<pixels;i++, out+=3 )
+            out[0] = out[1] = out[2] = yuvSaturate( t.y[y[i]] + t.c0[0][u[i]] + t.c1[0][v[i]] );
+        return;
+    }
+
+    for( int i=0;i<pixels;i++, out+=3 )
+    {
+        int Y = t.y[y[i]];
+
+        out[0] = yuvSaturate( Y + t.c0[0][u[i]] + t.c1[0][v[i]] );
+        out[1] = yuvSaturate( Y + t.c0[1][u[i]] + t.c1[1][v[i]] );
+        out[2] = yuvSaturate( Y + t.c0[2][u[i]] + t.c1[2][v[i]] );
+    }
+}
+
+
+// source span [first, last) under each output sample, never empty
+//
+static void areaSpans( int srcSize, int dstSize, std::vector<int> & first, std::vector<int> & last )
+{
+    first.resize( dstSize );
+    last.resize( dstSize );
+
+    for( int i=0;i<dstSize;i++ )
+    {
+        first[i] = (int)((long long)i * srcSize / dstSize);
+        last[i] = (int)((long long)(i + 1) * srcSize / dstSize);
+        if( last[i] <= first[i] ) last[i] = first[i] + 1;
+        if( last[i] > srcSize ) { last[i] = srcSize; first[i] = srcSize - 1; }
+    }
+}
+
+
+// add one source row into a full width accumulator, the common steps get their own loop
+//
+// - SSE2 widens 16, 8 or 4 samples at a time for steps of 1, 2 and 4 (Y, Y of YUYV / NV12 chroma,
+//   YUYV chroma), the loops stop short of the row end so no load reads past the last sample
+//
+static void accumulateRow( int * acc, const unsigned char * in, int samples, int step )
+{
+    int x = 0;
+
+#if defined(IMAGE_UTILS_SSE2)
+    if( getSimdLevel() != simdNone )
+    {
+        const __m128i zero = _mm_setzero_si128();
+
+        if( step == 1 )
+        {
+            for( ; x + 16 <= samples; x += 16 )
+            {
+                __m128i v = _mm_loadu_si128( (const __m128i *)(in + x) );
+                __m128i lo = _mm_unpacklo_epi8( v, zero );
+                __m128i hi = _mm_unpackhi_epi8( v, zero );
+                __m128i * a = (__m128i *)(acc + x);
+
+                _mm_storeu_si128( a + 0, _mm_add_epi32( _mm_loadu_si128( a + 0 ), _mm_unpacklo_epi16( lo, zero ) ) );
+                _mm_storeu_si128( a + 1, _mm_add_epi32( _mm_loadu_si128( a + 1 ), _mm_unpackhi_epi16( lo, zero ) ) );
+                _mm_storeu_si128( a + 2, _mm_add_epi32( _mm_loadu_si128( a + 2 ), _mm_unpacklo_epi16( hi, zero ) ) );
+                _mm_storeu_si128( a + 3, _mm_add_epi32( _mm_loadu_si128( a + 3 ), _mm_unpackhi_epi16( hi, zero ) ) );
+            }
+        } else if( step == 2 )
+        {
+            const __m128i lowByte = _mm_set1_epi16( 0x00FF );
+            for( ; x + 8 < samples; x += 8 )
+            {
+                __m128i v = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(in + 2 * x) ), lowByte );
+                __m128i * a = (__m128i *)(acc + x);
+
+                _mm_storeu_si128( a + 0, _mm_add_epi32( _mm_loadu_si128( a + 0 ), _mm_unpacklo_epi16( v, zero ) ) );
+                _mm_storeu_si128( a + 1, _mm_add_epi32( _mm_loadu_si128( a + 1 ), _mm_unpackhi_epi16( v, zero ) ) );
+            }
+        } else if( step == 4 )
+        {
+            const __m128i lowByte = _mm_set1_epi32( 0x000000FF );
+            for( ; x + 4 < samples; x += 4 )
+            {
+                __m128i v = _mm_and_si128( _mm_loadu_si128( (const __m128i *)(in + 4 * x) ), lowByte );
+                __m128i * a = (__m128i *)(acc + x);
+
+                _mm_storeu_si128( a, _mm_add_epi32( _mm_loadu_si128( a ), v ) );
+            }
+        }
+    }
+#endif
+
+    for( ; x < samples; x++ ) acc[x] += in[x * step];
+}
+
+
+// rounded average of the accumulated columns under each output pixel
+//
+// - acc[0] is zero and acc[x + 1] holds column x, the columns are turned into a running sum so every
+//   span is one subtraction however wide it is
+// - spans only take a couple of distinct widths, so the divide becomes a multiply by a reciprocal
+//   (24 fraction bits) looked up by span width
+//
+static void boxColumns( int * acc, int samples, const std::vector<int> & x0, const std::vector<int> & x1, int rows,
+                        std::vector<long long> & recip, int * out )
+{
+    for( int x = 1; x <= samples; x++ ) acc[x] += acc[x - 1];
+
+    for( size_t c = 1; c < recip.size(); c++ ) recip[c] = ((1LL << 24) + (rows * c) / 2) / (rows * c);
+
+    for( size_t ox = 0; ox < x0.size(); ox++ )
+    {
+        int s = acc[x1[ox]] - acc[x0[ox]];
+        out[ox] = (int)((s * recip[x1[ox] - x0[ox]] + (1LL << 23)) >> 24);
+    }
+}
+
+
+// widest span, sizes the reciprocal table
+//
+static int widestSpan( const std::vector<int> & x0, const std::vector<int> & x1 )
+{
+    int w = 1;
+    for( size_t i = 0; i < x0.size(); i++ ) w = std::max( w, x1[i] - x0[i] );
+
+    return w;
+}
+
+
+// box average of every source sample under each output pixel, rows are summed first then columns
+//
+static void scaleArea( const struct imageView & src, const struct imageView & dst, const struct yuvTables & t, bool grey )
+{
+    int widthC = (src.width + 1) / 2;
+    int samplesU = chromaRowSamples( src, 1 ), samplesV = chromaRowSamples( src, 2 );
+    bool colour = src.plane[1] && src.plane[2] && (samplesU > 0) && (samplesV > 0);
+    int heightC = ((src.height - 1) >> src.chromaRowShift) + 1;
+
+    std::vector<int> x0, x1, y0, y1, cx0, cx1, cy0, cy1;
+    areaSpans( src.width, dst.width, x0, x1 );
+    areaSpans( src.height, dst.height, y0, y1 );
+    areaSpans( widthC, dst.width, cx0, cx1 );
+    areaSpans( heightC, dst.height, cy0, cy1 );
+
+    // source bytes read for each output row
+    int rowBytes = src.width * ((src.height + dst.height - 1) / dst.height) * src.step[0];
+
+    runRowBands( dst.height, rowBytes, 1, [&]( int first, int last )
+    {
+        std::vector<int> accY( src.width + 1 ), accU( widthC + 1 ), accV( widthC + 1 );
+        std::vector<int> Y( dst.width ), U( dst.width ), V( dst.width );
+        std::vector<long long> recipY( widestSpan( x0, x1 ) + 1 ), recipC( widestSpan( cx0, cx1 ) + 1 );
+
+        for( int oy = first; oy < last; oy++ )
+        {
+            std::fill( accY.begin(), accY.end(), 0 );
+            for( int r = y0[oy]; r < y1[oy]; r++ )
+                accumulateRow( accY.data() + 1, src.plane[0] + r * src.stride[0], src.width, src.step[0] );
+            boxColumns( accY.data(), src.width, x0, x1, y1[oy] - y0[oy], recipY, Y.data() );
+
+            if( colour )
+            {
+                std::fill( accU.begin(), accU.end(), 0 );
+                std::fill( accV.begin(), accV.end(), 0 );
+                for( int r = cy0[oy]; r < cy1[oy]; r++ )
+                {
+                    accumulateRow( accU.data() + 1, src.plane[1] + r * src.stride[1], samplesU, src.step[1] );
+                    accumulateRow( accV.data() + 1, src.plane[2] + r * src.stride[2], samplesV, src.step[2] );
+                }
+
+                // the half pair at the end of an odd packed row reuses the chroma before it
+                if( samplesU < widthC ) accU[widthC] = accU[widthC - 1];
+                if( samplesV < widthC ) accV[widthC] = accV[widthC - 1];
+                boxColumns( accU.data(), widthC, cx0, cx1, cy1[oy] - cy0[oy], recipC, U.data() );
+                boxColumns( accV.data(), widthC, cx0, cx1, cy1[oy] - cy0[oy], recipC, V.data() );
+            }
+
+            yuv444RowToRGB( Y.data(), colour ? U.data() : nullptr, V.data(), dst.width, t, grey, dst.plane[0] + oy * dst.stride[0] );
+        }
+    });
+}
+
+
+// left tap and weight of the right tap for each output sample, pixel centres are lined up
+//
+static void bilinearTaps( int srcSize, int dstSize, std::vector<int> & tap, std::vector<int> & weight )
+{
+    tap.resize( dstSize );
+    weight.resize( dstSize );
+
+    for( int i=0;i<dstSize;i++ )
+    {
+        // (i + 0.5) * src / dst - 0.5 in SCALE_FRAC_BITS fixed point
+        long long pos = (((long long)(2 * i + 1) * srcSize * SCALE_ONE) / dstSize - SCALE_ONE) / 2;
+        if( pos < 0 ) pos = 0;
+
+        int p = (int)(pos >> SCALE_FRAC_BITS);
+        int w = (int)(pos & (SCALE_ONE - 1));
+        if( p >= srcSize - 1 ) { p = srcSize - 1; w = 0; }
+
+        tap[i] = p;
+        weight[i] = w;
+    }
+}
+
+
+static inline int bilinear( const unsigned char * r0, const unsigned char * r1, int a, int b, int wx, int wy )
+{
+    int top = r0[a] * (SCALE_ONE - wx) + r0[b] * wx;
+    int bottom = r1[a] * (SCALE_ONE - wx) + r1[b] * wx;
+
+    return (top * (SCALE_ONE - wy) + bottom * wy + (1 << (2 * SCALE_FRAC_BITS - 1))) >> (2 * SCALE_FRAC_BITS);
+}
+
+
+// four luma and four chroma samples per output pixel, whatever the scale factor
+//
+static void scaleBilinear( const struct imageView & src, const struct imageView & dst, const struct yuvTables & t, bool grey )
+{
+    int widthC = (src.width + 1) / 2;
+    int lastU = chromaRowSamples( src, 1 ) - 1, lastV = chromaRowSamples( src, 2 ) - 1;
+    bool colour = src.plane[1] && src.plane[2] && (lastU >= 0) && (lastV >= 0);
+    int heightC = ((src.height - 1) >> src.chromaRowShift) + 1;
+
+    std::vector<int> tx, wx, ty, wy, tcx, wcx, tcy, wcy;
+    bilinearTaps( src.width, dst.width, tx, wx );
+    bilinearTaps( src.height, dst.height, ty, wy );
+    bilinearTaps( widthC, dst.width, tcx, wcx );
+    bilinearTaps( heightC, dst.height, tcy, wcy );
+
+    // byte offsets of the left and right taps
+    std::vector<int> ya( dst.width ), yb( dst.width ), ua( dst.width ), ub( dst.width ), va( dst.width ), vb( dst.width );
+    for( int ox = 0; ox < dst.width; ox++ )
+    {
+        int right = (tx[ox] + 1 < src.width) ? tx[ox] + 1 : tx[ox];
+        ya[ox] = tx[ox] * src.step[0];
+        yb[ox] = right * src.step[0];
+
+        // taps past the last sample of an odd packed row fall back on the one before
+        int rightC = (tcx[ox] + 1 < widthC) ? tcx[ox] + 1 : tcx[ox];
+        ua[ox] = std::min( tcx[ox], lastU ) * src.step[1];
+        ub[ox] = std::min( rightC, lastU ) * src.step[1];
+        va[ox] = std::min( tcx[ox], lastV ) * src.step[2];
+        vb[ox] = std::min( rightC, lastV ) * src.step[2];
+    }
+
+    runRowBands( dst.height, dst.width * 3, 1, [&]( int first, int last )
+    {
+        std::vector<int> Y( dst.width ), U( dst.width ), V( dst.width );
+
+        for( int oy = first; oy < last; oy++ )
+        {
+            int below = (ty[oy] + 1 < src.height) ? ty[oy] + 1 : ty[oy];
+            const unsigned char * r0 = src.plane[0] + ty[oy] * src.stride[0];
+            const unsigned char * r1 = src.plane[0] + below * src.stride[0];
+
+            for( int ox = 0; ox < dst.width; ox++ ) Y[ox] = bilinear( r0, r1, ya[ox], yb[ox], wx[ox], wy[oy] );
+
+            if( colour )
+            {
+                int belowC = (tcy[oy] + 1 < heightC) ? tcy[oy] + 1 : tcy[oy];
+                const unsigned char * u0 = src.plane[1] + tcy[oy] * src.stride[1];
+                const unsigned char * u1 = src.plane[1] + belowC * src.stride[1];
+                const unsigned char * v0 = src.plane[2] + tcy[oy] * src.stride[2];
+                const unsigned char * v1 = src.plane[2] + belowC * src.stride[2];
+
+                for( int ox = 0; ox < dst.width; ox++ )
+                {
+                    U[ox] = bilinear( u0, u1, ua[ox], ub[ox], wcx[ox], wcy[oy] );
+                    V[ox] = bilinear( v0, v1, va[ox], vb[ox], wcx[ox], wcy[oy] );
+                }
+            }
+
+            yuv444RowToRGB( Y.data(), colour ? U.data() : nullptr, V.data(), dst.width, t, grey, dst.plane[0] + oy * dst.stride[0] );
+        }
+    });
+}
+
+
+static bool scaleView( const struct imageView & src, const struct imageView & dst, const struct yuvCoeffs & k, enum imageScaleFilter filter )
+{
+    if( !scaleViewsFit( src, dst ) ) return false;
+
+    struct yuvTables t;
+    buildYUVTables( k, t );
+
+    if( filter == scaleBilinearFilter ) scaleBilinear( src, dst, t, k.grey );
+    else scaleArea( src, dst, t, k.grey );
+
+    return true;
+}
+
+
+// YUYV, YVYU and all the 4:2:0 layouts, plane[1] is U and plane[2] is V
+//
+bool scaleYUV( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter )
+{
+    return scaleView( src, dst, classicYUVCoeffs( true, grayScale ), filter );
+}
+
+bool scaleYUY2( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter )
+{
+    // BT.601 full range, blue byte first, same as convertYUY2()
+    return scaleView( src, dst, yuvColorSpace<yuvMatrixBT601, yuvRangeFull>::coeffs( false ), filter );
+}
+
+bool scaleGrey( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter )
+{
+    // chroma planes are ignored, Y is copied to R, G and B
+    struct imageView grey = src;
+    grey.plane[1] = grey.plane[2] = nullptr;
+
+    return scaleView( grey, dst, classicYUVCoeffs( true, true ), filter );
+}
+
+// plane[1] is always U, so one specialization covers every YUV layout
+//
+template<enum yuvMatrix M, enum yuvRange R>
+bool scaleYUVAs( const struct imageView & src, const struct imageView & dst, bool grayScale, enum imageScaleFilter filter )
+{
+    return scaleView( src, dst, yuvColorSpace<M, R>::coeffs( grayScale ), filter );
+}
+
+#define SCALE_YUV_AS( M, R ) template bool scaleYUVAs<M, R>( const struct imageView &, const struct imageView &, bool, enum imageScaleFilter );
+YUV_COLOR_VARIANTS( SCALE_YUV_AS )
@@ -1,112 +1,82 @@
+#include <utility>
+
 #include "image_utils.h"
 
-unsigned char * yvu422ToRGB( unsigned char * yuyv_image, int width, int height, bool grayScale )
+// packed 4:2:2 rows are converted one at a time, so row padding in either view is skipped
+// and an odd width does not pair the last pixel of a row with the next row
+//
+static bool packed422View( const struct imageView & src, const struct imageView & dst, const struct yuvCoeffs & k )
 {
-    // return image array
-    unsigned char* rgb_image = new unsigned char[width * height * 3];
+    if( !imageViewsFit( src, dst ) ) return false;
 
-    int Y, U, V;
-    unsigned char R, G, B;
+    // tightly packed rows of pixel pairs convert a whole band in one call, the vector tail is only paid once
+    bool contiguous = !(src.width & 1) && (src.stride[0] == src.width * 2) && (dst.stride[0] == src.width * 3);
 
-    for( int i = 0, j = 0; i < width * height * 3; i+=6, j+=4 )
+    runRowBands( src.height, src.width * 3, 1, [&]( int first, int last )
     {
-        //first pixel
-        Y = yuyv_image[j];
-        V = yuyv_image[j+1];
-        U = yuyv_image[j+3];
-
-        R = R_fromYUV( Y, U, V );
-        G = R;
-        B = R;
-        if( !grayScale )
+        if( contiguous )
         {
-            G = G_fromYUV( Y, U, V );
-            B = B_fromYUV( Y, U, V );
+            convertPacked422( src.plane[0] + first * src.stride[0], dst.plane[0] + first * dst.stride[0], (last - first) * src.width, k );
+            return;
         }
 
-        rgb_image[i] = R;
-        rgb_image[i+1] = G;
-        rgb_image[i+2] = B;
+        for( int row = first; row < last; row++ )
+            convertPacked422( src.plane[0] + row * src.stride[0], dst.plane[0] + row * dst.stride[0], src.width, k );
+    });
 
-        //second pixel
-        Y = yuyv_image[j+2];
-        V = yuyv_image[j+1];
-        U = yuyv_image[j+3];
+    return true;
+}
 
-        R = R_fromYUV( Y, U, V );
-        G = R;
-        B = R;
-        if( !grayScale )
-        {
-            G = G_fromYUV( Y, U, V );
-            B = B_fromYUV( Y, U, V );
-        }
+bool convertYVYU( const struct imageView & src, const struct imageView & dst, bool grayScale )
+{
+    return packed422View( src, dst, classicYUVCoeffs( false, grayScale ) );
+}
 
-        rgb_image[i+3] = R;
-        rgb_image[i+4] = G;
-        rgb_image[i+5] = B;
-    }
+bool convertYUYV( const struct imageView & src, const struct imageView & dst, bool grayScale )
+{
+    return packed422View( src, dst, classicYUVCoeffs( true, grayScale ) );
+}
 
-    return rgb_image;
+bool convertYUY2( const struct imageView & src, const struct imageView & dst, bool grayScale )
+{
+    // BT.601 full range, blue byte first
+    return packed422View( src, dst, yuvColorSpace<yuvMatrixBT601, yuvRangeFull>::coeffs( false ) );
 }
 
-unsigned char * yuv422ToRGB( unsigned char * yuyv_image, int width, int height, bool grayScale )
+// YUYV and YUY2 have U at byte 1, YVYU has V there, the view says which
+//
+template<enum yuvMatrix M, enum yuvRange R>
+bool convertPacked422As( const struct imageView & src, const struct imageView & dst, bool grayScale )
 {
-    // return image array
-    unsigned char* rgb_image = new unsigned char[width * height * 3];
+    struct yuvCoeffs k = yuvColorSpace<M, R>::coeffs( grayScale );
 
-    int Y, U, V;
-    unsigned char R, G, B;
+    if( src.plane[2] < src.plane[1] )
+        for( int n=0;n<3;n++ ) std::swap( k.ch[n][0], k.ch[n][1] );
 
-    for( int i = 0, j = 0; i < width * height * 3; i+=6, j+=4 )
-    {
-        //first pixel
-        Y = yuyv_image[j];
-        U = yuyv_image[j+1];
-        V = yuyv_image[j+3];
-
-        R = R_fromYUV( Y, U, V );
-        G = R;
-        B = R;
-        if( !grayScale )
-        {
-            G = G_fromYUV( Y, U, V );
-            B = B_fromYUV( Y, U, V );
-        }
-
-        rgb_image[i] = R;
-        rgb_image[i+1] = G;
-        rgb_image[i+2] = B;
+    return packed422View( src, dst, k );
+}
 
-        //second pixel
-        Y = yuyv_image[j+2];
-        U = yuyv_image[j+1];
-        V = yuyv_image[j+3];
+#define PACKED422_AS( M, R ) template bool convertPacked422As<M, R>( const struct imageView &, const struct imageView &, bool );
+YUV_COLOR_VARIANTS( PACKED422_AS )
 
-        R = R_fromYUV( Y, U, V );
-        G = R;
-        B = R;
-        if( !grayScale )
-        {
-            G = G_fromYUV( Y, U, V );
-            B = B_fromYUV( Y, U, V );
-        }
+unsigned char * yvu422ToRGB( unsigned char * yuyv_image, int width, int height, bool grayScale )
+{
+    // return image array
+    unsigned char* rgb_image = new unsigned char[width * height * 3];
 
-        rgb_image[i+3] = R;
-        rgb_image[i+4] = G;
-        rgb_image[i+5] = B;
-    }
+    convertYVYU( packed422Layout( yuyv_image, width, height ), rgbView( rgb_image, width, height ), grayScale );
 
     return rgb_image;
 }
 
-unsigned char clamp(double value, double min, double max)
+unsigned char * yuv422ToRGB( unsigned char * yuyv_image, int width, int height, bool grayScale )
 {
-    if (value < min)
-        return static_cast<unsigned char>(min);
-    if (value > max)
-        return static_cast<unsigned char>(max);
-    return static_cast<unsigned char>(value);
+    // return image array
+    unsigned char* rgb_image = new unsigned char[width * height * 3];
+
+    convertYUYV( packed422Layout( yuyv_image, width, height ), rgbView( rgb_image, width, height ), grayScale );
+
+    return rgb_image;
 }
 
 unsigned char* yuy2422ToRGB(unsigned char* yuy2Data, int width, int height, bool grayScale)
@@ -114,22 +84,7 @@ unsigned char* yuy2422ToRGB(unsigned char* yuy2Data, int width, int height, bool
     // return image array
     unsigned char* rgbData = new unsigned char[width * height * 3];
 
-    int rgbIndex = 0;
-    for (int i = 0; i < width * height * 2; i += 4)
-    {
-        unsigned char y1 = yuy2Data[i];
-        unsigned char u = yuy2Data[i + 1];
-        unsigned char y2 = yuy2Data[i + 2];
-        unsigned char v = yuy2Data[i + 3];
-
-        rgbData[rgbIndex++] = clamp(y1 + 1.772 * (u - 128), 0.0, 255.0);
-        rgbData[rgbIndex++] = clamp(y1 - 0.344136 * (u - 128) - 0.714136 * (v - 128), 0.0, 255.0);
-        rgbData[rgbIndex++] = clamp(y1 + 1.402 * (v - 128), 0.0, 255.0);
-
-        rgbData[rgbIndex++] = clamp(y2 + 1.772 * (u - 128), 0.0, 255.0);
-        rgbData[rgbIndex++] = clamp(y2 - 0.344136 * (u - 128) - 0.714136 * (v - 128), 0.0, 255.0);
-        rgbData[rgbIndex++] = clamp(y2 + 1.402 * (v - 128), 0.0, 255.0);
-    }
+    convertYUY2( packed422Layout( yuy2Data, width, height ), rgbView( rgbData, width, height ), grayScale );
 
     return rgbData;
-}
\ No newline at end of file
+}
@@ -0,0 +1,309 @@
+#include <atomic>
+#include <cstring>
+
+#include "image_utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGE_UTILS_X86
+#endif
+
+#if defined(__aarch64__) && defined(IMAGE_UTILS_ENABLE_NEON)
+#include <arm_neon.h>
+#define IMAGE_UTILS_NEON
+#endif
+
+// Packed 4:2:2 (Y0 C1 Y1 C3) to 24 bit RGB kernels
+//
+// - all kernels use the same fixed point math as the table driven scalar core, so the output is
+//   byte identical whichever kernel runs
+// - the caller supplies the coefficients, which also decides which chroma byte is U and which is V
+//
+
+// the kernels ask from the conversion threads, so the override is atomic, -1 until setSimdLevel()
+static std::atomic<int> s_simdOverride( -1 );
+
+static enum imageSimdLevel detectSimdLevel()
+{
+#if defined(IMAGE_UTILS_X86)
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports( "avx2" ) ) return simdAVX2;
+    if( __builtin_cpu_supports( "sse2" ) ) return simdSSE2;
+#elif defined(IMAGE_UTILS_NEON)
+    // always present on aarch64
+    return simdNEON;
+#endif
+
+    return simdNone;
+}
+
+
+enum imageSimdLevel getSimdLevel()
+{
+    // detected once, thread safe static initialization
+    static const enum imageSimdLevel detected = detectSimdLevel();
+
+    int level = s_simdOverride.load( std::memory_order_relaxed );
+    return (level < 0) ? detected : (enum imageSimdLevel)level;
+}
+
+
+bool setSimdLevel( enum imageSimdLevel level )
+{
+    enum imageSimdLevel best = detectSimdLevel();
+    bool ok = (simdNone == level) || (level == best);
+
+#if defined(IMAGE_UTILS_X86)
+    // an AVX2 machine can still run the SSE2 kernel
+    if( (simdSSE2 == level) && (simdAVX2 == best) ) ok = true;
+#endif
+
+    if( !ok ) return false;
+
+    s_simdOverride.store( level, std::memory_order_relaxed );
+
+    return true;
+}
+
+
+std::string simdLevelToString( enum imageSimdLevel level )
+{
+    switch( level )
+    {
+        case simdSSE2: return "SSE2";
+        case simdAVX2: return "AVX2";
+        case simdNEON: return "NEON";
+        default: break;
+    }
+
+    return "scalar";
+}
+
+
+// Scalar reference, also used for the pixels left over by the vector kernels
+//
+static void packed422Scalar( const unsigned char * src, unsigned char * dst, int pixels, const struct yuvCoeffs & k )
+{
+    if( pixels <= 0 ) return;
+
+    // callers convert row by row, so the tables are only rebuilt when the coefficients change
+    thread_local struct yuvCoeffs built = {};
+    thread_local bool haveTables = false;
+    thread_local struct yuvTables t;
+
+    if( !haveTables || memcmp( built.ch, k.ch, sizeof(k.ch) ) || (built.y != k.y) || (built.yOffset != k.yOffset) )
+    {
+        buildYUVTables( k, t );
+        built = k;
+        haveTables = true;
+    }
+
+    int pairs = pixels & ~1;
+    yuvRowToRGB( src, 2, src + 1, src + 3, 4, pairs, t, k.grey, dst );
+
+    // odd pixel count, the last pixel has no partner so its second chroma sample is missing
+    if( pixels & 1 )
+    {
+        const unsigned char neutral = 128;
+        yuvRowToRGB( src + pairs * 2, 2, src + pairs * 2 + 1, &neutral, 0, 1, t, k.grey, dst + pairs * 3 );
+    }
+}
+
+
+#if defined(IMAGE_UTILS_X86)
+
+// 8 pixels per loop, pmaddwd works on the (C1, C3) pairs so each macro pixel needs one multiply-add per channel
+//
+static void packed422SSE2( const unsigned char * src, unsigned char * dst, int pixels, const struct yuvCoeffs & k )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowByte = _mm_set1_epi16( 0x00FF );
+    const __m128i c128 = _mm_set1_epi16( 128 );
+    const __m128i keep0 = _mm_set1_epi64x( 0x0000000000FFFFFFLL );
+    const __m128i keep1 = _mm_set1_epi64x( 0x0000FFFFFF000000LL );
+
+    const __m128i yOff = _mm_set1_epi16( k.yOffset );
+    const __m128i ky = _mm_set1_epi32( k.y & 0xFFFF );
+
+    __m128i kv[3];
+    for( int c=0;c<3;c++ ) kv[c] = _mm_set1_epi32( (k.ch[c][1] << 16) | (k.ch[c][0] & 0xFFFF) );
+
+    int i = 0;
+
+    // the last store writes 2 bytes past the 8th pixel, leave at least one pixel for the scalar tail
+    for( ;i+8<pixels;i+=8, src+=16, dst+=24 )
+    {
+        __m128i in = _mm_loadu_si128( (const __m128i *)src );
+        __m128i y = _mm_sub_epi16( _mm_and_si128( in, lowByte ), yOff );
+        __m128i c = _mm_sub_epi16( _mm_srli_epi16( in, 8 ), c128 );
+
+        // (Y - offset, 0) pairs, so one multiply-add applies the luma gain
+        __m128i ylo = _mm_madd_epi16( _mm_unpacklo_epi16( y, zero ), ky );
+        __m128i yhi = _mm_madd_epi16( _mm_unpackhi_epi16( y, zero ), ky );
+
+        __m128i ch[3];
+        for( int n=0;n<3;n++ )
+        {
+            if( k.grey && (n > 0) ) { ch[n] = ch[0]; continue; }
+
+            // one term per macro pixel, shared by both of its pixels
+            __m128i t = _mm_madd_epi16( c, kv[n] );
+            __m128i lo = _mm_srai_epi32( _mm_add_epi32( ylo, _mm_unpacklo_epi32( t, t ) ), YUV_FIX_SHIFT );
+            __m128i hi = _mm_srai_epi32( _mm_add_epi32( yhi, _mm_unpackhi_epi32( t, t ) ), YUV_FIX_SHIFT );
+            __m128i w = _mm_packs_epi32( lo, hi );
+            ch[n] = _mm_packus_epi16( w, w );
+        }
+
+        // interleave to 4 byte pixels, then squeeze each 64 bit lane down to 6 bytes
+        __m128i c01 = _mm_unpacklo_epi8( ch[0], ch[1] );
+        __m128i c2z = _mm_unpacklo_epi8( ch[2], zero );
+        __m128i p0 = _mm_unpacklo_epi16( c01, c2z );
+        __m128i p1 = _mm_unpackhi_epi16( c01, c2z );
+
+        p0 = _mm_or_si128( _mm_and_si128( p0, keep0 ), _mm_and_si128( _mm_srli_epi64( p0, 8 ), keep1 ) );
+        p1 = _mm_or_si128( _mm_and_si128( p1, keep0 ), _mm_and_si128( _mm_srli_epi64( p1, 8 ), keep1 ) );
+
+        // overlapping stores, each one overwrites the 2 spare bytes of the one before
+        _mm_storel_epi64( (__m128i *)(dst), p0 );
+        _mm_storel_epi64( (__m128i *)(dst + 6), _mm_srli_si128( p0, 8 ) );
+        _mm_storel_epi64( (__m128i *)(dst + 12), p1 );
+        _mm_storel_epi64( (__m128i *)(dst + 18), _mm_srli_si128( p1, 8 ) );
+    }
+
+    packed422Scalar( src, dst, pixels - i, k );
+}
+
+
+// 16 pixels per loop, same layout as the SSE2 kernel in each 128 bit lane
+//
+__attribute__((target("avx2")))
+static void packed422AVX2( const unsigned char * src, unsigned char * dst, int pixels, const struct yuvCoeffs & k )
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lowByte = _mm256_set1_epi16( 0x00FF );
+    const __m256i c128 = _mm256_set1_epi16( 128 );
+    const __m256i keep0 = _mm256_set1_epi64x( 0x0000000000FFFFFFLL );
+    const __m256i keep1 = _mm256_set1_epi64x( 0x0000FFFFFF000000LL );
+
+    const __m256i yOff = _mm256_set1_epi16( k.yOffset );
+    const __m256i ky = _mm256_set1_epi32( k.y & 0xFFFF );
+
+    __m256i kv[3];
+    for( int c=0;c<3;c++ ) kv[c] = _mm256_set1_epi32( (k.ch[c][1] << 16) | (k.ch[c][0] & 0xFFFF) );
+
+    int i = 0;
+
+    for( ;i+16<pixels;i+=16, src+=32, dst+=48 )
+    {
+        __m256i in = _mm256_loadu_si256( (const __m256i *)src );
+        __m256i y = _mm256_sub_epi16( _mm256_and_si256( in, lowByte ), yOff );
+        __m256i c = _mm256_sub_epi16( _mm256_srli_epi16( in, 8 ), c128 );
+
+        __m256i ylo = _mm256_madd_epi16( _mm256_unpacklo_epi16( y, zero ), ky );
+        __m256i yhi = _mm256_madd_epi16( _mm256_unpackhi_epi16( y, zero ), ky );
+
+        __m256i ch[3];
+        for( int n=0;n<3;n++ )
+        {
+            if( k.grey && (n > 0) ) { ch[n] = ch[0]; continue; }
+
+            __m256i t = _mm256_madd_epi16( c, kv[n] );
+            __m256i lo = _mm256_srai_epi32( _mm256_add_epi32( ylo, _mm256_unpacklo_epi32( t, t ) ), YUV_FIX_SHIFT );
+            __m256i hi = _mm256_srai_epi32( _mm256_add_epi32( yhi, _mm256_unpackhi_epi32( t, t ) ), YUV_FIX_SHIFT );
+            __m256i w = _mm256_packs_epi32( lo, hi );
+            ch[n] = _mm256_packus_epi16( w, w );
+        }
+
+        __m256i c01 = _mm256_unpacklo_epi8( ch[0], ch[1] );
+        __m256i c2z = _mm256_unpacklo_epi8( ch[2], zero );
+        __m256i p0 = _mm256_unpacklo_epi16( c01, c2z );
+        __m256i p1 = _mm256_unpackhi_epi16( c01, c2z );
+
+        p0 = _mm256_or_si256( _mm256_and_si256( p0, keep0 ), _mm256_and_si256( _mm256_srli_epi64( p0, 8 ), keep1 ) );
+        p1 = _mm256_or_si256( _mm256_and_si256( p1, keep0 ), _mm256_and_si256( _mm256_srli_epi64( p1, 8 ), keep1 ) );
+
+        // lane 0 holds pixels 0-7, lane 1 pixels 8-15
+        __m128i q[4] = { _mm256_castsi256_si128( p0 ), _mm256_castsi256_si128( p1 ),
+                         _mm256_extracti128_si256( p0, 1 ), _mm256_extracti128_si256( p1, 1 ) };
+
+        for( int n=0;n<4;n++ )
+        {
+            _mm_storel_epi64( (__m128i *)(dst + n * 12), q[n] );
+            _mm_storel_epi64( (__m128i *)(dst + n * 12 + 6), _mm_srli_si128( q[n], 8 ) );
+        }
+    }
+
+    packed422Scalar( src, dst, pixels - i, k );
+}
+
+#endif // IMAGE_UTILS_X86
+
+
+#if defined(IMAGE_UTILS_NEON)
+
+// 16 pixels per loop, vld4 splits Y0 / C1 / Y1 / C3 and vst3 does the RGB interleave
+//
+static void packed422NEON( const unsigned char * src, unsigned char * dst, int pixels, const struct yuvCoeffs & k )
+{
+    const int16x8_t c128 = vdupq_n_s16( 128 );
+    const int16x8_t yOff = vdupq_n_s16( k.yOffset );
+
+    int i = 0;
+
+    for( ;i+16<=pixels;i+=16, src+=32, dst+=48 )
+    {
+        uint8x8x4_t in = vld4_u8( src );
+
+        int16x8_t y0 = vsubq_s16( vreinterpretq_s16_u16( vmovl_u8( in.val[0] ) ), yOff );
+        int16x8_t y1 = vsubq_s16( vreinterpretq_s16_u16( vmovl_u8( in.val[2] ) ), yOff );
+        int16x8_t c1 = vsubq_s16( vreinterpretq_s16_u16( vmovl_u8( in.val[1] ) ), c128 );
+        int16x8_t c3 = vsubq_s16( vreinterpretq_s16_u16( vmovl_u8( in.val[3] ) ), c128 );
+
+        int32x4_t y0lo = vmull_n_s16( vget_low_s16( y0 ), k.y );
+        int32x4_t y0hi = vmull_n_s16( vget_high_s16( y0 ), k.y );
+        int32x4_t y1lo = vmull_n_s16( vget_low_s16( y1 ), k.y );
+        int32x4_t y1hi = vmull_n_s16( vget_high_s16( y1 ), k.y );
+
+        uint8x16x3_t out;
+        for( int n=0;n<3;n++ )
+        {
+            if( k.grey && (n > 0) ) { out.val[n] = out.val[0]; continue; }
+
+            int32x4_t tlo = vmlal_n_s16( vmull_n_s16( vget_low_s16( c1 ), k.ch[n][0] ), vget_low_s16( c3 ), k.ch[n][1] );
+            int32x4_t thi = vmlal_n_s16( vmull_n_s16( vget_high_s16( c1 ), k.ch[n][0] ), vget_high_s16( c3 ), k.ch[n][1] );
+
+            // narrowing shifts round down and saturate, same as the scalar clamp
+            uint8x8_t even = vqmovun_s16( vcombine_s16( vqshrn_n_s32( vaddq_s32( y0lo, tlo ), YUV_FIX_SHIFT ),
+                                                        vqshrn_n_s32( vaddq_s32( y0hi, thi ), YUV_FIX_SHIFT ) ) );
+            uint8x8_t odd = vqmovun_s16( vcombine_s16( vqshrn_n_s32( vaddq_s32( y1lo, tlo ), YUV_FIX_SHIFT ),
+                                                       vqshrn_n_s32( vaddq_s32( y1hi, thi ), YUV_FIX_SHIFT ) ) );
+
+            uint8x8x2_t z = vzip_u8( even, odd );
+            out.val[n] = vcombine_u8( z.val[0], z.val[1] );
+        }
+
+        vst3q_u8( dst, out );
+    }
+
+    packed422Scalar( src, dst, pixels - i, k );
+}
+
+#endif // IMAGE_UTILS_NEON
+
+
+void convertPacked422( const unsigned char * src, unsigned char * dst, int pixels, const struct yuvCoeffs & k )
+{
+    switch( getSimdLevel() )
+    {
+#if defined(IMAGE_UTILS_X86)
+        case simdAVX2: packed422AVX2( src, dst, pixels, k ); return;
+        case simdSSE2: packed422SSE2( src, dst, pixels, k ); return;
+#endif
+#if defined(IMAGE_UTILS_NEON)
+        case simdNEON: packed422NEON( src, dst, pixels, k ); return;
+#endif
+        default: break;
+    }
+
+    packed422Scalar( src, dst, pixels, k );
+}
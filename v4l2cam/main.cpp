@@ -5,8 +5,11 @@
 #include <string>
 #include <sstream>
 #include <chrono>
+#include <thread>
+#include <algorithm>
 
 #include "defines.h"
+#include "image_utils/image_utils.h"
 
 #ifdef __linux__
     #include <unistd.h>
@@ -53,6 +56,38 @@ int main( int argc, char** argv )
     // always print the version, if requested
 	if (cmdLine["v"] == "1") printVersionInfo();
 
+    // threads used for image conversion, applies to every command
+    if( cmdLine["j"].length() > 0 )
+    {
+        int threads = 0;
+        if( !parseInt( cmdLine["j"], threads ) )
+        {
+            outerr( "Invalid thread count [" + cmdLine["j"] + "]" );
+            return 1;
+        }
+
+        // past a few threads per core the bands only take turns
+        int most = 4 * std::max( (int)std::thread::hardware_concurrency(), 1 );
+        if( threads > most )
+        {
+            threads = most;
+            outwarn( "Too many conversion threads, using " + std::to_string(threads) );
+        }
+        setConversionThreads( threads );
+    }
+
+    // tone curve for the high bit depth grey modes, applies to every command
+    if( cmdLine["G"].length() > 0 )
+    {
+        struct greyToneMap map;
+        if( !parseGreyToneMap( cmdLine["G"], map ) )
+        {
+            outerr( "Invalid tone map [" + cmdLine["G"] + "]" );
+            return 1;
+        }
+        setGreyToneMap( map );
+    }
+
     // Exclusive Commands, execute and return
 
     // show example commands
@@ -105,7 +140,7 @@ int main( int argc, char** argv )
     else if( cmdLine["g"] == "1" )
     {
         // make sure there is a device specified
-        if( cmdLine["d"].length() > 0 ) captureFrame(cmdLine["d"], cmdLine["o"], cmdLine["f"]);
+        if( cmdLine["d"].length() > 0 ) captureFrame(cmdLine["d"], cmdLine["o"], cmdLine["f"], "", cmdLine["C"], cmdLine["q"]);
         else outwarn("Must provide a device number to grab an image : -d [0..63]");
     }
                     
@@ -113,7 +148,7 @@ int main( int argc, char** argv )
     else if( cmdLine["c"] == "1")
     {
         // make sure there is a device specified
-        if (cmdLine["d"].length() > 0) captureFrames(cmdLine["d"], cmdLine["t"], cmdLine["o"], cmdLine["H"]);
+        if (cmdLine["d"].length() > 0) captureFrames(cmdLine["d"], cmdLine["t"], cmdLine["o"], cmdLine["H"], cmdLine["P"], cmdLine["f"], cmdLine["A"], cmdLine["w"]);
         else outwarn("Must provide a device number to start video capture : -d [0..63]");
     }
                         
@@ -329,6 +364,97 @@ std::map<std::string, std::string> parseCmdLine( int argc, char** argv )
             }
         }
 
+        // Image conversion threads, 0 is one per core
+        if( argS == "-j" )
+        {
+            if( (i < argc) && (is_number(argv[i])) ) { cmdLine["j"] = argv[i++]; continue; }
+            else
+            {
+                outerr( "Invalid attribute for conversion threads [-j]" );
+                printBasicHelp();
+                cmdLine.clear();
+                return cmdLine;
+            }
+        }
+
+        // JPEG quality for image grabs from uncompressed modes
+        if( argS == "-q" )
+        {
+            if( (i < argc) && (is_number(argv[i])) ) { cmdLine["q"] = argv[i++]; continue; }
+            else
+            {
+                outerr( "Invalid attribute for JPEG quality [-q]" );
+                printBasicHelp();
+                cmdLine.clear();
+                return cmdLine;
+            }
+        }
+
+        // Tone curve for high bit depth grey, second parameter is a comma separated list
+        if( argS == "-G" )
+        {
+            if( (i < argc) ) { cmdLine["G"] = argv[i++]; continue; }
+            else
+            {
+                outerr( "Invalid attribute for Tone map [-G]" );
+                printBasicHelp();
+                cmdLine.clear();
+                return cmdLine;
+            }
+        }
+
+        // Crop rectangle for image grabs, second parameter is x,y,width,height
+        if( argS == "-C" )
+        {
+            if( (i < argc) ) { cmdLine["C"] = argv[i++]; continue; }
+            else
+            {
+                outerr( "Invalid attribute for Crop rectangle [-C]" );
+                printBasicHelp();
+                cmdLine.clear();
+                return cmdLine;
+            }
+        }
+
+        // Frame statistics for video capture, second parameter is the row subsample
+        if( argS == "-A" )
+        {
+            if( (i < argc) && (is_number(argv[i])) ) { cmdLine["A"] = argv[i++]; continue; }
+            else
+            {
+                outerr( "Invalid attribute for Frame statistics [-A]" );
+                printBasicHelp();
+                cmdLine.clear();
+                return cmdLine;
+            }
+        }
+
+        // Motion gating for video capture, second parameter is a comma separated list
+        if( argS == "-w" )
+        {
+            if( (i < argc) ) { cmdLine["w"] = argv[i++]; continue; }
+            else
+            {
+                outerr( "Invalid attribute for Motion gating [-w]" );
+                printBasicHelp();
+                cmdLine.clear();
+                return cmdLine;
+            }
+        }
+
+        // Preview image for video capture, second parameter is filename
+        if( argS == "-P" )
+        {
+            if( (i < argc) ) { cmdLine["P"] = argv[i++]; continue; }
+            else
+            {
+                outerr( "Invalid attribute for Preview file name [-P]" );
+                printBasicHelp();
+                cmdLine.clear();
+                return cmdLine;
+            }
+        }
+
         // Output File name, default to STDOUT if not set, second parameter is filename
         if( argS == "-o" )
         {
@@ -78,12 +78,29 @@ int printBasicHelp()
     outln( "---" );
     outln( "-o file     :   specify filename for output, will send to stdout if not set" );
     outln( "-f fmt      :   specify output format for image, no attempt will be made to ensure the format matches the requested file extension");
-    outln( "            :   ...   jpg - only supported if video mode is MJPEG");
-    outln( "            :   ...   bmp - supported from all video modes except MJPEG");
+    outln( "            :   ...   jpg - MJPEG frames are written as they are, other video modes are encoded to baseline JPEG");
+    outln( "            :   ...   bmp - supported from all video modes, MJPEG frames must be baseline (not progressive)");
+    outln( "            :   ...   qoi - lossless QOI image, grey modes keep 8 or 16 bit samples (single channel qoig variant)");
+    outln( "            :   ...   thumb - 1/8 scale bmp preview, MJPEG frames only decode the DC term of each block");
+    outln( "            :   ...   nv12, i420 - 4:2:0 YUV for an encoder, repacked from YUV modes (or decoded from MJPEG) without RGB");
+    outln( "            :   ...   nv12 and i420 also apply to video capture, each frame is repacked");
     outln( "            :   ...   h264 - special encapulation for H264 video data, only supported in video capture mode");
     outln( "            :   ...   raw - output raw image data captured from camera, including MJPEG");
     outln( "            :   ...   any other fmt, image will be output as raw image data");
     outln( "            :   ...   if no fmt specified or not flag, image will be output as raw image data");
+    outln( "-j [val]    :   number of threads used to convert images, default is one per core, 1 to disable");
+    outln( "-q [1..100] :   quality of jpg images encoded from uncompressed video modes, default is 85");
+    outln( "-C x,y,w,h  :   only convert and output this region of the image, bmp, qoi and encoded jpg output of image grabs only");
+    outln( "                ... moved out to whole pixel pairs (and row pairs for 4:2:0) to suit the chroma samples");
+    outln( "-G spec     :   tone curve for 10, 12, 14 and 16 bit grey (thermal) modes, comma separated words");
+    outln( "                ... linear (default), gamma[=2.2] or eq(ualize), auto sets the levels from the histogram");
+    outln( "                ... low:high is a fixed window of sample values, grey (default), iron or rainbow picks the colours");
+    outln( "-P file     :   keep a 1/8 scale bmp preview of the video capture in file, refreshed about once a second");
+    outln( "-A [n]      :   measure luma statistics of every captured frame from every n-th row, reported about once a second");
+    outln( "                ... mean, spread, percent clipped dark and bright, and a sharpness (focus) figure");
+    outln( "-w spec     :   only write video frames around motion, spec is on or comma separated words");
+    outln( "                ... level=10 mean luma change of a block, area=0.5 percent of blocks that have to change");
+    outln( "                ... learn=5 background follows 1/32 of each frame, pre=15 and post=60 frames kept around the motion");
     outln( "-H          :   add header to H264 frames, only supported in video capture mode");
     outln( "                ... H264 header has frame rate and frame size information");
     outln( "                ... if this option is excluded and normal raw header is used the header is");
@@ -0,0 +1,187 @@
+// Regression checks for image_utils, built with AddressSanitizer by "make check"
+//
+// - each check prints its name and ok or FAILED, the exit status is the number of failures
+// - damaged input has to fail cleanly, over-reads and over-writes are caught by the sanitizer
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../image_utils/image_utils.h"
+
+static int s_failures = 0;
+
+static void check( const std::string & name, bool ok )
+{
+    std::printf( "%-60s %s\n", name.c_str(), ok ? "ok" : "FAILED" );
+    if( !ok ) s_failures++;
+}
+
+
+// JPEG decoder
+//
+
+// a DHT segment with more codes of one length than the length can hold
+//
+static void checkOversubscribedDHT()
+{
+    for( int len=1;len<=9;len++ )
+    {
+        // one more code than len bits allow, 256 at most
+        int codes = std::min( (1 << len) + 1, 256 );
+        std::vector<unsigned char> jpeg = { 0xFF, 0xD8, 0xFF, 0xC4 };
+        int segment = 2 + 1 + 16 + codes;
+
+        jpeg.push_back( (unsigned char)(segment >> 8) );
+        jpeg.push_back( (unsigned char)(segment & 0xFF) );
+        jpeg.push_back( 0x00 );
+        for( int i=1;i<=16;i++ ) jpeg.push_back( (i == len) ? (unsigned char)codes : 0 );
+        for( int i=0;i<codes;i++ ) jpeg.push_back( (unsigned char)i );
+        jpeg.push_back( 0xFF );
+        jpeg.push_back( 0xD9 );
+
+        struct jpegInfo info;
+        check( "oversubscribed DHT, " + std::to_string( codes ) + " codes of length " + std::to_string( len ) + " rejected",
+               !jpegReadInfo( jpeg.data(), jpeg.size(), info ) );
+    }
+}
+
+
+// a frame with a restart marker on every MCU row decoded on four pool threads, as on one
+//
+static void checkThreadedRestartDecode()
+{
+    int width = 640, height = 480;
+    std::vector<unsigned char> frame( (size_t)width * 2 * height );
+    for( size_t i=0;i<frame.size();i++ ) frame[i] = (unsigned char)((i * 7) ^ (i >> 9));
+
+    std::vector<unsigned char> jpeg;
+    bool ok = encodeJPEG( packed422Layout( frame.data(), width, height ), jpeg, 85, yuvRangeFull, 1 );
+
+    int threads = getConversionThreads();
+    std::vector<unsigned char> rgb[2], thumb[2];
+
+    for( int n=0;n<2;n++ )
+    {
+        setConversionThreads( n ? 4 : 1 );
+        rgb[n].resize( (size_t)width * height * 3 );
+        thumb[n].resize( (size_t)(width / 8) * (height / 8) * 3 );
+        ok = ok && decodeJPEG( jpeg.data(), jpeg.size(), rgbView( rgb[n].data(), width, height ) );
+        ok = ok && decodeJPEGThumbnail( jpeg.data(), jpeg.size(), rgbView( thumb[n].data(), width / 8, height / 8 ) );
+    }
+    setConversionThreads( threads );
+
+    check( "decode 640x480 JPEG with restart markers on 4 threads", ok && (rgb[0] == rgb[1]) && (thumb[0] == thumb[1]) );
+}
+
+
+// Odd width packed 4:2:2
+//
+
+// a flat YUYV frame sized to the byte, the last pixel of each row is a half pair without V
+//
+static std::vector<unsigned char> flatYUYV( int width, int height )
+{
+    std::vector<unsigned char> frame( (size_t)width * 2 * height );
+
+    for( int y=0;y<height;y++ )
+        for( int x=0;x<width;x++ )
+        {
+            frame[((size_t)y * width + x) * 2] = 100;
+            frame[((size_t)y * width + x) * 2 + 1] = (x & 1) ? 160 : 90;
+        }
+
+    return frame;
+}
+
+static const int s_oddWidths[] = { 33, 101 };
+
+static void checkOddWidthScale()
+{
+    for( int width : s_oddWidths )
+    {
+        std::vector<unsigned char> frame = flatYUYV( width, 17 );
+        struct imageView src = packed422Layout( frame.data(), width, 17 );
+
+        for( int filter=0;filter<2;filter++ )
+            for( int outWidth : { width, width / 2 } )
+            {
+                std::vector<unsigned char> rgb( (size_t)outWidth * 8 * 3 );
+                bool ok = scaleYUV( src, rgbView( rgb.data(), outWidth, 8 ), false, (enum imageScaleFilter)filter );
+
+                // a flat frame stays flat up to the last column
+                for( size_t i=3;ok && (i<rgb.size());i++ ) ok = (rgb[i] == rgb[i % 3]);
+
+                check( "scale " + std::to_string( width ) + "x17 YUYV to " + std::to_string( outWidth ) + "x8, " +
+                       (filter ? "bilinear" : "area"), ok );
+            }
+    }
+}
+
+
+static void checkOddWidthJPEG()
+{
+    for( int width : s_oddWidths )
+    {
+        std::vector<unsigned char> frame = flatYUYV( width, 17 );
+        std::vector<unsigned char> jpeg;
+        bool ok = encodeJPEG( packed422Layout( frame.data(), width, 17 ), jpeg );
+
+        // decoded back the last column is as flat as the rest, within rounding
+        std::vector<unsigned char> rgb( (size_t)width * 17 * 3 );
+        ok = ok && decodeJPEG( jpeg.data(), jpeg.size(), rgbView( rgb.data(), width, 17 ) );
+        for( size_t i=3;ok && (i<rgb.size());i++ ) ok = (std::abs( rgb[i] - rgb[i % 3] ) <= 2);
+
+        check( "encode " + std::to_string( width ) + "x17 YUYV to JPEG", ok );
+    }
+}
+
+
+// YUYV to I420 and NV12 and back again, every filter keeps a flat frame as it is
+//
+static void checkOddWidthRepack()
+{
+    static const struct { const char * name; unsigned int fourcc; struct imageView (*layout)( unsigned char *, int, int ); } formats[] = {
+        { "I420", IMAGE_FOURCC('Y','U','1','2'), planarYUV420Layout },
+        { "NV12", IMAGE_FOURCC('N','V','1','2'), interleavedYUV420Layout },
+        { "YVYU", IMAGE_FOURCC('Y','V','Y','U'), packedYVU422Layout },
+    };
+
+    for( int width : s_oddWidths )
+        for( const auto & f : formats )
+            for( int filter=chromaFilterDrop;filter<=chromaFilterSmooth;filter++ )
+            {
+                std::vector<unsigned char> frame = flatYUYV( width, 17 );
+                std::vector<unsigned char> repacked( repackedFrameSize( f.fourcc, width, 17 ) );
+                std::vector<unsigned char> back( frame.size() );
+
+                bool ok = repackYUV( packed422Layout( frame.data(), width, 17 ), f.layout( repacked.data(), width, 17 ), (enum chromaFilter)filter );
+                ok = ok && repackYUV( f.layout( repacked.data(), width, 17 ), packed422Layout( back.data(), width, 17 ), (enum chromaFilter)filter );
+
+                check( "repack " + std::to_string( width ) + "x17 YUYV to " + f.name + " and back, filter " + std::to_string( filter ),
+                       ok && (back == frame) );
+            }
+}
+
+
+int main()
+{
+    for( int simd=0;simd<2;simd++ )
+    {
+        if( simd && !setSimdLevel( simdSSE2 ) && !setSimdLevel( simdNEON ) ) break;
+        if( !simd ) setSimdLevel( simdNone );
+        std::printf( "--- %s\n", simd ? "vector" : "scalar" );
+
+        checkOversubscribedDHT();
+        checkThreadedRestartDecode();
+        checkOddWidthScale();
+        checkOddWidthJPEG();
+        checkOddWidthRepack();
+    }
+
+    std::printf( "%d failure(s)\n", s_failures );
+    return s_failures;
+}
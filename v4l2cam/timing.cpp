@@ -29,6 +29,7 @@ void runTimingTest( std::string deviceID )
 
     int good_frames = 0;
     int bad_frames = 0;
+    int bad_reasons[jpegCheckTruncated + 1] = {};
 
     long long total_time = 0;
     int total_bytes = 0;
@@ -98,12 +99,16 @@ void runTimingTest( std::string deviceID )
 
                 if( inB && inB->buffer )
                 {
-                    // check for invalid JPG file (if MJPG imag format)
+                    // check for a damaged JPG frame (if MJPG imag format), truncated frames are the usual ones
                     if( "MJPG" == data->format_str )
                     {
-                        // check the header, should be 0xFF 0xD8 0xFF 
-                        if( (inB->buffer[0] == 0xff) && (inB->buffer[1] == 0xd8) && ((int)inB->buffer[2] == 0xff) ) good_frames++;
-                        else bad_frames++;
+                        enum jpegCheck check = jpegValidate( inB->buffer, inB->length );
+                        if( check == jpegCheckOk ) good_frames++;
+                        else
+                        {
+                            bad_frames++;
+                            bad_reasons[check]++;
+                        }
                     } else good_frames++;
 
                     // count the bytes
@@ -128,6 +133,8 @@ void runTimingTest( std::string deviceID )
             outinfo( "Timing Test Results for : " + cam->getDevName() + " " + cam->getUserName() );
             outinfo( "   ...good frames : " + std::to_string(good_frames) );
             outinfo( "   ...bad frames : " + std::to_string(bad_frames) );
+            for( int c = jpegCheckNoSOI; c <= jpegCheckTruncated; c++ )
+                if( bad_reasons[c] > 0 ) outinfo( "      ..." + jpegCheckToString( (enum jpegCheck)c ) + " : " + std::to_string(bad_reasons[c]) );
             outinfo( "   ...total bytes : " + std::to_string(total_bytes) );
             outinfo( "   ...average bytes per frame : " + std::to_string(total_bytes / good_frames) );
             outinfo( "   ...average frame time : " + std::to_string((total_time / good_frames)/1000) + " ms" );
@@ -5,6 +5,9 @@
 #include <string>
 #include <sstream>
 #include <chrono>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 
 #include "defines.h"
 
@@ -48,6 +51,20 @@ bool is_number(const std::string& s)
     return !s.empty() && it == s.end();
 }
 
+// whole decimal number from the command line, false for anything else or a value too big for an int
+//
+bool parseInt( const std::string & text, int & value )
+{
+    char * end = nullptr;
+
+    errno = 0;
+    long v = std::strtol( text.c_str(), &end, 10 );
+    if( (text.length() == 0) || (*end != 0) || (errno == ERANGE) || (v < INT_MIN) || (v > INT_MAX) ) return false;
+
+    value = (int)v;
+    return true;
+}
+
 std::string makeHexString( unsigned char * buf, int len, bool makeCaps )
 {
     std::stringstream tmp;